@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <esp_cpu.h>
+#include "bench.hpp"
+
+static std::atomic<uint32_t> theAllocations(0);
+
+void* operator new(std::size_t p_size)
+{
+    theAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* block = malloc(p_size ? p_size : 1);
+    if (block == nullptr)
+    {
+        abort();
+    }
+    return block;
+}
+
+void operator delete(void* p_block) noexcept
+{
+    free(p_block);
+}
+
+void operator delete(void* p_block, std::size_t) noexcept
+{
+    free(p_block);
+}
+
+uint32_t benchAllocations()
+{
+    return theAllocations.load(std::memory_order_relaxed);
+}
+
+void runBench(const char* p_name, uint32_t p_ops, const std::function<void(uint32_t)>& p_op,
+              const std::function<void()>& p_drain)
+{
+    // the cycle counter wraps after a few seconds, so sum up short chunks
+    const uint32_t chunk = 256;
+    uint64_t cycles = 0;
+    const uint32_t allocations = benchAllocations();
+    for (uint32_t first = 0; first < p_ops; first += chunk)
+    {
+        const uint32_t last = (p_ops - first > chunk) ? first + chunk : p_ops;
+        const uint32_t start = esp_cpu_get_cycle_count();
+        for (uint32_t i = first; i < last; i++)
+        {
+            p_op(i);
+        }
+        cycles += esp_cpu_get_cycle_count() - start;
+    }
+    if (p_drain)
+    {
+        const uint32_t start = esp_cpu_get_cycle_count();
+        p_drain();
+        cycles += esp_cpu_get_cycle_count() - start;
+    }
+    const uint32_t numAllocations = benchAllocations() - allocations;
+    printf("BENCH %-40s %8u ops %10.1f cycles/op %6.2f allocs/op\n", p_name, (unsigned) p_ops,
+           (double) cycles / p_ops, (double) numAllocations / p_ops);
+}
+
+void printLatency(const LatencyHistogram& p_latency)
+{
+    const LatencyHistogram::Snapshot snapshot = p_latency.read();
+    printf("      %-40s latency p50 <%u us, p99 <%u us, max %u us\n", "", (unsigned) snapshot.percentile(50),
+           (unsigned) snapshot.percentile(99), (unsigned) snapshot.itsMaxUs);
+}
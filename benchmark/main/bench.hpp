@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include <LatencyHistogram.hpp>
+
+/**
+ * @brief Returns the number of calls of operator new so far
+ *
+ * @return uint32_t
+ */
+uint32_t benchAllocations();
+
+/**
+ * @brief Run a benchmark and print its result line
+ * @details
+ * p_op is called p_ops times with the index of the operation, then p_drain
+ * (if given) waits until all asynchronous work has been done. Cycles and
+ * heap allocations are counted for both.
+ *
+ * @param p_name
+ * @param p_ops
+ * @param p_op
+ * @param p_drain
+ */
+void runBench(const char* p_name, uint32_t p_ops, const std::function<void(uint32_t)>& p_op,
+              const std::function<void()>& p_drain = nullptr);
+
+/**
+ * @brief Print percentiles of a latency histogram below the last result line
+ *
+ * @param p_latency
+ */
+void printLatency(const LatencyHistogram& p_latency);
+
+void benchPublishSubscribe();
+void benchDeferredCalls();
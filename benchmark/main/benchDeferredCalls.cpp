@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <atomic>
+#include <esp_timer.h>
+#include <DeferredCallsQueue.hpp>
+#include "bench.hpp"
+
+// higher than the benchmark task, so the calls run as soon as possible
+static const UBaseType_t theCallPriority = 5;
+
+static std::atomic<uint32_t> theExecuted(0);
+static LatencyHistogram theLatency;
+
+static void executed(int64_t p_addedUs)
+{
+    theLatency.record(esp_timer_get_time() - p_addedUs);
+    theExecuted.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void waitExecuted(uint32_t p_expected)
+{
+    const int64_t timeout = esp_timer_get_time() + 10 * 1000 * 1000;
+    while ((theExecuted.load() < p_expected) && (esp_timer_get_time() < timeout))
+    {
+        vTaskDelay(1);
+    }
+    if (theExecuted.load() < p_expected)
+    {
+        printf("      only %u of %u calls executed\n", (unsigned) theExecuted.load(), (unsigned) p_expected);
+    }
+}
+
+/**
+ * @brief Compare the queues with a direct link, for a call to the other core
+ * @details
+ * The paced variants wait for each call to be executed before adding the
+ * next one, so the latency includes waking up the task every time.
+ */
+static void benchHandoff()
+{
+    const uint32_t ops = 10000;
+    const BaseType_t otherCore = (portNUM_PROCESSORS > 1) ? !xPortGetCoreID() : 0;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    DeferredCallsQueue::DirectLink& link = dcq.createDirectLink(theCallPriority, otherCore, 64);
+
+    for (bool paced : {false, true})
+    {
+        char name[48];
+        snprintf(name, sizeof(name), "handoff/queue%s", paced ? "/paced" : "");
+        theExecuted.store(0);
+        theLatency.reset();
+        runBench(name, ops, [&dcq, otherCore, paced](uint32_t p_op)
+                 {
+                     dcq.addDeferredCall([added = esp_timer_get_time()]() { executed(added); },
+                                         theCallPriority, otherCore);
+                     while (paced && (theExecuted.load(std::memory_order_relaxed) <= p_op))
+                     {}
+                 }, [ops]() { waitExecuted(ops); });
+        printLatency(theLatency);
+
+        snprintf(name, sizeof(name), "handoff/link%s", paced ? "/paced" : "");
+        theExecuted.store(0);
+        theLatency.reset();
+        runBench(name, ops, [&link, paced](uint32_t p_op)
+                 {
+                     // the task of the link runs on the other core or preempts this one
+                     while (!link.addCall([added = esp_timer_get_time()]() { executed(added); }))
+                     {}
+                     while (paced && (theExecuted.load(std::memory_order_relaxed) <= p_op))
+                     {}
+                 }, [ops]() { waitExecuted(ops); });
+        printLatency(theLatency);
+    }
+}
+
+void benchDeferredCalls()
+{
+    benchHandoff();
+}
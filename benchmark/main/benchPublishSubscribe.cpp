@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <esp_timer.h>
+#include <PublishSubscribe.hpp>
+#include <Broker.hpp>
+#include "bench.hpp"
+
+// higher than the benchmark task, so asynchronous handlers run as soon as possible
+static const UBaseType_t theHandlerPriority = 5;
+
+static std::atomic<uint32_t> theHandled(0);
+static LatencyHistogram theLatency;
+
+struct Large
+{
+    int64_t itsTimeUs;
+    std::array<uint8_t, 248> itsData;
+};
+
+static void handled(int64_t p_publishedUs)
+{
+    theLatency.record(esp_timer_get_time() - p_publishedUs);
+    theHandled.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void resetHandled()
+{
+    theHandled.store(0);
+    theLatency.reset();
+}
+
+static void waitHandled(uint32_t p_expected)
+{
+    const int64_t timeout = esp_timer_get_time() + 10 * 1000 * 1000;
+    while ((theHandled.load() < p_expected) && (esp_timer_get_time() < timeout))
+    {
+        vTaskDelay(1);
+    }
+    if (theHandled.load() < p_expected)
+    {
+        printf("      only %u of %u calls handled\n", (unsigned) theHandled.load(), (unsigned) p_expected);
+    }
+}
+
+/**
+ * @brief Run a function in a task pinned to the given core
+ * @details
+ * Subscriptions take over the core affinity of the subscribing task.
+ */
+static void runOnCore(BaseType_t p_core, const std::function<void()>& p_function)
+{
+    struct Job
+    {
+        const std::function<void()>* itsFunction;
+        QueueHandle_t itsDone;
+    };
+    Job job = {&p_function, xQueueCreate(1, sizeof(int))};
+    xTaskCreatePinnedToCore([](void* p_job)
+    {
+        Job* job = static_cast<Job*>(p_job);
+        (*job->itsFunction)();
+        int done = 1;
+        xQueueSend(job->itsDone, &done, portMAX_DELAY);
+        vTaskDelete(NULL);
+    }, "bench-core", 4096, &job, uxTaskPriorityGet(NULL), NULL, p_core);
+    int done;
+    xQueueReceive(job.itsDone, &done, portMAX_DELAY);
+    vQueueDelete(job.itsDone);
+}
+
+static void benchSync()
+{
+    for (uint32_t numSubscribers : {1, 10, 100})
+    {
+        auto topic = PublishSubscribe<int64_t>::get().topic("bench/sync");
+        for (uint32_t i = 0; i < numSubscribers; i++)
+        {
+            topic.subscribeSync([](int64_t) { theHandled.fetch_add(1, std::memory_order_relaxed); });
+        }
+        char name[48];
+        snprintf(name, sizeof(name), "sync/subscribers=%u", (unsigned) numSubscribers);
+        runBench(name, 10000, [&topic](uint32_t) { topic.publish(0); });
+        topic.clear();
+    }
+}
+
+static void benchAsync()
+{
+    for (uint32_t numSubscribers : {1, 10, 100})
+    {
+        auto topic = PublishSubscribe<int64_t>::get().topic("bench/async");
+        for (uint32_t i = 0; i < numSubscribers; i++)
+        {
+            topic.subscribeAsyncWithPrio(handled, theHandlerPriority);
+        }
+        const uint32_t ops = 20000 / numSubscribers;
+        char name[48];
+        snprintf(name, sizeof(name), "async/subscribers=%u", (unsigned) numSubscribers);
+        resetHandled();
+        runBench(name, ops, [&topic](uint32_t) { topic.publishAsync(esp_timer_get_time()); },
+                 [ops, numSubscribers]() { waitHandled(ops * numSubscribers); });
+        printLatency(theLatency);
+        topic.clear();
+    }
+}
+
+static void benchTopics()
+{
+    for (uint32_t numTopics : {1, 100, 1000})
+    {
+        std::vector<std::string> names;
+        std::vector<PublishSubscribe<int64_t>::Topic> topics;
+        for (uint32_t i = 0; i < numTopics; i++)
+        {
+            names.push_back("bench/topics/" + std::to_string(i));
+            topics.push_back(PublishSubscribe<int64_t>::get().topic(names.back()));
+            topics.back().subscribeSync([](int64_t) {});
+        }
+        char name[48];
+        snprintf(name, sizeof(name), "topics=%u/by-name", (unsigned) numTopics);
+        runBench(name, 10000, [&names, numTopics](uint32_t p_op)
+                 { PublishSubscribe<int64_t>::get().publish(names[p_op % numTopics], 0); });
+        snprintf(name, sizeof(name), "topics=%u/by-handle", (unsigned) numTopics);
+        runBench(name, 10000, [&topics, numTopics](uint32_t p_op)
+                 { topics[p_op % numTopics].publish(0); });
+        for (auto& topic : topics)
+        {
+            topic.clear();
+        }
+    }
+}
+
+static void benchPayloads()
+{
+    const uint32_t numSubscribers = 4;
+    const uint32_t ops = 2000;
+    Large large = {};
+
+    auto byValue = PublishSubscribe<Large>::get().topic("bench/large");
+    for (uint32_t i = 0; i < numSubscribers; i++)
+    {
+        byValue.subscribeAsyncWithPrio([](Large p_large) { handled(p_large.itsTimeUs); }, theHandlerPriority);
+    }
+    resetHandled();
+    runBench("async/payload=256/by-value", ops, [&](uint32_t)
+             {
+                 large.itsTimeUs = esp_timer_get_time();
+                 byValue.publishAsync(large);
+             }, [&]() { waitHandled(ops * numSubscribers); });
+    printLatency(theLatency);
+    byValue.clear();
+
+    auto byRef = PublishSubscribe<const Large&>::get().topic("bench/large");
+    for (uint32_t i = 0; i < numSubscribers; i++)
+    {
+        byRef.subscribeAsyncWithPrio([](const Large& p_large) { handled(p_large.itsTimeUs); }, theHandlerPriority);
+    }
+    resetHandled();
+    runBench("async/payload=256/by-reference", ops, [&](uint32_t)
+             {
+                 large.itsTimeUs = esp_timer_get_time();
+                 byRef.publishAsync(large);
+             }, [&]() { waitHandled(ops * numSubscribers); });
+    printLatency(theLatency);
+    byRef.clear();
+
+    auto loaned = PublishSubscribe<LoanedBuffer>::get().topic("bench/loaned");
+    loaned.createLoanPool(sizeof(Large), 32);
+    for (uint32_t i = 0; i < numSubscribers; i++)
+    {
+        loaned.subscribeAsyncWithPrio([](LoanedBuffer p_buffer)
+        {
+            handled(reinterpret_cast<const Large*>(p_buffer.data())->itsTimeUs);
+        }, theHandlerPriority);
+    }
+    resetHandled();
+    runBench("async/payload=256/loaned", ops, [&](uint32_t)
+             {
+                 LoanedBuffer buffer = loaned.loan(sizeof(Large));
+                 while (!buffer)
+                 {
+                     vTaskDelay(1);
+                     buffer = loaned.loan(sizeof(Large));
+                 }
+                 reinterpret_cast<Large*>(buffer.data())->itsTimeUs = esp_timer_get_time();
+                 loaned.publishAsync(std::move(buffer));
+             }, [&]() { waitHandled(ops * numSubscribers); });
+    printLatency(theLatency);
+    loaned.clear();
+}
+
+static void benchPatterns()
+{
+    // patterns are matched when created, not on every publish
+    auto topic = PublishSubscribe<int64_t>::get().topic("bench/patterns/0");
+    topic.subscribeSync([](int64_t) {});
+    runBench("sync/patterns=0", 10000, [&topic](uint32_t) { topic.publish(0); });
+    for (uint32_t numPatterns : {1, 100})
+    {
+        std::vector<PublishSubscribe<int64_t>::Pattern> patterns;
+        for (uint32_t i = 0; i < numPatterns; i++)
+        {
+            // only the first one matches
+            patterns.push_back(PublishSubscribe<int64_t>::get().pattern("bench/+/" + std::to_string(i)));
+            patterns.back().subscribeSync([](int64_t) {});
+        }
+        char name[48];
+        snprintf(name, sizeof(name), "sync/patterns=%u", (unsigned) numPatterns);
+        runBench(name, 10000, [&topic](uint32_t) { topic.publish(0); });
+        for (auto& pattern : patterns)
+        {
+            pattern.clear();
+        }
+    }
+    topic.clear();
+}
+
+static void benchCores()
+{
+    const uint32_t ops = 5000;
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        auto topic = PublishSubscribe<int64_t>::get().topic("bench/cores");
+        runOnCore(core, [&topic]() { topic.subscribeAsyncWithPrio(handled, theHandlerPriority); });
+        char name[48];
+        snprintf(name, sizeof(name), "async/publisher=%d/handler=%d", (int) xPortGetCoreID(), (int) core);
+        resetHandled();
+        runBench(name, ops, [&topic](uint32_t) { topic.publishAsync(esp_timer_get_time()); },
+                 [ops]() { waitHandled(ops); });
+        printLatency(theLatency);
+        topic.clear();
+    }
+}
+
+static void benchContention()
+{
+    static std::atomic<bool> running;
+    auto topic = PublishSubscribe<int64_t>::get().topic("bench/contention");
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        topic.subscribeSync([](int64_t) {});
+    }
+
+    running.store(true);
+    QueueHandle_t done = xQueueCreate(1, sizeof(int));
+    const BaseType_t otherCore = (portNUM_PROCESSORS > 1) ? !xPortGetCoreID() : 0;
+    xTaskCreatePinnedToCore([](void* p_done)
+    {
+        auto topic = PublishSubscribe<int64_t>::get().topic("bench/contention");
+        while (running.load())
+        {
+            SubscriptionId id = topic.subscribeSync([](int64_t) {});
+            topic.unsubscribe(id);
+            if (portNUM_PROCESSORS == 1)
+            {
+                vTaskDelay(1);
+            }
+        }
+        int finished = 1;
+        xQueueSend(static_cast<QueueHandle_t>(p_done), &finished, portMAX_DELAY);
+        vTaskDelete(NULL);
+    }, "bench-churn", 4096, done, uxTaskPriorityGet(NULL), NULL, otherCore);
+
+    runBench("sync/subscribers=10/churn", 10000, [&topic](uint32_t) { topic.publish(0); });
+
+    running.store(false);
+    int finished;
+    xQueueReceive(done, &finished, portMAX_DELAY);
+    vQueueDelete(done);
+    topic.clear();
+}
+
+static void onStatic(int64_t)
+{
+    theHandled.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void benchStatic()
+{
+    using Topic = PublishSubscribe<int64_t>::StaticTopic<"bench/static", 4, &onStatic>;
+    runBench("sync/static", 10000, [](uint32_t) { Topic::publish(0); });
+}
+
+/**
+ * @brief Publish at full speed to an asynchronous, a throttled and a batching subscriber
+ * @details
+ * Prints the number of handler calls below the result line, which is what
+ * throttling and batching save.
+ */
+static void benchWindows()
+{
+    const uint32_t ops = 20000;
+    auto topic = PublishSubscribe<int64_t>::get().topic("bench/windows");
+
+    topic.subscribeAsyncWithPrio(handled, theHandlerPriority);
+    resetHandled();
+    runBench("async/chatty", ops, [&topic](uint32_t) { topic.publish(esp_timer_get_time()); },
+             [ops]() { waitHandled(ops); });
+    printf("      handler calls: %u\n", (unsigned) theHandled.load());
+    topic.clear();
+
+    topic.subscribeThrottledWithPrio(handled, 10, theHandlerPriority);
+    resetHandled();
+    runBench("async/chatty/throttled=10ms", ops, [&topic](uint32_t) { topic.publish(esp_timer_get_time()); },
+             []() { vTaskDelay(pdMS_TO_TICKS(20)); });
+    printf("      handler calls: %u\n", (unsigned) theHandled.load());
+    topic.clear();
+
+    static std::atomic<uint32_t> batched;
+    batched.store(0);
+    topic.subscribeBatchedWithPrio([](PublishSubscribe<int64_t>::Batch p_batch)
+    {
+        batched.fetch_add(p_batch.size(), std::memory_order_relaxed);
+        handled(std::get<0>(p_batch.front()));
+    }, 10, 2048, theHandlerPriority);
+    resetHandled();
+    runBench("async/chatty/batched=10ms", ops, [&topic](uint32_t) { topic.publish(esp_timer_get_time()); },
+             [ops]() { vTaskDelay(pdMS_TO_TICKS(20)); });
+    printf("      handler calls: %u, messages: %u\n", (unsigned) theHandled.load(), (unsigned) batched.load());
+    topic.clear();
+}
+
+static void benchBroker()
+{
+    // same as benchSync() and benchAsync() with one subscriber, for comparison
+    auto sync = Broker::get().topic<int64_t>("bench/broker/sync");
+    sync.subscribeSync([](int64_t) { theHandled.fetch_add(1, std::memory_order_relaxed); });
+    runBench("broker/sync/subscribers=1", 10000, [&sync](uint32_t) { sync.publish(0); });
+    sync.clear();
+
+    const uint32_t ops = 20000;
+    auto async = Broker::get().topic<int64_t>("bench/broker/async");
+    async.subscribeAsyncWithPrio(handled, theHandlerPriority);
+    resetHandled();
+    runBench("broker/async/subscribers=1", ops, [&async](uint32_t) { async.publishAsync(esp_timer_get_time()); },
+             [ops]() { waitHandled(ops); });
+    printLatency(theLatency);
+    async.clear();
+}
+
+void benchPublishSubscribe()
+{
+    benchSync();
+    benchStatic();
+    benchAsync();
+    benchTopics();
+    benchPatterns();
+    benchPayloads();
+    benchCores();
+    benchContention();
+    benchWindows();
+    benchBroker();
+}
@@ -0,0 +1,22 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <esp_system.h>
+#include "bench.hpp"
+
+extern "C"
+{
+void app_main(void)
+{
+    usleep(300 * 1000);
+
+    benchPublishSubscribe();
+    benchDeferredCalls();
+
+    // tells run-qemu.py that the run is complete
+    printf("OK\n");
+    fflush(stdout);
+    usleep(300 * 1000);
+
+    esp_restart();
+}
+}
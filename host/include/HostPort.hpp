@@ -0,0 +1,39 @@
+/**
+ * @file HostPort.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: entry point and scheduling model of the FreeRTOS emulation
+ * @details
+ * Every task is a std::thread. Tasks pinned to a core compete for that
+ * emulated core: only one of them runs at a time, and whenever the running
+ * task blocks (waiting on a queue, vTaskDelay(), usleep()) or yields, the
+ * core is handed to the ready task with the highest priority, the longest
+ * waiting one among equal priorities. A running task is not preempted while
+ * it does not block, not even by sending to a queue that wakes a task of
+ * higher priority. This keeps the order of calls on one core the same as on
+ * the target for everything the tests depend on.
+ * Tasks of different cores, tasks without affinity (tskNO_AFFINITY) and
+ * threads not created by xTaskCreatePinnedToCore() run truly in parallel,
+ * which is what ThreadSanitizer checks.
+ * app_main() is called in the main task, priority ESP_TASK_MAIN_PRIO pinned
+ * to core 0, like on the target.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+/**
+ * @brief Sets the exit status of the program for esp_restart()
+ *
+ * @param p_status
+ */
+void hostSetExitStatus(int p_status);
+
+/**
+ * @brief Returns the command line argument at the given index
+ *
+ * @param p_index 1 for the first argument
+ * @return const char* nullptr if there are fewer arguments
+ */
+const char* hostArgument(int p_index);
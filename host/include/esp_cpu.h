@@ -0,0 +1,18 @@
+/**
+ * @file esp_cpu.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: cycle counter
+ * @details
+ * The host has no portable cycle counter, esp_cpu_get_cycle_count() counts
+ * nanoseconds of the monotonic clock instead. It wraps like the 32 bit
+ * counter of the target, after about 4.3 seconds.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_cpu_get_cycle_count();
@@ -0,0 +1,41 @@
+/**
+ * @file esp_heap_caps.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: capability based allocation mapped to the C heap
+ * @details
+ * The host has a single kind of memory, so the capabilities are accepted and
+ * ignored.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+inline void* heap_caps_malloc(size_t p_size, uint32_t)
+{
+    return malloc(p_size);
+}
+
+inline void* heap_caps_aligned_alloc(size_t p_alignment, size_t p_size, uint32_t)
+{
+    // aligned_alloc() requires the size to be a multiple of the alignment
+    return aligned_alloc(p_alignment, (p_size + p_alignment - 1) / p_alignment * p_alignment);
+}
+
+inline void heap_caps_free(void* p_block)
+{
+    free(p_block);
+}
@@ -0,0 +1,26 @@
+/**
+ * @file esp_log.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: ESP-IDF logging macros writing to stderr
+ * @details
+ * stderr keeps log lines out of the standard output, which the unit tests
+ * compare with their expected output.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+// file name without directories, used in log messages
+#ifndef __FILENAME__
+#define __FILENAME__ __FILE_NAME__
+#endif
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ((void) 0)
+#define ESP_LOGV(tag, format, ...) ((void) 0)
@@ -0,0 +1,21 @@
+/**
+ * @file esp_system.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: system functions
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+/**
+ * @brief Ends the program
+ * @details
+ * Running tasks are not stopped, so the program exits immediately without
+ * destroying static objects. The exit status is the one set by
+ * hostSetExitStatus() (see HostPort.hpp), 0 by default.
+ */
+[[noreturn]] void esp_restart();
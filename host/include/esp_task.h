@@ -0,0 +1,13 @@
+/**
+ * @file esp_task.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: priorities of the system tasks
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#define ESP_TASK_MAIN_PRIO 1
+#define ESP_TASK_MAIN_CORE 0
@@ -0,0 +1,39 @@
+/**
+ * @file esp_timer.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: microsecond time since start of the program and one-shot timers
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+int64_t esp_timer_get_time();
+
+typedef struct esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum
+{
+    ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct
+{
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* p_args, esp_timer_handle_t* p_handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t p_timer, uint64_t p_timeoutUs);
+esp_err_t esp_timer_stop(esp_timer_handle_t p_timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t p_timer);
+bool esp_timer_is_active(esp_timer_handle_t p_timer);
@@ -0,0 +1,55 @@
+/**
+ * @file FreeRTOS.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS base types and port macros
+ * @details
+ * The host port emulates the used subset of the FreeRTOS API of ESP-IDF with
+ * one thread per task, see HostPort.hpp for its scheduling model.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+#define pdFALSE ((BaseType_t) 0)
+#define pdTRUE ((BaseType_t) 1)
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES 25
+#define configMINIMAL_STACK_SIZE 768
+
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define portNUM_PROCESSORS CONFIG_FREERTOS_NUMBER_OF_CORES
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t) (((uint64_t) (xTimeInMs) * configTICK_RATE_HZ) / 1000U))
+
+#define tskNO_AFFINITY ((BaseType_t) 0x7FFFFFFF)
+
+#define portYIELD_FROM_ISR(...) ((void) 0)
+#define IRAM_ATTR
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+/**
+ * @brief Returns the emulated core the calling task is pinned to
+ * @details
+ * Tasks without affinity report core 0.
+ */
+BaseType_t xPortGetCoreID();
@@ -0,0 +1,21 @@
+/**
+ * @file event_groups.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS event groups, without waiting for bits
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef TickType_t EventBits_t;
+typedef struct HostEventGroup* EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreate();
+void vEventGroupDelete(EventGroupHandle_t p_group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t p_group, EventBits_t p_bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t p_group, EventBits_t p_bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t p_group);
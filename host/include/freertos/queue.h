@@ -0,0 +1,26 @@
+/**
+ * @file queue.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS queues
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct HostQueue* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t p_length, UBaseType_t p_itemSize);
+void vQueueDelete(QueueHandle_t p_queue);
+BaseType_t xQueueSend(QueueHandle_t p_queue, const void* p_item, TickType_t p_ticksToWait);
+BaseType_t xQueueSendToFront(QueueHandle_t p_queue, const void* p_item, TickType_t p_ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t p_queue, void* p_item, TickType_t p_ticksToWait);
+BaseType_t xQueueSendFromISR(QueueHandle_t p_queue, const void* p_item, BaseType_t* p_higherPriorityTaskWoken);
+BaseType_t xQueueReceiveFromISR(QueueHandle_t p_queue, void* p_item, BaseType_t* p_higherPriorityTaskWoken);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t p_queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t p_queue);
+
+#define xQueueSendToBack xQueueSend
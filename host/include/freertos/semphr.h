@@ -0,0 +1,23 @@
+/**
+ * @file semphr.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS counting semaphores
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include "freertos/queue.h"
+
+/// like in FreeRTOS, a semaphore is a queue with items of size 0
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t p_maxCount, UBaseType_t p_initialCount);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t p_semaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t p_semaphore, TickType_t p_ticksToWait);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t p_semaphore, BaseType_t* p_higherPriorityTaskWoken);
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t p_semaphore);
+
+#define vSemaphoreDelete(xSemaphore) vQueueDelete(xSemaphore)
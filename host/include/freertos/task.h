@@ -0,0 +1,51 @@
+/**
+ * @file task.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS task functions
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+typedef struct HostTask* TaskHandle_t;
+typedef uint8_t StackType_t;
+
+/**
+ * @brief Placeholder for the task control block of static tasks
+ * @details
+ * Host tasks are threads with their own stack, so the buffers passed to
+ * xTaskCreateStaticPinnedToCore() are not used.
+ */
+typedef struct
+{
+    void* itsUnused;
+} StaticTask_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t p_function, const char* p_name, uint32_t p_stackDepth,
+                                   void* p_parameter, UBaseType_t p_priority, TaskHandle_t* p_handle,
+                                   BaseType_t p_coreId);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t p_function, const char* p_name, uint32_t p_stackDepth,
+                                           void* p_parameter, UBaseType_t p_priority, StackType_t* p_stack,
+                                           StaticTask_t* p_taskBuffer, BaseType_t p_coreId);
+BaseType_t xTaskCreate(TaskFunction_t p_function, const char* p_name, uint32_t p_stackDepth,
+                       void* p_parameter, UBaseType_t p_priority, TaskHandle_t* p_handle);
+void vTaskDelete(TaskHandle_t p_task);
+void vTaskDelay(TickType_t p_ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+UBaseType_t uxTaskPriorityGet(TaskHandle_t p_task);
+void vTaskPrioritySet(TaskHandle_t p_task, UBaseType_t p_priority);
+BaseType_t xTaskGetAffinity(TaskHandle_t p_task);
+const char* pcTaskGetName(TaskHandle_t p_task);
+BaseType_t xTaskNotifyGive(TaskHandle_t p_task);
+void vTaskNotifyGiveFromISR(TaskHandle_t p_task, BaseType_t* p_higherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t p_clearCountOnExit, TickType_t p_ticksToWait);
+// stack use cannot be measured on the host, the whole stack is reported as free
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t p_task);
+
+#define taskYIELD() vTaskDelay(0)
@@ -0,0 +1,17 @@
+/**
+ * @file sdkconfig.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: configuration normally generated by the ESP-IDF build
+ * @details
+ * Only the options the library and its tests depend on are defined here, the
+ * PUBSUB options fall back to the defaults in PubSubConfig.hpp unless they
+ * are given on the compiler command line.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_FREERTOS_NUMBER_OF_CORES 2
@@ -0,0 +1,42 @@
+/**
+ * @file HostEventGroups.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS event groups, without waiting for bits
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#include <atomic>
+#include "freertos/event_groups.h"
+
+struct HostEventGroup
+{
+    std::atomic<EventBits_t> itsBits{0};
+};
+
+EventGroupHandle_t xEventGroupCreate()
+{
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t p_group)
+{
+    delete p_group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t p_group, EventBits_t p_bits)
+{
+    return p_group->itsBits.fetch_or(p_bits) | p_bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t p_group, EventBits_t p_bits)
+{
+    // like FreeRTOS, the value before clearing is returned
+    return p_group->itsBits.fetch_and(~p_bits);
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t p_group)
+{
+    return p_group->itsBits.load();
+}
@@ -0,0 +1,257 @@
+/**
+ * @file HostQueue.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS queues copying fixed size items
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "HostScheduler.hpp"
+
+struct HostQueue
+{
+    HostQueue(UBaseType_t p_length, UBaseType_t p_itemSize) :
+        itsLength(p_length),
+        itsItemSize(p_itemSize),
+        itsStorage(size_t(p_length) * p_itemSize),
+        itsHead(0),
+        itsCount(0)
+    {}
+
+    void put(const void* p_item, bool p_front)
+    {
+        size_t index;
+        if (p_front)
+        {
+            itsHead = (itsHead + itsLength - 1) % itsLength;
+            index = itsHead;
+        }
+        else
+        {
+            index = (itsHead + itsCount) % itsLength;
+        }
+        if (itsItemSize > 0)
+        {
+            memcpy(&itsStorage[index * itsItemSize], p_item, itsItemSize);
+        }
+        itsCount++;
+        hostSignal(itsReceivers);
+        itsChanged.notify_all();
+    }
+
+    void take(void* p_item)
+    {
+        if (itsItemSize > 0)
+        {
+            memcpy(p_item, &itsStorage[itsHead * itsItemSize], itsItemSize);
+        }
+        itsHead = (itsHead + 1) % itsLength;
+        itsCount--;
+        hostSignal(itsSenders);
+        itsChanged.notify_all();
+    }
+
+    /**
+     * @brief Runs an operation as soon as the queue is ready for it
+     * @details
+     * A blocked task is signaled by the task that makes the queue ready and
+     * is thereby ready to run on its core right away, like in FreeRTOS. The
+     * queue is unlocked before the task waits for its core again, so tasks
+     * holding a core never wait for the queue.
+     *
+     * @param p_waiters the list to wait in
+     * @param p_ticks
+     * @param p_ready
+     * @param p_operation
+     * @param p_preempt whether the calling task may be preempted by a task
+     *        woken by the operation (not in an ISR)
+     * @return pdPASS if the operation was run before the timeout
+     */
+    template <typename Ready, typename Operation>
+    BaseType_t when(std::vector<HostWaiter*>& p_waiters, TickType_t p_ticks, Ready p_ready,
+                    Operation p_operation, bool p_preempt)
+    {
+        HostTask& task = hostCurrentTask();
+        HostWaiter waiter = {&task, false};
+        {
+            std::lock_guard<std::mutex> lock(itsMutex);
+            if (p_ready())
+            {
+                p_operation();
+                p_ticks = 0;
+            }
+            else if (p_ticks == 0)
+            {
+                return pdFAIL;
+            }
+            else
+            {
+                // from now on the task is signaled, even before it has released its core
+                p_waiters.push_back(&waiter);
+            }
+        }
+        if (p_ticks == 0)
+        {
+            if (p_preempt)
+            {
+                hostPreemptionPoint();
+            }
+            return pdPASS;
+        }
+        return hostBlock([&]()
+        {
+            const auto timeout = std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds(uint64_t(p_ticks) * portTICK_PERIOD_MS);
+            std::unique_lock<std::mutex> lock(itsMutex);
+            while (true)
+            {
+                if (p_ready())
+                {
+                    if (!waiter.itsSignaled)
+                    {
+                        std::erase(p_waiters, &waiter);
+                    }
+                    p_operation();
+                    return pdPASS;
+                }
+                if (waiter.itsSignaled)
+                {
+                    // another task was faster, so block again
+                    waiter.itsSignaled = false;
+                    if (HostCore* core = HostCore::of(task))
+                    {
+                        core->makeUnready(task);
+                    }
+                    p_waiters.push_back(&waiter);
+                }
+                if (p_ticks == portMAX_DELAY)
+                {
+                    itsChanged.wait(lock);
+                }
+                else if ((itsChanged.wait_until(lock, timeout) == std::cv_status::timeout) &&
+                         !waiter.itsSignaled && !p_ready())
+                {
+                    std::erase(p_waiters, &waiter);
+                    return pdFAIL;
+                }
+            }
+        });
+    }
+
+    BaseType_t send(const void* p_item, TickType_t p_ticks, bool p_front, bool p_preempt = true)
+    {
+        return when(itsSenders, p_ticks, [this]() { return itsCount < itsLength; },
+                    [this, p_item, p_front]() { put(p_item, p_front); }, p_preempt);
+    }
+
+    BaseType_t receive(void* p_item, TickType_t p_ticks, bool p_preempt = true)
+    {
+        return when(itsReceivers, p_ticks, [this]() { return itsCount > 0; },
+                    [this, p_item]() { take(p_item); }, p_preempt);
+    }
+
+    const size_t itsLength;
+    const size_t itsItemSize;
+    std::vector<uint8_t> itsStorage;
+    size_t itsHead;
+    size_t itsCount;
+    std::mutex itsMutex;
+    std::condition_variable itsChanged;
+    std::vector<HostWaiter*> itsReceivers;
+    std::vector<HostWaiter*> itsSenders;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t p_length, UBaseType_t p_itemSize)
+{
+    if (p_length == 0)
+    {
+        return nullptr;
+    }
+    return new HostQueue(p_length, p_itemSize);
+}
+
+void vQueueDelete(QueueHandle_t p_queue)
+{
+    delete p_queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t p_queue, const void* p_item, TickType_t p_ticksToWait)
+{
+    return p_queue->send(p_item, p_ticksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t p_queue, const void* p_item, TickType_t p_ticksToWait)
+{
+    return p_queue->send(p_item, p_ticksToWait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t p_queue, void* p_item, TickType_t p_ticksToWait)
+{
+    return p_queue->receive(p_item, p_ticksToWait);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t p_queue, const void* p_item, BaseType_t* p_higherPriorityTaskWoken)
+{
+    if (p_higherPriorityTaskWoken)
+    {
+        *p_higherPriorityTaskWoken = pdFALSE;
+    }
+    return p_queue->send(p_item, 0, false, false);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t p_queue, void* p_item, BaseType_t* p_higherPriorityTaskWoken)
+{
+    if (p_higherPriorityTaskWoken)
+    {
+        *p_higherPriorityTaskWoken = pdFALSE;
+    }
+    return p_queue->receive(p_item, 0, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t p_queue)
+{
+    std::lock_guard<std::mutex> lock(p_queue->itsMutex);
+    return p_queue->itsCount;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t p_queue)
+{
+    std::lock_guard<std::mutex> lock(p_queue->itsMutex);
+    return p_queue->itsLength - p_queue->itsCount;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t p_maxCount, UBaseType_t p_initialCount)
+{
+    HostQueue* semaphore = new HostQueue(p_maxCount, 0);
+    semaphore->itsCount = std::min(p_initialCount, p_maxCount);
+    return semaphore;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t p_semaphore)
+{
+    return p_semaphore->send(nullptr, 0, false);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t p_semaphore, TickType_t p_ticksToWait)
+{
+    return p_semaphore->receive(nullptr, p_ticksToWait);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t p_semaphore, BaseType_t* p_higherPriorityTaskWoken)
+{
+    return xQueueSendFromISR(p_semaphore, nullptr, p_higherPriorityTaskWoken);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t p_semaphore)
+{
+    return uxQueueMessagesWaiting(p_semaphore);
+}
@@ -0,0 +1,171 @@
+/**
+ * @file HostScheduler.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: tasks and emulated cores
+ * @details
+ * See HostPort.hpp for the scheduling model.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+
+struct HostTask
+{
+    std::string itsName;
+    std::atomic<UBaseType_t> itsPriority;  ///< changed by vTaskPrioritySet() from any thread
+    BaseType_t itsCoreId;
+    uint64_t itsTicket;
+    uint32_t itsStackDepth = 0;
+
+    std::mutex itsNotifyMutex;                 ///< guards the notification value
+    std::condition_variable itsNotified;
+    uint32_t itsNotifyValue = 0;
+    bool itsNotifyWaiting = false;             ///< blocked in ulTaskNotifyTake()
+};
+
+class HostCore
+{
+public:
+    /**
+     * @brief Returns the emulated core a task runs on
+     *
+     * @param p_task
+     * @return HostCore* nullptr for tasks without affinity
+     */
+    static HostCore* of(const HostTask& p_task);
+
+    /**
+     * @brief Marks a task as ready to run on this core
+     * @details
+     * Called when a task is created or unblocked by another one, so the
+     * unblocking task knows right away whether it is preempted.
+     *
+     * @param p_task
+     */
+    void makeReady(HostTask& p_task);
+
+    /**
+     * @brief Reverts makeReady() if the task blocks again without running
+     *
+     * @param p_task
+     */
+    void makeUnready(HostTask& p_task);
+
+    /**
+     * @brief Changes the priority of a task, rescheduling ready tasks
+     *
+     * @param p_task
+     * @param p_priority
+     */
+    void setPriority(HostTask& p_task, UBaseType_t p_priority);
+
+    /**
+     * @brief Waits until the task may run on this core
+     *
+     * @param p_task
+     */
+    void acquire(HostTask& p_task);
+
+    /**
+     * @brief Hands the core to the next ready task
+     *
+     * @param p_task the running task
+     */
+    void release(HostTask& p_task);
+
+    /**
+     * @brief Lets a ready task run first
+     * @details
+     * A preempted task waits at most itsPreemptionTimeout for the core to
+     * be released, since the preempting task may wait for a std::mutex the
+     * preempted one holds. It then continues next to the preempting task.
+     *
+     * @param p_task the running task
+     * @param p_equal also yield to tasks of the same priority
+     */
+    void yield(HostTask& p_task, bool p_equal);
+
+private:
+    inline static constexpr std::chrono::milliseconds itsPreemptionTimeout{50};
+
+    bool isNext(const HostTask& p_task) const;
+    void enqueue(HostTask& p_task);
+
+    std::mutex itsMutex;
+    std::condition_variable itsChanged;
+    HostTask* itsRunning = nullptr;
+    std::vector<HostTask*> itsReady;
+    uint64_t itsNextTicket = 0;
+};
+
+/**
+ * @brief A task blocked on a queue until another task signals it
+ */
+struct HostWaiter
+{
+    HostTask* itsTask;
+    bool itsSignaled;
+};
+
+/**
+ * @brief Signals the waiter of highest priority and removes it from the list
+ *
+ * @param p_waiters
+ */
+void hostSignal(std::vector<HostWaiter*>& p_waiters);
+
+/**
+ * @brief Lets a task of higher priority run that was made ready meanwhile
+ */
+void hostPreemptionPoint();
+
+/**
+ * @brief Returns the task of the calling thread
+ * @details
+ * Threads not created as tasks get a task without affinity and priority 0.
+ *
+ * @return HostTask&
+ */
+HostTask& hostCurrentTask();
+
+/**
+ * @brief Makes the calling thread the main task and waits for its core
+ */
+void hostStartMainTask();
+
+/**
+ * @brief Runs a blocking wait without occupying the core of the calling task
+ * @details
+ * p_wait must not take any locks that a task holding a core may wait for
+ * after p_wait returned.
+ *
+ * @param p_wait
+ * @return the result of p_wait
+ */
+template <typename Wait>
+auto hostBlock(Wait&& p_wait)
+{
+    HostTask& task = hostCurrentTask();
+    HostCore* core = HostCore::of(task);
+    if (core)
+    {
+        core->release(task);
+    }
+    auto result = p_wait();
+    if (core)
+    {
+        core->acquire(task);
+    }
+    return result;
+}
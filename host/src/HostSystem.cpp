@@ -0,0 +1,80 @@
+/**
+ * @file HostSystem.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: time, program start and end
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <esp_cpu.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "HostPort.hpp"
+#include "HostScheduler.hpp"
+
+static const auto theStartTime = std::chrono::steady_clock::now();
+static std::atomic<int> theExitStatus(0);
+static int theArgc = 0;
+static char** theArgv = nullptr;
+
+int64_t esp_timer_get_time()
+{
+    const auto elapsed = std::chrono::steady_clock::now() - theStartTime;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+uint32_t esp_cpu_get_cycle_count()
+{
+    const auto elapsed = std::chrono::steady_clock::now() - theStartTime;
+    return uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+void hostSetExitStatus(int p_status)
+{
+    theExitStatus.store(p_status);
+}
+
+const char* hostArgument(int p_index)
+{
+    return (p_index < theArgc) ? theArgv[p_index] : nullptr;
+}
+
+void esp_restart()
+{
+    fflush(stdout);
+    fflush(stderr);
+    _exit(theExitStatus.load());
+}
+
+/**
+ * @brief Blocks the calling task like usleep() of ESP-IDF
+ * @details
+ * The C library version would keep the emulated core busy while sleeping.
+ * This definition takes precedence over the one of the C library.
+ */
+extern "C" int usleep(useconds_t p_us)
+{
+    hostBlock([p_us]()
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(p_us));
+        return true;
+    });
+    return 0;
+}
+
+extern "C" void app_main(void);
+
+int main(int p_argc, char** p_argv)
+{
+    theArgc = p_argc;
+    theArgv = p_argv;
+    hostStartMainTask();
+    app_main();
+    esp_restart();
+}
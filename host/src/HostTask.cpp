@@ -0,0 +1,401 @@
+/**
+ * @file HostTask.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: FreeRTOS tasks on std::thread
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#include <pthread.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <esp_log.h>
+#include <esp_task.h>
+#include "freertos/task.h"
+#include "HostScheduler.hpp"
+
+static const char* TAG = "HostTask";
+
+static HostCore theCores[portNUM_PROCESSORS];
+
+static thread_local HostTask theThreadTask = {"thread", 0, tskNO_AFFINITY, 0};
+static thread_local HostTask* theCurrentTask = &theThreadTask;
+
+static const auto theStartTime = std::chrono::steady_clock::now();
+
+HostCore* HostCore::of(const HostTask& p_task)
+{
+    if ((p_task.itsCoreId >= 0) && (p_task.itsCoreId < portNUM_PROCESSORS))
+    {
+        return &theCores[p_task.itsCoreId];
+    }
+    return nullptr;
+}
+
+bool HostCore::isNext(const HostTask& p_task) const
+{
+    if (itsRunning != nullptr)
+    {
+        return false;
+    }
+    for (const HostTask* ready : itsReady)
+    {
+        if ((ready->itsPriority > p_task.itsPriority) ||
+            ((ready->itsPriority == p_task.itsPriority) && (ready->itsTicket < p_task.itsTicket)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void HostCore::enqueue(HostTask& p_task)
+{
+    if (std::find(itsReady.begin(), itsReady.end(), &p_task) == itsReady.end())
+    {
+        p_task.itsTicket = itsNextTicket++;
+        itsReady.push_back(&p_task);
+    }
+}
+
+void HostCore::makeReady(HostTask& p_task)
+{
+    std::lock_guard<std::mutex> lock(itsMutex);
+    enqueue(p_task);
+}
+
+void HostCore::makeUnready(HostTask& p_task)
+{
+    {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        auto it = std::find(itsReady.begin(), itsReady.end(), &p_task);
+        if (it == itsReady.end())
+        {
+            return;
+        }
+        itsReady.erase(it);
+    }
+    itsChanged.notify_all();
+}
+
+void HostCore::setPriority(HostTask& p_task, UBaseType_t p_priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        p_task.itsPriority.store(p_priority);
+    }
+    itsChanged.notify_all();
+}
+
+void HostCore::acquire(HostTask& p_task)
+{
+    std::unique_lock<std::mutex> lock(itsMutex);
+    enqueue(p_task);
+    itsChanged.wait(lock, [this, &p_task]() { return isNext(p_task); });
+    itsReady.erase(std::find(itsReady.begin(), itsReady.end(), &p_task));
+    itsRunning = &p_task;
+}
+
+void HostCore::release(HostTask& p_task)
+{
+    {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        if (itsRunning != &p_task)
+        {
+            // resumed after a preemption timeout, the core belongs to another task
+            return;
+        }
+        itsRunning = nullptr;
+    }
+    itsChanged.notify_all();
+}
+
+void HostCore::yield(HostTask& p_task, bool p_equal)
+{
+    std::unique_lock<std::mutex> lock(itsMutex);
+    const bool other = std::any_of(itsReady.begin(), itsReady.end(), [&p_task, p_equal](const HostTask* ready)
+                                   {
+                                       return (ready->itsPriority > p_task.itsPriority) ||
+                                              (p_equal && (ready->itsPriority == p_task.itsPriority));
+                                   });
+    if (!other || (itsRunning != &p_task))
+    {
+        return;
+    }
+    itsRunning = nullptr;
+    itsChanged.notify_all();
+    enqueue(p_task);
+    if (itsChanged.wait_for(lock, itsPreemptionTimeout, [this, &p_task]() { return isNext(p_task); }))
+    {
+        itsRunning = &p_task;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "task %s resumed while preempted, it may hold a lock the preempting task waits for",
+                 p_task.itsName.c_str());
+    }
+    itsReady.erase(std::find(itsReady.begin(), itsReady.end(), &p_task));
+}
+
+void hostSignal(std::vector<HostWaiter*>& p_waiters)
+{
+    if (p_waiters.empty())
+    {
+        return;
+    }
+    // the first one of the highest priority, i.e. the longest waiting one
+    auto next = p_waiters.begin();
+    for (auto it = p_waiters.begin(); it != p_waiters.end(); ++it)
+    {
+        if ((*it)->itsTask->itsPriority > (*next)->itsTask->itsPriority)
+        {
+            next = it;
+        }
+    }
+    HostWaiter* waiter = *next;
+    p_waiters.erase(next);
+    waiter->itsSignaled = true;
+    HostCore* core = HostCore::of(*waiter->itsTask);
+    if (core)
+    {
+        core->makeReady(*waiter->itsTask);
+    }
+}
+
+void hostPreemptionPoint()
+{
+    HostTask& task = hostCurrentTask();
+    HostCore* core = HostCore::of(task);
+    if (core)
+    {
+        core->yield(task, false);
+    }
+}
+
+HostTask& hostCurrentTask()
+{
+    return *theCurrentTask;
+}
+
+void hostStartMainTask()
+{
+    theThreadTask.itsName = "main";
+    theThreadTask.itsPriority.store(ESP_TASK_MAIN_PRIO);
+    theThreadTask.itsCoreId = ESP_TASK_MAIN_CORE;
+    theCores[ESP_TASK_MAIN_CORE].acquire(theThreadTask);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t p_function, const char* p_name, uint32_t p_stackDepth,
+                                   void* p_parameter, UBaseType_t p_priority, TaskHandle_t* p_handle,
+                                   BaseType_t p_coreId)
+{
+    HostTask* task = new HostTask{p_name ? p_name : "", p_priority, p_coreId, 0, p_stackDepth};
+    if (p_handle)
+    {
+        *p_handle = task;
+    }
+    HostCore* core = HostCore::of(*task);
+    if (core)
+    {
+        core->makeReady(*task);
+    }
+    std::thread([task, p_function, p_parameter]()
+    {
+        theCurrentTask = task;
+        HostCore* core = HostCore::of(*task);
+        if (core)
+        {
+            core->acquire(*task);
+        }
+        p_function(p_parameter);
+        ESP_LOGE(TAG, "task %s returned from its function", task->itsName.c_str());
+        vTaskDelete(NULL);
+    }).detach();
+    hostPreemptionPoint();
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t p_function, const char* p_name, uint32_t p_stackDepth,
+                                           void* p_parameter, UBaseType_t p_priority, StackType_t*,
+                                           StaticTask_t*, BaseType_t p_coreId)
+{
+    TaskHandle_t task = nullptr;
+    xTaskCreatePinnedToCore(p_function, p_name, p_stackDepth, p_parameter, p_priority, &task, p_coreId);
+    return task;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t p_function, const char* p_name, uint32_t p_stackDepth, void* p_parameter,
+                       UBaseType_t p_priority, TaskHandle_t* p_handle)
+{
+    return xTaskCreatePinnedToCore(p_function, p_name, p_stackDepth, p_parameter, p_priority, p_handle,
+                                   tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t p_task)
+{
+    HostTask& task = hostCurrentTask();
+    if (p_task && (p_task != &task))
+    {
+        // a thread cannot be stopped from the outside
+        ESP_LOGE(TAG, "deleting another task is not supported");
+        abort();
+    }
+    HostCore* core = HostCore::of(task);
+    if (core)
+    {
+        core->release(task);
+    }
+    // the task object may still be referenced by handles, so it is leaked
+    pthread_exit(nullptr);
+}
+
+void vTaskDelay(TickType_t p_ticks)
+{
+    HostTask& task = hostCurrentTask();
+    HostCore* core = HostCore::of(task);
+    if (p_ticks == 0)
+    {
+        if (core)
+        {
+            core->yield(task, true);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+        return;
+    }
+    hostBlock([p_ticks]()
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(uint64_t(p_ticks) * portTICK_PERIOD_MS * 1000));
+        return true;
+    });
+}
+
+TickType_t xTaskGetTickCount()
+{
+    const auto elapsed = std::chrono::steady_clock::now() - theStartTime;
+    return TickType_t(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return &hostCurrentTask();
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t p_task)
+{
+    return (p_task ? *p_task : hostCurrentTask()).itsPriority.load();
+}
+
+void vTaskPrioritySet(TaskHandle_t p_task, UBaseType_t p_priority)
+{
+    HostTask& task = p_task ? *p_task : hostCurrentTask();
+    if (HostCore* core = HostCore::of(task))
+    {
+        core->setPriority(task, p_priority);
+    }
+    else
+    {
+        task.itsPriority.store(p_priority);
+    }
+    // a lowered task may have to give way
+    hostPreemptionPoint();
+}
+
+BaseType_t xTaskGetAffinity(TaskHandle_t p_task)
+{
+    return (p_task ? *p_task : hostCurrentTask()).itsCoreId;
+}
+
+const char* pcTaskGetName(TaskHandle_t p_task)
+{
+    return (p_task ? *p_task : hostCurrentTask()).itsName.c_str();
+}
+
+/**
+ * @brief Increments the notification value and wakes the task if it waits
+ *
+ * @param p_task
+ */
+static void notifyGive(HostTask& p_task)
+{
+    {
+        std::lock_guard<std::mutex> lock(p_task.itsNotifyMutex);
+        p_task.itsNotifyValue++;
+        if (p_task.itsNotifyWaiting)
+        {
+            p_task.itsNotifyWaiting = false;
+            if (HostCore* core = HostCore::of(p_task))
+            {
+                core->makeReady(p_task);
+            }
+        }
+    }
+    p_task.itsNotified.notify_all();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t p_task)
+{
+    notifyGive(*p_task);
+    hostPreemptionPoint();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t p_task, BaseType_t* p_higherPriorityTaskWoken)
+{
+    if (p_higherPriorityTaskWoken)
+    {
+        *p_higherPriorityTaskWoken = pdFALSE;
+    }
+    notifyGive(*p_task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t p_clearCountOnExit, TickType_t p_ticksToWait)
+{
+    HostTask& task = hostCurrentTask();
+    auto take = [&task, p_clearCountOnExit]()
+    {
+        const uint32_t value = task.itsNotifyValue;
+        task.itsNotifyValue = p_clearCountOnExit ? 0 : value - 1;
+        return value;
+    };
+    {
+        std::lock_guard<std::mutex> lock(task.itsNotifyMutex);
+        if ((task.itsNotifyValue > 0) || (p_ticksToWait == 0))
+        {
+            return (task.itsNotifyValue > 0) ? take() : 0;
+        }
+        // from now on the task is made ready by a notification, even before it has released its core
+        task.itsNotifyWaiting = true;
+    }
+    return hostBlock([&]()
+    {
+        std::unique_lock<std::mutex> lock(task.itsNotifyMutex);
+        auto notified = [&task]() { return task.itsNotifyValue > 0; };
+        if (p_ticksToWait == portMAX_DELAY)
+        {
+            task.itsNotified.wait(lock, notified);
+        }
+        else if (!task.itsNotified.wait_for(lock, std::chrono::milliseconds(uint64_t(p_ticksToWait) *
+                                                                            portTICK_PERIOD_MS), notified))
+        {
+            task.itsNotifyWaiting = false;
+            return uint32_t(0);
+        }
+        return take();
+    });
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t p_task)
+{
+    return (p_task ? *p_task : hostCurrentTask()).itsStackDepth;
+}
+
+BaseType_t xPortGetCoreID()
+{
+    const BaseType_t coreId = hostCurrentTask().itsCoreId;
+    return HostCore::of(hostCurrentTask()) ? coreId : 0;
+}
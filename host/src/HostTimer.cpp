@@ -0,0 +1,133 @@
+/**
+ * @file HostTimer.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: one-shot esp_timer timers run by a timer task
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <esp_timer.h>
+#include "freertos/task.h"
+#include "HostScheduler.hpp"
+
+// like ESP_TASK_TIMER_PRIO and the default CONFIG_ESP_TIMER_TASK_AFFINITY of ESP-IDF
+static const UBaseType_t theTimerTaskPriority = configMAX_PRIORITIES - 3;
+static const BaseType_t theTimerTaskCore = 0;
+
+struct esp_timer
+{
+    esp_timer_cb_t itsCallback;
+    void* itsArg;
+    bool itsArmed;
+    std::multimap<int64_t, esp_timer*>::iterator itsAlarm;
+};
+
+static std::mutex theMutex;
+static std::condition_variable theChanged;
+static std::multimap<int64_t, esp_timer*> theAlarms;   ///< armed timers by alarm time, guarded by theMutex
+static std::once_flag theTaskStarted;
+
+/**
+ * @brief Waits for the next alarm and returns the callback to run
+ */
+static std::pair<esp_timer_cb_t, void*> waitForAlarm()
+{
+    std::unique_lock<std::mutex> lock(theMutex);
+    while (true)
+    {
+        if (theAlarms.empty())
+        {
+            theChanged.wait(lock);
+            continue;
+        }
+        const int64_t delayUs = theAlarms.begin()->first - esp_timer_get_time();
+        if (delayUs > 0)
+        {
+            theChanged.wait_for(lock, std::chrono::microseconds(delayUs));
+            continue;
+        }
+        esp_timer* timer = theAlarms.begin()->second;
+        theAlarms.erase(theAlarms.begin());
+        timer->itsArmed = false;
+        return {timer->itsCallback, timer->itsArg};
+    }
+}
+
+static void timerTask(void*)
+{
+    while (true)
+    {
+        auto [callback, arg] = hostBlock(waitForAlarm);
+        callback(arg);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* p_args, esp_timer_handle_t* p_handle)
+{
+    if ((p_args == nullptr) || (p_args->callback == nullptr) || (p_handle == nullptr))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::call_once(theTaskStarted, []()
+    {
+        xTaskCreatePinnedToCore(timerTask, "esp_timer", 4096, nullptr, theTimerTaskPriority, nullptr,
+                                theTimerTaskCore);
+    });
+    *p_handle = new esp_timer{p_args->callback, p_args->arg, false, {}};
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t p_timer, uint64_t p_timeoutUs)
+{
+    {
+        std::lock_guard<std::mutex> lock(theMutex);
+        if (p_timer->itsArmed)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        p_timer->itsArmed = true;
+        p_timer->itsAlarm = theAlarms.emplace(esp_timer_get_time() + int64_t(p_timeoutUs), p_timer);
+    }
+    theChanged.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t p_timer)
+{
+    std::lock_guard<std::mutex> lock(theMutex);
+    if (!p_timer->itsArmed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    theAlarms.erase(p_timer->itsAlarm);
+    p_timer->itsArmed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t p_timer)
+{
+    if (p_timer == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    {
+        std::lock_guard<std::mutex> lock(theMutex);
+        if (p_timer->itsArmed)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    delete p_timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t p_timer)
+{
+    std::lock_guard<std::mutex> lock(theMutex);
+    return p_timer->itsArmed;
+}
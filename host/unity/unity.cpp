@@ -0,0 +1,105 @@
+/**
+ * @file unity.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: registration and runner of the unit tests
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "HostPort.hpp"
+#include "unity.h"
+
+struct UnityTest
+{
+    const char* itsName;
+    const char* itsGroup;
+    const char* itsFile;
+    int itsLine;
+    UnityTestFunction itsFunction;
+};
+
+static std::vector<UnityTest>& unityTests()
+{
+    static std::vector<UnityTest> tests;
+    return tests;
+}
+
+static unsigned theNumTests = 0;
+static unsigned theNumFailures = 0;
+static bool theCurrentFailed = false;
+
+UnityTestRegistration::UnityTestRegistration(const char* p_name, const char* p_group, const char* p_file,
+                                             int p_line, UnityTestFunction p_function)
+{
+    unityTests().push_back({p_name, p_group, p_file, p_line, p_function});
+}
+
+void unityFail(const char* p_file, int p_line, const char* p_message, const char* p_expected,
+               const char* p_actual)
+{
+    theCurrentFailed = true;
+    printf("%s:%d:FAIL: %s\n", p_file, p_line, p_message);
+    if (p_expected && p_actual)
+    {
+        printf("--- expected\n%s\n--- actual\n%s\n---\n", p_expected, p_actual);
+    }
+}
+
+bool unityEqualString(const char* p_file, int p_line, const char* p_expected, const char* p_actual)
+{
+    if (strcmp(p_expected, p_actual) == 0)
+    {
+        return true;
+    }
+    unityFail(p_file, p_line, "Strings differ", p_expected, p_actual);
+    return false;
+}
+
+void UnityBegin(const char*)
+{
+    theNumTests = 0;
+    theNumFailures = 0;
+}
+
+int UnityEnd(void)
+{
+    printf("\n-----------------------\n%u Tests %u Failures 0 Ignored\n%s\n", theNumTests, theNumFailures,
+           theNumFailures ? "FAIL" : "OK");
+    fflush(stdout);
+    hostSetExitStatus(theNumFailures ? 1 : 0);
+    return int(theNumFailures);
+}
+
+void unity_run_all_tests(void)
+{
+    const char* filter = hostArgument(1);
+    for (const UnityTest& test : unityTests())
+    {
+        if (filter && !strstr(test.itsName, filter) && !strstr(test.itsGroup, filter))
+        {
+            continue;
+        }
+        printf("Running %s %s...\n", test.itsGroup, test.itsName);
+        fflush(stdout);
+        theCurrentFailed = false;
+        setUp();
+        test.itsFunction();
+        tearDown();
+        theNumTests++;
+        if (theCurrentFailed)
+        {
+            theNumFailures++;
+        }
+        printf("%s:%d:%s:%s\n", test.itsFile, test.itsLine, test.itsName, theCurrentFailed ? "FAIL" : "PASS");
+        fflush(stdout);
+    }
+}
+
+void unity_run_menu(void)
+{
+    unity_run_all_tests();
+}
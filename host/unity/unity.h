@@ -0,0 +1,80 @@
+/**
+ * @file unity.h
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Host build: the subset of the Unity test framework used by the unit tests
+ * @details
+ * TEST_CASE registers a test like the ESP-IDF unity component does. A failed
+ * assertion ends the current function (the test or tearDown()), the tests are
+ * run by unity_run_all_tests(). If the first command line argument is given,
+ * only the tests whose name or group (e.g. "[Rcu]") contains it are run.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <unistd.h>  // usleep(), tests get it through the ESP-IDF unity component
+
+typedef void (*UnityTestFunction)(void);
+
+struct UnityTestRegistration
+{
+    UnityTestRegistration(const char* p_name, const char* p_group, const char* p_file, int p_line,
+                          UnityTestFunction p_function);
+};
+
+void unityFail(const char* p_file, int p_line, const char* p_message, const char* p_expected,
+               const char* p_actual);
+
+bool unityEqualString(const char* p_file, int p_line, const char* p_expected, const char* p_actual);
+
+extern "C"
+{
+void setUp(void);
+void tearDown(void);
+}
+
+void UnityBegin(const char* p_filename);
+int UnityEnd(void);
+void unity_run_all_tests(void);
+void unity_run_menu(void);
+
+#define UNITY_CONCAT_(a, b) a##b
+#define UNITY_CONCAT(a, b) UNITY_CONCAT_(a, b)
+
+#define TEST_CASE(name, group)                                                              \
+    static void UNITY_CONCAT(unity_test_, __LINE__)(void);                                  \
+    static UnityTestRegistration UNITY_CONCAT(unity_registration_, __LINE__)(               \
+        name, group, __FILE__, __LINE__, &UNITY_CONCAT(unity_test_, __LINE__));             \
+    static void UNITY_CONCAT(unity_test_, __LINE__)(void)
+
+#define TEST_FAIL_MESSAGE(message)                                                          \
+    do                                                                                      \
+    {                                                                                       \
+        unityFail(__FILE__, __LINE__, message, nullptr, nullptr);                           \
+        return;                                                                             \
+    } while (0)
+
+#define TEST_ASSERT_TRUE(condition)                                                         \
+    do                                                                                      \
+    {                                                                                       \
+        if (!(condition))                                                                   \
+        {                                                                                   \
+            TEST_FAIL_MESSAGE("Expected TRUE: " #condition);                                \
+        }                                                                                   \
+    } while (0)
+
+#define TEST_ASSERT(condition) TEST_ASSERT_TRUE(condition)
+#define TEST_ASSERT_FALSE(condition) TEST_ASSERT_TRUE(!(condition))
+#define TEST_ASSERT_EQUAL(expected, actual) TEST_ASSERT_TRUE((expected) == (actual))
+
+// a single expression, so temporaries passed as arguments live long enough
+#define TEST_ASSERT_EQUAL_STRING(expected, actual)                                          \
+    do                                                                                      \
+    {                                                                                       \
+        if (!unityEqualString(__FILE__, __LINE__, (expected), (actual)))                    \
+        {                                                                                   \
+            return;                                                                         \
+        }                                                                                   \
+    } while (0)
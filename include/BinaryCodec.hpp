@@ -0,0 +1,302 @@
+/**
+ * @file BinaryCodec.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Compact binary encoding of argument lists, selected at compile time
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+static_assert(std::endian::native == std::endian::little, "the encoding assumes a little-endian CPU");
+
+/**
+ * @brief Appends encoded values to a buffer of fixed size
+ * @details
+ * Writing beyond the end of the buffer sets the overflow flag instead, so
+ * a sequence of values may be written without checking each of them.
+ */
+class BinaryWriter
+{
+public:
+    BinaryWriter(uint8_t* p_data, std::size_t p_capacity) :
+        itsData(p_data),
+        itsCapacity(p_capacity),
+        itsSize(0),
+        itsOverflow(false)
+    {}
+
+    void write(const void* p_data, std::size_t p_size)
+    {
+        if (p_size > itsCapacity - itsSize)
+        {
+            itsOverflow = true;
+            itsSize = itsCapacity;
+            return;
+        }
+        memcpy(itsData + itsSize, p_data, p_size);
+        itsSize += p_size;
+    }
+
+    void writeByte(uint8_t p_byte)
+    {
+        write(&p_byte, 1);
+    }
+
+    /**
+     * @brief Write an unsigned integer with 7 bits per byte, least
+     *        significant first, the high bit telling that more bytes follow
+     *
+     * @param p_value
+     */
+    void writeVarint(uint64_t p_value)
+    {
+        while (p_value >= 0x80)
+        {
+            writeByte(uint8_t(p_value) | 0x80);
+            p_value >>= 7;
+        }
+        writeByte(uint8_t(p_value));
+    }
+
+    std::size_t size() const
+    {
+        return itsSize;
+    }
+
+    bool overflow() const
+    {
+        return itsOverflow;
+    }
+
+private:
+    uint8_t* itsData;
+    std::size_t itsCapacity;
+    std::size_t itsSize;
+    bool itsOverflow;
+};
+
+/**
+ * @brief Reads encoded values from a buffer
+ * @details
+ * Reading beyond the end of the buffer or an invalid encoding sets the
+ * error flag, values read afterwards are undefined.
+ */
+class BinaryReader
+{
+public:
+    BinaryReader(const uint8_t* p_data, std::size_t p_size) :
+        itsData(p_data),
+        itsSize(p_size),
+        itsPosition(0),
+        itsError(false)
+    {}
+
+    void read(void* p_data, std::size_t p_size)
+    {
+        if (p_size > itsSize - itsPosition)
+        {
+            itsError = true;
+            itsPosition = itsSize;
+            memset(p_data, 0, p_size);
+            return;
+        }
+        memcpy(p_data, itsData + itsPosition, p_size);
+        itsPosition += p_size;
+    }
+
+    uint8_t readByte()
+    {
+        uint8_t byte;
+        read(&byte, 1);
+        return byte;
+    }
+
+    uint64_t readVarint()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            const uint8_t byte = readByte();
+            value |= uint64_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+        itsError = true;
+        return 0;
+    }
+
+    std::size_t remaining() const
+    {
+        return itsSize - itsPosition;
+    }
+
+    bool error() const
+    {
+        return itsError;
+    }
+
+    void setError()
+    {
+        itsError = true;
+    }
+
+private:
+    const uint8_t* itsData;
+    std::size_t itsSize;
+    std::size_t itsPosition;
+    bool itsError;
+};
+
+/**
+ * @brief Encoding of a single type, specialized per kind of type
+ * @details
+ *   * bool and 1-byte integers: 1 byte
+ *   * wider unsigned integers and enums: varint
+ *   * wider signed integers: zigzag varint, so small negative values stay short
+ *   * floating point: IEEE 754 bytes
+ *   * std::string: varint length and the characters
+ *   * std::array: its elements
+ *   * other trivially copyable types: their bytes, so all nodes must use
+ *     the same layout
+ * Other types fail to compile, a specialization may be added for them.
+ *
+ * @tparam T
+ */
+template <typename T, typename Enable = void>
+struct BinaryCodec
+{
+    static_assert(std::is_trivially_copyable_v<T>, "no binary encoding for this type, add a BinaryCodec specialization");
+
+    static void encode(BinaryWriter& p_writer, const T& p_value)
+    {
+        p_writer.write(&p_value, sizeof(T));
+    }
+
+    static void decode(BinaryReader& p_reader, T& p_value)
+    {
+        p_reader.read(&p_value, sizeof(T));
+    }
+};
+
+template <typename T>
+struct BinaryCodec<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>>
+{
+    using Underlying = typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>,
+                                                   std::type_identity<T>>::type;
+
+    static void encode(BinaryWriter& p_writer, const T& p_value)
+    {
+        const Underlying value = static_cast<Underlying>(p_value);
+        if constexpr (sizeof(Underlying) == 1)
+        {
+            p_writer.writeByte(static_cast<uint8_t>(value));
+        }
+        else if constexpr (std::is_signed_v<Underlying>)
+        {
+            const int64_t wide = value;
+            p_writer.writeVarint((uint64_t(wide) << 1) ^ uint64_t(wide >> 63));
+        }
+        else
+        {
+            p_writer.writeVarint(value);
+        }
+    }
+
+    static void decode(BinaryReader& p_reader, T& p_value)
+    {
+        if constexpr (sizeof(Underlying) == 1)
+        {
+            p_value = static_cast<T>(p_reader.readByte());
+        }
+        else if constexpr (std::is_signed_v<Underlying>)
+        {
+            const uint64_t zigzag = p_reader.readVarint();
+            p_value = static_cast<T>(static_cast<Underlying>(int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1)));
+        }
+        else
+        {
+            p_value = static_cast<T>(static_cast<Underlying>(p_reader.readVarint()));
+        }
+    }
+};
+
+template <>
+struct BinaryCodec<std::string>
+{
+    static void encode(BinaryWriter& p_writer, const std::string& p_value)
+    {
+        p_writer.writeVarint(p_value.size());
+        p_writer.write(p_value.data(), p_value.size());
+    }
+
+    static void decode(BinaryReader& p_reader, std::string& p_value)
+    {
+        const uint64_t size = p_reader.readVarint();
+        if (size > p_reader.remaining())
+        {
+            p_reader.setError();
+            return;
+        }
+        p_value.resize(size);
+        p_reader.read(p_value.data(), size);
+    }
+};
+
+template <typename T, std::size_t N>
+struct BinaryCodec<std::array<T, N>, std::enable_if_t<!std::is_trivially_copyable_v<T> ||
+                                                      std::is_integral_v<T> || std::is_enum_v<T>>>
+{
+    static void encode(BinaryWriter& p_writer, const std::array<T, N>& p_value)
+    {
+        for (const T& element : p_value)
+        {
+            BinaryCodec<T>::encode(p_writer, element);
+        }
+    }
+
+    static void decode(BinaryReader& p_reader, std::array<T, N>& p_value)
+    {
+        for (T& element : p_value)
+        {
+            BinaryCodec<T>::decode(p_reader, element);
+        }
+    }
+};
+
+/**
+ * @brief Encode a list of values one after the other
+ *
+ * @param p_writer
+ * @param p_values
+ */
+template <typename... Types>
+void binaryEncode(BinaryWriter& p_writer, const Types&... p_values)
+{
+    (BinaryCodec<Types>::encode(p_writer, p_values), ...);
+}
+
+/**
+ * @brief Decode the elements of a tuple one after the other
+ *
+ * @param p_reader
+ * @param p_values
+ */
+template <typename... Types>
+void binaryDecode(BinaryReader& p_reader, std::tuple<Types...>& p_values)
+{
+    std::apply([&p_reader](Types&... p_elements) { (BinaryCodec<Types>::decode(p_reader, p_elements), ...); },
+               p_values);
+}
@@ -0,0 +1,516 @@
+/**
+ * @file Broker.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Single publish/subscribe broker shared by all message signatures
+ * @details
+ * Every PublishSubscribe<Types...> is a singleton of its own, with its own
+ * channel map, Rcu, recursion queue and a copy of the complete dispatch
+ * code. The Broker instead keeps the channels of all signatures in one
+ * registry. Only the thin typed front-end Broker::Topic<Types...> and three
+ * small functions per signature (calling a callback, creating a payload and
+ * calling a callback with a payload) are templates, the dispatch path is
+ * compiled once in Broker.cpp.
+ *
+ * Each channel records the signature it has been created with, resolving
+ * the same name with different argument types is a fatal error.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <string_view>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+
+#include "freertos/FreeRTOS.h"
+
+#include "PublishSubscribe.hpp"
+#include "PendingOps.hpp"
+
+/**
+ * @brief Type-erased publish/subscribe broker
+ * @details
+ * Supports the topic handles of PublishSubscribe with synchronous,
+ * asynchronous and latest-value subscriptions, publishing from tasks and
+ * ISRs, statistics and reentrancy (subscriptions requested from within a
+ * synchronous handler take effect after the outermost publish of the task,
+ * as with PublishSubscribe). Wildcard patterns, loan pools, static topics and
+ * latency histograms are only provided by PublishSubscribe.
+ *
+ * Usage:
+ *   auto temp = Broker::get().topic<float>("sensor/temp");
+ *   temp.subscribeAsync([](float p_celsius) { ... });
+ *   temp.publish(21.5f);
+ */
+class Broker
+{
+public:
+    template <typename... Types>
+    class Topic;
+
+    /**
+     * @brief Returns the broker instance
+     *
+     * @return Broker&
+     */
+    static Broker& getInstance();
+
+    /**
+     * @brief Alias for getInstance().
+     *
+     * @return Broker&
+     */
+    static constexpr auto get = &getInstance;
+
+    /**
+     * @brief Resolve a channel once and return a typed handle to it
+     * @details
+     * The channel is created with the given argument types if it does not
+     * exist yet. Resolving an existing channel with other argument types
+     * is a fatal error.
+     *
+     * @tparam Types argument types of the messages of the channel
+     * @param p_channel
+     * @return Topic<Types...>
+     */
+    template <typename... Types>
+    Topic<Types...> topic(std::string_view p_channel)
+    {
+        return Topic<Types...>(*this, getChannel(p_channel, &Signature::itsOf<Types...>));
+    }
+
+    /**
+     * @brief Remove all callbacks of all channels
+     * @details
+     * The channels themselves are kept so that existing topic handles stay valid.
+     */
+    void clear();
+
+    /**
+     * @brief Returns the counters of all channels
+     *
+     * @return std::vector<TopicStats>
+     */
+    std::vector<TopicStats> getStats();
+
+    /**
+     * @brief Reset the counters of all channels
+     */
+    void resetStats();
+
+private:
+    enum class Delivery : uint8_t
+    {
+        Sync,
+        Critical,
+        Async,
+        Latest
+    };
+
+    /**
+     * @brief Type-erased callback, a std::function<void(Types...)> of the
+     *        signature of the channel
+     */
+    using CallbackPtr = std::shared_ptr<const void>;
+
+    /**
+     * @brief Type-erased immutable copy of the arguments of a message,
+     *        a std::tuple<std::decay_t<Types>...>
+     */
+    using PayloadPtr = std::shared_ptr<const void>;
+
+    /**
+     * @brief The functions depending on the argument types of a channel
+     * @details
+     * While a message is published its arguments are passed as a pointer to
+     * a std::tuple<Types&...>.
+     */
+    struct Signature
+    {
+        void (*itsCall)(const void* p_callback, void* p_args);
+        void (*itsCallPayload)(const void* p_callback, const void* p_payload);
+        PayloadPtr (*itsMakePayload)(void* p_args, bool p_movable);
+
+        template <typename... Types>
+        static const Signature itsOf;
+    };
+
+    template <typename... Types>
+    struct SignatureOf;
+
+    struct LatestValue
+    {
+        std::mutex itsMutex;
+        PayloadPtr itsPayload;   ///< pending message, if any
+    };
+
+    struct Subscriber
+    {
+        CallbackPtr itsCallback;                  ///< shared by all copies of the table
+        SubscriptionId itsId;
+        UBaseType_t itsPriority;
+        BaseType_t itsAffinity;
+        Delivery itsDelivery;
+        std::shared_ptr<LatestValue> itsLatest;   ///< shared by all copies of the table
+
+        Subscriber(SubscriptionId p_id,
+                   const CallbackPtr& p_callback,
+                   UBaseType_t p_priority,
+                   BaseType_t p_affinity,
+                   Delivery p_delivery);
+
+        bool isSync() const
+        {
+            return (itsDelivery == Delivery::Sync) || (itsDelivery == Delivery::Critical);
+        }
+    };
+
+    /**
+     * @brief Subscribers in the order of subscription and the call order of
+     *        the synchronous ones, as for PublishSubscribe
+     */
+    struct SubscriberTable
+    {
+        std::vector<Subscriber, PoolAllocator<Subscriber>> itsSubscribers;
+        std::vector<uint32_t, PoolAllocator<uint32_t>> itsSyncOrder;   ///< indices into itsSubscribers
+        uint32_t itsNumCritical = 0;
+        bool itsHasAsync = false;
+
+        static bool callsAfter(const Subscriber& p_left, const Subscriber& p_right);
+        void updateOrder();
+    };
+
+    /**
+     * @brief Channel of one signature, never released
+     */
+    struct Channel
+    {
+        PoolString itsName;
+        TopicInfo itsInfo;
+        const Signature* itsSignature;
+        std::atomic<const SubscriberTable*> itsTable;
+
+        Channel(std::string_view p_name, const Signature* p_signature);
+    };
+
+    using ChannelMap = std::map<std::string_view, Channel*, std::less<>,
+                                PoolAllocator<std::pair<const std::string_view, Channel*>>>;
+
+    /**
+     * @brief Subscription deferred until the outermost publish of a task has finished
+     */
+    struct PendingOp
+    {
+        Channel* itsChannel;
+        Subscriber itsSubscriber;
+    };
+
+    /// subscriptions deferred by the current task, see PendingOps
+    using Pending = PendingOps<Broker, PendingOp>;
+
+    class Message;
+    class ReadSection;
+
+    inline static const char TAG[] = "Broker";
+
+    /// nesting depth of reader sections of the current task
+    static thread_local uint32_t itsReadDepth;
+
+    Rcu itsRcu;
+    std::mutex itsWriterMutex;
+    std::mutex itsChannelsMutex;
+    std::atomic<const ChannelMap*> itsChannels;
+    std::atomic<SubscriptionId> itsNextSubscriptionId;
+
+    Broker();
+    ~Broker();
+
+    Broker(const Broker&) = delete;
+    Broker& operator=(const Broker&) = delete;
+
+    Channel* findChannel(std::string_view p_channel);
+    Channel& getChannel(std::string_view p_channel, const Signature* p_signature);
+
+    void publish(Channel& p_channel, void* p_args);
+    void publishAsync(Channel& p_channel, void* p_args, int p_prio);
+
+    static void deliverSync(const Subscriber& p_subscriber, Message& p_message);
+    static void dispatchAsync(const Subscriber& p_subscriber, Message& p_message, int p_prio);
+    static void dispatchLatest(const Subscriber& p_subscriber, Message& p_message, int p_prio);
+    static void clearLatest(void* p_latest);
+
+    static void reserveStack(UBaseType_t p_priority, BaseType_t p_affinity, uint32_t p_stackSize);
+
+    /**
+     * @brief Hand a call over to the ISR task of DeferredCallsQueue
+     *
+     * @param p_call
+     * @return false if the call was dropped
+     */
+    template <typename Call>
+    static bool deferFromISR(Call&& p_call)
+    {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        BaseType_t result = DeferredCallsQueue::get().addDeferredCallFromISR(std::forward<Call>(p_call),
+                                                                            &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+        return result == pdTRUE;
+    }
+
+    SubscriptionId subscribe(Channel& p_channel, CallbackPtr&& p_callback, UBaseType_t p_priority,
+                             BaseType_t p_affinity, Delivery p_delivery);
+    void addSubscriber(Channel& p_channel, Subscriber&& p_subscriber);
+    void unsubscribe(Channel& p_channel, SubscriptionId p_id);
+    void clear(Channel& p_channel);
+    TopicStats getStats(Channel& p_channel);
+
+    template <typename Modify>
+    void updateChannel(Channel& p_channel, Modify p_modify);
+
+    void runOp(PendingOp&& p_op);
+    void runQueuedCalls();
+};
+
+/**
+ * @brief Typed handle to a channel of the broker
+ * @details
+ * Like PublishSubscribe::Topic, a handle refers directly to its channel and
+ * remains valid for the lifetime of the program. The argument types are
+ * checked at compile time against the handle, and against the channel when
+ * the handle is created.
+ *
+ * @tparam Types argument types of the messages of the channel
+ */
+template <typename... Types>
+class Broker::Topic
+{
+public:
+    using SubscribeCallback = std::function<void(Types...)> const;
+
+    /**
+     * @brief Publish a message to this topic
+     *
+     * @param p_args
+     */
+    void publish(Types... p_args) const
+    {
+        std::tuple<Types&...> args(p_args...);
+        itsBroker->publish(*itsChannel, &args);
+    }
+
+    void publishAsync(Types... p_args) const
+    {
+        std::tuple<Types&...> args(p_args...);
+        itsBroker->publishAsync(*itsChannel, &args, -1);
+    }
+
+    void publishAsyncWithPrio(Types... p_args, UBaseType_t p_priority) const
+    {
+        std::tuple<Types&...> args(p_args...);
+        itsBroker->publishAsync(*itsChannel, &args, p_priority);
+    }
+
+    /**
+     * @brief Publish a message to this topic from an interrupt service routine
+     * @details
+     * The arguments are copied into a slot reserved for interrupts, the
+     * message is then published by the ISR task of DeferredCallsQueue.
+     *
+     * @param p_args
+     * @return false if the message was dropped because all slots are in use
+     */
+    bool publishFromISR(Types... p_args) const
+    {
+        static_assert((std::is_trivially_copyable_v<Types> && ...),
+                      "only trivially copyable arguments may be published from an ISR");
+        return deferFromISR(IsrCall{itsBroker, itsChannel, {p_args...}});
+    }
+
+    /**
+     * @brief Subscribe to this topic
+     *
+     * @param p_callback
+     * @return subscription ID, should be stored if you wanna unsubscribe
+     */
+    SubscriptionId subscribeSync(SubscribeCallback& p_callback) const
+    {
+        return itsBroker->subscribe(*itsChannel, makeCallback(p_callback), uxTaskPriorityGet(NULL),
+                                    xTaskGetAffinity(NULL), Delivery::Sync);
+    }
+
+    /**
+     * @brief Subscribe synchronously, called before any deferred call of a
+     *        message is added and before the other synchronous subscribers
+     *
+     * @param p_callback
+     * @return subscription ID, should be stored if you wanna unsubscribe
+     */
+    SubscriptionId subscribeCritical(SubscribeCallback& p_callback) const
+    {
+        return itsBroker->subscribe(*itsChannel, makeCallback(p_callback), uxTaskPriorityGet(NULL),
+                                    xTaskGetAffinity(NULL), Delivery::Critical);
+    }
+
+    SubscriptionId subscribeAsync(SubscribeCallback& p_callback) const
+    {
+        return itsBroker->subscribe(*itsChannel, makeCallback(p_callback), uxTaskPriorityGet(NULL),
+                                    xTaskGetAffinity(NULL), Delivery::Async);
+    }
+
+    /**
+     * @brief Subscribe asynchronously with the given priority
+     *
+     * @param p_callback
+     * @param p_priority
+     * @param p_stackSize stack size in bytes needed by the callback, 0 for the default
+     * @return subscription ID, should be stored if you wanna unsubscribe
+     */
+    SubscriptionId subscribeAsyncWithPrio(SubscribeCallback& p_callback, UBaseType_t p_priority,
+                                          uint32_t p_stackSize = 0) const
+    {
+        BaseType_t affinity = xTaskGetAffinity(NULL);
+        reserveStack(p_priority, affinity, p_stackSize);
+        return itsBroker->subscribe(*itsChannel, makeCallback(p_callback), p_priority, affinity, Delivery::Async);
+    }
+
+    /**
+     * @brief Subscribe asynchronously, only receiving the latest message
+     *
+     * @param p_callback
+     * @return subscription ID, should be stored if you wanna unsubscribe
+     */
+    SubscriptionId subscribeLatest(SubscribeCallback& p_callback) const
+    {
+        return itsBroker->subscribe(*itsChannel, makeCallback(p_callback), uxTaskPriorityGet(NULL),
+                                    xTaskGetAffinity(NULL), Delivery::Latest);
+    }
+
+    SubscriptionId subscribeLatestWithPrio(SubscribeCallback& p_callback, UBaseType_t p_priority,
+                                           uint32_t p_stackSize = 0) const
+    {
+        BaseType_t affinity = xTaskGetAffinity(NULL);
+        reserveStack(p_priority, affinity, p_stackSize);
+        return itsBroker->subscribe(*itsChannel, makeCallback(p_callback), p_priority, affinity, Delivery::Latest);
+    }
+
+    void unsubscribe(SubscriptionId p_id) const
+    {
+        itsBroker->unsubscribe(*itsChannel, p_id);
+    }
+
+    /**
+     * @brief Remove all callbacks for this topic
+     */
+    void clear() const
+    {
+        itsBroker->clear(*itsChannel);
+    }
+
+    std::string_view name() const
+    {
+        return itsChannel->itsName;
+    }
+
+    TopicStats getStats() const
+    {
+        return itsBroker->getStats(*itsChannel);
+    }
+
+    void resetStats() const
+    {
+        itsChannel->itsInfo.reset();
+    }
+
+private:
+    friend class Broker;
+
+    using Callback = std::function<void(Types...)>;
+
+    /**
+     * @brief Deferred call publishing a message on behalf of an ISR
+     */
+    struct IsrCall
+    {
+        Broker* itsBroker;
+        Channel* itsChannel;
+        std::tuple<Types...> itsArgs;
+
+        void operator()()
+        {
+            std::apply([this](Types&... p_args)
+            {
+                std::tuple<Types&...> args(p_args...);
+                itsBroker->publish(*itsChannel, &args);
+            }, itsArgs);
+        }
+    };
+
+    Broker* itsBroker;
+    Channel* itsChannel;
+
+    Topic(Broker& p_broker, Channel& p_channel) :
+        itsBroker(&p_broker),
+        itsChannel(&p_channel)
+    {}
+
+    static CallbackPtr makeCallback(SubscribeCallback& p_callback)
+    {
+        return std::allocate_shared<const Callback>(PoolAllocator<Callback>(), p_callback);
+    }
+};
+
+/**
+ * @brief Implementation of Signature for the given argument types
+ */
+template <typename... Types>
+struct Broker::SignatureOf
+{
+    using Callback = std::function<void(Types...)>;
+    using Args = std::tuple<Types&...>;
+    using Payload = std::tuple<std::decay_t<Types>...>;
+
+    static void call(const void* p_callback, void* p_args)
+    {
+        std::apply(*static_cast<const Callback*>(p_callback), *static_cast<Args*>(p_args));
+    }
+
+    static void callPayload(const void* p_callback, const void* p_payload)
+    {
+        std::apply(*static_cast<const Callback*>(p_callback), *static_cast<const Payload*>(p_payload));
+    }
+
+    static PayloadPtr makePayload(void* p_args, bool p_movable)
+    {
+        return std::apply([p_movable](Types&... p_args) -> PayloadPtr
+        {
+            return std::allocate_shared<Payload>(PoolAllocator<Payload>(), forward<Types>(p_args, p_movable)...);
+        }, *static_cast<Args*>(p_args));
+    }
+
+    template <typename T>
+    static decltype(auto) forward(T& p_arg, bool p_movable)
+    {
+        // arguments passed by reference belong to the publisher
+        if constexpr (!std::is_reference_v<T> && std::is_move_constructible_v<T>)
+        {
+            return p_movable ? std::decay_t<T>(std::move(p_arg)) : std::decay_t<T>(p_arg);
+        }
+        else
+        {
+            return static_cast<const std::decay_t<T>&>(p_arg);
+        }
+    }
+};
+
+template <typename... Types>
+inline const Broker::Signature Broker::Signature::itsOf = {&Broker::SignatureOf<Types...>::call,
+                                                           &Broker::SignatureOf<Types...>::callPayload,
+                                                           &Broker::SignatureOf<Types...>::makePayload};
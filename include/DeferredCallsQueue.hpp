@@ -9,22 +9,133 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <unordered_map>
 #include <mutex>
+#include <type_traits>
+#include <vector>
 #include <esp_task.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include "PubSubConfig.hpp"
+#include "InlineCall.hpp"
+#include "LatencyHistogram.hpp"
 
 class DeferredCallsQueue
 {
 public:
-    using CallType = std::function<void()>;
+    using CallType = InlineCall;
+
+    /**
+     * @brief What to do with a call if its queue is full
+     */
+    enum class OverflowPolicy : uint8_t
+    {
+        Block,        ///< wait for a free slot up to the timeout, then drop the call
+        DropNewest,   ///< drop the call to be added
+        DropOldest,   ///< drop the oldest pending call
+        Coalesce      ///< collect up to the depth of the queue in a single batch entry, then drop the call
+    };
 
-    inline static const UBaseType_t itsQueueSize = 20;
+    /**
+     * @brief What to do with a call which has not started by its deadline
+     */
+    enum class ExpiredPolicy : uint8_t
+    {
+        Run,          ///< run the call anyway, it is counted as missed
+        Drop          ///< drop the call, it is counted as missed and expired
+    };
+
+    /**
+     * @brief Counters of a single queue
+     */
+    struct QueueStats
+    {
+        UBaseType_t itsPriority;      ///< priority of the task of the queue
+        BaseType_t itsCoreId;         ///< core affinity of the task of the queue
+        UBaseType_t itsSize;          ///< number of calls the queue may hold
+        UBaseType_t itsPending;       ///< number of calls waiting right now
+        UBaseType_t itsHighWater;     ///< maximum number of calls waiting at the same time
+        uint32_t itsAdded;            ///< calls added to a slot
+        uint32_t itsDropped;          ///< calls dropped due to the overflow policy
+        uint32_t itsTimeouts;         ///< calls dropped after blocking until the timeout
+        uint32_t itsCoalesced;        ///< calls added to the batch entry of a full queue
+        uint32_t itsWaits;            ///< calls which had to wait for a free slot
+        uint64_t itsWaitTimeUs;       ///< total time callers waited for a free slot
+        uint32_t itsMaxWaitTimeUs;
+        uint32_t itsExecuted;         ///< calls executed by the task of the queue
+        uint64_t itsExecTimeUs;       ///< total execution time of the calls
+        uint32_t itsMaxExecTimeUs;
+        bool itsUnpinned;             ///< holds calls without core affinity assigned to this core
+        uint32_t itsStolen;           ///< calls executed by the task of another core
+        uint32_t itsMissed;           ///< calls started after their deadline, including the expired ones
+        uint32_t itsExpired;          ///< calls dropped because their deadline had passed
+        bool itsEarliestFirst;        ///< calls are ordered by their deadlines
+    };
+
+    /**
+     * @brief Function notified when a queue drops a call it has accepted
+     * @details
+     * Called with itsContext by the task dropping the call, i.e. the task
+     * of the queue or a task adding another call, before the function
+     * object of the call is destroyed, so the function object may keep the
+     * context alive. No lock of the queue is held meanwhile.
+     */
+    struct DropHandler
+    {
+        void (*itsFunction)(void* p_context);   ///< nullptr if not needed
+        void* itsContext;
+
+        void operator()() const
+        {
+            if (itsFunction != nullptr)
+            {
+                itsFunction(itsContext);
+            }
+        }
+    };
+
+    struct TaskStats
+    {
+        const char* itsName;          ///< name of the task
+        UBaseType_t itsPriority;      ///< current priority, changes for workers of a pool
+        BaseType_t itsCoreId;         ///< core affinity of the task
+        uint32_t itsStackSize;        ///< stack size in bytes
+        uint32_t itsStackFree;        ///< minimum free stack in bytes so far (high-water mark)
+    };
+
+    class DirectLink;
+    class Timer;
+
+    inline static const UBaseType_t itsQueueSize = CONFIG_PUBSUB_QUEUE_SIZE;
+    inline static const UBaseType_t itsMaxQueueSize = CONFIG_PUBSUB_QUEUE_MAX_SIZE;
     inline static const BaseType_t itsCurrentAffinity = tskNO_AFFINITY - 1;
+    inline static const int64_t itsNoDeadline = INT64_MAX;
+    inline static const uint32_t itsDefaultStackSize = CONFIG_PUBSUB_TASK_STACK_SIZE;
+#if CONFIG_PUBSUB_TASK_STACK_IN_PSRAM
+    inline static const uint32_t itsDefaultStackCaps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+#else
+    inline static const uint32_t itsDefaultStackCaps = 0;   ///< stack allocated by FreeRTOS
+#endif
+
+#if defined(CONFIG_PUBSUB_QUEUE_OVERFLOW_DROP_NEWEST)
+    inline static const OverflowPolicy itsDefaultPolicy = OverflowPolicy::DropNewest;
+#elif defined(CONFIG_PUBSUB_QUEUE_OVERFLOW_DROP_OLDEST)
+    inline static const OverflowPolicy itsDefaultPolicy = OverflowPolicy::DropOldest;
+#elif defined(CONFIG_PUBSUB_QUEUE_OVERFLOW_COALESCE)
+    inline static const OverflowPolicy itsDefaultPolicy = OverflowPolicy::Coalesce;
+#else
+    inline static const OverflowPolicy itsDefaultPolicy = OverflowPolicy::Block;
+#endif
 
     /**
      * @brief Returns a PubSub instance, use this to instantiate the PubSub object.
@@ -42,23 +153,662 @@ public:
     /**
      * @brief Adds a call to be deferred to a task with the given priority
      *        and core affinity.
+     * @details
+     * The call is moved into a slot preallocated for the respective queue,
+     * so no heap allocation takes place unless the function object is larger
+     * than InlineCall::itsCapacity. If the queue is full, the overflow policy
+     * of the queue applies.
+     * A call which has not started by its deadline is counted as missed and
+     * handled according to the ExpiredPolicy of the queue, see
+     * setDeadlineScheduling(). Calls coalesced by OverflowPolicy::Coalesce
+     * lose their deadlines.
+     * A call may still be dropped after it has been added, by
+     * OverflowPolicy::DropOldest or ExpiredPolicy::Drop, which is notified
+     * to p_onDrop. Callers keeping state until their call runs need both the
+     * result and p_onDrop to reset it.
      *
-     * @param p_call the function to call
+     * @param p_call the function to call, left unchanged if it is dropped right away
      * @param p_priority the priority with which to execte the function (default: main priority)
      * @param p_core_id the core where to execute the function (default: current task's setting)
+     * @param p_deadlineUs latest start time of the call in esp_timer_get_time() microseconds
+     * @param p_onDrop notified if the call is dropped after it has been added
+     * @return false if the call was dropped right away due to the overflow policy
+     */
+    bool addDeferredCall(CallType&& p_call, UBaseType_t p_priority = ESP_TASK_MAIN_PRIO,
+                         BaseType_t p_core_id = itsCurrentAffinity, int64_t p_deadlineUs = itsNoDeadline,
+                         DropHandler p_onDrop = {});
+
+    /**
+     * @brief Configure the depth and overflow policy of a queue
+     * @details
+     * The queue is created with the given depth if it does not exist yet.
+     * The depth of an existing queue may only be increased. The depth is
+     * limited to itsMaxQueueSize. OverflowPolicy::Coalesce allocates a
+     * second set of slots with the depth of the queue for the batch entry.
+     *
+     * @param p_priority the priority of the queue
+     * @param p_core_id the core of the queue (default: current task's setting)
+     * @param p_size number of calls the queue may hold
+     * @param p_policy what to do with calls if the queue is full
+     * @param p_timeoutMs how long to wait for a free slot with OverflowPolicy::Block
+     */
+    void setQueueConfig(UBaseType_t p_priority, BaseType_t p_core_id, UBaseType_t p_size,
+                        OverflowPolicy p_policy, uint32_t p_timeoutMs = CONFIG_PUBSUB_QUEUE_BLOCK_TIMEOUT_MS);
+
+    /**
+     * @brief Returns the counters of a single queue
+     * @details
+     * All counters are zero if the queue does not exist.
+     *
+     * @param p_priority the priority of the queue
+     * @param p_core_id the core of the queue (default: current task's setting)
+     * @return QueueStats
      */
-    void addDeferredCall(const CallType& p_call, UBaseType_t p_priority = ESP_TASK_MAIN_PRIO,
-                         BaseType_t p_core_id = itsCurrentAffinity);
+    QueueStats getQueueStats(UBaseType_t p_priority, BaseType_t p_core_id = itsCurrentAffinity);
+
+    /**
+     * @brief Returns the counters of all queues, including the queue of ISR calls
+     *
+     * @return std::vector<QueueStats>
+     */
+    std::vector<QueueStats> getStats();
+
+    /**
+     * @brief Reset the counters and high-water marks of all queues
+     */
+    void resetStats();
+
+    /**
+     * @brief Returns the stack use of all tasks executing deferred calls
+     * @details
+     * Lists the tasks of the queues, the workers of all pools and the task
+     * of the ISR queue. The high-water mark of the stack is never reset, so
+     * run the application under full load before reducing stack sizes.
+     *
+     * @return std::vector<TaskStats>
+     */
+    std::vector<TaskStats> getTaskStats();
+
+    /**
+     * @brief Returns the histogram of the delays between adding calls to a
+     *        queue and the start of their execution
+     * @details
+     * Only recorded if CONFIG_PUBSUB_LATENCY_HISTOGRAM is enabled, otherwise
+     * the histogram is empty. The histogram is reset by resetStats().
+     *
+     * @param p_priority the priority of the queue
+     * @param p_core_id the core of the queue (default: current task's setting)
+     * @return LatencyHistogram::Snapshot
+     */
+    LatencyHistogram::Snapshot getLatency(UBaseType_t p_priority, BaseType_t p_core_id = itsCurrentAffinity);
+
+    /**
+     * @brief Set how many calls the task of a queue executes per wakeup
+     * @details
+     * The task of a queue yields to other tasks of the same priority after
+     * each batch of calls. A batch ends after p_maxCalls calls, after
+     * p_maxTimeUs microseconds (0 for no limit), or when the queue is empty.
+     * The queue is created if it does not exist yet.
+     *
+     * @param p_priority the priority of the queue
+     * @param p_core_id the core of the queue (default: current task's setting)
+     * @param p_maxCalls maximum number of calls per batch, at least 1
+     * @param p_maxTimeUs maximum duration of a batch in microseconds
+     */
+    void setBatching(UBaseType_t p_priority, BaseType_t p_core_id, uint32_t p_maxCalls, uint32_t p_maxTimeUs = 0);
+
+    /**
+     * @brief Set the order of the calls of a queue and how to treat calls
+     *        which missed their deadline
+     * @details
+     * With p_earliestFirst the task of the queue runs the pending call with
+     * the earliest deadline next (EDF), calls without a deadline run after
+     * all others in the order they were added. Otherwise the calls run in
+     * the order they were added, deadlines are only checked. The task keeps
+     * the calls of its current batch in a heap on its stack, which needs
+     * about (itsMaxQueueSize + 2) pointers. Calls left over at the end of a
+     * batch are put back into the queue, so small batches add some overhead.
+     * The queue is created if it does not exist yet.
+     *
+     * @param p_priority the priority of the queue
+     * @param p_core_id the core of the queue (default: current task's setting)
+     * @param p_earliestFirst run the call with the earliest deadline first
+     * @param p_expired what to do with a call which has not started by its deadline
+     */
+    void setDeadlineScheduling(UBaseType_t p_priority, BaseType_t p_core_id, bool p_earliestFirst,
+                               ExpiredPolicy p_expired = ExpiredPolicy::Run);
+
+    /**
+     * @brief Get the queue of the deferred call running in the current task
+     * @details
+     * Used to add follow-up calls to the same queue, e.g. to resume a
+     * coroutine. The calls of distributed unpinned queues are reported
+     * with tskNO_AFFINITY.
+     *
+     * @param p_priority priority of the queue
+     * @param p_core_id core of the queue
+     * @return false if the task is not running a deferred call, the
+     *         priority and core affinity of the task are returned then
+     */
+    static bool getCurrentQueue(UBaseType_t& p_priority, BaseType_t& p_core_id);
+
+    /**
+     * @brief Execute the queues of a core by a pool of worker tasks
+     * @details
+     * By default every (priority, core) queue gets its own task. Queues of
+     * the given core created after this call are instead served by
+     * p_numWorkers tasks shared by all of them. A worker takes the pending
+     * call of the highest priority and runs it with the priority of its
+     * queue, so calls keep the priority semantics of dedicated tasks as long
+     * as not all workers are busy. The calls of one queue are still executed
+     * one after the other and in order. While waiting for calls, the workers
+     * run with the highest priority of their queues.
+     * The number of workers of an existing pool may only be increased,
+     * p_numWorkers = 0 gives dedicated tasks to queues created afterwards.
+     * The default for all cores is CONFIG_PUBSUB_WORKERS_PER_CORE.
+     *
+     * @param p_core_id the core of the queues (default: current task's setting)
+     * @param p_numWorkers number of worker tasks
+     * @param p_stackSize stack size in bytes of workers started from now on
+     * @param p_caps memory capabilities of the stacks, see setStackSize()
+     */
+    void setWorkerPool(BaseType_t p_core_id, UBaseType_t p_numWorkers,
+                       uint32_t p_stackSize = itsDefaultStackSize, uint32_t p_caps = itsDefaultStackCaps);
+
+    /**
+     * @brief Distribute calls without core affinity to the cores
+     * @details
+     * By default, calls added with tskNO_AFFINITY go to a single queue
+     * served by a single unpinned task. With distribution enabled, each
+     * priority gets one queue per core instead, each served by a task
+     * pinned to its core. A new call goes to the queue with the fewest
+     * pending calls (the caller's core if equal), and a task whose own
+     * queue is empty takes over calls from the queues of the other cores.
+     * Thus calls without affinity of one priority may run in parallel and
+     * not in the order they were added. Queues of pinned calls are not
+     * affected. Applies to calls added afterwards, the default is
+     * CONFIG_PUBSUB_DISTRIBUTE_UNPINNED. setQueueConfig() and
+     * setBatching() for tskNO_AFFINITY apply to all queues of the
+     * priority, their statistics are reported per core by getStats().
+     *
+     * @param p_enable
+     */
+    void setUnpinnedDistribution(bool p_enable);
+
+    /**
+     * @brief Set the stack of the task of a queue
+     * @details
+     * The stack is allocated when the queue receives its first call or
+     * configuration, so this has to be called before. The default is
+     * CONFIG_PUBSUB_TASK_STACK_SIZE. With p_caps = 0 FreeRTOS allocates the
+     * stack from internal RAM, otherwise it is allocated with the given
+     * capabilities, e.g. MALLOC_CAP_SPIRAM (only if the IDF is configured
+     * to allow task stacks in external memory, and the calls must not run
+     * while the flash cache is disabled). Queues served by a worker pool
+     * use the stacks of the pool's workers.
+     *
+     * @param p_priority the priority of the queue
+     * @param p_core_id the core of the queue (default: current task's setting)
+     * @param p_stackSize stack size in bytes
+     * @param p_caps memory capabilities of the stack, 0 for the FreeRTOS default
+     * @return false if the queue already exists, then its stack is not changed
+     */
+    bool setStackSize(UBaseType_t p_priority, BaseType_t p_core_id, uint32_t p_stackSize,
+                      uint32_t p_caps = itsDefaultStackCaps);
+
+    /**
+     * @brief Make sure the task of a queue has at least the given stack
+     * @details
+     * Like setStackSize(), but only ever increases the stack size, so
+     * subscriptions sharing a queue may each state what they need.
+     *
+     * @param p_priority the priority of the queue
+     * @param p_core_id the core of the queue (default: current task's setting)
+     * @param p_stackSize minimum stack size in bytes
+     * @return false if the queue already exists with a smaller stack
+     */
+    bool reserveStack(UBaseType_t p_priority, BaseType_t p_core_id, uint32_t p_stackSize);
+
+    /**
+     * @brief Create a point-to-point link to a task of its own
+     * @details
+     * Calls added to the queues pass through two FreeRTOS queues, each of
+     * them taking a critical section, which is shared between the cores.
+     * A link instead keeps its calls in a ring of p_size slots (rounded up
+     * to a power of two) that a single producer writes and the task of the
+     * link reads without any lock. The task only sleeps when the ring is
+     * empty and is woken with a task notification, which is only given if
+     * it actually sleeps. So a link is meant for hot paths with a single
+     * producing task, e.g. one publisher feeding one asynchronous
+     * subscriber on the other core. Links are never deleted, and their
+     * calls must not wait for a notification of their own task.
+     *
+     * @param p_priority the priority of the task of the link
+     * @param p_core_id the core of the task of the link (default: current task's setting)
+     * @param p_size number of calls the link may hold
+     * @param p_stackSize stack size in bytes
+     * @param p_caps memory capabilities of the stack, see setStackSize()
+     * @return DirectLink&
+     */
+    DirectLink& createDirectLink(UBaseType_t p_priority, BaseType_t p_core_id = itsCurrentAffinity,
+                                 UBaseType_t p_size = itsQueueSize, uint32_t p_stackSize = itsDefaultStackSize,
+                                 uint32_t p_caps = itsDefaultStackCaps);
+
+    /**
+     * @brief Adds a call from an interrupt service routine
+     * @details
+     * The call is moved into one of CONFIG_PUBSUB_ISR_QUEUE_SIZE slots reserved
+     * for interrupts and executed by a task with priority
+     * CONFIG_PUBSUB_ISR_TASK_PRIORITY. The function object must fit into a
+     * slot, and neither a lock nor the heap is used. If all slots are in use,
+     * the call is dropped, which is counted by getISRDropCount().
+     *
+     * @param p_function the function to call
+     * @param p_higherPriorityTaskWoken as for xQueueSendFromISR()
+     * @return pdTRUE if the call was added, pdFALSE if it was dropped
+     */
+    template <typename F>
+    BaseType_t addDeferredCallFromISR(F&& p_function, BaseType_t* p_higherPriorityTaskWoken)
+    {
+        static_assert(CallType::fitsInline<std::decay_t<F>>,
+                      "function object is too large to be deferred from an ISR");
+        Slot* slot;
+        if (unlikely((itsISRQueue == nullptr) ||
+                     (xQueueReceiveFromISR(itsISRQueue->itsFreeSlots, &slot, p_higherPriorityTaskWoken) != pdPASS)))
+        {
+            itsISRDropCount.fetch_add(1, std::memory_order_relaxed);
+            return pdFALSE;
+        }
+        slot->itsCall = CallType(std::forward<F>(p_function));
+        stamp(slot);
+        // cannot fail, the queue is large enough to hold all slots
+        xQueueSendFromISR(itsISRQueue->itsCalls, &slot, p_higherPriorityTaskWoken);
+        return pdTRUE;
+    }
+
+    /**
+     * @brief Returns how many calls from ISRs have been dropped because
+     *        all slots reserved for interrupts were in use
+     *
+     * @return uint32_t
+     */
+    uint32_t getISRDropCount() const
+    {
+        return itsISRDropCount.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns how often a deferred call had to be stored on the heap
+     *        because its function object did not fit into a queue slot
+     *
+     * @return uint32_t
+     */
+    static uint32_t getHeapFallbackCount()
+    {
+        return CallType::getHeapFallbackCount();
+    }
 
 private:
+    /**
+     * @brief Storage of a pending call
+     */
+    struct Slot
+    {
+        CallType itsCall;
+        DropHandler itsOnDrop = {};
+        int64_t itsDeadlineUs = itsNoDeadline;   ///< latest start time of the call
+        uint32_t itsSequence = 0;    ///< orders calls with the same deadline, only set for EDF queues
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+        int64_t itsAddedUs;          ///< time the call was added
+#endif
+    };
+
+    struct WorkerPool;
+
+    struct StackConfig
+    {
+        uint32_t itsSize;
+        uint32_t itsCaps;
+    };
+
+    struct PoolConfig
+    {
+        UBaseType_t itsNumWorkers;
+        StackConfig itsStack;
+    };
+
+    struct TaskInfo
+    {
+        TaskHandle_t itsHandle;
+        uint32_t itsStackSize;
+    };
+
+    struct CallQueue;
+
+    /**
+     * @brief Per core queues of the calls without affinity of one priority
+     * @details
+     * itsPending is given for every call added to one of the queues and
+     * wakes up one of the tasks. The tasks drain all queues before
+     * waiting again, so its count is only a hint.
+     */
+    struct UnpinnedGroup
+    {
+        SemaphoreHandle_t itsPending;
+        std::array<CallQueue*, portNUM_PROCESSORS> itsQueues;
+    };
+
+    /**
+     * @brief Queue of calls for one priority/core combination
+     * @details
+     * FreeRTOS queues copy their items bytewise, which is not a valid way to
+     * move arbitrary function objects. Therefore the calls are stored in
+     * the preallocated slots, and the FreeRTOS queues only pass pointers
+     * to these slots back and forth.
+     */
+    struct CallQueue
+    {
+        QueueHandle_t itsCalls;      ///< slots with pending calls
+        QueueHandle_t itsFreeSlots;  ///< slots available for new calls
+        Slot itsFlushSlot;           ///< runs the calls coalesced while the queue was full
+        std::atomic<UBaseType_t> itsSize;
+        std::atomic<uint32_t> itsBatchCalls;
+        std::atomic<uint32_t> itsBatchTimeUs;
+        std::atomic<OverflowPolicy> itsPolicy;
+        std::atomic<TickType_t> itsTimeout;
+        std::atomic<bool> itsEarliestFirst;
+        std::atomic<ExpiredPolicy> itsExpiredPolicy;
+        std::atomic<uint32_t> itsSequence;
+
+        std::mutex itsOverflowMutex;
+        std::unique_ptr<Slot[]> itsOverflow;    ///< ring of coalesced calls, allocated for OverflowPolicy::Coalesce
+        UBaseType_t itsOverflowSize;           ///< capacity of itsOverflow, the depth of the queue
+        UBaseType_t itsOverflowHead;           ///< oldest coalesced call
+        UBaseType_t itsOverflowCount;
+        bool itsFlushPending;
+
+        std::atomic<UBaseType_t> itsHighWater;
+        std::atomic<uint32_t> itsAdded;
+        std::atomic<uint32_t> itsDropped;
+        std::atomic<uint32_t> itsTimeouts;
+        std::atomic<uint32_t> itsCoalesced;
+        std::atomic<uint32_t> itsWaits;
+        std::atomic<uint64_t> itsWaitTimeUs;
+        std::atomic<uint32_t> itsMaxWaitTimeUs;
+        std::atomic<uint32_t> itsExecuted;
+        std::atomic<uint64_t> itsExecTimeUs;
+        std::atomic<uint32_t> itsMaxExecTimeUs;
+        std::atomic<uint32_t> itsStolen;
+        std::atomic<uint32_t> itsMissed;
+        std::atomic<uint32_t> itsExpired;
+
+        UBaseType_t itsPriority;
+        BaseType_t itsCoreId;
+        WorkerPool* itsPool;         ///< nullptr if the queue has its own task
+        UnpinnedGroup* itsGroup;     ///< set for the per core queues of calls without affinity
+        StackConfig itsStack;        ///< stack of the queue's own task
+        bool itsClaimed;             ///< a worker runs calls of the queue, guarded by the pool's mutex
+
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+        LatencyHistogram itsLatency;
+#endif
+    };
+
+    /**
+     * @brief Worker tasks shared by the queues of one core
+     * @details
+     * itsPending is given for every call added to one of the queues, so
+     * it is at least the number of pending calls.
+     */
+    struct WorkerPool
+    {
+        BaseType_t itsCoreId;
+        SemaphoreHandle_t itsPending;
+        std::mutex itsMutex;
+        std::vector<CallQueue*> itsQueues;  ///< ordered by descending priority
+        std::atomic<UBaseType_t> itsMaxPriority;
+        UBaseType_t itsNumWorkers;          ///< guarded by itsQueueListMutex
+        UBaseType_t itsNumStarted;          ///< guarded by itsQueueListMutex
+        StackConfig itsStack;               ///< guarded by itsQueueListMutex
+    };
+
     std::mutex itsQueueListMutex;
-    std::unordered_map<uint32_t, QueueHandle_t> itsQueueList;
+    std::unordered_map<uint32_t, CallQueue*> itsQueueList;
+    std::unordered_map<BaseType_t, WorkerPool*> itsWorkerPools;
+    std::unordered_map<BaseType_t, PoolConfig> itsPoolConfigs;     ///< set by setWorkerPool()
+    std::unordered_map<uint32_t, StackConfig> itsStackConfigs;     ///< set by setStackSize(), by queue key
+    std::vector<TaskInfo> itsTasks;                                ///< all tasks created so far
+    CallQueue* itsISRQueue;               ///< created upfront, used from ISRs
+    std::atomic<uint32_t> itsISRDropCount;
+    std::unordered_map<UBaseType_t, UnpinnedGroup*> itsUnpinnedGroups;
+    std::atomic<bool> itsDistributeUnpinned;
+    std::vector<DirectLink*> itsLinks;    ///< guarded by itsQueueListMutex
+    inline static thread_local CallQueue* itsRunningQueue = nullptr;   ///< queue of the current batch
 
     DeferredCallsQueue();
 
-    QueueHandle_t getQueueList(UBaseType_t p_priority, BaseType_t p_core_id);
+    CallQueue* getQueueList(UBaseType_t p_priority, BaseType_t p_core_id, UBaseType_t p_numCalls = itsQueueSize);
+    CallQueue* findQueue(UBaseType_t p_priority, BaseType_t p_core_id);
+    CallQueue* createQueue(UBaseType_t p_priority, BaseType_t p_core_id, UBaseType_t p_numCalls,
+                           UBaseType_t p_maxCalls);
+    void growQueue(CallQueue* p_queue, UBaseType_t p_numCalls);
+    static void addSlots(CallQueue* p_queue, UBaseType_t p_numSlots);
+    CallQueue* selectQueue(UBaseType_t p_priority, BaseType_t p_core_id);
+    bool addToQueue(CallQueue* p_queue, CallType& p_call, UBaseType_t p_priority, BaseType_t p_core_id,
+                    int64_t p_deadlineUs, const DropHandler& p_onDrop, bool p_mayBlock);
+    bool acquireSlot(CallQueue* p_queue, Slot*& p_slot, UBaseType_t p_priority, BaseType_t p_core_id,
+                     bool p_mayBlock);
+    static void post(CallQueue* p_queue, Slot* p_slot);
+    WorkerPool* getWorkerPool(BaseType_t p_core_id);
+    UnpinnedGroup* getUnpinnedGroup(UBaseType_t p_priority, UBaseType_t p_numCalls = itsQueueSize);
+    CallQueue* getUnpinnedQueue(UBaseType_t p_priority);
+    static void addToPool(WorkerPool* p_pool, CallQueue* p_queue);
+    void startWorkers(WorkerPool* p_pool);
+
+    static void stamp(Slot* p_slot)
+    {
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+        p_slot->itsAddedUs = esp_timer_get_time();
+#endif
+    }
+
+    static void setDeadline(CallQueue* p_queue, Slot* p_slot, int64_t p_deadlineUs)
+    {
+        p_slot->itsDeadlineUs = p_deadlineUs;
+        if (unlikely(p_queue->itsEarliestFirst.load(std::memory_order_relaxed)))
+        {
+            p_slot->itsSequence = p_queue->itsSequence.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Order of the heap of an EDF queue, true if p_first runs after p_second
+     */
+    static bool runsAfter(const Slot* p_first, const Slot* p_second)
+    {
+        if (p_first->itsDeadlineUs != p_second->itsDeadlineUs)
+        {
+            return p_first->itsDeadlineUs > p_second->itsDeadlineUs;
+        }
+        return int32_t(p_first->itsSequence - p_second->itsSequence) > 0;
+    }
+    /**
+     * @brief Result of coalesce()
+     */
+    enum class Coalesced : uint8_t
+    {
+        NotPending,   ///< no coalesced calls are pending, the call was not taken
+        Added,
+        Dropped       ///< the batch entry is full
+    };
+
+    Coalesced coalesce(CallQueue* p_queue, CallType& p_call, const DropHandler& p_onDrop, bool p_onlyIfPending);
+    static void reserveOverflow(CallQueue* p_queue);
+    static UBaseType_t beginCoalesced(CallQueue* p_queue);
+    static bool takeCoalesced(CallQueue* p_queue, Slot& p_entry);
+    static void dropCoalesced(CallQueue* p_queue);
+    static void runCoalesced(CallQueue* p_queue);
+    static void drop(Slot* p_slot);
+    static QueueStats readStats(CallQueue* p_queue);
+    static void resetStats(CallQueue* p_queue);
+    void createTask(CallQueue* p_queue, const char* p_name, UBaseType_t p_priority, BaseType_t p_core_id);
+    TaskHandle_t spawnTask(TaskFunction_t p_function, const char* p_name, void* p_parameter,
+                           UBaseType_t p_priority, BaseType_t p_core_id, const StackConfig& p_stack);
+    StackConfig getStackConfig(uint32_t p_key) const;
+
+    static uint32_t queueKey(UBaseType_t p_priority, BaseType_t p_core_id)
+    {
+        return ((p_priority & 0xffff) << 16) | (p_core_id & 0xffff);
+    }
+
+    static uint32_t unpinnedKey(UBaseType_t p_priority, BaseType_t p_core_id)
+    {
+        // distinct from the pinned queue of the core and from tskNO_AFFINITY
+        return queueKey(p_priority, p_core_id) | 0x8000;
+    }
     char coreToChar(BaseType_t p_core_id) const;
 
-    void callerTask(QueueHandle_t p_queue);
+    static uint32_t runBatch(CallQueue* p_queue, Slot* p_first);
+    static uint32_t runEarliestFirst(CallQueue* p_queue, Slot* p_first);
+    static int64_t runCall(CallQueue* p_queue, Slot* p_slot, int64_t p_start);
+    void callerTask(CallQueue* p_queue);
     static void callerTaskWrapper(void* pvParameter);
+    static CallQueue* claimQueue(WorkerPool* p_pool);
+    void workerTask(WorkerPool* p_pool);
+    static void workerTaskWrapper(void* pvParameter);
+    static CallQueue* takeUnpinned(CallQueue* p_queue, Slot*& p_slot);
+    void unpinnedTask(CallQueue* p_queue);
+    static void unpinnedTaskWrapper(void* pvParameter);
+};
+
+/**
+ * @brief Lock-free ring of calls from a single producer to a task of its own
+ * @details
+ * Created by DeferredCallsQueue::createDirectLink(). Only one task at a
+ * time may add calls.
+ */
+class DeferredCallsQueue::DirectLink
+{
+public:
+    DirectLink(const DirectLink&) = delete;
+    DirectLink& operator=(const DirectLink&) = delete;
+
+    /**
+     * @brief Add a call to be executed by the task of the link
+     * @details
+     * The call is moved into the next free slot of the ring. Neither a lock
+     * nor the heap is used unless the function object is larger than
+     * InlineCall::itsCapacity, and the task of the link is only notified if
+     * it waits for calls.
+     *
+     * @param p_call the function to call
+     * @return false if the ring is full, then the call is dropped
+     */
+    bool addCall(CallType&& p_call);
+
+    /**
+     * @brief Returns the counters of the link
+     * @details
+     * Only the size, pending, high-water, added, dropped and execution
+     * counters are used.
+     *
+     * @return QueueStats
+     */
+    QueueStats getStats() const;
+
+    /**
+     * @brief Reset the counters and the high-water mark of the link
+     */
+    void resetStats();
+
+    /**
+     * @brief Returns the histogram of the delays between adding calls and
+     *        the start of their execution
+     *
+     * @return LatencyHistogram::Snapshot
+     */
+    LatencyHistogram::Snapshot getLatency() const;
+
+private:
+    friend class DeferredCallsQueue;
+
+    DirectLink(UBaseType_t p_priority, BaseType_t p_core_id, UBaseType_t p_size);
+
+    void run();
+    static void linkTaskWrapper(void* pvParameter);
+
+    const uint32_t itsMask;
+    std::unique_ptr<Slot[]> itsSlots;
+    std::atomic<uint32_t> itsHead;       ///< next slot to execute, written by the task of the link
+    std::atomic<uint32_t> itsTail;       ///< next slot to fill, written by the producer
+    std::atomic<bool> itsWaiting;        ///< the task of the link sleeps or is about to
+    TaskHandle_t itsTask;
+    const UBaseType_t itsPriority;
+    const BaseType_t itsCoreId;
+
+    std::atomic<UBaseType_t> itsHighWater;
+    std::atomic<uint32_t> itsAdded;
+    std::atomic<uint32_t> itsDropped;
+    std::atomic<uint32_t> itsExecuted;
+    std::atomic<uint64_t> itsExecTimeUs;
+    std::atomic<uint32_t> itsMaxExecTimeUs;
+
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+    LatencyHistogram itsLatency;
+#endif
+};
+
+/**
+ * @brief Reusable one-shot timer adding a deferred call when it expires
+ * @details
+ * The call is kept in the timer until it expires and is then added from
+ * the esp_timer task to the queue of the given priority and core, so it
+ * is executed like any other deferred call. The esp_timer is created once
+ * and the queue is looked up (or created) by start(), so the esp_timer
+ * task neither allocates memory nor creates a task. It never waits for a
+ * full queue either: OverflowPolicy::Block drops the call right away.
+ * A timer holds one call at a time, so it may only be started again once
+ * it has expired or has been stopped.
+ */
+class DeferredCallsQueue::Timer
+{
+public:
+    Timer();
+    ~Timer();
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    /**
+     * @brief Add a call after the given delay
+     *
+     * @param p_delayUs delay in microseconds
+     * @param p_call the function to call
+     * @param p_priority the priority with which to execute the function
+     * @param p_core_id the core where to execute the function (default: current task's setting)
+     * @param p_onDrop notified if the call cannot be added when the timer
+     *        expires or is dropped by the queue later, may delete the timer
+     * @return false if the timer is still running, then the call is dropped
+     *         without notifying p_onDrop
+     */
+    bool start(uint64_t p_delayUs, CallType&& p_call, UBaseType_t p_priority,
+               BaseType_t p_core_id = itsCurrentAffinity, DropHandler p_onDrop = {});
+
+    /**
+     * @brief Stop the timer before it expires, dropping its call
+     *
+     * @return false if the timer is not running
+     */
+    bool stop();
+
+private:
+    static void expired(void* p_timer);
+
+    esp_timer_handle_t itsTimer;
+    std::atomic<bool> itsArmed;      ///< set by start() until expired() has taken the call
+    CallType itsCall;                ///< only accessed by the owner of itsArmed
+    CallQueue* itsQueue;
+    UBaseType_t itsPriority;
+    BaseType_t itsCoreId;
+    DropHandler itsOnDrop;
 };
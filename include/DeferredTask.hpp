@@ -0,0 +1,386 @@
+/**
+ * @file DeferredTask.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Coroutines executed by the tasks of DeferredCallsQueue
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include <esp_timer.h>
+#include <esp_log.h>
+
+#include "PubSubConfig.hpp"
+#include "DeferredCallsQueue.hpp"
+
+/**
+ * @brief Coroutine running in the tasks of DeferredCallsQueue
+ * @details
+ * A coroutine returning DeferredTask does not run until it is started
+ * with start() or awaited by another DeferredTask coroutine. It then runs
+ * in the calling task until it suspends at a co_await. The awaitables
+ * below resume it by a deferred call of the queue it was started from, so
+ * meanwhile the task of the queue runs other calls instead of blocking.
+ * The coroutine frame is allocated on the heap and freed as soon as the
+ * coroutine has finished, a coroutine needs no stack while suspended.
+ *
+ *   DeferredTask blink(int p_times)
+ *   {
+ *       for (int i = 0; i < p_times; i++)
+ *       {
+ *           toggleLed();
+ *           co_await DeferredTask::delay(500);
+ *       }
+ *   }
+ *
+ *   blink(3).start();
+ *
+ * A suspended coroutine is only resumed by its deferred call. If the queue
+ * drops that call, the coroutine is destroyed at its suspension point
+ * together with the coroutines awaiting it, running the destructors of
+ * their locals, so queues resuming coroutines should not drop calls.
+ * Exceptions thrown by a coroutine terminate the program.
+ */
+class DeferredTask
+{
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    /**
+     * @brief Frees the finished coroutine and continues the coroutine
+     *        awaiting it, if any
+     */
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(Handle p_handle) noexcept;
+
+        void await_resume() const noexcept
+        {}
+    };
+
+    struct promise_type
+    {
+        UBaseType_t itsPriority = ESP_TASK_MAIN_PRIO;     ///< queue resuming the coroutine
+        BaseType_t itsCoreId = tskNO_AFFINITY;
+        Handle itsContinuation;                           ///< coroutine awaiting this one
+        std::shared_ptr<const void> itsKeepAlive;         ///< kept until the coroutine has finished
+
+        DeferredTask get_return_object()
+        {
+            return DeferredTask(Handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {}
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+
+        /**
+         * @brief Resume the coroutine by a deferred call of its queue
+         */
+        void resumeDeferred()
+        {
+            const Handle handle = Handle::from_promise(*this);
+            const DeferredCallsQueue::DropHandler onDrop = dropHandler(handle);
+            if (unlikely(!DeferredCallsQueue::get().addDeferredCall([handle]() { handle.resume(); },
+                                                                    itsPriority, itsCoreId,
+                                                                    DeferredCallsQueue::itsNoDeadline, onDrop)))
+            {
+                onDrop();
+            }
+        }
+
+        /**
+         * @brief Drop handler of a call resuming the coroutine p_handle
+         */
+        static DeferredCallsQueue::DropHandler dropHandler(Handle p_handle)
+        {
+            return {abandon, p_handle.address()};
+        }
+
+        /**
+         * @brief Destroy a coroutine which cannot be resumed anymore, and
+         *        the coroutines awaiting it
+         *
+         * @param p_address address of the suspended coroutine
+         */
+        static void abandon(void* p_address)
+        {
+            ESP_LOGW(TAG, "Resumption dropped, destroying the coroutine");
+            Handle handle = Handle::from_address(p_address);
+            while (handle)
+            {
+                const Handle continuation = handle.promise().itsContinuation;
+                handle.destroy();
+                handle = continuation;
+            }
+        }
+    };
+
+    class Delay;
+    class WaitBits;
+
+    DeferredTask(DeferredTask&& p_other) noexcept :
+        itsHandle(std::exchange(p_other.itsHandle, nullptr))
+    {}
+
+    DeferredTask(const DeferredTask&) = delete;
+    DeferredTask& operator=(const DeferredTask&) = delete;
+    DeferredTask& operator=(DeferredTask&&) = delete;
+
+    /**
+     * @brief Frees the coroutine if it was never started
+     */
+    ~DeferredTask()
+    {
+        if (itsHandle)
+        {
+            itsHandle.destroy();
+        }
+    }
+
+    /**
+     * @brief Run the coroutine in the current task until it suspends
+     * @details
+     * The coroutine is resumed within the queue of the deferred call
+     * starting it. Started from a task not running a deferred call, it is
+     * resumed within the queue of the task's priority and core.
+     * The DeferredTask object is empty afterwards.
+     *
+     * @param p_keepAlive object kept until the coroutine has finished, e.g.
+     *        the arguments referred to by the coroutine
+     */
+    void start(std::shared_ptr<const void> p_keepAlive = nullptr)
+    {
+        Handle handle = std::exchange(itsHandle, nullptr);
+        promise_type& promise = handle.promise();
+        DeferredCallsQueue::getCurrentQueue(promise.itsPriority, promise.itsCoreId);
+        promise.itsKeepAlive = std::move(p_keepAlive);
+        handle.resume();
+    }
+
+    /**
+     * @brief co_await another DeferredTask, it runs within the queue of the
+     *        awaiting coroutine and continues it when it has finished
+     */
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(Handle p_caller) noexcept
+    {
+        promise_type& promise = itsHandle.promise();
+        promise.itsPriority = p_caller.promise().itsPriority;
+        promise.itsCoreId = p_caller.promise().itsCoreId;
+        promise.itsContinuation = p_caller;
+        return std::exchange(itsHandle, nullptr);
+    }
+
+    void await_resume() const noexcept
+    {}
+
+    /**
+     * @brief Awaitable suspending the coroutine for a while
+     *
+     * @param p_delayMs
+     * @return Delay
+     */
+    static Delay delay(uint32_t p_delayMs);
+
+    /**
+     * @brief Awaitable suspending the coroutine until bits of an event group
+     *        are set, like xEventGroupWaitBits()
+     * @details
+     * The bits are checked when awaited and then every
+     * CONFIG_PUBSUB_COROUTINE_POLL_MS by a timer. Clearing the bits on exit
+     * is not atomic with checking them.
+     *
+     * @param p_group
+     * @param p_bits bits to wait for
+     * @param p_clearOnExit clear p_bits once the condition is met
+     * @param p_waitForAll wait for all of p_bits instead of any of them
+     * @param p_timeout ticks to wait at most, portMAX_DELAY to wait forever
+     * @return WaitBits, resulting in the bits of the group when the
+     *         condition was met or the timeout expired
+     */
+    static WaitBits waitBits(EventGroupHandle_t p_group, EventBits_t p_bits, bool p_clearOnExit, bool p_waitForAll,
+                             TickType_t p_timeout = portMAX_DELAY);
+
+private:
+    inline static const char TAG[] = "DeferredTask";
+
+    Handle itsHandle;
+
+    explicit DeferredTask(Handle p_handle) :
+        itsHandle(p_handle)
+    {}
+};
+
+
+inline std::coroutine_handle<> DeferredTask::FinalAwaiter::await_suspend(Handle p_handle) noexcept
+{
+    const Handle continuation = p_handle.promise().itsContinuation;
+    p_handle.destroy();
+    return continuation ? std::coroutine_handle<>(continuation) : std::noop_coroutine();
+}
+
+
+class DeferredTask::Delay
+{
+public:
+    explicit Delay(uint64_t p_delayUs) :
+        itsDelayUs(p_delayUs)
+    {}
+
+    bool await_ready() const noexcept
+    {
+        return itsDelayUs == 0;
+    }
+
+    bool await_suspend(Handle p_handle)
+    {
+        const promise_type& promise = p_handle.promise();
+        // the coroutine continues right away if the timer cannot be started
+        return itsTimer.start(itsDelayUs, [p_handle]() { p_handle.resume(); }, promise.itsPriority,
+                              promise.itsCoreId, promise_type::dropHandler(p_handle));
+    }
+
+    void await_resume() const noexcept
+    {}
+
+private:
+    uint64_t itsDelayUs;
+    DeferredCallsQueue::Timer itsTimer;
+};
+
+
+class DeferredTask::WaitBits
+{
+public:
+    WaitBits(EventGroupHandle_t p_group, EventBits_t p_bits, bool p_clearOnExit, bool p_waitForAll,
+             TickType_t p_timeout) :
+        itsGroup(p_group),
+        itsBits(p_bits),
+        itsClearOnExit(p_clearOnExit),
+        itsWaitForAll(p_waitForAll),
+        itsTimeout(p_timeout),
+        itsValue(0),
+        itsDeadlineUs(DeferredCallsQueue::itsNoDeadline)
+    {}
+
+    bool await_ready()
+    {
+        return check() || (itsTimeout == 0);
+    }
+
+    void await_suspend(Handle p_handle)
+    {
+        itsHandle = p_handle;
+        if (itsTimeout != portMAX_DELAY)
+        {
+            itsDeadlineUs = esp_timer_get_time() + int64_t(itsTimeout) * portTICK_PERIOD_MS * 1000;
+        }
+        poll();
+    }
+
+    EventBits_t await_resume() const noexcept
+    {
+        return itsValue;
+    }
+
+private:
+    EventGroupHandle_t itsGroup;
+    EventBits_t itsBits;
+    bool itsClearOnExit;
+    bool itsWaitForAll;
+    TickType_t itsTimeout;
+    EventBits_t itsValue;
+    int64_t itsDeadlineUs;
+    Handle itsHandle;
+    DeferredCallsQueue::Timer itsTimer;
+
+    bool check()
+    {
+        itsValue = xEventGroupGetBits(itsGroup);
+        const EventBits_t set = itsValue & itsBits;
+        const bool met = itsWaitForAll ? (set == itsBits) : (set != 0);
+        if (met && itsClearOnExit)
+        {
+            xEventGroupClearBits(itsGroup, itsBits);
+        }
+        return met;
+    }
+
+    void poll()
+    {
+        const promise_type& promise = itsHandle.promise();
+        const bool started = itsTimer.start(uint64_t(CONFIG_PUBSUB_COROUTINE_POLL_MS) * 1000, [this]()
+        {
+            // resuming the coroutine destroys the awaitable
+            if (check() || (esp_timer_get_time() >= itsDeadlineUs))
+            {
+                itsHandle.resume();
+            }
+            else
+            {
+                poll();
+            }
+        }, promise.itsPriority, promise.itsCoreId, promise_type::dropHandler(itsHandle));
+        if (unlikely(!started))
+        {
+            // keeps the coroutine from waiting forever, esp_timer_start_once() failed
+            itsHandle.promise().resumeDeferred();
+        }
+    }
+};
+
+
+inline DeferredTask::Delay DeferredTask::delay(uint32_t p_delayMs)
+{
+    return Delay(uint64_t(p_delayMs) * 1000);
+}
+
+
+inline DeferredTask::WaitBits DeferredTask::waitBits(EventGroupHandle_t p_group, EventBits_t p_bits,
+                                                     bool p_clearOnExit, bool p_waitForAll, TickType_t p_timeout)
+{
+    return WaitBits(p_group, p_bits, p_clearOnExit, p_waitForAll, p_timeout);
+}
+
+
+/**
+ * @brief A handler returning a DeferredTask coroutine when called with Args
+ */
+template <typename Handler, typename... Args>
+concept DeferredTaskHandler = std::same_as<std::invoke_result_t<Handler&, Args...>, DeferredTask>;
@@ -0,0 +1,81 @@
+/**
+ * @file EspNowTransport.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Bridge transport sending frames with ESP-NOW
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include <esp_now.h>
+
+#include "PubSubBridge.hpp"
+
+/**
+ * @brief Sends every frame as one ESP-NOW packet, by default as broadcast
+ * @details
+ * WiFi and ESP-NOW must be initialized (esp_wifi_start(), esp_now_init())
+ * before the transport is created, the transport adds the peer and takes
+ * over the receive callback of ESP-NOW, so only one instance may exist.
+ * The callback runs in the WiFi task, it only copies the packet to a queue,
+ * a task of the transport passes the packets to the bridge. Packets are
+ * dropped while the queue is full.
+ */
+class EspNowTransport : public PubSubBridge::Transport
+{
+public:
+    inline static constexpr uint8_t itsBroadcast[ESP_NOW_ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+    /**
+     * @brief Add the peer and start the receiving task
+     *
+     * @param p_peer MAC address to send to
+     * @param p_channel WiFi channel of the peer, 0 for the current one
+     * @param p_priority priority of the receiving task, which also publishes the received messages
+     * @param p_core_id core of the receiving task
+     */
+    EspNowTransport(const uint8_t* p_peer = itsBroadcast, uint8_t p_channel = 0,
+                    UBaseType_t p_priority = CONFIG_PUBSUB_BRIDGE_TASK_PRIORITY, BaseType_t p_core_id = tskNO_AFFINITY);
+    ~EspNowTransport() override;
+
+    EspNowTransport(const EspNowTransport&) = delete;
+    EspNowTransport& operator=(const EspNowTransport&) = delete;
+
+    std::size_t maxFrameSize() const override
+    {
+        return ESP_NOW_MAX_DATA_LEN;
+    }
+
+    bool send(const uint8_t* p_frame, std::size_t p_size) override;
+
+    /**
+     * @brief Returns the number of packets dropped because the queue was full
+     *
+     * @return uint32_t
+     */
+    uint32_t getDropped() const
+    {
+        return itsDropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Packet
+    {
+        uint8_t itsSize;
+        uint8_t itsData[ESP_NOW_MAX_DATA_LEN];
+    };
+
+    static void receiveTask(void* p_transport);
+    static void enqueue(const uint8_t* p_data, int p_size);
+
+    uint8_t itsPeer[ESP_NOW_ETH_ALEN];
+    QueueHandle_t itsQueue;
+    std::atomic<bool> itsStopped;
+    std::atomic<uint32_t> itsDropped;
+};
@@ -0,0 +1,161 @@
+/**
+ * @file InlineCall.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Move-only callable storing small function objects without heap allocation
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "PubSubConfig.hpp"
+
+/**
+ * @brief Move-only replacement for std::function<void()>
+ * @details
+ * Function objects up to CONFIG_PUBSUB_INLINE_CALL_SIZE bytes are stored
+ * inside the object itself. Larger function objects are moved to the heap,
+ * which is counted and may be queried with getHeapFallbackCount().
+ */
+class InlineCall
+{
+public:
+    inline static constexpr std::size_t itsCapacity = CONFIG_PUBSUB_INLINE_CALL_SIZE;
+    static_assert(itsCapacity >= sizeof(void*), "inline storage must at least hold a pointer");
+
+    /**
+     * @brief Tells whether a function object of the given type is stored inline
+     *
+     * @tparam F type of the function object
+     */
+    template <typename F>
+    inline static constexpr bool fitsInline = (sizeof(F) <= itsCapacity) &&
+                                              (alignof(F) <= alignof(std::max_align_t)) &&
+                                              std::is_nothrow_move_constructible_v<F>;
+
+    InlineCall() = default;
+
+    template <typename F,
+              typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineCall>>>
+    InlineCall(F&& p_function)
+    {
+        using Function = std::decay_t<F>;
+        if constexpr (fitsInline<Function>)
+        {
+            new (itsStorage) Function(std::forward<F>(p_function));
+            itsOps = &itsInlineOps<Function>;
+        }
+        else
+        {
+            itsHeapFallbacks.fetch_add(1, std::memory_order_relaxed);
+            *reinterpret_cast<Function**>(itsStorage) = new Function(std::forward<F>(p_function));
+            itsOps = &itsHeapOps<Function>;
+        }
+    }
+
+    InlineCall(InlineCall&& p_other) noexcept
+    {
+        moveFrom(p_other);
+    }
+
+    InlineCall& operator=(InlineCall&& p_other) noexcept
+    {
+        if (this != &p_other)
+        {
+            reset();
+            moveFrom(p_other);
+        }
+        return *this;
+    }
+
+    InlineCall(const InlineCall&) = delete;
+    InlineCall& operator=(const InlineCall&) = delete;
+
+    ~InlineCall()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        itsOps->invoke(itsStorage);
+    }
+
+    explicit operator bool() const
+    {
+        return itsOps != nullptr;
+    }
+
+    /**
+     * @brief Destroy the stored function object
+     */
+    void reset()
+    {
+        if (itsOps != nullptr)
+        {
+            itsOps->destroy(itsStorage);
+            itsOps = nullptr;
+        }
+    }
+
+    /**
+     * @brief Returns how often a function object was too large to be stored inline
+     *
+     * @return uint32_t
+     */
+    static uint32_t getHeapFallbackCount()
+    {
+        return itsHeapFallbacks.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void* p_storage);
+        void (*move)(void* p_dest, void* p_src);
+        void (*destroy)(void* p_storage);
+    };
+
+    template <typename Function>
+    inline static constexpr Ops itsInlineOps =
+    {
+        [](void* p_storage) { (*static_cast<Function*>(p_storage))(); },
+        [](void* p_dest, void* p_src)
+        {
+            new (p_dest) Function(std::move(*static_cast<Function*>(p_src)));
+            static_cast<Function*>(p_src)->~Function();
+        },
+        [](void* p_storage) { static_cast<Function*>(p_storage)->~Function(); }
+    };
+
+    template <typename Function>
+    inline static constexpr Ops itsHeapOps =
+    {
+        [](void* p_storage) { (**static_cast<Function**>(p_storage))(); },
+        [](void* p_dest, void* p_src) { *static_cast<Function**>(p_dest) = *static_cast<Function**>(p_src); },
+        [](void* p_storage) { delete *static_cast<Function**>(p_storage); }
+    };
+
+    inline static std::atomic<uint32_t> itsHeapFallbacks{0};
+
+    alignas(std::max_align_t) unsigned char itsStorage[itsCapacity];
+    const Ops* itsOps = nullptr;
+
+    void moveFrom(InlineCall& p_other)
+    {
+        itsOps = p_other.itsOps;
+        if (itsOps != nullptr)
+        {
+            itsOps->move(itsStorage, p_other.itsStorage);
+            p_other.itsOps = nullptr;
+        }
+    }
+};
@@ -0,0 +1,122 @@
+/**
+ * @file LatencyHistogram.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Compact histogram of latencies with logarithmic buckets
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Histogram of latencies in microseconds with power-of-two buckets
+ * @details
+ * Bucket 0 counts latencies of 0 us, bucket i (i > 0) counts latencies in
+ * the range [2^(i-1), 2^i) us, and the last bucket all latencies of at least
+ * 2^(itsNumBuckets-2) us. Recording is a few relaxed atomic operations, so
+ * it may be done from any task or ISR.
+ */
+class LatencyHistogram
+{
+public:
+    inline static constexpr std::size_t itsNumBuckets = 20;
+
+    struct Snapshot
+    {
+        std::array<uint32_t, itsNumBuckets> itsBuckets;
+        uint32_t itsCount;
+        uint32_t itsMaxUs;
+
+        /**
+         * @brief Returns an upper bound of the given percentile
+         *
+         * @param p_percent 0..100
+         * @return upper limit of the bucket containing the percentile, or
+         *         itsMaxUs for the last bucket
+         */
+        uint32_t percentile(uint32_t p_percent) const
+        {
+            const uint64_t rank = (static_cast<uint64_t>(itsCount) * p_percent + 99) / 100;
+            uint64_t sum = 0;
+            for (std::size_t i = 0; i < itsNumBuckets - 1; i++)
+            {
+                sum += itsBuckets[i];
+                if ((sum >= rank) && (sum > 0))
+                {
+                    return bucketLimit(i);
+                }
+            }
+            return itsMaxUs;
+        }
+    };
+
+    constexpr LatencyHistogram() :
+        itsBuckets{},
+        itsCount(0),
+        itsMaxUs(0)
+    {}
+
+    void record(uint32_t p_latencyUs)
+    {
+        itsBuckets[bucketOf(p_latencyUs)].fetch_add(1, std::memory_order_relaxed);
+        itsCount.fetch_add(1, std::memory_order_relaxed);
+        uint32_t max = itsMaxUs.load(std::memory_order_relaxed);
+        while ((p_latencyUs > max) &&
+               !itsMaxUs.compare_exchange_weak(max, p_latencyUs, std::memory_order_relaxed))
+        {}
+    }
+
+    Snapshot read() const
+    {
+        Snapshot snapshot;
+        for (std::size_t i = 0; i < itsNumBuckets; i++)
+        {
+            snapshot.itsBuckets[i] = itsBuckets[i].load(std::memory_order_relaxed);
+        }
+        snapshot.itsCount = itsCount.load(std::memory_order_relaxed);
+        snapshot.itsMaxUs = itsMaxUs.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+    void reset()
+    {
+        for (auto& bucket : itsBuckets)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        itsCount.store(0, std::memory_order_relaxed);
+        itsMaxUs.store(0, std::memory_order_relaxed);
+    }
+
+    static constexpr std::size_t bucketOf(uint32_t p_latencyUs)
+    {
+        if (p_latencyUs == 0)
+        {
+            return 0;
+        }
+        const std::size_t bucket = 32 - __builtin_clz(p_latencyUs);
+        return (bucket < itsNumBuckets) ? bucket : itsNumBuckets - 1;
+    }
+
+    /**
+     * @brief Returns the (exclusive) upper limit of a bucket in microseconds
+     *
+     * @param p_bucket
+     * @return uint32_t
+     */
+    static constexpr uint32_t bucketLimit(std::size_t p_bucket)
+    {
+        return uint32_t(1) << p_bucket;
+    }
+
+private:
+    std::array<std::atomic<uint32_t>, itsNumBuckets> itsBuckets;
+    std::atomic<uint32_t> itsCount;
+    std::atomic<uint32_t> itsMaxUs;
+};
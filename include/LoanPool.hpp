@@ -0,0 +1,176 @@
+/**
+ * @file LoanPool.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Fixed-size pool of buffers loaned to publishers of large payloads
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+class LoanPool;
+
+/**
+ * @brief Reference to a buffer of a LoanPool
+ * @details
+ * Copying a LoanedBuffer only increments the reference count of the buffer,
+ * the data is never copied. The buffer returns to its pool when the last
+ * reference is destroyed, e.g. when the last deferred call delivering it has
+ * finished. After publishing, the publisher should not modify the data
+ * anymore, as subscribers may still be reading it.
+ */
+class LoanedBuffer
+{
+public:
+    LoanedBuffer() :
+        itsPool(nullptr),
+        itsIndex(0)
+    {}
+
+    LoanedBuffer(const LoanedBuffer& p_other);
+    LoanedBuffer(LoanedBuffer&& p_other) noexcept :
+        itsPool(std::exchange(p_other.itsPool, nullptr)),
+        itsIndex(p_other.itsIndex)
+    {}
+
+    LoanedBuffer& operator=(const LoanedBuffer& p_other);
+    LoanedBuffer& operator=(LoanedBuffer&& p_other) noexcept;
+
+    ~LoanedBuffer()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Return the reference to the pool
+     */
+    void reset();
+
+    /**
+     * @brief Returns false if no buffer could be loaned
+     */
+    explicit operator bool() const
+    {
+        return itsPool != nullptr;
+    }
+
+    uint8_t* data();
+    const uint8_t* data() const;
+
+    /**
+     * @brief Returns the number of bytes requested when loaning the buffer
+     *
+     * @return std::size_t
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Returns the block size of the pool
+     *
+     * @return std::size_t
+     */
+    std::size_t capacity() const;
+
+private:
+    friend class LoanPool;
+
+    LoanPool* itsPool;
+    std::size_t itsIndex;
+
+    LoanedBuffer(LoanPool* p_pool, std::size_t p_index) :
+        itsPool(p_pool),
+        itsIndex(p_index)
+    {}
+};
+
+/**
+ * @brief Pool of a fixed number of equally sized buffers
+ * @details
+ * All buffers are allocated in one block on creation of the pool, using the
+ * given heap capabilities (e.g. MALLOC_CAP_SPIRAM or MALLOC_CAP_DMA). Loaning
+ * and returning buffers does not use the heap. Buffers must not be loaned
+ * from an ISR. The pool must outlive all buffers loaned from it.
+ */
+class LoanPool
+{
+public:
+    inline static constexpr std::size_t itsAlignment = 16;
+
+    struct Stats
+    {
+        std::size_t itsBlockSize;
+        std::size_t itsNumBlocks;
+        std::size_t itsBlocksInUse;
+        std::size_t itsBlocksHighWater; ///< maximum number of buffers loaned at the same time
+        std::size_t itsFailed;          ///< loans failed as all buffers were in use
+    };
+
+    /**
+     * @brief Create a pool
+     *
+     * @param p_blockSize size of each buffer, rounded up to itsAlignment
+     * @param p_numBlocks number of buffers
+     * @param p_caps heap capabilities as for heap_caps_malloc()
+     */
+    LoanPool(std::size_t p_blockSize, std::size_t p_numBlocks, uint32_t p_caps);
+    ~LoanPool();
+
+    LoanPool(const LoanPool&) = delete;
+    LoanPool& operator=(const LoanPool&) = delete;
+
+    /**
+     * @brief Loan a buffer
+     *
+     * @param p_size number of bytes needed
+     * @return LoanedBuffer, empty if p_size exceeds the block size or all
+     *         buffers are in use
+     */
+    LoanedBuffer loan(std::size_t p_size);
+
+    std::size_t getBlockSize() const
+    {
+        return itsBlockSize;
+    }
+
+    /**
+     * @brief Returns usage and high-water mark of the pool
+     *
+     * @return Stats
+     */
+    Stats getStats();
+
+private:
+    friend class LoanedBuffer;
+
+    struct Block
+    {
+        std::atomic<uint32_t> itsRefs;
+        std::size_t itsSize;
+        Block* itsNext;              ///< next free block
+    };
+
+    const std::size_t itsBlockSize;
+    const std::size_t itsNumBlocks;
+    uint8_t* itsData;
+    Block* itsBlocks;
+
+    std::mutex itsMutex;
+    Block* itsFreeList;
+    std::size_t itsBlocksInUse;
+    std::size_t itsBlocksHighWater;
+    std::size_t itsFailed;
+
+    void addRef(std::size_t p_index)
+    {
+        itsBlocks[p_index].itsRefs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(std::size_t p_index);
+};
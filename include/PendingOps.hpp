@@ -0,0 +1,120 @@
+/**
+ * @file PendingOps.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Operations deferred by a task until its outermost publish has finished
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <esp_log.h>
+
+#include "PubSubConfig.hpp"
+
+/**
+ * @brief Per-task FIFO of operations deferred while the task is publishing
+ * @details
+ * Every task keeps its own ring of Size records in thread-local storage, so
+ * deferring an operation neither allocates memory nor takes a lock, and the
+ * end of the outermost reader section of a task only runs the operations
+ * of that task. Operations which do not fit are rejected.
+ * The storage is trivially constructed and destroyed, it takes
+ * Size * sizeof(Op) bytes of the thread-local storage of every task.
+ * Pending operations are owned by the task that deferred them. They can
+ * only remain when an Owner is destroyed while a task is still within one
+ * of its reader sections, which is not supported anyway.
+ *
+ * @tparam Owner class deferring the operations, each gets its own ring
+ * @tparam Op record of an operation, must be move constructible
+ * @tparam Size number of records per task
+ */
+template <typename Owner, typename Op, std::size_t Size = CONFIG_PUBSUB_PENDING_OPS_SIZE>
+class PendingOps
+{
+    static_assert(Size > 0, "at least one operation must fit");
+
+public:
+    /**
+     * @brief Keep an operation of the current task
+     *
+     * @param p_op
+     * @return false if the ring of the task is full, then p_op is left unchanged
+     */
+    static bool defer(Op&& p_op)
+    {
+        Ring& ring = itsRing;
+        if (unlikely(ring.itsCount == Size))
+        {
+            ESP_LOGE(TAG, "too many deferred subscriptions in task %s, subscription rejected", pcTaskGetName(NULL));
+            return false;
+        }
+        new (ring.itsStorage[(ring.itsHead + ring.itsCount) % Size]) Op(std::move(p_op));
+        ring.itsCount++;
+        return true;
+    }
+
+    /**
+     * @brief Run the operations of the current task in the order they were
+     *        deferred, including those deferred while running them
+     *
+     * @param p_run called with each operation, which is removed before
+     */
+    template <typename Run>
+    static void runAll(Run&& p_run)
+    {
+        Ring& ring = itsRing;
+        while (unlikely(ring.itsCount > 0))
+        {
+            Op op = take(ring);
+            p_run(std::move(op));
+        }
+    }
+
+    /**
+     * @brief Destroy the operations of the current task without running them
+     */
+    static void discard()
+    {
+        Ring& ring = itsRing;
+        while (ring.itsCount > 0)
+        {
+            take(ring);
+        }
+    }
+
+private:
+    inline static const char TAG[] = "PubSub";
+
+    struct Ring
+    {
+        alignas(Op) unsigned char itsStorage[Size][sizeof(Op)];
+        uint32_t itsHead;
+        uint32_t itsCount;
+
+        Op* slot(uint32_t p_index)
+        {
+            return std::launder(reinterpret_cast<Op*>(itsStorage[p_index]));
+        }
+    };
+
+    /// zero-initialized, so tasks need neither constructors nor destructors of thread-local objects
+    inline static thread_local Ring itsRing;
+
+    static Op take(Ring& p_ring)
+    {
+        Op* slot = p_ring.slot(p_ring.itsHead);
+        Op op = std::move(*slot);
+        slot->~Op();
+        p_ring.itsHead = (p_ring.itsHead + 1) % Size;
+        p_ring.itsCount--;
+        return op;
+    }
+};
@@ -0,0 +1,310 @@
+/**
+ * @file PubSubBridge.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Forward topics to other nodes and republish their messages
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "PubSubConfig.hpp"
+#include "PublishSubscribe.hpp"
+#include "BinaryCodec.hpp"
+#include "TopicName.hpp"
+
+/**
+ * @brief Counters of a bridge
+ */
+struct BridgeStats
+{
+    uint32_t itsFramesSent;
+    uint32_t itsMessagesSent;
+    uint64_t itsBytesSent;
+    uint32_t itsSendErrors;       ///< frames the transport failed to send
+    uint32_t itsOversized;        ///< messages too large for a single frame
+    uint32_t itsSuppressed;       ///< received messages not forwarded again
+    uint32_t itsFramesReceived;
+    uint32_t itsMessagesReceived;
+    uint64_t itsBytesReceived;
+    uint32_t itsOwnFrames;        ///< frames of this node received back, e.g. broadcast echoes
+    uint32_t itsInvalidFrames;    ///< frames with a wrong header or a truncated message
+    uint32_t itsUnknownTopics;    ///< messages of topics not bridged by this node
+    uint32_t itsDecodeErrors;     ///< messages whose arguments could not be decoded
+};
+
+/**
+ * @brief Bridge of selected topics to other nodes over a frame transport
+ * @details
+ * For every bridged topic, a synchronous subscriber encodes the arguments
+ * of each message with BinaryCodec and appends it to the pending frame.
+ * The frame is sent when the next message does not fit anymore, or by a
+ * DeferredCallsQueue::Timer at most CONFIG_PUBSUB_BRIDGE_FLUSH_MS after its
+ * first message (0 sends every message right away). Frames received by the
+ * transport are decoded and their messages are published synchronously to
+ * the local topics of the same names.
+ *
+ * Frame layout, all integers little-endian:
+ *   * magic "PS", version, number of messages (1 byte each)
+ *   * node ID of the origin (4 bytes)
+ *   * per message: topic ID (4 bytes, see topicId()), length of the
+ *     arguments (2 bytes), the encoded arguments
+ *
+ * Loops are suppressed in two ways: frames carrying the ID of the node
+ * itself are dropped, and messages published by any bridge while handling
+ * a received frame are not forwarded by the bridges of the node, so nodes
+ * do not relay messages of other nodes. All nodes must bridge a topic name
+ * with the same argument types.
+ */
+class PubSubBridge
+{
+public:
+    /**
+     * @brief Interface of a link to other nodes sending and receiving
+     *        whole frames
+     * @details
+     * The transport passes received frames to receive() of the bridge it
+     * is attached to, from a task (not from an ISR or a WiFi callback).
+     */
+    class Transport
+    {
+    public:
+        virtual ~Transport() = default;
+
+        /**
+         * @brief Returns the maximum size of a frame in bytes
+         *
+         * @return std::size_t
+         */
+        virtual std::size_t maxFrameSize() const = 0;
+
+        /**
+         * @brief Send a frame to the other nodes
+         *
+         * @param p_frame
+         * @param p_size
+         * @return false if the frame could not be sent
+         */
+        virtual bool send(const uint8_t* p_frame, std::size_t p_size) = 0;
+
+    protected:
+        friend class PubSubBridge;
+
+        /**
+         * @brief Pass a received frame to the bridge
+         *
+         * @param p_frame
+         * @param p_size
+         */
+        void received(const uint8_t* p_frame, std::size_t p_size)
+        {
+            PubSubBridge* bridge = itsBridge.load(std::memory_order_acquire);
+            if (bridge != nullptr)
+            {
+                bridge->receive(p_frame, p_size);
+            }
+        }
+
+    private:
+        std::atomic<PubSubBridge*> itsBridge{nullptr};
+    };
+
+    inline static constexpr std::size_t itsHeaderSize = 8;
+    inline static constexpr std::size_t itsMessageHeaderSize = 6;
+    inline static constexpr uint8_t itsVersion = 1;
+
+    /**
+     * @brief Create a bridge sending its frames through a transport
+     * @details
+     * The bridge attaches itself to the transport. Destroying the bridge
+     * unsubscribes its forwarding subscribers and drops the pending frame,
+     * the transport must not receive frames anymore at that time.
+     *
+     * @param p_transport
+     * @param p_nodeId ID unique among the nodes, e.g. derived from the MAC address
+     * @param p_flushMs how long to collect messages in a frame, 0 to send them right away
+     * @param p_priority priority of the deferred call sending a frame after p_flushMs
+     */
+    PubSubBridge(Transport& p_transport, uint32_t p_nodeId, uint32_t p_flushMs = CONFIG_PUBSUB_BRIDGE_FLUSH_MS,
+                 UBaseType_t p_priority = CONFIG_PUBSUB_BRIDGE_TASK_PRIORITY);
+    ~PubSubBridge();
+
+    PubSubBridge(const PubSubBridge&) = delete;
+    PubSubBridge& operator=(const PubSubBridge&) = delete;
+
+    /**
+     * @brief Forward the messages of a local topic and republish the
+     *        messages other nodes forward for it
+     * @details
+     * A topic may only be bridged once per bridge.
+     *
+     * @tparam Types argument types of the topic, as for PublishSubscribe
+     * @param p_name name of the topic
+     * @return SubscriptionId of the forwarding subscriber
+     */
+    template <typename... Types>
+    SubscriptionId bridge(std::string_view p_name)
+    {
+        using PubSub = PublishSubscribe<Types...>;
+        typename PubSub::Topic topic = PubSub::get().topic(p_name);
+        const uint32_t id = topicId(p_name);
+
+        const SubscriptionId subscription = topic.subscribeSync([this, id](const std::decay_t<Types>&... p_args)
+        {
+            forward(id, [&p_args...](BinaryWriter& p_writer) { binaryEncode(p_writer, p_args...); });
+        });
+
+        Inbound inbound;
+        inbound.itsDecoder = [topic](BinaryReader& p_reader)
+        {
+            std::tuple<std::decay_t<Types>...> args;
+            binaryDecode(p_reader, args);
+            if (p_reader.error() || (p_reader.remaining() > 0))
+            {
+                return false;
+            }
+            std::apply([&topic](auto&... p_args) { topic.publish(p_args...); }, args);
+            return true;
+        };
+        inbound.itsUnsubscribe = [topic, subscription]() { topic.unsubscribe(subscription); };
+        addInbound(id, p_name, std::move(inbound));
+        return subscription;
+    }
+
+    /**
+     * @brief Send the pending frame right away
+     */
+    void flush();
+
+    /**
+     * @brief Decode a frame received from another node and publish its messages
+     *
+     * @param p_frame
+     * @param p_size
+     */
+    void receive(const uint8_t* p_frame, std::size_t p_size);
+
+    uint32_t nodeId() const
+    {
+        return itsNodeId;
+    }
+
+    BridgeStats getStats() const;
+    void resetStats();
+
+private:
+    /**
+     * @brief A bridged topic
+     */
+    struct Inbound
+    {
+        std::function<bool(BinaryReader&)> itsDecoder;   ///< decodes and publishes a message
+        std::function<void()> itsUnsubscribe;            ///< removes the forwarding subscriber
+    };
+
+    Transport& itsTransport;
+    const uint32_t itsNodeId;
+    const uint32_t itsFlushUs;
+    const UBaseType_t itsPriority;
+
+    std::mutex itsFrameMutex;
+    std::vector<uint8_t> itsFrame;        ///< pending frame, guarded by itsFrameMutex
+    std::size_t itsFrameSize;             ///< bytes used in itsFrame
+    uint8_t itsFrameMessages;
+    bool itsFlushScheduled;               ///< a flush is armed for the pending frame
+    DeferredCallsQueue::Timer itsFlushTimer;
+    std::atomic<uint32_t> itsFlushCalls;  ///< flush calls armed or queued, see ~PubSubBridge()
+
+    std::mutex itsInboundMutex;
+    std::unordered_map<uint32_t, Inbound> itsInbound;   ///< by topic ID, never erased
+
+    /**
+     * @brief Set while the task publishes the messages of a received frame
+     */
+    inline static thread_local bool itsReceiving = false;
+
+    std::atomic<uint32_t> itsFramesSent;
+    std::atomic<uint32_t> itsMessagesSent;
+    std::atomic<uint64_t> itsBytesSent;
+    std::atomic<uint32_t> itsSendErrors;
+    std::atomic<uint32_t> itsOversized;
+    std::atomic<uint32_t> itsSuppressed;
+    std::atomic<uint32_t> itsFramesReceived;
+    std::atomic<uint32_t> itsMessagesReceived;
+    std::atomic<uint64_t> itsBytesReceived;
+    std::atomic<uint32_t> itsOwnFrames;
+    std::atomic<uint32_t> itsInvalidFrames;
+    std::atomic<uint32_t> itsUnknownTopics;
+    std::atomic<uint32_t> itsDecodeErrors;
+
+    void addInbound(uint32_t p_topicId, std::string_view p_name, Inbound&& p_inbound);
+
+    /**
+     * @brief Append a message to the pending frame
+     *
+     * @param p_topicId
+     * @param p_encode writes the arguments
+     */
+    template <typename Encode>
+    void forward(uint32_t p_topicId, Encode&& p_encode)
+    {
+        if (itsReceiving)
+        {
+            itsSuppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(itsFrameMutex);
+        if (!append(p_topicId, p_encode))
+        {
+            // start a new frame if the message does not fit anymore
+            sendFrame();
+            if (!append(p_topicId, p_encode))
+            {
+                itsOversized.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        messageAdded();
+    }
+
+    template <typename Encode>
+    bool append(uint32_t p_topicId, Encode& p_encode)
+    {
+        if ((itsFrameMessages == UINT8_MAX) || (itsFrameSize + itsMessageHeaderSize > itsFrame.size()))
+        {
+            return false;
+        }
+        uint8_t* message = itsFrame.data() + itsFrameSize;
+        BinaryWriter writer(message + itsMessageHeaderSize, itsFrame.size() - itsFrameSize - itsMessageHeaderSize);
+        p_encode(writer);
+        if (writer.overflow())
+        {
+            return false;
+        }
+        const uint16_t length = writer.size();
+        memcpy(message, &p_topicId, sizeof(p_topicId));
+        memcpy(message + sizeof(p_topicId), &length, sizeof(length));
+        itsFrameSize += itsMessageHeaderSize + length;
+        itsFrameMessages++;
+        return true;
+    }
+
+    void messageAdded();
+    void flushExpired();
+    static void flushDropped(void* p_bridge);
+    void sendFrame();
+    void startFrame();
+};
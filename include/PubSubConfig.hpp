@@ -0,0 +1,99 @@
+/**
+ * @file PubSubConfig.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Default values for configuration options from the Kconfig file
+ * @details
+ * The defaults are only used when the configuration options are not
+ * available, e.g. when building without the ESP-IDF configuration system.
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+
+#ifndef CONFIG_PUBSUB_INLINE_CALL_SIZE
+#define CONFIG_PUBSUB_INLINE_CALL_SIZE 48
+#endif
+
+#ifndef CONFIG_PUBSUB_POOL_CHUNK_SIZE
+#define CONFIG_PUBSUB_POOL_CHUNK_SIZE 1024
+#endif
+
+#ifndef CONFIG_PUBSUB_PENDING_OPS_SIZE
+#define CONFIG_PUBSUB_PENDING_OPS_SIZE 4
+#endif
+
+#ifndef CONFIG_PUBSUB_QUEUE_SIZE
+#define CONFIG_PUBSUB_QUEUE_SIZE 20
+#endif
+
+#ifndef CONFIG_PUBSUB_QUEUE_MAX_SIZE
+#define CONFIG_PUBSUB_QUEUE_MAX_SIZE 64
+#endif
+
+#ifndef CONFIG_PUBSUB_QUEUE_BLOCK_TIMEOUT_MS
+#define CONFIG_PUBSUB_QUEUE_BLOCK_TIMEOUT_MS 5000
+#endif
+
+#ifndef CONFIG_PUBSUB_ISR_QUEUE_SIZE
+#define CONFIG_PUBSUB_ISR_QUEUE_SIZE 16
+#endif
+
+#ifndef CONFIG_PUBSUB_ISR_TASK_PRIORITY
+#define CONFIG_PUBSUB_ISR_TASK_PRIORITY 18
+#endif
+
+#ifndef CONFIG_PUBSUB_TASK_STACK_SIZE
+#define CONFIG_PUBSUB_TASK_STACK_SIZE 8192
+#endif
+
+#ifndef CONFIG_PUBSUB_TASK_STACK_IN_PSRAM
+#define CONFIG_PUBSUB_TASK_STACK_IN_PSRAM 0
+#endif
+
+#ifndef CONFIG_PUBSUB_WORKERS_PER_CORE
+#define CONFIG_PUBSUB_WORKERS_PER_CORE 0
+#endif
+
+#ifndef CONFIG_PUBSUB_DISTRIBUTE_UNPINNED
+#define CONFIG_PUBSUB_DISTRIBUTE_UNPINNED 0
+#endif
+
+#ifndef CONFIG_PUBSUB_BATCH_CALLS
+#define CONFIG_PUBSUB_BATCH_CALLS 1
+#endif
+
+#ifndef CONFIG_PUBSUB_BATCH_TIME_US
+#define CONFIG_PUBSUB_BATCH_TIME_US 0
+#endif
+
+#ifndef CONFIG_PUBSUB_COROUTINE_POLL_MS
+#define CONFIG_PUBSUB_COROUTINE_POLL_MS 10
+#endif
+
+#ifndef CONFIG_PUBSUB_TRACE_RING_SIZE
+#define CONFIG_PUBSUB_TRACE_RING_SIZE 256
+#endif
+
+#ifndef CONFIG_PUBSUB_LATENCY_HISTOGRAM
+#define CONFIG_PUBSUB_LATENCY_HISTOGRAM 0
+#endif
+
+#ifndef CONFIG_PUBSUB_BRIDGE_FLUSH_MS
+#define CONFIG_PUBSUB_BRIDGE_FLUSH_MS 5
+#endif
+
+#ifndef CONFIG_PUBSUB_BRIDGE_TASK_PRIORITY
+#define CONFIG_PUBSUB_BRIDGE_TASK_PRIORITY 10
+#endif
+
+#ifndef CONFIG_PUBSUB_BRIDGE_UDP_FRAME_SIZE
+#define CONFIG_PUBSUB_BRIDGE_UDP_FRAME_SIZE 1400
+#endif
+
+#ifndef CONFIG_PUBSUB_BRIDGE_RX_QUEUE_SIZE
+#define CONFIG_PUBSUB_BRIDGE_RX_QUEUE_SIZE 8
+#endif
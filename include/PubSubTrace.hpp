@@ -0,0 +1,140 @@
+/**
+ * @file PubSubTrace.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Tracing of published messages, selected at compile time
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_log.h>
+
+#include "PubSubConfig.hpp"
+
+/**
+ * @brief Events recorded while publishing
+ */
+enum class TraceEvent : uint8_t
+{
+    Publish,        ///< message published (subscriber = 0)
+    PublishAsync,   ///< message published asynchronously (subscriber = 0)
+    DispatchSync,   ///< subscriber called directly
+    DispatchAsync,  ///< deferred call added for a subscriber
+    ReplaceLatest,  ///< pending message of a latest-value or throttled subscriber replaced
+    AddToBatch,     ///< message added to the pending batch of a batching subscriber
+    DropFromBatch,  ///< message dropped because the pending batch is full
+    Retained,       ///< retained message delivered to a new subscriber
+    NumEvents
+};
+
+/**
+ * @brief Compile-time selectable tracing of the dispatch path
+ * @details
+ * The level is chosen by the Kconfig option PUBSUB_TRACE:
+ *   * None: record() compiles to nothing.
+ *   * Counters: one relaxed atomic increment per event.
+ *   * Log: counters, and every event is logged with ESP_LOGI.
+ *   * Ring: counters, and every event is stored as a 16-byte record in a
+ *     ring buffer of CONFIG_PUBSUB_TRACE_RING_SIZE entries, which may be
+ *     read with readRing() or dumped with dumpRing() later. Records are
+ *     written without locking, a record being overwritten while the ring
+ *     is read may therefore be inconsistent.
+ */
+class PubSubTrace
+{
+public:
+    enum class Level
+    {
+        None,
+        Counters,
+        Log,
+        Ring
+    };
+
+#if CONFIG_PUBSUB_TRACE_RING
+    static constexpr Level itsLevel = Level::Ring;
+#elif CONFIG_PUBSUB_TRACE_LOG
+    static constexpr Level itsLevel = Level::Log;
+#elif CONFIG_PUBSUB_TRACE_COUNTERS
+    static constexpr Level itsLevel = Level::Counters;
+#else
+    static constexpr Level itsLevel = Level::None;
+#endif
+
+    static constexpr std::size_t itsRingSize = CONFIG_PUBSUB_TRACE_RING_SIZE;
+    static constexpr std::size_t itsNumEvents = static_cast<std::size_t>(TraceEvent::NumEvents);
+
+    struct Record
+    {
+        uint32_t itsTimestamp;      ///< lower 32 bits of esp_timer_get_time()
+        uint32_t itsTopic;          ///< topic ID, see topicId()
+        uint32_t itsSubscriber;     ///< subscription ID, or 0
+        TraceEvent itsEvent;
+        uint8_t itsPriority;        ///< priority of the publishing task
+        uint8_t itsCore;
+        uint8_t itsReserved;
+    };
+
+    using Counters = std::array<uint32_t, itsNumEvents>;
+
+    /**
+     * @brief Record an event according to the configured level
+     *
+     * @param p_event
+     * @param p_topicId
+     * @param p_topicName
+     * @param p_subscriber subscription ID, or 0 for publish events
+     */
+    static inline void record(TraceEvent p_event, uint32_t p_topicId, const char* p_topicName,
+                              uint32_t p_subscriber = 0)
+    {
+        if constexpr (itsLevel != Level::None)
+        {
+            itsCounters[static_cast<std::size_t>(p_event)].fetch_add(1, std::memory_order_relaxed);
+        }
+        if constexpr (itsLevel == Level::Log)
+        {
+            log(p_event, p_topicName, p_subscriber);
+        }
+        if constexpr (itsLevel == Level::Ring)
+        {
+            push(p_event, p_topicId, p_subscriber);
+        }
+    }
+
+    /**
+     * @brief Returns the number of events recorded so far, indexed by TraceEvent
+     *
+     * @return Counters, all 0 if tracing is disabled
+     */
+    static Counters getCounters();
+
+    /**
+     * @brief Copy the records of the ring buffer, oldest first
+     *
+     * @param p_records destination
+     * @param p_maxRecords capacity of the destination
+     * @return number of records copied
+     */
+    static std::size_t readRing(Record* p_records, std::size_t p_maxRecords);
+
+    /**
+     * @brief Log all records of the ring buffer, oldest first
+     */
+    static void dumpRing();
+
+    static const char* eventName(TraceEvent p_event);
+
+private:
+    inline static std::array<std::atomic<uint32_t>, itsNumEvents> itsCounters{};
+
+    static void log(TraceEvent p_event, const char* p_topicName, uint32_t p_subscriber);
+    static void push(TraceEvent p_event, uint32_t p_topicId, uint32_t p_subscriber);
+};
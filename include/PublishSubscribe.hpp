@@ -16,6 +16,40 @@
  *   * Asynchronous and synchronous publishing and subscriptions
  *   * Flexible task priority for asynchronous operations, default to the task
  *     priority of the current task.
+ *   * Topic handles:
+ *     Channels may be resolved once, avoiding the name lookup on every publish.
+ *   * Static topics:
+ *     Topics known at compile time use a fixed-size subscriber table and
+ *     may have subscribers bound at compile time.
+ *   * Subscription IDs:
+ *     Subscribing returns an ID to unsubscribe with, subscribers are kept in
+ *     a contiguous list per channel.
+ *   * Lock-free publishing:
+ *     Publishers read an immutable snapshot of the subscribers, which is
+ *     replaced (read-copy-update) when subscribing or unsubscribing.
+ *   * Publishing from ISRs:
+ *     Topic handles and static topics may be published from interrupts.
+ *   * Zero-copy asynchronous delivery:
+ *     The arguments of a message are copied at most once into a shared
+ *     block, which all deferred calls of the message refer to.
+ *   * Loaned buffers:
+ *     Large payloads may be written into buffers loaned from a fixed-size
+ *     pool of the topic, which are passed on by reference count only.
+ *   * Latest-value subscriptions:
+ *     Asynchronous subscribers may only receive the latest of the messages
+ *     published while a message is still pending.
+ *   * Throttled and batching subscriptions:
+ *     Asynchronous subscribers may be called at most once per interval with
+ *     the latest message, or once per time window with all of its messages.
+ *   * Priority-ordered synchronous dispatch:
+ *     Synchronous subscribers are called in the order of their priority,
+ *     critical ones before any deferred call of the message is added.
+ *   * Wildcard subscriptions:
+ *     MQTT-style patterns like "sensor/+/accel" or "sensor/#", matched once
+ *     per channel instead of on every publish.
+ *   * Coroutine subscribers:
+ *     Asynchronous subscribers may be DeferredTask coroutines, which free
+ *     their task while waiting for a delay, event bits or another message.
  *
  * @copyright Copyright (c) 2023 Thomas Reitmayr
  * MIT License
@@ -29,25 +63,137 @@
 #pragma once
 
 #include <map>
+#include <vector>
+#include <array>
+#include <optional>
+#include <atomic>
 #include <mutex>
-#include <shared_mutex>
-#include <queue>
+#include <new>
 #include <string>
+#include <string_view>
 #include <cstdlib>
 #include <algorithm>
 #include <functional>
 #include <limits>
+#include <type_traits>
+#include <memory>
+#include <tuple>
+#include <span>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
 #include <esp_log.h>
 #include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
 
 #include "DeferredCallsQueue.hpp"
+#include "DeferredTask.hpp"
+#include "SubscriptionPool.hpp"
+#include "TopicName.hpp"
+#include "Rcu.hpp"
+#include "LoanPool.hpp"
+#include "PubSubTrace.hpp"
+#include "LatencyHistogram.hpp"
+#include "PendingOps.hpp"
+
+/**
+ * @brief Handle of a subscription, needed to unsubscribe again
+ * @details
+ * IDs start at 1, 0 is returned for a subscription which was rejected.
+ */
+using SubscriptionId = uint32_t;
+
+/**
+ * @brief Counters of a topic
+ * @details
+ * Handlers bound to a StaticTopic at compile time are not timed.
+ */
+struct TopicStats
+{
+    std::string_view itsName;
+    uint32_t itsSubscribers;      ///< current number of run-time subscriptions
+    uint32_t itsPublished;        ///< messages published (synchronously or asynchronously)
+    uint32_t itsSyncCalls;        ///< synchronous handler calls
+    uint64_t itsSyncTimeUs;       ///< total execution time of synchronous handlers
+    uint32_t itsMaxSyncTimeUs;
+};
+
+/**
+ * @brief Identification and counters of a topic, updated by publishers
+ * @details
+ * Shared by PublishSubscribe and Broker.
+ */
+struct TopicInfo
+{
+    const char* itsName;
+    uint32_t itsId;                           ///< topic ID of the name, for tracing
+    std::atomic<uint32_t> itsPublished;
+    std::atomic<uint32_t> itsSyncCalls;
+    std::atomic<uint64_t> itsSyncTimeUs;
+    std::atomic<uint32_t> itsMaxSyncTimeUs;
+
+    constexpr TopicInfo(const char* p_name, uint32_t p_id) :
+        itsName(p_name),
+        itsId(p_id),
+        itsPublished(0),
+        itsSyncCalls(0),
+        itsSyncTimeUs(0),
+        itsMaxSyncTimeUs(0)
+    {}
+
+    void addSyncCall(uint32_t p_timeUs)
+    {
+        itsSyncCalls.fetch_add(1, std::memory_order_relaxed);
+        itsSyncTimeUs.fetch_add(p_timeUs, std::memory_order_relaxed);
+        uint32_t max = itsMaxSyncTimeUs.load(std::memory_order_relaxed);
+        while ((p_timeUs > max) &&
+               !itsMaxSyncTimeUs.compare_exchange_weak(max, p_timeUs, std::memory_order_relaxed))
+        {}
+    }
+
+    TopicStats read(uint32_t p_subscribers) const
+    {
+        return {itsName,
+                p_subscribers,
+                itsPublished.load(std::memory_order_relaxed),
+                itsSyncCalls.load(std::memory_order_relaxed),
+                itsSyncTimeUs.load(std::memory_order_relaxed),
+                itsMaxSyncTimeUs.load(std::memory_order_relaxed)};
+    }
+
+    void reset()
+    {
+        itsPublished.store(0, std::memory_order_relaxed);
+        itsSyncCalls.store(0, std::memory_order_relaxed);
+        itsSyncTimeUs.store(0, std::memory_order_relaxed);
+        itsMaxSyncTimeUs.store(0, std::memory_order_relaxed);
+    }
+};
 
 /**
  * @brief Publish/Subscribe library for inter-class communication
+ * @details
+ * Publishing never takes a lock. The subscribers of a channel are kept in
+ * an immutable table which is read within an Rcu reader section. Subscribing
+ * and unsubscribing create a modified copy of the table, swap it in
+ * atomically and retire the old table, which is released once the last
+ * publisher still using it has finished.
+ *
+ * A synchronous publish first calls the critical subscribers, then adds the
+ * deferred calls of the asynchronous subscribers in the order of
+ * subscription, and finally calls the other synchronous subscribers by
+ * descending priority (the priority of the subscribing task). Subscribers of
+ * the same priority are called in the order of subscription, subscribers of
+ * patterns after those of the channel itself. Static topics call their
+ * subscribers in the order of their slots.
+ *
+ * Subscriptions requested from within a synchronous subscription handler are
+ * deferred until the outermost publish of the current task has finished,
+ * so they do not receive messages published further down the same
+ * call chain. Each task keeps up to CONFIG_PUBSUB_PENDING_OPS_SIZE of them,
+ * further subscriptions are rejected and return the invalid ID 0.
  */
 
 template <typename... Types>
@@ -57,396 +203,2697 @@ public:
     using SubscribeCallback = std::function<void(Types...)> const;
 
     /**
-     * @brief Returns a PubSub instance, use this to instantiate the PubSub object
+     * @brief Messages passed to a batching subscriber, as tuples of their arguments
+     */
+    using Batch = std::span<const std::tuple<std::decay_t<Types>...>>;
+    using BatchCallback = std::function<void(Batch)> const;
+
+private:
+    /**
+     * @brief How messages are delivered to a subscriber
+     */
+    enum class Delivery : uint8_t
+    {
+        Sync,         ///< called by the publisher, unless published asynchronously
+        Critical,     ///< like Sync, but called before any deferred call of the message is added
+        Async,        ///< always called by a deferred calls task
+        Latest,       ///< like Async, but only the latest pending message is delivered
+        Throttled,    ///< like Latest, but at most one call per interval
+        Batched,      ///< all messages of a time window are delivered in a single call
+        Coroutine     ///< like Async, the callback starts a DeferredTask keeping the payload until it has finished
+    };
+
+    using Callback = std::function<void(Types...)>;
+    using CallbackPtr = std::shared_ptr<const Callback>;
+
+    /**
+     * @brief Immutable copy of the arguments of a message, shared by all
+     *        deferred calls delivering the message
+     */
+    using Payload = std::tuple<std::decay_t<Types>...>;
+    using PayloadPtr = std::shared_ptr<const Payload>;
+
+    /**
+     * @brief Arguments of a message while it is being published
+     * @details
+     * The arguments are passed on by reference. They are copied (or moved,
+     * if nobody else uses them anymore) into a shared payload block only
+     * once, when the first deferred call needs them.
+     */
+    class Message
+    {
+    public:
+        Message(TopicInfo& p_topic, bool p_movable, Types&... p_args) :
+            itsTopic(p_topic),
+            itsArgs(p_args...),
+            itsMovable(p_movable)
+        {
+            itsTopic.itsPublished.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Message delivering the retained arguments of a topic, not
+         *        counted as published again
+         *
+         * @param p_topic
+         * @param p_retained copy of the arguments, may be moved into the payload
+         */
+        Message(TopicInfo& p_topic, Payload& p_retained) :
+            itsTopic(p_topic),
+            itsArgs(std::apply([](std::decay_t<Types>&... p_args) { return std::tuple<Types&...>(p_args...); },
+                               p_retained)),
+            itsMovable(true)
+        {}
+
+        void trace(TraceEvent p_event, SubscriptionId p_subscriber = 0) const
+        {
+            PubSubTrace::record(p_event, itsTopic.itsId, itsTopic.itsName, p_subscriber);
+        }
+
+        void deliver(const Callback& p_callback) const
+        {
+            const int64_t start = esp_timer_get_time();
+            std::apply(p_callback, itsArgs);
+            itsTopic.addSyncCall(esp_timer_get_time() - start);
+        }
+
+        /**
+         * @brief Latest start time of the deferred calls delivering the message
+         *
+         * @param p_deadlineUs time in esp_timer_get_time() microseconds
+         */
+        void setDeadline(int64_t p_deadlineUs)
+        {
+            itsDeadlineUs = p_deadlineUs;
+        }
+
+        int64_t deadline() const
+        {
+            return itsDeadlineUs;
+        }
+
+        const PayloadPtr& payload()
+        {
+            if (!itsPayload)
+            {
+                itsPayload = std::apply([this](Types&... p_args)
+                {
+                    return std::allocate_shared<Payload>(PoolAllocator<Payload>(), forward<Types>(p_args)...);
+                }, itsArgs);
+            }
+            return itsPayload;
+        }
+
+        /**
+         * @brief Append a copy of the arguments to a batch
+         * @details
+         * Movable arguments are copied from the payload, as they may already
+         * have been moved into it for another subscriber.
+         *
+         * @param p_batch
+         */
+        void append(std::vector<Payload>& p_batch)
+        {
+            if (itsMovable || itsPayload)
+            {
+                p_batch.push_back(*payload());
+            }
+            else
+            {
+                std::apply([&p_batch](Types&... p_args) { p_batch.emplace_back(p_args...); }, itsArgs);
+            }
+        }
+
+    private:
+        TopicInfo& itsTopic;
+        std::tuple<Types&...> itsArgs;
+        bool itsMovable;
+        int64_t itsDeadlineUs = DeferredCallsQueue::itsNoDeadline;
+        PayloadPtr itsPayload;
+
+        template <typename T>
+        decltype(auto) forward(T& p_arg) const
+        {
+            // arguments passed by reference belong to the publisher
+            if constexpr (!std::is_reference_v<T> && std::is_move_constructible_v<T>)
+            {
+                return itsMovable ? std::decay_t<T>(std::move(p_arg)) : std::decay_t<T>(p_arg);
+            }
+            else
+            {
+                return static_cast<const std::decay_t<T>&>(p_arg);
+            }
+        }
+    };
+
+    /**
+     * @brief Last message of a retained topic
+     * @details
+     * The arguments are copied into a slot allocated when the topic is
+     * retained, so publishing does not allocate memory unless copying the
+     * arguments does (e.g. a string growing beyond its capacity).
+     */
+    struct RetainedValue
+    {
+        std::mutex itsMutex;
+        std::optional<Payload> itsValue;
+
+        void store(Types&... p_args)
+        {
+            std::lock_guard<std::mutex> lock(itsMutex);
+            if (itsValue)
+            {
+                *itsValue = std::forward_as_tuple(p_args...);
+            }
+            else
+            {
+                itsValue.emplace(p_args...);
+            }
+        }
+
+        std::optional<Payload> load()
+        {
+            std::lock_guard<std::mutex> lock(itsMutex);
+            return itsValue;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(itsMutex);
+            itsValue.reset();
+        }
+    };
+
+    /**
+     * @brief Latest message pending for a subscriber with Delivery::Latest
+     * @details
+     * While a message is pending, newer messages replace its payload
+     * instead of adding further deferred calls.
+     */
+    struct LatestValue
+    {
+        std::mutex itsMutex;
+        PayloadPtr itsPayload;   ///< pending message, if any
+    };
+
+    /**
+     * @brief Pending messages of a throttled or batching subscriber
+     * @details
+     * itsScheduled is set while the timer or the deferred call of the
+     * subscriber is pending, further messages only update the state until
+     * the call takes them. Both buffers of a batching subscriber are
+     * allocated upfront and swapped by the call, so collecting messages
+     * does not allocate memory unless copying the arguments does.
+     */
+    struct WindowState
+    {
+        const uint32_t itsWindowUs;      ///< minimum interval or length of the window
+        const uint32_t itsMaxMessages;   ///< capacity of a batch
+        BatchCallback itsBatchCallback;
+        std::mutex itsMutex;
+        bool itsScheduled;
+        int64_t itsNextCallUs;           ///< earliest start of the next call of a throttled subscriber
+        PayloadPtr itsLatest;            ///< pending message of a throttled subscriber
+        std::vector<Payload> itsPending;       ///< messages of the current window
+        std::vector<Payload> itsDelivering;    ///< messages passed to the batch callback
+        std::mutex itsDeliverMutex;            ///< held while itsDelivering is in use
+        DeferredCallsQueue::Timer itsTimer;
+
+        WindowState(uint32_t p_windowMs, BatchCallback& p_batchCallback, uint32_t p_maxMessages) :
+            itsWindowUs(p_windowMs * 1000),
+            itsMaxMessages(p_maxMessages),
+            itsBatchCallback(p_batchCallback),
+            itsScheduled(false),
+            itsNextCallUs(0)
+        {
+            itsPending.reserve(itsMaxMessages);
+            itsDelivering.reserve(itsMaxMessages);
+        }
+    };
+
+    /**
+     * @brief Subscription as stored in the subscriber table of a channel
+     */
+    struct Subscriber
+    {
+        CallbackPtr itsCallback;                  ///< shared by all copies of the table
+        SubscriptionId itsId;
+        UBaseType_t itsPriority;
+        BaseType_t itsAffinity;
+        Delivery itsDelivery;
+        std::shared_ptr<LatestValue> itsLatest;   ///< shared by all copies of the table
+        std::shared_ptr<WindowState> itsWindow;   ///< shared by all copies of the table
+        PoolString itsName;
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+        std::shared_ptr<LatencyHistogram> itsLatency;   ///< delays of deferred calls
+#endif
+
+        Subscriber(SubscriptionId p_id,
+                   std::string_view p_name,
+                   SubscribeCallback& p_callback,
+                   UBaseType_t p_priority,
+                   BaseType_t p_affinity,
+                   Delivery p_delivery,
+                   std::shared_ptr<WindowState> p_window = nullptr) :
+            itsCallback(std::allocate_shared<const Callback>(PoolAllocator<Callback>(), p_callback)),
+            itsId(p_id),
+            itsPriority(p_priority),
+            itsAffinity(p_affinity),
+            itsDelivery(p_delivery),
+            itsLatest((p_delivery == Delivery::Latest) ?
+                      std::allocate_shared<LatestValue>(PoolAllocator<LatestValue>()) : nullptr),
+            itsWindow(std::move(p_window)),
+            itsName(p_name)
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+            , itsLatency(std::allocate_shared<LatencyHistogram>(PoolAllocator<LatencyHistogram>()))
+#endif
+        {}
+
+        bool isSync() const
+        {
+            return (itsDelivery == Delivery::Sync) || (itsDelivery == Delivery::Critical);
+        }
+
+        LatencyHistogram::Snapshot getLatency() const
+        {
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+            return itsLatency->read();
+#else
+            return LatencyHistogram().read();
+#endif
+        }
+    };
+
+    /**
+     * @brief Measures the delay between adding a deferred call for a
+     *        subscriber and the start of the call
+     * @details
+     * Empty unless CONFIG_PUBSUB_LATENCY_HISTOGRAM is enabled.
+     */
+    struct LatencyProbe
+    {
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+        std::shared_ptr<LatencyHistogram> itsHistogram;
+        int64_t itsAddedUs;
+
+        explicit LatencyProbe(const Subscriber& p_subscriber) :
+            itsHistogram(p_subscriber.itsLatency),
+            itsAddedUs(esp_timer_get_time())
+        {}
+
+        void started() const
+        {
+            itsHistogram->record(esp_timer_get_time() - itsAddedUs);
+        }
+#else
+        explicit LatencyProbe(const Subscriber&)
+        {}
+
+        void started() const
+        {}
+#endif
+    };
+
+    /**
+     * @brief Subscribers of a channel, never modified once published
+     * @details
+     * The subscribers are kept in the order of subscription, which is the
+     * order of their deferred calls. itsSyncOrder lists the synchronous
+     * subscribers in the order they are called: critical subscribers first,
+     * then by descending priority, subscribers of the same priority in the
+     * order of subscription.
+     */
+    struct SubscriberTable
+    {
+        std::vector<Subscriber, PoolAllocator<Subscriber>> itsSubscribers;
+        std::vector<uint32_t, PoolAllocator<uint32_t>> itsSyncOrder;   ///< indices into itsSubscribers
+        uint32_t itsNumCritical = 0;
+        bool itsHasAsync = false;
+
+        /**
+         * @brief Tells whether p_left is called after p_right, both being synchronous
+         */
+        static bool callsAfter(const Subscriber& p_left, const Subscriber& p_right)
+        {
+            if (p_left.itsDelivery != p_right.itsDelivery)
+            {
+                return p_right.itsDelivery == Delivery::Critical;
+            }
+            return p_left.itsPriority < p_right.itsPriority;
+        }
+
+        /**
+         * @brief Determine the call order after the subscribers have been modified
+         */
+        void updateOrder()
+        {
+            itsSyncOrder.clear();
+            itsNumCritical = 0;
+            itsHasAsync = false;
+            for (uint32_t i = 0; i < itsSubscribers.size(); i++)
+            {
+                if (itsSubscribers[i].isSync())
+                {
+                    itsSyncOrder.push_back(i);
+                    itsNumCritical += (itsSubscribers[i].itsDelivery == Delivery::Critical);
+                }
+                else
+                {
+                    itsHasAsync = true;
+                }
+            }
+            // insertion sort, stable and without a temporary buffer on the heap
+            for (uint32_t i = 1; i < itsSyncOrder.size(); i++)
+            {
+                const uint32_t index = itsSyncOrder[i];
+                const Subscriber& subscriber = itsSubscribers[index];
+                uint32_t j = i;
+                while ((j > 0) && callsAfter(itsSubscribers[itsSyncOrder[j - 1]], subscriber))
+                {
+                    itsSyncOrder[j] = itsSyncOrder[j - 1];
+                    j--;
+                }
+                itsSyncOrder[j] = index;
+            }
+        }
+    };
+
+    struct Channel;
+
+    /**
+     * @brief Patterns matching a channel in the order of their creation,
+     *        never modified once published
+     */
+    using PatternList = std::vector<const Channel*, PoolAllocator<const Channel*>>;
+
+    /**
+     * @brief Channel referring to its current subscriber table
+     * @details
+     * Channels are never released, so topic handles may refer to them directly.
+     * The table is accessed sequentially consistent, ordering it with the
+     * reader counts of the Rcu epochs.
+     * Wildcard patterns are channels as well, which are not part of the
+     * channel map. Their subscribers are reached through the pattern lists
+     * of the matching channels.
+     */
+    struct Channel
+    {
+        PoolString itsName;
+        TopicInfo itsInfo;
+        std::atomic<const SubscriberTable*> itsTable;
+        std::atomic<LoanPool*> itsLoanPool;
+        std::atomic<const PatternList*> itsPatterns;   ///< nullptr if no pattern matches
+        std::atomic<RetainedValue*> itsRetained;       ///< nullptr unless the channel is retained
+
+        explicit Channel(std::string_view p_name) :
+            itsName(p_name),
+            itsInfo(itsName.c_str(), topicId(p_name)),
+            itsTable(nullptr),
+            itsLoanPool(nullptr),
+            itsPatterns(nullptr),
+            itsRetained(nullptr)
+        {}
+    };
+
+    /**
+     * @brief Name published to without a channel, together with all patterns
+     *        which may match it
+     */
+    struct UnnamedChannel
+    {
+        std::string_view itsName;
+        const PatternList& itsPatterns;
+    };
+
+    /**
+     * @brief Map of all channels, keys refer to the names stored in the channels
+     */
+    using ChannelMap = std::map<std::string_view, Channel*, std::less<>,
+                                PoolAllocator<std::pair<const std::string_view, Channel*>>>;
+
+public:
+    /**
+     * @brief Awaitable resuming a DeferredTask coroutine with the arguments
+     *        of the next message of a channel, see Topic::nextMessage()
+     */
+    class NextMessage
+    {
+    public:
+        NextMessage(PublishSubscribe& p_pubSub, Channel& p_channel) :
+            itsPubSub(p_pubSub),
+            itsChannel(p_channel),
+            itsState(std::make_shared<State>()),
+            itsId(0)
+        {}
+
+        /**
+         * @brief Unsubscribes if the coroutine is destroyed while waiting,
+         *        as its resumption was dropped
+         */
+        ~NextMessage()
+        {
+            if (unlikely(itsId != 0))
+            {
+                itsPubSub.unsubscribe(itsChannel, itsId);
+            }
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(DeferredTask::Handle p_handle)
+        {
+            // the subscription may be called before it returns its ID
+            std::shared_ptr<State> state = itsState;
+            state->itsHandle = p_handle;
+            itsId = itsPubSub.subscribe(itsChannel, [state](Types... p_args)
+            {
+                if (!state->itsTaken.exchange(true))
+                {
+                    state->itsValue.emplace(p_args...);
+                    state->arrive();
+                }
+            }, uxTaskPriorityGet(NULL), xTaskGetAffinity(NULL), Delivery::Sync);
+            if (unlikely(itsId == 0))
+            {
+                // the subscription was rejected, no message can resume the coroutine
+                DeferredTask::promise_type::abandon(p_handle.address());
+                return;
+            }
+            state->arrive();
+        }
+
+        Payload await_resume()
+        {
+            itsPubSub.unsubscribe(itsChannel, std::exchange(itsId, 0));
+            return std::move(*itsState->itsValue);
+        }
+
+    private:
+        /**
+         * @brief Shared with the subscription, which may be called again
+         *        until it is unsubscribed
+         */
+        struct State
+        {
+            std::atomic<bool> itsTaken{false};
+            std::atomic<uint8_t> itsPending{2};   ///< the message and the subscription ID
+            std::optional<Payload> itsValue;
+            DeferredTask::Handle itsHandle;
+
+            void arrive()
+            {
+                if (itsPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    itsHandle.promise().resumeDeferred();
+                }
+            }
+        };
+
+        PublishSubscribe& itsPubSub;
+        Channel& itsChannel;
+        std::shared_ptr<State> itsState;
+        SubscriptionId itsId;
+    };
+
+    /**
+     * @brief Handle to a channel which has been resolved once
+     * @details
+     * A topic handle refers directly to its channel, so publishing through it
+     * neither looks up nor copies the channel name. Handles are cheap to copy
+     * and remain valid for the lifetime of the program, as channels are never
+     * removed (only their subscriptions are).
+     */
+    class Topic
+    {
+    public:
+        /**
+         * @brief Publish a message to this topic
+         *
+         * @param p_args
+         */
+        void publish(Types... p_args) const
+        {
+            itsPubSub->publish(*itsChannel, p_args...);
+        }
+
+        void publishAsync(Types... p_args) const
+        {
+            itsPubSub->publishAsync(*itsChannel, p_args...);
+        }
+
+        void publishAsyncWithPrio(Types... p_args, UBaseType_t p_priority) const
+        {
+            itsPubSub->publishAsync(*itsChannel, p_args..., p_priority);
+        }
+
+        /**
+         * @brief Publish a message whose deferred calls should start by a deadline
+         * @details
+         * Queues configured by DeferredCallsQueue::setDeadlineScheduling() run
+         * the calls with the earliest deadline first and may drop them once
+         * the deadline has passed. Throttled and batched subscriptions ignore
+         * the deadline.
+         *
+         * @param p_args
+         * @param p_deadlineUs latest start time in esp_timer_get_time() microseconds
+         */
+        void publishAsyncWithDeadline(Types... p_args, int64_t p_deadlineUs) const
+        {
+            itsPubSub->publishAsync(*itsChannel, p_args..., -1, p_deadlineUs);
+        }
+
+        /**
+         * @brief Publish a message to this topic from an interrupt service routine
+         * @details
+         * The arguments are copied into a slot reserved for interrupts, the
+         * message is then published by the ISR task of DeferredCallsQueue.
+         *
+         * @param p_args
+         * @return false if the message was dropped because all slots are in use
+         */
+        bool publishFromISR(Types... p_args) const
+        {
+            PublishSubscribe* pubSub = itsPubSub;
+            Channel* channel = itsChannel;
+            return deferFromISR([pubSub, channel, p_args...]() mutable
+                                { pubSub->publish(*channel, p_args...); });
+        }
+
+        /**
+         * @brief Subscribe to this topic
+         *
+         * @param p_callback
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        SubscriptionId subscribeSync(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Sync);
+        }
+
+        /**
+         * @brief Subscribe synchronously, called before all other subscribers
+         * @details
+         * Critical subscribers are called before any deferred call of the
+         * message is added (which might preempt the publisher), followed by
+         * the other synchronous subscribers in the order of their priority.
+         *
+         * @param p_callback
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        SubscriptionId subscribeCritical(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Critical);
+        }
+
+        SubscriptionId subscribeAsync(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Async);
+        }
+
+        /**
+         * @brief Subscribe asynchronously with the given priority
+         * @details
+         * If p_stackSize is given, the task executing the deferred calls of
+         * the priority is created with at least this stack size, see
+         * DeferredCallsQueue::reserveStack().
+         *
+         * @param p_callback
+         * @param p_priority
+         * @param p_stackSize stack size in bytes needed by the callback, 0 for the default
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        SubscriptionId subscribeAsyncWithPrio(SubscribeCallback& p_callback, UBaseType_t p_priority,
+                                              uint32_t p_stackSize = 0) const
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            reserveStack(p_priority, affinity, p_stackSize);
+            return itsPubSub->subscribe(*itsChannel, p_callback, p_priority, affinity, Delivery::Async);
+        }
+
+        /**
+         * @brief Subscribe a coroutine to this topic
+         * @details
+         * Every message starts the DeferredTask returned by p_handler in the
+         * deferred calls task of the subscription, which runs other calls
+         * while the coroutine is suspended. Arguments of reference types
+         * (e.g. const Frame&) stay valid until the coroutine has finished,
+         * the coroutine should take all others by value. Captures of
+         * p_handler must outlive its coroutines.
+         *
+         * @param p_handler callable returning a DeferredTask
+         * @param p_priority
+         * @param p_stackSize stack size in bytes needed by the coroutine, 0 for the default
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        template <typename Handler>
+            requires DeferredTaskHandler<Handler, Types...>
+        SubscriptionId subscribeAsync(Handler p_handler) const
+        {
+            return subscribeAsyncWithPrio(std::move(p_handler), uxTaskPriorityGet(NULL));
+        }
+
+        template <typename Handler>
+            requires DeferredTaskHandler<Handler, Types...>
+        SubscriptionId subscribeAsyncWithPrio(Handler p_handler, UBaseType_t p_priority,
+                                              uint32_t p_stackSize = 0) const
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            reserveStack(p_priority, affinity, p_stackSize);
+            return itsPubSub->subscribe(*itsChannel, coroutineCallback(std::move(p_handler)), p_priority, affinity,
+                                        Delivery::Coroutine);
+        }
+
+        /**
+         * @brief Awaitable for DeferredTask coroutines resulting in the
+         *        arguments of the next message published to this topic
+         * @details
+         * The coroutine subscribes synchronously when awaiting, copies the
+         * arguments and unsubscribes when it is resumed. On a retained topic
+         * the retained message is the result right away.
+         *
+         *   auto [id, text] = co_await topic.nextMessage();
+         *
+         * @return NextMessage
+         */
+        NextMessage nextMessage() const
+        {
+            return NextMessage(*itsPubSub, *itsChannel);
+        }
+
+        /**
+         * @brief Subscribe asynchronously, only receiving the latest message
+         * @details
+         * If a message is still pending for this subscription when the next
+         * one is published, the pending message is replaced. So at most one
+         * deferred call is queued for the subscription at any time.
+         *
+         * @param p_callback
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        SubscriptionId subscribeLatest(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Latest);
+        }
+
+        SubscriptionId subscribeLatestWithPrio(SubscribeCallback& p_callback, UBaseType_t p_priority,
+                                               uint32_t p_stackSize = 0) const
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            reserveStack(p_priority, affinity, p_stackSize);
+            return itsPubSub->subscribe(*itsChannel, p_callback, p_priority, affinity, Delivery::Latest);
+        }
+
+        /**
+         * @brief Subscribe asynchronously, called at most once per interval
+         * @details
+         * A message is delivered right away if the previous call started at
+         * least p_intervalMs ago. Otherwise a timer adds the deferred call
+         * once the interval has passed, and messages published meanwhile
+         * replace the pending one, so only the latest message is delivered.
+         *
+         * @param p_callback
+         * @param p_intervalMs minimum time between the starts of two calls
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        SubscriptionId subscribeThrottled(SubscribeCallback& p_callback, uint32_t p_intervalMs) const
+        {
+            return subscribeThrottledWithPrio(p_callback, p_intervalMs, uxTaskPriorityGet(NULL));
+        }
+
+        SubscriptionId subscribeThrottledWithPrio(SubscribeCallback& p_callback, uint32_t p_intervalMs,
+                                                  UBaseType_t p_priority, uint32_t p_stackSize = 0) const
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            reserveStack(p_priority, affinity, p_stackSize);
+            return itsPubSub->subscribe(*itsChannel, p_callback, p_priority, affinity, Delivery::Throttled,
+                                        makeWindow(p_intervalMs, BatchCallback(), 0));
+        }
+
+        /**
+         * @brief Subscribe asynchronously to batches of the messages of a
+         *        time window
+         * @details
+         * The first message of a window starts a timer, and after p_windowMs
+         * all messages collected until then are passed to the callback in a
+         * single deferred call, in the order of publishing. Messages exceeding
+         * p_maxMessages within a window are dropped.
+         *
+         * @param p_callback
+         * @param p_windowMs length of a window
+         * @param p_maxMessages maximum number of messages per batch
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        SubscriptionId subscribeBatched(BatchCallback& p_callback, uint32_t p_windowMs,
+                                        uint32_t p_maxMessages) const
+        {
+            return subscribeBatchedWithPrio(p_callback, p_windowMs, p_maxMessages, uxTaskPriorityGet(NULL));
+        }
+
+        SubscriptionId subscribeBatchedWithPrio(BatchCallback& p_callback, uint32_t p_windowMs,
+                                                uint32_t p_maxMessages, UBaseType_t p_priority,
+                                                uint32_t p_stackSize = 0) const
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            reserveStack(p_priority, affinity, p_stackSize);
+            return itsPubSub->subscribe(*itsChannel, SubscribeCallback(), p_priority, affinity, Delivery::Batched,
+                                        makeWindow(p_windowMs, p_callback, p_maxMessages));
+        }
+
+        /**
+         * @brief Unsubscribe from this topic
+         *
+         * @param p_id
+         */
+        void unsubscribe(SubscriptionId p_id) const
+        {
+            itsPubSub->unsubscribe(*itsChannel, p_id);
+        }
+
+        void unsubscribe(const std::string& p_callbackName) const
+        {
+            itsPubSub->unsubscribe(*itsChannel, p_callbackName);
+        }
+
+        /**
+         * @brief Remove all callbacks for this topic
+         */
+        void clear() const
+        {
+            itsPubSub->clear(*itsChannel);
+        }
+
+        /**
+         * @brief Keep the last message of this topic and deliver it to every
+         *        new subscriber
+         * @details
+         * Once its subscription is in effect, a new subscriber gets the last
+         * message published before, in the way it subscribed (synchronously
+         * in the subscribing task, or as a deferred call). The slot for the
+         * message is allocated here, retaining cannot be turned off again.
+         * Subscriptions to patterns do not get retained messages.
+         */
+        void retain() const
+        {
+            itsPubSub->retain(*itsChannel);
+        }
+
+        /**
+         * @brief Forget the retained message, e.g. when it became invalid
+         */
+        void clearRetained() const
+        {
+            RetainedValue* retained = itsChannel->itsRetained.load(std::memory_order_acquire);
+            if (retained != nullptr)
+            {
+                retained->clear();
+            }
+        }
+
+        /**
+         * @brief Create the pool of buffers handed out by loan()
+         * @details
+         * May be called only once per topic, the pool lives as long as the
+         * PublishSubscribe instance.
+         *
+         * @param p_blockSize size of each buffer
+         * @param p_numBlocks number of buffers
+         * @param p_caps heap capabilities, e.g. MALLOC_CAP_SPIRAM or MALLOC_CAP_DMA
+         */
+        void createLoanPool(std::size_t p_blockSize, std::size_t p_numBlocks,
+                            uint32_t p_caps = MALLOC_CAP_DEFAULT) const
+        {
+            itsPubSub->createLoanPool(*itsChannel, p_blockSize, p_numBlocks, p_caps);
+        }
+
+        /**
+         * @brief Loan a buffer from the pool of this topic
+         * @details
+         * The buffer is filled by the caller and then published as a
+         * LoanedBuffer argument, e.g. with PublishSubscribe<LoanedBuffer>:
+         *   auto buf = topic.loan(size);
+         *   fill(buf.data(), buf.size());
+         *   topic.publishAsync(std::move(buf));
+         * It returns to the pool when the last subscriber is done with it.
+         *
+         * @param p_size
+         * @return LoanedBuffer, empty if no buffer of this size is available
+         */
+        LoanedBuffer loan(std::size_t p_size) const
+        {
+            return itsPubSub->loan(*itsChannel, p_size);
+        }
+
+        /**
+         * @brief Returns the name of the channel this topic refers to
+         *
+         * @return std::string_view
+         */
+        std::string_view name() const
+        {
+            return itsChannel->itsName;
+        }
+
+        /**
+         * @brief Returns the counters of this topic
+         *
+         * @return TopicStats
+         */
+        TopicStats getStats() const
+        {
+            return itsPubSub->getStats(*itsChannel);
+        }
+
+        void resetStats() const
+        {
+            itsChannel->itsInfo.reset();
+        }
+
+        /**
+         * @brief Returns the histogram of the delays between publishing and
+         *        the start of deferred calls of a subscription
+         * @details
+         * Only recorded if CONFIG_PUBSUB_LATENCY_HISTOGRAM is enabled. The
+         * histogram is empty if the subscription does not exist.
+         *
+         * @param p_id
+         * @return LatencyHistogram::Snapshot
+         */
+        LatencyHistogram::Snapshot getLatency(SubscriptionId p_id) const
+        {
+            return itsPubSub->getLatency(*itsChannel, p_id);
+        }
+
+    private:
+        friend class PublishSubscribe;
+
+        PublishSubscribe* itsPubSub;
+        Channel* itsChannel;
+
+        Topic(PublishSubscribe& p_pubSub, Channel& p_channel) :
+            itsPubSub(&p_pubSub),
+            itsChannel(&p_channel)
+        {}
+    };
+
+    /**
+     * @brief Handle to a wildcard pattern for subscriptions
+     * @details
+     * Patterns follow the MQTT rules: a "+" level matches exactly one level
+     * of a topic name, a trailing "#" level matches any number of remaining
+     * levels, e.g. "sensor/+/accel" or "sensor/#". Subscribers of a pattern
+     * receive the messages of all matching channels, after the subscribers
+     * of the channel itself. The patterns matching a channel are determined
+     * when the channel or the pattern is created, so publishing does not
+     * compare any names. Static topics are not matched by patterns.
+     */
+    class Pattern
+    {
+    public:
+        SubscriptionId subscribeSync(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Sync);
+        }
+
+        SubscriptionId subscribeCritical(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Critical);
+        }
+
+        SubscriptionId subscribeAsync(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Async);
+        }
+
+        SubscriptionId subscribeAsyncWithPrio(SubscribeCallback& p_callback, UBaseType_t p_priority,
+                                              uint32_t p_stackSize = 0) const
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            reserveStack(p_priority, affinity, p_stackSize);
+            return itsPubSub->subscribe(*itsChannel, p_callback, p_priority, affinity, Delivery::Async);
+        }
+
+        SubscriptionId subscribeLatest(SubscribeCallback& p_callback) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Latest);
+        }
+
+        SubscriptionId subscribeThrottled(SubscribeCallback& p_callback, uint32_t p_intervalMs) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, p_callback, priority, affinity, Delivery::Throttled,
+                                        makeWindow(p_intervalMs, BatchCallback(), 0));
+        }
+
+        SubscriptionId subscribeBatched(BatchCallback& p_callback, uint32_t p_windowMs,
+                                        uint32_t p_maxMessages) const
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return itsPubSub->subscribe(*itsChannel, SubscribeCallback(), priority, affinity, Delivery::Batched,
+                                        makeWindow(p_windowMs, p_callback, p_maxMessages));
+        }
+
+        void unsubscribe(SubscriptionId p_id) const
+        {
+            itsPubSub->unsubscribe(*itsChannel, p_id);
+        }
+
+        /**
+         * @brief Remove all callbacks for this pattern
+         */
+        void clear() const
+        {
+            itsPubSub->clear(*itsChannel);
+        }
+
+        std::string_view name() const
+        {
+            return itsChannel->itsName;
+        }
+
+    private:
+        friend class PublishSubscribe;
+
+        PublishSubscribe* itsPubSub;
+        Channel* itsChannel;
+
+        Pattern(PublishSubscribe& p_pubSub, Channel& p_channel) :
+            itsPubSub(&p_pubSub),
+            itsChannel(&p_channel)
+        {}
+    };
+
+    /**
+     * @brief Topic declared at compile time
+     * @details
+     * A static topic does not use the subscription map at all. Its subscriber
+     * table is a statically allocated array of the given size, and
+     * synchronous handlers passed as template arguments are called directly
+     * (and may thus be inlined) on every publish. Static topics are
+     * independent of string channels with the same name.
+     *
+     * Usage:
+     *   using Temp = PublishSubscribe<int>::StaticTopic<"sensor/temp", 4, &onTemp>;
+     *   Temp::subscribeAsync(...);
+     *   Temp::publish(42);
+     *
+     * @tparam Name name of the topic
+     * @tparam MaxSubscribers maximum number of run-time subscriptions
+     * @tparam SyncHandlers functions subscribed synchronously at compile time
+     */
+    template <TopicName Name, std::size_t MaxSubscribers = 4, auto... SyncHandlers>
+    class StaticTopic
+    {
+    public:
+        static constexpr uint32_t itsId = Name.id();
+
+        StaticTopic() = delete;
+
+        /**
+         * @brief Publish a message to this topic
+         *
+         * @param p_args
+         */
+        static void publish(Types... p_args)
+        {
+            (SyncHandlers(p_args...), ...);
+            publishDynamic(p_args...);
+        }
+
+        static void publishAsync(Types... p_args)
+        {
+            publishAsyncDynamic(p_args..., -1);
+        }
+
+        static void publishAsyncWithPrio(Types... p_args, UBaseType_t p_priority)
+        {
+            publishAsyncDynamic(p_args..., p_priority);
+        }
+
+        /**
+         * @brief Publish a message whose deferred calls should start by a deadline
+         *
+         * @param p_args
+         * @param p_deadlineUs latest start time in esp_timer_get_time() microseconds
+         */
+        static void publishAsyncWithDeadline(Types... p_args, int64_t p_deadlineUs)
+        {
+            publishAsyncDynamic(p_args..., -1, p_deadlineUs);
+        }
+
+        /**
+         * @brief Publish a message to this topic from an interrupt service routine
+         * @details
+         * getInstance() must have been called from a task before.
+         *
+         * @param p_args
+         * @return false if the message was dropped because all slots are in use
+         */
+        static bool publishFromISR(Types... p_args)
+        {
+            return deferFromISR([p_args...]()
+                                { publish(p_args...); });
+        }
+
+        /**
+         * @brief Subscribe to this topic at run time
+         *
+         * @param p_callback
+         * @return subscription ID, should be stored if you wanna unsubscribe
+         */
+        static SubscriptionId subscribeSync(SubscribeCallback& p_callback)
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return subscribe(p_callback, priority, affinity, Delivery::Sync);
+        }
+
+        static SubscriptionId subscribeAsync(SubscribeCallback& p_callback)
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return subscribe(p_callback, priority, affinity, Delivery::Async);
+        }
+
+        static SubscriptionId subscribeAsyncWithPrio(SubscribeCallback& p_callback, UBaseType_t p_priority)
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return subscribe(p_callback, p_priority, affinity, Delivery::Async);
+        }
+
+        static SubscriptionId subscribeLatest(SubscribeCallback& p_callback)
+        {
+            UBaseType_t priority = uxTaskPriorityGet(NULL);
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return subscribe(p_callback, priority, affinity, Delivery::Latest);
+        }
+
+        static SubscriptionId subscribeLatestWithPrio(SubscribeCallback& p_callback, UBaseType_t p_priority)
+        {
+            BaseType_t affinity = xTaskGetAffinity(NULL);
+            return subscribe(p_callback, p_priority, affinity, Delivery::Latest);
+        }
+
+        /**
+         * @brief Unsubscribe a run-time subscription from this topic
+         * @details
+         * The slot of the subscription becomes available again once no
+         * publisher can access it anymore.
+         *
+         * @param p_id
+         */
+        static void unsubscribe(SubscriptionId p_id)
+        {
+            PublishSubscribe& pubSub = getInstance();
+            std::lock_guard<std::mutex> lock(pubSub.itsWriterMutex);
+            for (auto& slot : itsSlots)
+            {
+                if ((slot.itsState.load() == SlotState::Active) &&
+                    (slot.itsSubscriber->itsId == p_id))
+                {
+                    slot.itsState.store(SlotState::Retired);
+                    pubSub.itsRcu.retire(&slot, &releaseSlot);
+                }
+            }
+        }
+
+        static constexpr std::string_view name()
+        {
+            return Name.view();
+        }
+
+        /**
+         * @brief Keep the last message of this topic and deliver it to every
+         *        new run-time subscriber, see Topic::retain()
+         * @details
+         * Handlers bound at compile time are there from the start, so they
+         * do not get retained messages.
+         */
+        static void retain()
+        {
+            PublishSubscribe& pubSub = getInstance();
+            std::lock_guard<std::mutex> lock(pubSub.itsWriterMutex);
+            if (itsRetained.load() == nullptr)
+            {
+                itsRetained.store(poolNew<RetainedValue>(), std::memory_order_release);
+            }
+        }
+
+        static void clearRetained()
+        {
+            RetainedValue* retained = itsRetained.load(std::memory_order_acquire);
+            if (retained != nullptr)
+            {
+                retained->clear();
+            }
+        }
+
+        /**
+         * @brief Returns the counters of this topic
+         *
+         * @return TopicStats
+         */
+        static TopicStats getStats()
+        {
+            uint32_t subscribers = std::count_if(itsSlots.begin(), itsSlots.end(), [](const Slot& p_slot)
+                                                 { return p_slot.itsState.load() == SlotState::Active; });
+            return itsInfo.read(subscribers);
+        }
+
+        static void resetStats()
+        {
+            itsInfo.reset();
+        }
+
+        static LatencyHistogram::Snapshot getLatency(SubscriptionId p_id)
+        {
+            ReadSection section(getInstance());
+            for (const auto& slot : itsSlots)
+            {
+                if ((slot.itsState.load() == SlotState::Active) && (slot.itsSubscriber->itsId == p_id))
+                {
+                    return slot.itsSubscriber->getLatency();
+                }
+            }
+            return LatencyHistogram().read();
+        }
+
+    private:
+        enum class SlotState : uint8_t
+        {
+            Free,
+            Active,
+            Retired
+        };
+
+        struct Slot
+        {
+            std::optional<Subscriber> itsSubscriber;
+            std::atomic<SlotState> itsState{SlotState::Free};
+        };
+
+        inline static std::array<Slot, MaxSubscribers> itsSlots;
+        inline static TopicInfo itsInfo{Name.itsName, itsId};
+        inline static std::atomic<RetainedValue*> itsRetained{nullptr};   ///< never released, like the slots
+
+        static void retainMessage(Types&... p_args)
+        {
+            RetainedValue* retained = itsRetained.load(std::memory_order_acquire);
+            if (unlikely(retained != nullptr))
+            {
+                retained->store(p_args...);
+            }
+        }
+
+        static void publishDynamic(Types&... p_args)
+        {
+            retainMessage(p_args...);
+            ReadSection section(getInstance());
+            Message message(itsInfo, false, p_args...);
+            message.trace(TraceEvent::Publish);
+            for (const auto& slot : itsSlots)
+            {
+                if (slot.itsState.load() == SlotState::Active)
+                {
+                    dispatch(*slot.itsSubscriber, message);
+                }
+            }
+        }
+
+        static void publishAsyncDynamic(Types&... p_args, int p_prio,
+                                        int64_t p_deadlineUs = DeferredCallsQueue::itsNoDeadline)
+        {
+            retainMessage(p_args...);
+            // only deferred calls use the arguments, so they may be moved into the payload
+            Message message(itsInfo, true, p_args...);
+            message.setDeadline(p_deadlineUs);
+            message.trace(TraceEvent::PublishAsync);
+
+            // handlers bound at compile time run with the publisher's priority
+            UBaseType_t priority = (p_prio < 0) ? uxTaskPriorityGet(NULL) : p_prio;
+            (dispatchHandlerAsync(SyncHandlers, message, priority), ...);
+
+            ReadSection section(getInstance());
+            for (const auto& slot : itsSlots)
+            {
+                if (slot.itsState.load() == SlotState::Active)
+                {
+                    dispatchAsync(*slot.itsSubscriber, message, p_prio);
+                }
+            }
+        }
+
+        template <typename Handler>
+        static void dispatchHandlerAsync(Handler p_handler, Message& p_message, UBaseType_t p_prio)
+        {
+            p_message.trace(TraceEvent::DispatchAsync);
+            DeferredCallsQueue::get().addDeferredCall([p_handler, payload = p_message.payload()]()
+                                                      { std::apply(p_handler, *payload); },
+                                                      p_prio, DeferredCallsQueue::itsCurrentAffinity,
+                                                      p_message.deadline());
+        }
+
+        static SubscriptionId subscribe(SubscribeCallback& p_callback,
+                                        UBaseType_t p_priority,
+                                        BaseType_t p_affinity,
+                                        Delivery p_delivery)
+        {
+            PublishSubscribe& pubSub = getInstance();
+            SubscriptionId id = pubSub.newSubscriptionId();
+            if (unlikely(itsReadDepth > 0))
+            {
+                const bool accepted = deferSubscriber(PendingOp::Code::SubscribeStatic, nullptr, &addSubscriber,
+                                                      Subscriber(id, std::string_view(), p_callback, p_priority,
+                                                                 p_affinity, p_delivery));
+                return accepted ? id : 0;
+            }
+            else
+            {
+                addSubscriber(Subscriber(id, std::string_view(), p_callback, p_priority, p_affinity, p_delivery));
+            }
+            return id;
+        }
+
+        static void addSubscriber(Subscriber&& p_subscriber)
+        {
+            PublishSubscribe& pubSub = getInstance();
+            RetainedValue* retained = itsRetained.load(std::memory_order_acquire);
+            std::optional<Subscriber> newcomer;
+            if (unlikely(retained != nullptr))
+            {
+                newcomer.emplace(p_subscriber);
+            }
+            while (true)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(pubSub.itsWriterMutex);
+                    auto it = std::find_if(itsSlots.begin(), itsSlots.end(), [](const Slot& p_slot)
+                                           { return p_slot.itsState.load() == SlotState::Free; });
+                    if (it != itsSlots.end())
+                    {
+                        it->itsSubscriber.emplace(std::move(p_subscriber));
+                        it->itsState.store(SlotState::Active);
+                        break;
+                    }
+
+                    bool anyRetired = std::any_of(itsSlots.begin(), itsSlots.end(), [](const Slot& p_slot)
+                                                  { return p_slot.itsState.load() == SlotState::Retired; });
+                    // a publisher cannot wait for itself to leave the slots
+                    if (unlikely(!anyRetired || (itsReadDepth > 0)))
+                    {
+                        ESP_LOGE(TAG, "too many subscribers for static topic '%s'", Name.itsName);
+                        ESP_ERROR_CHECK(ESP_FAIL);
+                        return;
+                    }
+                }
+                // wait for publishers to leave the slots of removed subscriptions
+                pubSub.itsRcu.synchronize();
+            }
+            if (unlikely(newcomer.has_value()))
+            {
+                pubSub.deliverRetained(itsInfo, *retained, *newcomer);
+            }
+        }
+
+        static void releaseSlot(void* p_slot)
+        {
+            Slot* slot = static_cast<Slot*>(p_slot);
+            slot->itsSubscriber.reset();
+            slot->itsState.store(SlotState::Free);
+        }
+    };
+
+    /**
+     * @brief Returns a PubSub instance, use this to instantiate the PubSub object
+     *
+     * @return PublishSubscribe&
+     */
+    static PublishSubscribe &getInstance()
+    {
+        static PublishSubscribe<Types...> instance;
+        return instance;
+    }
+
+    /**
+     * @brief Alias for getInstance().
+     *
+     * @return PublishSubscribe&
+     */
+    static constexpr auto get = &getInstance;
+
+    /**
+     * @brief Resolve a channel once and return a handle to it
+     * @details
+     * The channel is created if it does not exist yet. The name is not
+     * copied if the channel is already known.
+     *
+     * @param p_channel
+     * @return Topic
+     */
+    Topic topic(std::string_view p_channel)
+    {
+        return Topic(*this, getChannel(p_channel));
+    }
+
+    /**
+     * @brief Returns a handle to subscribe to all channels matching a pattern
+     * @details
+     * The pattern is created if it does not exist yet. Creating a pattern
+     * checks it against all existing channels, so it should be done once.
+     *
+     * @param p_pattern e.g. "sensor/imu/+" or "sensor/#"
+     * @return Pattern
+     */
+    Pattern pattern(std::string_view p_pattern)
+    {
+        return Pattern(*this, getPattern(p_pattern));
+    }
+
+    /**
+     * @brief Publish a message to a specific channel
+     *
+     * @param p_channel
+     * @param p_args
+     */
+    void publish(const std::string& p_channel, Types... p_args)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (likely(channel != nullptr))
+        {
+            publish(*channel, p_args...);
+        }
+        else
+        {
+            publishToPatterns(p_channel, false, p_args...);
+        }
+    }
+
+    void publishAsync(const std::string& p_channel, Types... p_args)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (likely(channel != nullptr))
+        {
+            publishAsync(*channel, p_args...);
+        }
+        else
+        {
+            publishToPatterns(p_channel, true, p_args...);
+        }
+    }
+
+    void publishAsyncWithPrio(const std::string& p_channel, Types... p_args, UBaseType_t p_priority)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (likely(channel != nullptr))
+        {
+            publishAsync(*channel, p_args..., p_priority);
+        }
+        else
+        {
+            publishToPatterns(p_channel, true, p_args..., p_priority);
+        }
+    }
+
+    void publishAsyncWithDeadline(const std::string& p_channel, Types... p_args, int64_t p_deadlineUs)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (likely(channel != nullptr))
+        {
+            publishAsync(*channel, p_args..., -1, p_deadlineUs);
+        }
+        else
+        {
+            publishToPatterns(p_channel, true, p_args..., -1, p_deadlineUs);
+        }
+    }
+
+    /**
+     * @brief Subscribe to a specific channel
+     *
+     * @param p_channel
+     * @param p_callback
+     * @return subscription ID, should be stored if you wanna unsubscribe
+     */
+    inline SubscriptionId subscribeSync(const std::string& p_channel, SubscribeCallback& p_callback)
+    {
+        return topic(p_channel).subscribeSync(p_callback);
+    }
+
+    inline SubscriptionId subscribeCritical(const std::string& p_channel, SubscribeCallback& p_callback)
+    {
+        return topic(p_channel).subscribeCritical(p_callback);
+    }
+
+    inline SubscriptionId subscribeAsync(const std::string& p_channel, SubscribeCallback& p_callback)
+    {
+        return topic(p_channel).subscribeAsync(p_callback);
+    }
+
+    template <typename Handler>
+        requires DeferredTaskHandler<Handler, Types...>
+    SubscriptionId subscribeAsync(const std::string& p_channel, Handler p_handler)
+    {
+        return topic(p_channel).subscribeAsync(std::move(p_handler));
+    }
+
+    inline SubscriptionId subscribeAsyncWithPrio(const std::string& p_channel, SubscribeCallback& p_callback,
+                                                 UBaseType_t p_priority, uint32_t p_stackSize = 0)
+    {
+        return topic(p_channel).subscribeAsyncWithPrio(p_callback, p_priority, p_stackSize);
+    }
+
+    /**
+     * @brief Subscribe asynchronously to a specific channel, only receiving
+     *        the latest message
+     *
+     * @param p_channel
+     * @param p_callback
+     * @return subscription ID, should be stored if you wanna unsubscribe
+     */
+    inline SubscriptionId subscribeLatest(const std::string& p_channel, SubscribeCallback& p_callback)
+    {
+        return topic(p_channel).subscribeLatest(p_callback);
+    }
+
+    inline SubscriptionId subscribeLatestWithPrio(const std::string& p_channel, SubscribeCallback& p_callback,
+                                                  UBaseType_t p_priority, uint32_t p_stackSize = 0)
+    {
+        return topic(p_channel).subscribeLatestWithPrio(p_callback, p_priority, p_stackSize);
+    }
+
+    /**
+     * @brief Subscribe to a topic
+     *
+     * @param p_channel
+     * @param p_callbackName
+     * @param p_callback
+     */
+    inline void subscribeSync(const std::string& p_channel, const std::string& p_callbackName,
+                              SubscribeCallback& p_callback)
+    {
+        UBaseType_t priority = uxTaskPriorityGet(NULL);
+        BaseType_t affinity = xTaskGetAffinity(NULL);
+        subscribe(getChannel(p_channel), newSubscriptionId(), p_callbackName, p_callback,
+                  priority, affinity, Delivery::Sync);
+    }
+
+    inline void subscribeAsync(const std::string& p_channel, const std::string& p_callbackName,
+                               SubscribeCallback& p_callback)
+    {
+        UBaseType_t priority = uxTaskPriorityGet(NULL);
+        BaseType_t affinity = xTaskGetAffinity(NULL);
+        subscribe(getChannel(p_channel), newSubscriptionId(), p_callbackName, p_callback,
+                  priority, affinity, Delivery::Async);
+    }
+
+    /**
+     * @brief Unsubscribe from a topic
+     * @details
+     * A message which is currently being published may still be delivered
+     * to the subscription, but no further ones.
+     *
+     * @param p_channel
+     * @param p_id
+     */
+    void unsubscribe(const std::string& p_channel, SubscriptionId p_id)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (channel != nullptr)
+        {
+            unsubscribe(*channel, p_id);
+        }
+    }
+
+    /**
+     * @brief Unsubscribe a named subscription from a topic
+     *
+     * @param p_channel
+     * @param p_callbackName
+     */
+    void unsubscribe(const std::string& p_channel, const std::string& p_callbackName)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (channel != nullptr)
+        {
+            unsubscribe(*channel, p_callbackName);
+        }
+    }
+
+    /**
+     * @brief Remove all callbacks for a topic
+     *
+     * @param channel
+     */
+    void clear(const std::string& p_channel)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (channel != nullptr)
+        {
+            clear(*channel);
+        }
+    }
+
+    /**
+     * @brief Remove all callbacks.
+     * @details
+     * The channels themselves are kept so that existing topic handles stay valid.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(itsChannelsMutex);
+        const ChannelMap* channels = itsChannels.load();
+        if (channels != nullptr)
+        {
+            for (auto& entry : *channels)
+            {
+                clear(*entry.second);
+            }
+        }
+        for (Channel* pattern : itsPatterns)
+        {
+            clear(*pattern);
+        }
+    }
+
+    /**
+     * @brief Returns the counters of all channels
+     *
+     * @return std::vector<TopicStats>
+     */
+    std::vector<TopicStats> getStats()
+    {
+        std::vector<TopicStats> stats;
+        Rcu::ReadGuard guard(itsRcu);
+        const ChannelMap* channels = itsChannels.load();
+        if (channels != nullptr)
+        {
+            stats.reserve(channels->size());
+            for (auto& entry : *channels)
+            {
+                stats.push_back(getStats(*entry.second));
+            }
+        }
+        return stats;
+    }
+
+    /**
+     * @brief Returns the counters of a specific channel
+     * @details
+     * All counters are zero if the channel does not exist.
+     *
+     * @param p_channel
+     * @return TopicStats
+     */
+    TopicStats getStats(std::string_view p_channel)
+    {
+        Rcu::ReadGuard guard(itsRcu);
+        Channel* channel = findChannel(p_channel);
+        return (channel != nullptr) ? getStats(*channel) : TopicStats{};
+    }
+
+    /**
+     * @brief Returns the histogram of the delays between publishing and
+     *        the start of deferred calls of a subscription
+     * @details
+     * Only recorded if CONFIG_PUBSUB_LATENCY_HISTOGRAM is enabled.
+     *
+     * @param p_channel
+     * @param p_id
+     * @return LatencyHistogram::Snapshot, empty if the subscription does not exist
+     */
+    LatencyHistogram::Snapshot getLatency(std::string_view p_channel, SubscriptionId p_id)
+    {
+        Rcu::ReadGuard guard(itsRcu);
+        Channel* channel = findChannel(p_channel);
+        return (channel != nullptr) ? getLatency(*channel, p_id) : LatencyHistogram().read();
+    }
+
+    /**
+     * @brief Reset the counters of all channels
+     */
+    void resetStats()
+    {
+        Rcu::ReadGuard guard(itsRcu);
+        const ChannelMap* channels = itsChannels.load();
+        if (channels != nullptr)
+        {
+            for (auto& entry : *channels)
+            {
+                entry.second->itsInfo.reset();
+            }
+        }
+    }
+
+private:
+    /**
+     * @brief Operation deferred until the outermost publish of a task has finished
+     */
+    struct PendingOp
+    {
+        enum class Code : uint8_t
+        {
+            Subscribe,          ///< add itsSubscriber to itsChannel
+            SubscribeStatic     ///< add itsSubscriber with itsAddStatic
+        };
+
+        Code itsCode;
+        Channel* itsChannel;
+        void (*itsAddStatic)(Subscriber&&);
+        Subscriber itsSubscriber;
+    };
+
+    /// operations deferred by the current task, see PendingOps
+    using Pending = PendingOps<PublishSubscribe, PendingOp>;
+
+    /**
+     * @brief Reader section of a publisher
+     * @details
+     * Calls deferred while the current task was publishing are run when
+     * its outermost reader section ends.
+     */
+    class ReadSection
+    {
+    public:
+        explicit ReadSection(PublishSubscribe& p_pubSub) :
+            itsPubSub(p_pubSub),
+            itsToken(p_pubSub.itsRcu.readLock())
+        {
+            itsReadDepth++;
+        }
+
+        ~ReadSection()
+        {
+            itsPubSub.itsRcu.readUnlock(itsToken);
+            if (--itsReadDepth == 0)
+            {
+                itsPubSub.runQueuedCalls();
+            }
+        }
+
+        ReadSection(const ReadSection&) = delete;
+        ReadSection& operator=(const ReadSection&) = delete;
+
+    private:
+        PublishSubscribe& itsPubSub;
+        uint32_t itsToken;
+    };
+
+    inline static const char TAG[] = "PubSub";
+
+    /// nesting depth of reader sections of the current task
+    inline static thread_local uint32_t itsReadDepth = 0;
+
+    /// payload delivered to the Delivery::Coroutine subscriber called by the current task
+    inline static thread_local const PayloadPtr* itsDelivering = nullptr;
+
+    Rcu itsRcu;
+    std::mutex itsWriterMutex;
+    std::mutex itsChannelsMutex;
+    std::atomic<const ChannelMap*> itsChannels;
+    std::vector<Channel*, PoolAllocator<Channel*>> itsPatterns;   ///< in order of creation, guarded by itsChannelsMutex
+    std::atomic<const PatternList*> itsPatternList;   ///< RCU copy of itsPatterns, nullptr without patterns
+    std::atomic<SubscriptionId> itsNextSubscriptionId;
+
+    /**
+     * @brief Private constructor enforcing singleton pattern
+     */
+    PublishSubscribe() :
+        itsChannels(nullptr),
+        itsPatternList(nullptr),
+        itsNextSubscriptionId(1)
+    {
+        // make sure the pool outlives the subscription maps
+        SubscriptionPool::get();
+        // the calls queue cannot be created from an ISR
+        DeferredCallsQueue::get();
+    }
+
+    ~PublishSubscribe()
+    {
+        // operations of other tasks cannot be pending, they would still be publishing
+        Pending::discard();
+        const ChannelMap* channels = itsChannels.load();
+        if (channels != nullptr)
+        {
+            for (auto& entry : *channels)
+            {
+                poolDelete(entry.second->itsTable.load());
+                poolDelete(entry.second->itsLoanPool.load());
+                poolDelete(entry.second->itsPatterns.load());
+                poolDelete(entry.second->itsRetained.load());
+                poolDelete(entry.second);
+            }
+            poolDelete(channels);
+        }
+        for (Channel* pattern : itsPatterns)
+        {
+            poolDelete(pattern->itsTable.load());
+            poolDelete(pattern);
+        }
+        poolDelete(itsPatternList.load());
+    }
+
+    template <typename T, typename... Args>
+    static T* poolNew(Args&&... p_args)
+    {
+        T* object = PoolAllocator<T>().allocate(1);
+        return new (object) T(std::forward<Args>(p_args)...);
+    }
+
+    template <typename T>
+    static void poolDelete(const T* p_object)
+    {
+        if (p_object != nullptr)
+        {
+            T* object = const_cast<T*>(p_object);
+            object->~T();
+            PoolAllocator<T>().deallocate(object, 1);
+        }
+    }
+
+    template <typename T>
+    static void poolDeleter(void* p_object)
+    {
+        poolDelete(static_cast<T*>(p_object));
+    }
+
+    SubscriptionId newSubscriptionId()
+    {
+        return itsNextSubscriptionId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Hand a call over to the ISR task of DeferredCallsQueue
+     * @details
+     * Safe to be called from an ISR, as long as the arguments can be copied
+     * without side effects. Yields at the end of the ISR if the ISR task has
+     * been woken up.
+     *
+     * @param p_function
+     * @return false if the call was dropped
+     */
+    template <typename Function>
+    static bool deferFromISR(Function&& p_function)
+    {
+        static_assert((std::is_trivially_copyable_v<Types> && ...),
+                      "only trivially copyable arguments may be published from an ISR");
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        BaseType_t result = DeferredCallsQueue::get().addDeferredCallFromISR(std::forward<Function>(p_function),
+                                                                            &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+        return result == pdTRUE;
+    }
+
+    /**
+     * @brief Add a subscriber once the outermost publish of the current
+     *        task has finished
+     *
+     * @param p_code
+     * @param p_channel channel for PendingOp::Code::Subscribe
+     * @param p_addStatic function for PendingOp::Code::SubscribeStatic
+     * @param p_subscriber
+     * @return false if the task has too many operations pending, the
+     *         subscription is rejected then
+     */
+    static bool deferSubscriber(typename PendingOp::Code p_code, Channel* p_channel,
+                                void (*p_addStatic)(Subscriber&&), Subscriber&& p_subscriber)
+    {
+        return Pending::defer({p_code, p_channel, p_addStatic, std::move(p_subscriber)});
+    }
+
+    void runOp(PendingOp&& p_op)
+    {
+        switch (p_op.itsCode)
+        {
+            case PendingOp::Code::Subscribe:
+                addSubscriber(*p_op.itsChannel, std::move(p_op.itsSubscriber));
+                break;
+            case PendingOp::Code::SubscribeStatic:
+                p_op.itsAddStatic(std::move(p_op.itsSubscriber));
+                break;
+        }
+    }
+
+    /**
+     * @brief Look up an existing channel
+     * @details
+     * Channels are only ever added, so the returned pointer stays valid
+     * after the reader section has ended.
+     *
+     * @param p_channel
+     * @return pointer to the channel, or nullptr if it does not exist
+     */
+    Channel* findChannel(std::string_view p_channel)
+    {
+        Rcu::ReadGuard guard(itsRcu);
+        const ChannelMap* channels = itsChannels.load();
+        if (channels == nullptr)
+        {
+            return nullptr;
+        }
+        auto it = channels->find(p_channel);
+        return (it != channels->end()) ? it->second : nullptr;
+    }
+
+    /**
+     * @brief Look up a channel, create it if it does not exist yet
+     *
+     * @param p_channel
+     * @return Channel&
+     */
+    Channel& getChannel(std::string_view p_channel)
+    {
+        Channel* channel = findChannel(p_channel);
+        if (likely(channel != nullptr))
+        {
+            return *channel;
+        }
+
+        std::lock_guard<std::mutex> lock(itsChannelsMutex);
+        const ChannelMap* channels = itsChannels.load();
+        if (channels != nullptr)
+        {
+            // the channel may have been created in the meantime
+            auto it = channels->find(p_channel);
+            if (it != channels->end())
+            {
+                return *it->second;
+            }
+        }
+
+        channel = poolNew<Channel>(p_channel);
+        for (const Channel* pattern : itsPatterns)
+        {
+            if (topicMatches(pattern->itsName, channel->itsName))
+            {
+                addPattern(*channel, *pattern);
+            }
+        }
+        ChannelMap* newChannels = (channels != nullptr) ? poolNew<ChannelMap>(*channels) : poolNew<ChannelMap>();
+        newChannels->emplace(channel->itsName, channel);
+        itsChannels.store(newChannels);
+        if (channels != nullptr)
+        {
+            itsRcu.retire(const_cast<ChannelMap*>(channels), &poolDeleter<ChannelMap>);
+        }
+        return *channel;
+    }
+
+    /**
+     * @brief Look up a pattern, create it if it does not exist yet
+     * @details
+     * A new pattern is added to the pattern lists of all channels it matches.
+     *
+     * @param p_pattern
+     * @return Channel& holding the subscribers of the pattern
+     */
+    Channel& getPattern(std::string_view p_pattern)
+    {
+        if (unlikely(!isTopicPattern(p_pattern)))
+        {
+            ESP_LOGE(TAG, "invalid topic pattern '%.*s'", (int) p_pattern.size(), p_pattern.data());
+            ESP_ERROR_CHECK(ESP_FAIL);
+        }
+
+        std::lock_guard<std::mutex> lock(itsChannelsMutex);
+        for (Channel* pattern : itsPatterns)
+        {
+            if (std::string_view(pattern->itsName) == p_pattern)
+            {
+                return *pattern;
+            }
+        }
+
+        Channel* pattern = poolNew<Channel>(p_pattern);
+        itsPatterns.push_back(pattern);
+        const ChannelMap* channels = itsChannels.load();
+        if (channels != nullptr)
+        {
+            for (auto& entry : *channels)
+            {
+                if (topicMatches(pattern->itsName, entry.first))
+                {
+                    addPattern(*entry.second, *pattern);
+                }
+            }
+        }
+        const PatternList* patterns = itsPatternList.load();
+        itsPatternList.store(poolNew<PatternList>(itsPatterns.begin(), itsPatterns.end()));
+        if (patterns != nullptr)
+        {
+            itsRcu.retire(const_cast<PatternList*>(patterns), &poolDeleter<PatternList>);
+        }
+        return *pattern;
+    }
+
+    /**
+     * @brief Replace the pattern list of a channel by a copy with an
+     *        additional pattern, called with itsChannelsMutex locked
      *
-     * @return PublishSubscribe&
+     * @param p_channel
+     * @param p_pattern
      */
-    static PublishSubscribe &getInstance()
+    void addPattern(Channel& p_channel, const Channel& p_pattern)
     {
-        static PublishSubscribe<Types...> instance;
-        return instance;
+        const PatternList* patterns = p_channel.itsPatterns.load();
+        PatternList* newPatterns = (patterns != nullptr) ? poolNew<PatternList>(*patterns) : poolNew<PatternList>();
+        newPatterns->push_back(&p_pattern);
+        p_channel.itsPatterns.store(newPatterns);
+        if (patterns != nullptr)
+        {
+            itsRcu.retire(const_cast<PatternList*>(patterns), &poolDeleter<PatternList>);
+        }
+    }
+
+    void publish(Channel& p_channel, Types&... p_args)
+    {
+        retainMessage(p_channel, p_args...);
+        ReadSection section(*this);
+        Message message(p_channel.itsInfo, false, p_args...);
+        publishUnguarded(p_channel, message);
+    }
+
+    void publishAsync(Channel& p_channel, Types&... p_args, int p_prio = -1,
+                      int64_t p_deadlineUs = DeferredCallsQueue::itsNoDeadline)
+    {
+        retainMessage(p_channel, p_args...);
+        ReadSection section(*this);
+        // only deferred calls use the arguments, so they may be moved into the payload
+        Message message(p_channel.itsInfo, true, p_args...);
+        message.setDeadline(p_deadlineUs);
+        publishAsyncUnguarded(p_channel, message, p_prio);
     }
 
     /**
-     * @brief Alias for getInstance().
+     * @brief Publish a message to a name without a channel
+     * @details
+     * Only patterns can match such a name. They are compared with the name
+     * on every publish instead of creating a channel for it, so publishing
+     * to arbitrary names does not grow the channel map. The message is not
+     * counted in the statistics of any channel.
      *
-     * @return PublishSubscribe&
+     * @param p_name
+     * @param p_async
+     * @param p_args
+     * @param p_prio
+     * @param p_deadlineUs
      */
-    static constexpr auto get = &getInstance;
+    void publishToPatterns(const std::string& p_name, bool p_async, Types&... p_args, int p_prio = -1,
+                           int64_t p_deadlineUs = DeferredCallsQueue::itsNoDeadline)
+    {
+        if (likely(itsPatternList.load(std::memory_order_relaxed) == nullptr))
+        {
+            return;
+        }
+        ReadSection section(*this);
+        const UnnamedChannel target = {p_name, *itsPatternList.load()};
+        TopicInfo topic(p_name.c_str(), topicId(p_name));
+        Message message(topic, p_async, p_args...);
+        if (p_async)
+        {
+            message.setDeadline(p_deadlineUs);
+            publishAsyncUnguarded(target, message, p_prio);
+        }
+        else
+        {
+            publishUnguarded(target, message);
+        }
+    }
 
     /**
-     * @brief Publish a message to a specific channel
+     * @brief Keep a copy of the message if the channel is retained
+     * @details
+     * The copy is stored before the message is dispatched, so a subscriber
+     * added concurrently gets this message either from the table or as the
+     * retained message (possibly both), never stale.
      *
      * @param p_channel
      * @param p_args
      */
-    void publish(const std::string& p_channel, Types... p_args)
+    static void retainMessage(Channel& p_channel, Types&... p_args)
     {
-        if (itsPubSubMutex.try_lock_shared())
+        RetainedValue* retained = p_channel.itsRetained.load(std::memory_order_acquire);
+        if (unlikely(retained != nullptr))
         {
-            publishUnguarded(p_channel, p_args...);
-            itsPubSubMutex.unlock_shared();
-            runQueuedCalls();
+            retained->store(p_args...);
         }
-        else
+    }
+
+    /**
+     * @brief Deliver the retained message to a subscriber just added
+     *
+     * @param p_topic
+     * @param p_retained
+     * @param p_subscriber copy of the subscriber added to the table
+     */
+    void deliverRetained(TopicInfo& p_topic, RetainedValue& p_retained, const Subscriber& p_subscriber)
+    {
+        std::optional<Payload> value = p_retained.load();
+        if (!value)
         {
-            std::lock_guard<std::mutex> lock(itsDefCallsMutex);
-            itsRecursiveCallsQueue.emplace([this, p_channel, p_args...]()
-                                           { publish(p_channel, p_args...); });
+            return;
         }
+        ReadSection section(*this);
+        Message message(p_topic, *value);
+        message.trace(TraceEvent::Retained, p_subscriber.itsId);
+        dispatch(p_subscriber, message);
     }
 
-    void publishAsync(const std::string& p_channel, Types... p_args)
+    /**
+     * @brief Publish a message to a specific channel, must be called
+     *        within a reader section
+     *
+     * @param p_channel
+     * @param p_message
+     */
+    template <typename Target>
+    void publishUnguarded(const Target& p_channel, Message& p_message)
     {
-        if (itsPubSubMutex.try_lock_shared())
+        p_message.trace(TraceEvent::Publish);
+        // adding a deferred call may preempt the publisher, so critical subscribers come first
+        forEachTable(p_channel, [&p_message](const SubscriberTable& p_table)
         {
-            publishAsyncUnguarded(p_channel, p_args...);
-            itsPubSubMutex.unlock_shared();
-            runQueuedCalls();
-        }
-        else
+            for (uint32_t i = 0; i < p_table.itsNumCritical; i++)
+            {
+                deliverSync(p_table.itsSubscribers[p_table.itsSyncOrder[i]], p_message);
+            }
+        });
+        forEachTable(p_channel, [&p_message](const SubscriberTable& p_table)
         {
-            std::lock_guard<std::mutex> lock(itsDefCallsMutex);
-            itsRecursiveCallsQueue.emplace([this, p_channel, p_args...]()
-                                           { publishAsyncUnguarded(p_channel, p_args...); });
-        }
+            if (p_table.itsHasAsync)
+            {
+                for (const auto& subscriber : p_table.itsSubscribers)
+                {
+                    if (!subscriber.isSync())
+                    {
+                        dispatchAsync(subscriber, p_message, -1);
+                    }
+                }
+            }
+        });
+        forEachTable(p_channel, [&p_message](const SubscriberTable& p_table)
+        {
+            for (uint32_t i = p_table.itsNumCritical; i < p_table.itsSyncOrder.size(); i++)
+            {
+                deliverSync(p_table.itsSubscribers[p_table.itsSyncOrder[i]], p_message);
+            }
+        });
     }
 
-    void publishAsyncWithPrio(const std::string& p_channel, Types... p_args, UBaseType_t p_priority)
+    template <typename Target>
+    void publishAsyncUnguarded(const Target& p_channel, Message& p_message, int p_prio = -1)
+    {
+        p_message.trace(TraceEvent::PublishAsync);
+        forEachTable(p_channel, [&p_message, p_prio](const SubscriberTable& p_table)
+        {
+            for (const auto& subscriber : p_table.itsSubscribers)
+            {
+                dispatchAsync(subscriber, p_message, p_prio);
+            }
+        });
+    }
+
+    /**
+     * @brief Call a function for the subscriber table of a channel, followed
+     *        by the tables of the patterns matching it, must be called
+     *        within a reader section
+     *
+     * @param p_channel
+     * @param p_function
+     */
+    template <typename Function>
+    static void forEachTable(const Channel& p_channel, Function&& p_function)
     {
-        if (itsPubSubMutex.try_lock_shared())
+        const SubscriberTable* table = p_channel.itsTable.load();
+        if (table != nullptr)
         {
-            publishAsyncUnguarded(p_channel, p_args..., p_priority);
-            itsPubSubMutex.unlock_shared();
-            runQueuedCalls();
+            p_function(*table);
         }
-        else
+        const PatternList* patterns = p_channel.itsPatterns.load();
+        if (unlikely(patterns != nullptr))
         {
-            std::lock_guard<std::mutex> lock(itsDefCallsMutex);
-            itsRecursiveCallsQueue.emplace([this, p_channel, p_priority, p_args...]()
-                                           { publishAsyncUnguarded(p_channel, p_args..., p_priority); });
+            for (const Channel* pattern : *patterns)
+            {
+                table = pattern->itsTable.load();
+                if (table != nullptr)
+                {
+                    p_function(*table);
+                }
+            }
         }
     }
 
     /**
-     * @brief Subscribe to a specific channel
+     * @brief Call a function for the subscriber tables of the patterns
+     *        matching a name without a channel, must be called within a
+     *        reader section
      *
      * @param p_channel
-     * @param p_callback
-     * @return callback name, should be stored if you wanna unsubscribe
+     * @param p_function
      */
-    inline std::string subscribeSync(const std::string& p_channel, SubscribeCallback& p_callback)
+    template <typename Function>
+    static void forEachTable(const UnnamedChannel& p_channel, Function&& p_function)
     {
-        UBaseType_t priority = uxTaskPriorityGet(NULL);
-        BaseType_t affinity = xTaskGetAffinity(NULL);
-        return subscribe(p_channel, p_callback, priority, affinity, false);
+        for (const Channel* pattern : p_channel.itsPatterns)
+        {
+            const SubscriberTable* table = pattern->itsTable.load();
+            if (table != nullptr && topicMatches(pattern->itsName, p_channel.itsName))
+            {
+                p_function(*table);
+            }
+        }
     }
 
-    inline std::string subscribeAsync(const std::string& p_channel, SubscribeCallback& p_callback)
+    /**
+     * @brief Deliver a message to a single subscriber, either directly or
+     *        deferred depending on the subscription
+     *
+     * @param p_subscriber
+     * @param p_message
+     */
+    static void dispatch(const Subscriber& p_subscriber, Message& p_message)
     {
-        UBaseType_t priority = uxTaskPriorityGet(NULL);
-        BaseType_t affinity = xTaskGetAffinity(NULL);
-        return subscribe(p_channel, p_callback, priority, affinity, true);
+        if (!p_subscriber.isSync())
+        {
+            dispatchAsync(p_subscriber, p_message, -1);
+        }
+        else
+        {
+            deliverSync(p_subscriber, p_message);
+        }
     }
 
-    inline std::string subscribeAsyncWithPrio(const std::string& p_channel, SubscribeCallback& p_callback,
-                                              UBaseType_t p_priority)
+    static void deliverSync(const Subscriber& p_subscriber, Message& p_message)
     {
-        BaseType_t affinity = xTaskGetAffinity(NULL);
-        return subscribe(p_channel, p_callback, p_priority, affinity, true);
+        p_message.trace(TraceEvent::DispatchSync, p_subscriber.itsId);
+        p_message.deliver(*p_subscriber.itsCallback);
     }
 
     /**
-     * @brief Subscribe to a topic
+     * @brief Deliver a message to a single subscriber in a deferred way
+     * @details
+     * The deferred call only refers to the callback and the shared payload
+     * of the message, neither of them is copied.
      *
-     * @param p_channel
-     * @param p_callbackName
-     * @param p_callback
+     * @param p_subscriber
+     * @param p_message
+     * @param p_prio priority to use, or -1 for the subscriber's priority
      */
-    inline void subscribeSync(const std::string& p_channel, const std::string& p_callbackName,
-                              SubscribeCallback& p_callback)
+    static void dispatchAsync(const Subscriber& p_subscriber, Message& p_message, int p_prio)
     {
-        UBaseType_t priority = uxTaskPriorityGet(NULL);
-        BaseType_t affinity = xTaskGetAffinity(NULL);
-        subscribe(p_channel, p_callbackName, p_callback, priority, affinity, false);
+        switch (p_subscriber.itsDelivery)
+        {
+            case Delivery::Latest:
+                dispatchLatest(p_subscriber, p_message, p_prio);
+                return;
+            case Delivery::Throttled:
+                dispatchThrottled(p_subscriber, p_message, p_prio);
+                return;
+            case Delivery::Batched:
+                dispatchBatched(p_subscriber, p_message, p_prio);
+                return;
+            case Delivery::Coroutine:
+                dispatchCoroutine(p_subscriber, p_message, p_prio);
+                return;
+            default:
+                break;
+        }
+
+        p_message.trace(TraceEvent::DispatchAsync, p_subscriber.itsId);
+        DeferredCallsQueue::get().addDeferredCall([callback = p_subscriber.itsCallback, payload = p_message.payload(),
+                                                   probe = LatencyProbe(p_subscriber)]()
+                                                  {
+                                                      probe.started();
+                                                      std::apply(*callback, *payload);
+                                                  },
+                                                  (p_prio < 0) ? p_subscriber.itsPriority : p_prio,
+                                                  p_subscriber.itsAffinity, p_message.deadline());
     }
 
-    inline void subscribeAsync(const std::string& p_channel, const std::string& p_callbackName,
-                               SubscribeCallback& p_callback)
+    /**
+     * @brief Deliver a message to a subscriber with Delivery::Coroutine
+     * @details
+     * Like the deferred call of Delivery::Async, but the callback gets the
+     * payload via itsDelivering and passes it on to the coroutine.
+     *
+     * @param p_subscriber
+     * @param p_message
+     * @param p_prio priority to use, or -1 for the subscriber's priority
+     */
+    static void dispatchCoroutine(const Subscriber& p_subscriber, Message& p_message, int p_prio)
     {
-        UBaseType_t priority = uxTaskPriorityGet(NULL);
-        BaseType_t affinity = xTaskGetAffinity(NULL);
-        subscribe(p_channel, p_callbackName, p_callback, priority, affinity, true);
+        p_message.trace(TraceEvent::DispatchAsync, p_subscriber.itsId);
+        DeferredCallsQueue::get().addDeferredCall([callback = p_subscriber.itsCallback, payload = p_message.payload(),
+                                                   probe = LatencyProbe(p_subscriber)]()
+                                                  {
+                                                      probe.started();
+                                                      itsDelivering = &payload;
+                                                      std::apply(*callback, *payload);
+                                                      itsDelivering = nullptr;
+                                                  },
+                                                  (p_prio < 0) ? p_subscriber.itsPriority : p_prio,
+                                                  p_subscriber.itsAffinity, p_message.deadline());
     }
 
     /**
-     * @brief Unsubscribe from a topic
+     * @brief Wrap a coroutine handler into the callback of a subscriber with
+     *        Delivery::Coroutine
      *
-     * @param p_channel
-     * @param p_callbackName
+     * @param p_handler callable returning a DeferredTask
+     * @return Callback
      */
-    void unsubscribe(const std::string& p_channel, const std::string& p_callbackName)
+    template <typename Handler>
+    static Callback coroutineCallback(Handler p_handler)
     {
-        if (itsPubSubMutex.try_lock())
-        {
-            unsubscribeUnguarded(p_channel, p_callbackName);
-            itsPubSubMutex.unlock();
-            runQueuedCalls();
-        }
-        else
+        return [handler = std::move(p_handler)](Types... p_args) mutable
         {
-            std::lock_guard<std::mutex> lock(itsDefCallsMutex);
-            itsRecursiveCallsQueue.emplace([this, p_channel, p_callbackName]()
-                                           { unsubscribeUnguarded(p_channel, p_callbackName); });
-        }
+            DeferredTask task = handler(p_args...);
+            // arguments passed by reference point into the payload
+            task.start((itsDelivering != nullptr) ? *itsDelivering : nullptr);
+        };
     }
 
     /**
-     * @brief Remove all callbacks for a topic
+     * @brief Deliver a message to a subscriber with Delivery::Latest
+     * @details
+     * A deferred call is only added if no message is pending for the
+     * subscriber, otherwise the pending payload is replaced and the
+     * pending call keeps its deadline. If the queue drops the call, the
+     * pending message is dropped as well, so the next message adds a call
+     * again.
      *
-     * @param channel
+     * @param p_subscriber
+     * @param p_message
+     * @param p_prio priority to use, or -1 for the subscriber's priority
      */
-    void clear(const std::string& p_channel)
+    static void dispatchLatest(const Subscriber& p_subscriber, Message& p_message, int p_prio)
     {
-        if (itsPubSubMutex.try_lock())
+        std::shared_ptr<LatestValue> latest = p_subscriber.itsLatest;
         {
-            clearUnguarded(p_channel);
-            itsPubSubMutex.unlock();
-            runQueuedCalls();
+            std::lock_guard<std::mutex> lock(latest->itsMutex);
+            bool pending = (latest->itsPayload != nullptr);
+            latest->itsPayload = p_message.payload();
+            if (pending)
+            {
+                p_message.trace(TraceEvent::ReplaceLatest, p_subscriber.itsId);
+                return;
+            }
         }
-        else
+
+        p_message.trace(TraceEvent::DispatchAsync, p_subscriber.itsId);
+        // the call keeps the state alive until the drop handler has returned
+        const DeferredCallsQueue::DropHandler onDrop = {clearLatest, latest.get()};
+        if (unlikely(!DeferredCallsQueue::get().addDeferredCall([callback = p_subscriber.itsCallback, latest,
+                                                                 probe = LatencyProbe(p_subscriber)]()
+            {
+                probe.started();
+                std::unique_lock<std::mutex> lock(latest->itsMutex);
+                PayloadPtr payload = std::move(latest->itsPayload);
+                lock.unlock();
+                std::apply(*callback, *payload);
+            },
+            (p_prio < 0) ? p_subscriber.itsPriority : p_prio,
+            p_subscriber.itsAffinity, p_message.deadline(), onDrop)))
         {
-            std::lock_guard<std::mutex> lock(itsDefCallsMutex);
-            itsRecursiveCallsQueue.emplace([this, p_channel]()
-                                           { clear(p_channel); });
+            onDrop();
         }
     }
 
     /**
-     * @brief Remove all callbacks.
+     * @brief Drop handler of the deferred call of Delivery::Latest
+     *
+     * @param p_latest LatestValue of the subscriber
      */
-    void clear()
+    static void clearLatest(void* p_latest)
     {
-        if (itsPubSubMutex.try_lock())
+        LatestValue* latest = static_cast<LatestValue*>(p_latest);
+        std::lock_guard<std::mutex> lock(latest->itsMutex);
+        latest->itsPayload.reset();
+    }
+
+    /**
+     * @brief Deliver a message to a subscriber with Delivery::Throttled
+     * @details
+     * Like dispatchLatest(), but the deferred call is added by the timer of
+     * the subscriber if the interval since the start of the previous call
+     * has not passed yet.
+     *
+     * @param p_subscriber
+     * @param p_message
+     * @param p_prio priority to use, or -1 for the subscriber's priority
+     */
+    static void dispatchThrottled(const Subscriber& p_subscriber, Message& p_message, int p_prio)
+    {
+        std::shared_ptr<WindowState> window = p_subscriber.itsWindow;
+        int64_t delayUs;
         {
-            clearUnguarded();
-            itsPubSubMutex.unlock();
-            runQueuedCalls();
+            std::lock_guard<std::mutex> lock(window->itsMutex);
+            window->itsLatest = p_message.payload();
+            if (window->itsScheduled)
+            {
+                p_message.trace(TraceEvent::ReplaceLatest, p_subscriber.itsId);
+                return;
+            }
+            window->itsScheduled = true;
+            delayUs = window->itsNextCallUs - esp_timer_get_time();
         }
-        else
+
+        p_message.trace(TraceEvent::DispatchAsync, p_subscriber.itsId);
+        DeferredCallsQueue::CallType call([callback = p_subscriber.itsCallback, window,
+                                           probe = LatencyProbe(p_subscriber)]()
         {
-            std::lock_guard<std::mutex> lock(itsDefCallsMutex);
-            itsRecursiveCallsQueue.emplace([this]()
-                                           { clear(); });
+            probe.started();
+            std::unique_lock<std::mutex> lock(window->itsMutex);
+            PayloadPtr payload = std::move(window->itsLatest);
+            window->itsScheduled = false;
+            window->itsNextCallUs = esp_timer_get_time() + window->itsWindowUs;
+            lock.unlock();
+            std::apply(*callback, *payload);
+        });
+        const UBaseType_t priority = (p_prio < 0) ? p_subscriber.itsPriority : p_prio;
+        // the call keeps the state alive until the drop handler has returned
+        const DeferredCallsQueue::DropHandler onDrop = {clearThrottled, window.get()};
+        const bool added = (delayUs <= 0) ?
+            DeferredCallsQueue::get().addDeferredCall(std::move(call), priority, p_subscriber.itsAffinity,
+                                                      DeferredCallsQueue::itsNoDeadline, onDrop) :
+            window->itsTimer.start(delayUs, std::move(call), priority, p_subscriber.itsAffinity, onDrop);
+        if (unlikely(!added))
+        {
+            onDrop();
         }
     }
 
-private:
-    struct MapEntryType
-    {
-        const SubscribeCallback itsCallback;
-        const UBaseType_t itsPriority;
-        const BaseType_t itsAffinity;
-        const bool itsAlwaysAsync;
-
-        MapEntryType(SubscribeCallback& p_callback,
-                     UBaseType_t p_priority,
-                     BaseType_t p_affinity,
-                     bool p_alwaysAsync) :
-            itsCallback(p_callback),
-            itsPriority(p_priority),
-            itsAffinity(p_affinity),
-            itsAlwaysAsync(p_alwaysAsync)
-        {}
-    };
-
-    using CallbackMap = std::map<std::string, MapEntryType>;
-    using SubscriptionMap = std::map<std::string, CallbackMap>;
-    using RecursiveCalls = std::function<void()>;
-
-    inline static const char TAG[] = "PubSub";
-
-    std::shared_mutex itsPubSubMutex;
-    std::mutex itsDefCallsMutex;
-    SubscriptionMap itsSubscriptions;
-    std::queue<RecursiveCalls> itsRecursiveCallsQueue;
-    bool itsInRecursion;
-
     /**
-     * @brief Private constructor enforcing singleton pattern
+     * @brief Drop handler of the deferred call of Delivery::Throttled
+     *
+     * @param p_window WindowState of the subscriber
      */
-    PublishSubscribe()
+    static void clearThrottled(void* p_window)
     {
+        WindowState* window = static_cast<WindowState*>(p_window);
+        std::lock_guard<std::mutex> lock(window->itsMutex);
+        window->itsLatest.reset();
+        window->itsScheduled = false;
     }
 
     /**
-     * @brief Publish a message to a specific channel
+     * @brief Deliver a message to a subscriber with Delivery::Batched
+     * @details
+     * The arguments are copied into the pending batch of the subscriber. The
+     * first message of a window starts the timer, which adds the deferred
+     * call passing the batch to the callback.
      *
-     * @param p_channel
-     * @param p_args
+     * @param p_subscriber
+     * @param p_message
+     * @param p_prio priority to use, or -1 for the subscriber's priority
      */
-    void publishUnguarded(const std::string& p_channel, Types... p_args)
+    static void dispatchBatched(const Subscriber& p_subscriber, Message& p_message, int p_prio)
     {
-        ESP_LOGI(TAG, "Publishing '%s'", p_channel.c_str());
-        if (itsSubscriptions.contains(p_channel)) {
-            for (const auto& kv : itsSubscriptions[p_channel])
+        std::shared_ptr<WindowState> window = p_subscriber.itsWindow;
+        {
+            std::lock_guard<std::mutex> lock(window->itsMutex);
+            if (unlikely(window->itsPending.size() >= window->itsMaxMessages))
             {
-                if (kv.second.itsAlwaysAsync)
-                {
-                    ESP_LOGI(TAG, "  ~> %s", kv.first.c_str());
-                    auto& callback = kv.second.itsCallback;
-                    DeferredCallsQueue::get().addDeferredCall([callback, p_args...]()
-                                                              { callback(p_args...); },
-                                                              kv.second.itsPriority,
-                                                              kv.second.itsAffinity);
-                }
-                else
-                {
-                    ESP_LOGI(TAG, "  -> %s", kv.first.c_str());
-                    kv.second.itsCallback(p_args...);
-                }
+                p_message.trace(TraceEvent::DropFromBatch, p_subscriber.itsId);
+                return;
             }
+            p_message.append(window->itsPending);
+            if (window->itsScheduled)
+            {
+                p_message.trace(TraceEvent::AddToBatch, p_subscriber.itsId);
+                return;
+            }
+            window->itsScheduled = true;
         }
-    }
 
-    void publishAsyncUnguarded(const std::string& p_channel, Types... p_args, int p_prio = -1)
-    {
-        ESP_LOGI(TAG, "Publishing '%s'", p_channel.c_str());
-        if (itsSubscriptions.contains(p_channel)) {
-            for (const auto& kv : itsSubscriptions[p_channel])
+        p_message.trace(TraceEvent::DispatchAsync, p_subscriber.itsId);
+        // the call keeps the state alive until the drop handler has returned
+        const DeferredCallsQueue::DropHandler onDrop = {clearBatched, window.get()};
+        if (unlikely(!window->itsTimer.start(window->itsWindowUs, [window, probe = LatencyProbe(p_subscriber)]()
+        {
+            probe.started();
+            // the calls of two windows may run in parallel without core affinity
+            std::lock_guard<std::mutex> deliverLock(window->itsDeliverMutex);
             {
-                ESP_LOGI(TAG, "  ~> %s", kv.first.c_str());
-                auto& callback = kv.second.itsCallback;
-                DeferredCallsQueue::get().addDeferredCall([callback, p_args...]()
-                                                          { callback(p_args...); },
-                                                          (p_prio < 0) ? kv.second.itsPriority : p_prio,
-                                                          kv.second.itsAffinity);
+                std::lock_guard<std::mutex> lock(window->itsMutex);
+                std::swap(window->itsPending, window->itsDelivering);
+                window->itsScheduled = false;
             }
+            window->itsBatchCallback(Batch(window->itsDelivering));
+            window->itsDelivering.clear();
+        },
+        (p_prio < 0) ? p_subscriber.itsPriority : p_prio,
+        p_subscriber.itsAffinity, onDrop)))
+        {
+            onDrop();
+        }
+    }
+
+    /**
+     * @brief Drop handler of the deferred call of Delivery::Batched, the
+     *        messages of the window are dropped with it
+     *
+     * @param p_window WindowState of the subscriber
+     */
+    static void clearBatched(void* p_window)
+    {
+        WindowState* window = static_cast<WindowState*>(p_window);
+        std::lock_guard<std::mutex> lock(window->itsMutex);
+        window->itsPending.clear();
+        window->itsScheduled = false;
+    }
+
+    static std::shared_ptr<WindowState> makeWindow(uint32_t p_windowMs, BatchCallback& p_batchCallback,
+                                                   uint32_t p_maxMessages)
+    {
+        return std::allocate_shared<WindowState>(PoolAllocator<WindowState>(), p_windowMs, p_batchCallback,
+                                                 p_maxMessages);
+    }
+
+    /**
+     * @brief Raise the stack of the task of a deferred calls queue
+     *
+     * @param p_priority
+     * @param p_affinity
+     * @param p_stackSize stack size in bytes, 0 to keep the configured size
+     */
+    static void reserveStack(UBaseType_t p_priority, BaseType_t p_affinity, uint32_t p_stackSize)
+    {
+        if ((p_stackSize > 0) && !DeferredCallsQueue::get().reserveStack(p_priority, p_affinity, p_stackSize))
+        {
+            ESP_LOGW(TAG, "the task for priority %d, core %d already exists with less than %u bytes of stack",
+                     p_priority, p_affinity, (unsigned) p_stackSize);
         }
     }
 
-    std::string subscribe(const std::string& p_channel,
-                          SubscribeCallback& p_callback,
-                          UBaseType_t p_priority,
-                          BaseType_t p_affinity,
-                          bool p_alwaysAsync)
+    SubscriptionId subscribe(Channel& p_channel,
+                             SubscribeCallback& p_callback,
+                             UBaseType_t p_priority,
+                             BaseType_t p_affinity,
+                             Delivery p_delivery,
+                             std::shared_ptr<WindowState> p_window = nullptr)
     {
-        auto callbackName = generateRandomString();
-        subscribe(p_channel, callbackName, p_callback, p_priority, p_affinity, p_alwaysAsync);
-        return callbackName;
+        SubscriptionId id = newSubscriptionId();
+        const bool accepted = subscribe(p_channel, id, std::string(), p_callback, p_priority, p_affinity, p_delivery,
+                                        std::move(p_window));
+        return accepted ? id : 0;
     }
 
-    void subscribe(const std::string& p_channel,
+    bool subscribe(Channel& p_channel,
+                   SubscriptionId p_id,
                    const std::string& p_callbackName,
                    SubscribeCallback& p_callback,
                    UBaseType_t p_priority,
                    BaseType_t p_affinity,
-                   bool p_alwaysAsync)
+                   Delivery p_delivery,
+                   std::shared_ptr<WindowState> p_window = nullptr)
     {
-        if (itsPubSubMutex.try_lock())
+        Subscriber subscriber(p_id, p_callbackName, p_callback, p_priority, p_affinity, p_delivery,
+                              std::move(p_window));
+        if (unlikely(itsReadDepth > 0))
         {
-            subscribeUnguarded(p_channel, p_callbackName, p_callback, p_priority, p_affinity, p_alwaysAsync);
-            itsPubSubMutex.unlock();
-            runQueuedCalls();
+            return deferSubscriber(PendingOp::Code::Subscribe, &p_channel, nullptr, std::move(subscriber));
         }
-        else
+        addSubscriber(p_channel, std::move(subscriber));
+        return true;
+    }
+
+    void addSubscriber(Channel& p_channel, Subscriber&& p_subscriber)
+    {
+        RetainedValue* retained = p_channel.itsRetained.load(std::memory_order_acquire);
+        std::optional<Subscriber> newcomer;
+        if (unlikely(retained != nullptr))
+        {
+            newcomer.emplace(p_subscriber);
+        }
+        updateChannel(p_channel, [&p_subscriber](SubscriberTable& p_table)
         {
-            std::lock_guard<std::mutex> lock(itsDefCallsMutex);
-            itsRecursiveCallsQueue.emplace([this, p_channel, p_callbackName, p_callback, p_priority, p_affinity,
-                                            p_alwaysAsync]()
+            const std::string_view name(p_subscriber.itsName);
+            if (unlikely(!name.empty() &&
+                         std::any_of(p_table.itsSubscribers.begin(), p_table.itsSubscribers.end(),
+                                     [name](const Subscriber& p_other)
+                                     { return std::string_view(p_other.itsName) == name; })))
             {
-                subscribe(p_channel, p_callbackName, p_callback, p_priority, p_affinity, p_alwaysAsync);
-            });
+                ESP_LOGE(TAG, "callback name '%s' is already taken, NOT overwriting", p_subscriber.itsName.c_str());
+                ESP_ERROR_CHECK(ESP_FAIL);
+                return false;
+            }
+            p_table.itsSubscribers.push_back(std::move(p_subscriber));
+            return true;
+        });
+        if (unlikely(newcomer.has_value()))
+        {
+            deliverRetained(p_channel.itsInfo, *retained, *newcomer);
         }
     }
 
-    void subscribeUnguarded(const std::string& p_channel,
-                            const std::string& p_callbackName,
-                            SubscribeCallback& p_callback,
-                            UBaseType_t p_priority,
-                            BaseType_t p_affinity,
-                            bool p_alwaysAsync)
+    void retain(Channel& p_channel)
     {
-        if (unlikely(itsSubscriptions[p_channel].count(p_callbackName) > 0))
+        std::lock_guard<std::mutex> lock(itsWriterMutex);
+        if (p_channel.itsRetained.load() == nullptr)
         {
-            ESP_LOGE(TAG, "callback name '%s' is already taken, NOT overwriting", p_callbackName.c_str());
-            ESP_ERROR_CHECK(ESP_FAIL);
+            p_channel.itsRetained.store(poolNew<RetainedValue>(), std::memory_order_release);
         }
-        else
+    }
+
+    void unsubscribe(Channel& p_channel, SubscriptionId p_id)
+    {
+        updateChannel(p_channel, [p_id](SubscriberTable& p_table)
         {
-            itsSubscriptions[p_channel].try_emplace(p_callbackName, p_callback, p_priority, p_affinity, p_alwaysAsync);
-        }
+            return std::erase_if(p_table.itsSubscribers, [p_id](const Subscriber& p_subscriber)
+                                 { return p_subscriber.itsId == p_id; }) > 0;
+        });
     }
 
-    /**
-     * @brief Unsubscribe from a topic
-     *
-     * @param p_channel
-     * @param p_callbackName
-     */
-    inline void unsubscribeUnguarded(const std::string& p_channel, const std::string& p_callbackName)
+    void unsubscribe(Channel& p_channel, const std::string& p_callbackName)
     {
-        itsSubscriptions[p_channel].erase(p_callbackName);
+        updateChannel(p_channel, [&p_callbackName](SubscriberTable& p_table)
+        {
+            return std::erase_if(p_table.itsSubscribers, [&p_callbackName](const Subscriber& p_subscriber)
+                                 { return std::string_view(p_subscriber.itsName) == p_callbackName; }) > 0;
+        });
     }
 
-    /**
-     * @brief Remove all callbacks for a topic
-     *
-     * @param channel
-     */
-    void clearUnguarded(const std::string& p_channel)
+    void clear(Channel& p_channel)
     {
-        itsSubscriptions[p_channel].clear();
+        updateChannel(p_channel, [](SubscriberTable& p_table)
+        {
+            bool changed = !p_table.itsSubscribers.empty();
+            p_table.itsSubscribers.clear();
+            return changed;
+        });
     }
 
-    /**
-     * @brief Remove all callbacks.
-     */
-    void clearUnguarded()
+    LatencyHistogram::Snapshot getLatency(Channel& p_channel, SubscriptionId p_id)
+    {
+        Rcu::ReadGuard guard(itsRcu);
+        const SubscriberTable* table = p_channel.itsTable.load();
+        if (table != nullptr)
+        {
+            for (const auto& subscriber : table->itsSubscribers)
+            {
+                if (subscriber.itsId == p_id)
+                {
+                    return subscriber.getLatency();
+                }
+            }
+        }
+        return LatencyHistogram().read();
+    }
+
+    TopicStats getStats(Channel& p_channel)
     {
-        itsSubscriptions.clear();
+        Rcu::ReadGuard guard(itsRcu);
+        const SubscriberTable* table = p_channel.itsTable.load();
+        return p_channel.itsInfo.read((table != nullptr) ? table->itsSubscribers.size() : 0);
     }
 
-    /**
-     * @brief Generates a random string
-     *
-     * @param p_length length of string, defaults to 16 characters
-     * @return std::string with specified length
-     */
-    static std::string generateRandomString(unsigned int p_length = 16)
+    void createLoanPool(Channel& p_channel, std::size_t p_blockSize, std::size_t p_numBlocks, uint32_t p_caps)
+    {
+        std::lock_guard<std::mutex> lock(itsWriterMutex);
+        if (unlikely(p_channel.itsLoanPool.load() != nullptr))
+        {
+            ESP_LOGE(TAG, "channel '%s' already has a loan pool", p_channel.itsName.c_str());
+            ESP_ERROR_CHECK(ESP_FAIL);
+        }
+        p_channel.itsLoanPool.store(poolNew<LoanPool>(p_blockSize, p_numBlocks, p_caps));
+    }
+
+    LoanedBuffer loan(Channel& p_channel, std::size_t p_size)
     {
-        char chars[p_length];
-        for (unsigned int i = 0; i < p_length; i++)
+        LoanPool* pool = p_channel.itsLoanPool.load();
+        if (unlikely(pool == nullptr))
         {
-            chars[i] = ' ' + 1 + (rand() % 64);
+            ESP_LOGE(TAG, "channel '%s' has no loan pool", p_channel.itsName.c_str());
+            ESP_ERROR_CHECK(ESP_FAIL);
         }
-        return std::string(chars, p_length);
+        return pool->loan(p_size);
     }
 
     /**
-     * @brief Run all queued calls and in the process, remove them from the queue
+     * @brief Replace the subscriber table of a channel by a modified copy
+     * @details
+     * The old table is released as soon as no publisher is using it anymore.
+     *
+     * @param p_channel
+     * @param p_modify modifies the new table, returns false if nothing changed
      */
-    void runQueuedCalls()
+    template <typename Modify>
+    void updateChannel(Channel& p_channel, Modify p_modify)
     {
-        itsDefCallsMutex.lock();
-        if (!itsRecursiveCallsQueue.empty())
+        std::lock_guard<std::mutex> lock(itsWriterMutex);
+        const SubscriberTable* table = p_channel.itsTable.load();
+        SubscriberTable* newTable = (table != nullptr) ? poolNew<SubscriberTable>(*table) : poolNew<SubscriberTable>();
+        if (!p_modify(*newTable))
         {
-            typeof(itsRecursiveCallsQueue) recursiveCallsQueueCopy;
-            // use queue in local version while emptying global version
-            itsRecursiveCallsQueue.swap(recursiveCallsQueueCopy);
-            itsDefCallsMutex.unlock();
-
-            while (!itsRecursiveCallsQueue.empty())
-            {
-                // execute queued call
-                recursiveCallsQueueCopy.front()();
-                // remove call from queue
-                recursiveCallsQueueCopy.pop();
-            }
+            poolDelete(newTable);
+            return;
+        }
+        if (newTable->itsSubscribers.empty())
+        {
+            poolDelete(newTable);
+            newTable = nullptr;
         }
         else
         {
-            itsDefCallsMutex.unlock();
+            newTable->updateOrder();
         }
+        p_channel.itsTable.store(newTable);
+        if (table != nullptr)
+        {
+            itsRcu.retire(const_cast<SubscriberTable*>(table), &poolDeleter<SubscriberTable>);
+        }
+    }
+
+    /**
+     * @brief Run the operations deferred by the current task
+     * @details
+     * Called whenever the outermost reader section of a task ends. An
+     * operation may publish a retained message and defer further operations,
+     * which are run by the same loop.
+     */
+    void runQueuedCalls()
+    {
+        Pending::runAll([this](PendingOp&& p_op) { runOp(std::move(p_op)); });
     }
 };
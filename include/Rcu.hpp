@@ -0,0 +1,126 @@
+/**
+ * @file Rcu.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Epoch-based read-copy-update for lock-free readers
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "SubscriptionPool.hpp"
+
+/**
+ * @brief Epoch-based reclamation of data shared with lock-free readers
+ * @details
+ * Readers announce themselves in the reader count of the current epoch and
+ * may then access any data published through atomic pointers without taking
+ * a lock. Writers replace such data by a modified copy and retire the old
+ * version, which is released only after all readers which might still see
+ * it have left.
+ *
+ * The epoch is advanced only when no reader of the previous epoch is left,
+ * so readers are always counted in one of two counters (by the parity of
+ * their epoch). Data retired in epoch e is therefore unreachable as soon as
+ * the epoch has advanced to e + 2. Neither readers nor writers ever block:
+ * retired data which cannot be released yet is kept until the next write,
+ * or until the last reader leaves.
+ */
+class Rcu
+{
+public:
+    using Deleter = void (*)(void*);
+
+    /**
+     * @brief Reader section, released in the destructor
+     */
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(Rcu& p_rcu) :
+            itsRcu(p_rcu),
+            itsToken(p_rcu.readLock())
+        {}
+
+        ~ReadGuard()
+        {
+            itsRcu.readUnlock(itsToken);
+        }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+    private:
+        Rcu& itsRcu;
+        uint32_t itsToken;
+    };
+
+    Rcu();
+    ~Rcu();
+
+    Rcu(const Rcu&) = delete;
+    Rcu& operator=(const Rcu&) = delete;
+
+    /**
+     * @brief Enter a reader section, may be nested
+     *
+     * @return token to be passed to readUnlock()
+     */
+    uint32_t readLock();
+
+    /**
+     * @brief Leave a reader section
+     *
+     * @param p_token as returned by the corresponding readLock()
+     */
+    void readUnlock(uint32_t p_token);
+
+    /**
+     * @brief Release data as soon as no reader can access it anymore
+     * @details
+     * The data must already have been made unreachable for new readers.
+     *
+     * @param p_data
+     * @param p_deleter function releasing the data
+     */
+    void retire(void* p_data, Deleter p_deleter);
+
+    /**
+     * @brief Wait until all readers present at the time of the call have left
+     * @details
+     * Must not be called from within a reader section of the same Rcu.
+     */
+    void synchronize();
+
+    /**
+     * @brief Returns the number of retired data blocks not released yet
+     *
+     * @return std::size_t
+     */
+    std::size_t getRetiredCount();
+
+private:
+    struct Retired
+    {
+        void* itsData;
+        Deleter itsDeleter;
+        uint32_t itsEpoch;
+    };
+
+    std::atomic<uint32_t> itsEpoch;
+    std::array<std::atomic<uint32_t>, 2> itsReaders;
+    std::atomic<bool> itsHasRetired;
+
+    std::mutex itsRetiredMutex;
+    std::vector<Retired, PoolAllocator<Retired>> itsRetired;
+
+    bool tryAdvance();
+    void reclaim();
+};
@@ -0,0 +1,142 @@
+/**
+ * @file SubscriptionPool.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Memory pool for the subscription data structures
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "PubSubConfig.hpp"
+
+/**
+ * @brief Pool of fixed-size memory blocks for subscription data
+ * @details
+ * Blocks are provided in a small number of size classes. Each size class is
+ * grown by carving chunks of CONFIG_PUBSUB_POOL_CHUNK_SIZE bytes from the heap
+ * with the configured capabilities (e.g. MALLOC_CAP_SPIRAM). Released blocks
+ * return to their size class and are never given back to the heap, so
+ * subscribing and unsubscribing repeatedly does not fragment the heap.
+ * Requests larger than the largest size class are served by the heap directly.
+ */
+class SubscriptionPool
+{
+public:
+    inline static constexpr std::size_t itsNumClasses = 5;
+    inline static constexpr std::size_t itsMinBlockSize = 16;
+    inline static constexpr std::size_t itsMaxBlockSize = itsMinBlockSize << (itsNumClasses - 1);
+
+    struct ClassStats
+    {
+        std::size_t itsBlockSize;
+        std::size_t itsBlocksTotal;     ///< blocks carved from chunks
+        std::size_t itsBlocksInUse;
+        std::size_t itsBlocksHighWater; ///< maximum number of blocks in use at the same time
+    };
+
+    struct Stats
+    {
+        std::array<ClassStats, itsNumClasses> itsClasses;
+        std::size_t itsChunkBytes;      ///< total bytes taken from the heap for chunks
+        std::size_t itsLargeInUse;      ///< allocations too large for any size class
+        std::size_t itsLargeHighWater;
+    };
+
+    /**
+     * @brief Returns the SubscriptionPool instance.
+     * @return SubscriptionPool&
+     */
+    static SubscriptionPool& getInstance();
+
+    /**
+     * @brief Alias for getInstance().
+     *
+     * @return SubscriptionPool&
+     */
+    inline static constexpr auto get = &getInstance;
+
+    /**
+     * @brief Set the heap capabilities used for new chunks
+     *
+     * @param p_caps heap capabilities as for heap_caps_malloc()
+     */
+    void setCaps(uint32_t p_caps);
+
+    void* allocate(std::size_t p_size);
+    void deallocate(void* p_block, std::size_t p_size);
+
+    /**
+     * @brief Returns usage and high-water marks of the pool
+     *
+     * @return Stats
+     */
+    Stats getStats();
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* itsNext;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock* itsFreeList;
+        ClassStats itsStats;
+    };
+
+    std::mutex itsMutex;
+    uint32_t itsCaps;
+    std::array<SizeClass, itsNumClasses> itsClasses;
+    std::size_t itsChunkBytes;
+    std::size_t itsLargeInUse;
+    std::size_t itsLargeHighWater;
+
+    SubscriptionPool();
+
+    static std::size_t sizeToClass(std::size_t p_size);
+    void grow(SizeClass& p_class);
+};
+
+/**
+ * @brief Allocator for standard containers drawing from the SubscriptionPool
+ *
+ * @tparam T
+ */
+template <typename T>
+struct PoolAllocator
+{
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&)
+    {}
+
+    T* allocate(std::size_t p_count)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+        return static_cast<T*>(SubscriptionPool::get().allocate(p_count * sizeof(T)));
+    }
+
+    void deallocate(T* p_block, std::size_t p_count)
+    {
+        SubscriptionPool::get().deallocate(p_block, p_count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const
+    {
+        return true;
+    }
+};
+
+using PoolString = std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
@@ -0,0 +1,126 @@
+/**
+ * @file TopicName.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Topic names and IDs known at compile time
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * @brief Calculate the ID of a topic name (32-bit FNV-1a hash)
+ *
+ * @param p_name
+ * @return topic ID, usable as compile-time constant
+ */
+constexpr uint32_t topicId(std::string_view p_name)
+{
+    uint32_t hash = 2166136261u;
+    for (char c : p_name)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Check whether a topic pattern is well-formed
+ * @details
+ * Levels of a pattern are separated by "/". A level may be "+", matching
+ * exactly one level of a topic name, and the last level may be "#",
+ * matching any number of remaining levels. Otherwise the wildcard
+ * characters must not be used.
+ *
+ * @param p_pattern
+ * @return true if the pattern is valid
+ */
+constexpr bool isTopicPattern(std::string_view p_pattern)
+{
+    while (true)
+    {
+        const std::size_t end = p_pattern.find('/');
+        const std::string_view level = p_pattern.substr(0, end);
+        if ((level.find_first_of("+#") != std::string_view::npos) && (level != "+") &&
+            ((level != "#") || (end != std::string_view::npos)))
+        {
+            return false;
+        }
+        if (end == std::string_view::npos)
+        {
+            return true;
+        }
+        p_pattern.remove_prefix(end + 1);
+    }
+}
+
+/**
+ * @brief Check whether a topic name matches a pattern
+ * @details
+ * Uses the MQTT rules, e.g. "sensor/+/accel" matches "sensor/imu/accel",
+ * "sensor/#" matches "sensor", "sensor/imu" and "sensor/imu/gyro".
+ *
+ * @param p_pattern a valid pattern, see isTopicPattern()
+ * @param p_topic
+ * @return true if the topic matches
+ */
+constexpr bool topicMatches(std::string_view p_pattern, std::string_view p_topic)
+{
+    while (true)
+    {
+        const std::size_t patternEnd = p_pattern.find('/');
+        const std::string_view level = p_pattern.substr(0, patternEnd);
+        if (level == "#")
+        {
+            return true;
+        }
+        const std::size_t topicEnd = p_topic.find('/');
+        if ((level != "+") && (level != p_topic.substr(0, topicEnd)))
+        {
+            return false;
+        }
+        if ((patternEnd == std::string_view::npos) || (topicEnd == std::string_view::npos))
+        {
+            // a trailing "#" also matches the parent level
+            return (patternEnd == topicEnd) || (p_pattern.substr(patternEnd + 1) == "#");
+        }
+        p_pattern.remove_prefix(patternEnd + 1);
+        p_topic.remove_prefix(topicEnd + 1);
+    }
+}
+
+/**
+ * @brief Topic name which may be used as a template parameter,
+ *        e.g. StaticTopic<"sensor/temp">
+ *
+ * @tparam N size of the string literal including the terminating zero
+ */
+template <std::size_t N>
+struct TopicName
+{
+    char itsName[N];
+
+    consteval TopicName(const char (&p_name)[N])
+    {
+        for (std::size_t i = 0; i < N; i++)
+        {
+            itsName[i] = p_name[i];
+        }
+    }
+
+    constexpr std::string_view view() const
+    {
+        return std::string_view(itsName, N - 1);
+    }
+
+    constexpr uint32_t id() const
+    {
+        return topicId(view());
+    }
+};
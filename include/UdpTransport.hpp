@@ -0,0 +1,62 @@
+/**
+ * @file UdpTransport.hpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Bridge transport sending frames as UDP datagrams
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <netinet/in.h>
+
+#include "PubSubBridge.hpp"
+
+/**
+ * @brief Sends every frame as one UDP datagram, by default as broadcast
+ * @details
+ * A task receives the datagrams on the given port and passes them to the
+ * bridge. On the target the network interface must be up before the
+ * transport is created. Nodes on the same host may share a port, then
+ * every node also receives its own frames, which the bridge drops.
+ */
+class UdpTransport : public PubSubBridge::Transport
+{
+public:
+    inline static constexpr std::size_t itsMaxFrameSize = CONFIG_PUBSUB_BRIDGE_UDP_FRAME_SIZE;
+
+    /**
+     * @brief Open the socket and start the receiving task
+     *
+     * @param p_port UDP port to receive on and to send to
+     * @param p_destination IPv4 address to send to, a broadcast or unicast address
+     * @param p_priority priority of the receiving task, which also publishes the received messages
+     * @param p_core_id core of the receiving task
+     */
+    UdpTransport(uint16_t p_port, const char* p_destination = "255.255.255.255",
+                 UBaseType_t p_priority = CONFIG_PUBSUB_BRIDGE_TASK_PRIORITY, BaseType_t p_core_id = tskNO_AFFINITY);
+    ~UdpTransport() override;
+
+    UdpTransport(const UdpTransport&) = delete;
+    UdpTransport& operator=(const UdpTransport&) = delete;
+
+    std::size_t maxFrameSize() const override
+    {
+        return itsMaxFrameSize;
+    }
+
+    bool send(const uint8_t* p_frame, std::size_t p_size) override;
+
+private:
+    static void receiveTask(void* p_transport);
+
+    int itsSocket;
+    sockaddr_in itsDestination;
+    std::vector<uint8_t> itsBuffer;       ///< only used by the receiving task
+    std::atomic<bool> itsStopping;
+    std::atomic<bool> itsStopped;
+};
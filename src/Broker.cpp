@@ -0,0 +1,551 @@
+/**
+ * @file Broker.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Single publish/subscribe broker shared by all message signatures
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include <algorithm>
+#include "Broker.hpp"
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+
+/**
+ * @brief Arguments of a message while it is being published
+ * @details
+ * The arguments are copied (or moved) into a shared payload block only
+ * once, when the first deferred call needs them.
+ */
+class Broker::Message
+{
+public:
+    Message(Channel& p_channel, void* p_args, bool p_movable) :
+        itsChannel(p_channel),
+        itsArgs(p_args),
+        itsMovable(p_movable)
+    {
+        itsChannel.itsInfo.itsPublished.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void trace(TraceEvent p_event, SubscriptionId p_subscriber = 0) const
+    {
+        PubSubTrace::record(p_event, itsChannel.itsInfo.itsId, itsChannel.itsInfo.itsName, p_subscriber);
+    }
+
+    const Signature& signature() const
+    {
+        return *itsChannel.itsSignature;
+    }
+
+    void deliver(const CallbackPtr& p_callback) const
+    {
+        const int64_t start = esp_timer_get_time();
+        signature().itsCall(p_callback.get(), itsArgs);
+        itsChannel.itsInfo.addSyncCall(esp_timer_get_time() - start);
+    }
+
+    const PayloadPtr& payload()
+    {
+        if (!itsPayload)
+        {
+            itsPayload = signature().itsMakePayload(itsArgs, itsMovable);
+        }
+        return itsPayload;
+    }
+
+private:
+    Channel& itsChannel;
+    void* itsArgs;
+    bool itsMovable;
+    PayloadPtr itsPayload;
+};
+
+
+/**
+ * @brief Reader section of a publisher, runs the calls deferred while the
+ *        current task was publishing when the outermost section ends
+ */
+class Broker::ReadSection
+{
+public:
+    explicit ReadSection(Broker& p_broker) :
+        itsBroker(p_broker),
+        itsToken(p_broker.itsRcu.readLock())
+    {
+        itsReadDepth++;
+    }
+
+    ~ReadSection()
+    {
+        itsBroker.itsRcu.readUnlock(itsToken);
+        if (--itsReadDepth == 0)
+        {
+            itsBroker.runQueuedCalls();
+        }
+    }
+
+    ReadSection(const ReadSection&) = delete;
+    ReadSection& operator=(const ReadSection&) = delete;
+
+private:
+    Broker& itsBroker;
+    uint32_t itsToken;
+};
+
+
+thread_local uint32_t Broker::itsReadDepth = 0;
+
+
+template <typename T, typename... Args>
+static T* poolNew(Args&&... p_args)
+{
+    T* object = PoolAllocator<T>().allocate(1);
+    return new (object) T(std::forward<Args>(p_args)...);
+}
+
+
+template <typename T>
+static void poolDelete(const T* p_object)
+{
+    if (p_object != nullptr)
+    {
+        T* object = const_cast<T*>(p_object);
+        object->~T();
+        PoolAllocator<T>().deallocate(object, 1);
+    }
+}
+
+
+template <typename T>
+static void poolDeleter(void* p_object)
+{
+    poolDelete(static_cast<T*>(p_object));
+}
+
+
+Broker::Subscriber::Subscriber(SubscriptionId p_id,
+                               const CallbackPtr& p_callback,
+                               UBaseType_t p_priority,
+                               BaseType_t p_affinity,
+                               Delivery p_delivery) :
+    itsCallback(p_callback),
+    itsId(p_id),
+    itsPriority(p_priority),
+    itsAffinity(p_affinity),
+    itsDelivery(p_delivery),
+    itsLatest((p_delivery == Delivery::Latest) ?
+              std::allocate_shared<LatestValue>(PoolAllocator<LatestValue>()) : nullptr)
+{}
+
+
+bool Broker::SubscriberTable::callsAfter(const Subscriber& p_left, const Subscriber& p_right)
+{
+    // critical subscribers first, then by descending priority
+    if (p_left.itsDelivery != p_right.itsDelivery)
+    {
+        return p_right.itsDelivery == Delivery::Critical;
+    }
+    return p_left.itsPriority < p_right.itsPriority;
+}
+
+
+void Broker::SubscriberTable::updateOrder()
+{
+    itsSyncOrder.clear();
+    itsNumCritical = 0;
+    itsHasAsync = false;
+    for (uint32_t i = 0; i < itsSubscribers.size(); i++)
+    {
+        if (itsSubscribers[i].isSync())
+        {
+            itsSyncOrder.push_back(i);
+            itsNumCritical += (itsSubscribers[i].itsDelivery == Delivery::Critical);
+        }
+        else
+        {
+            itsHasAsync = true;
+        }
+    }
+    // insertion sort, stable and without a temporary buffer on the heap
+    for (uint32_t i = 1; i < itsSyncOrder.size(); i++)
+    {
+        const uint32_t index = itsSyncOrder[i];
+        const Subscriber& subscriber = itsSubscribers[index];
+        uint32_t j = i;
+        while ((j > 0) && callsAfter(itsSubscribers[itsSyncOrder[j - 1]], subscriber))
+        {
+            itsSyncOrder[j] = itsSyncOrder[j - 1];
+            j--;
+        }
+        itsSyncOrder[j] = index;
+    }
+}
+
+
+Broker::Channel::Channel(std::string_view p_name, const Signature* p_signature) :
+    itsName(p_name),
+    itsInfo(itsName.c_str(), topicId(p_name)),
+    itsSignature(p_signature),
+    itsTable(nullptr)
+{}
+
+
+Broker& Broker::getInstance()
+{
+    static Broker instance;
+    return instance;
+}
+
+
+Broker::Broker() :
+    itsChannels(nullptr),
+    itsNextSubscriptionId(1)
+{
+    // make sure the pool outlives the subscription maps
+    SubscriptionPool::get();
+    // the calls queue cannot be created from an ISR
+    DeferredCallsQueue::get();
+}
+
+
+Broker::~Broker()
+{
+    // operations of other tasks cannot be pending, they would still be publishing
+    Pending::discard();
+    const ChannelMap* channels = itsChannels.load();
+    if (channels != nullptr)
+    {
+        for (auto& entry : *channels)
+        {
+            poolDelete(entry.second->itsTable.load());
+            poolDelete(entry.second);
+        }
+        poolDelete(channels);
+    }
+}
+
+
+void Broker::clear()
+{
+    std::lock_guard<std::mutex> lock(itsChannelsMutex);
+    const ChannelMap* channels = itsChannels.load();
+    if (channels != nullptr)
+    {
+        for (auto& entry : *channels)
+        {
+            clear(*entry.second);
+        }
+    }
+}
+
+
+std::vector<TopicStats> Broker::getStats()
+{
+    std::vector<TopicStats> stats;
+    Rcu::ReadGuard guard(itsRcu);
+    const ChannelMap* channels = itsChannels.load();
+    if (channels != nullptr)
+    {
+        stats.reserve(channels->size());
+        for (auto& entry : *channels)
+        {
+            stats.push_back(getStats(*entry.second));
+        }
+    }
+    return stats;
+}
+
+
+void Broker::resetStats()
+{
+    Rcu::ReadGuard guard(itsRcu);
+    const ChannelMap* channels = itsChannels.load();
+    if (channels != nullptr)
+    {
+        for (auto& entry : *channels)
+        {
+            entry.second->itsInfo.reset();
+        }
+    }
+}
+
+
+Broker::Channel* Broker::findChannel(std::string_view p_channel)
+{
+    Rcu::ReadGuard guard(itsRcu);
+    const ChannelMap* channels = itsChannels.load();
+    if (channels == nullptr)
+    {
+        return nullptr;
+    }
+    auto it = channels->find(p_channel);
+    return (it != channels->end()) ? it->second : nullptr;
+}
+
+
+Broker::Channel& Broker::getChannel(std::string_view p_channel, const Signature* p_signature)
+{
+    Channel* channel = findChannel(p_channel);
+    if (unlikely(channel == nullptr))
+    {
+        std::lock_guard<std::mutex> lock(itsChannelsMutex);
+        const ChannelMap* channels = itsChannels.load();
+        // the channel may have been created in the meantime
+        auto it = (channels != nullptr) ? channels->find(p_channel) : ChannelMap::const_iterator();
+        if ((channels != nullptr) && (it != channels->end()))
+        {
+            channel = it->second;
+        }
+        else
+        {
+            channel = poolNew<Channel>(p_channel, p_signature);
+            ChannelMap* newChannels = (channels != nullptr) ? poolNew<ChannelMap>(*channels) : poolNew<ChannelMap>();
+            newChannels->emplace(channel->itsName, channel);
+            itsChannels.store(newChannels);
+            if (channels != nullptr)
+            {
+                itsRcu.retire(const_cast<ChannelMap*>(channels), &poolDeleter<ChannelMap>);
+            }
+        }
+    }
+
+    if (unlikely(channel->itsSignature != p_signature))
+    {
+        ESP_LOGE(TAG, "channel '%s' already exists with other argument types", channel->itsName.c_str());
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+    return *channel;
+}
+
+
+void Broker::publish(Channel& p_channel, void* p_args)
+{
+    ReadSection section(*this);
+    Message message(p_channel, p_args, false);
+    message.trace(TraceEvent::Publish);
+    const SubscriberTable* table = p_channel.itsTable.load();
+    if (table == nullptr)
+    {
+        return;
+    }
+    // adding a deferred call may preempt the publisher, so critical subscribers come first
+    for (uint32_t i = 0; i < table->itsNumCritical; i++)
+    {
+        deliverSync(table->itsSubscribers[table->itsSyncOrder[i]], message);
+    }
+    if (table->itsHasAsync)
+    {
+        for (const auto& subscriber : table->itsSubscribers)
+        {
+            if (!subscriber.isSync())
+            {
+                dispatchAsync(subscriber, message, -1);
+            }
+        }
+    }
+    for (uint32_t i = table->itsNumCritical; i < table->itsSyncOrder.size(); i++)
+    {
+        deliverSync(table->itsSubscribers[table->itsSyncOrder[i]], message);
+    }
+}
+
+
+void Broker::publishAsync(Channel& p_channel, void* p_args, int p_prio)
+{
+    ReadSection section(*this);
+    // only deferred calls use the arguments, so they may be moved into the payload
+    Message message(p_channel, p_args, true);
+    message.trace(TraceEvent::PublishAsync);
+    const SubscriberTable* table = p_channel.itsTable.load();
+    if (table != nullptr)
+    {
+        for (const auto& subscriber : table->itsSubscribers)
+        {
+            dispatchAsync(subscriber, message, p_prio);
+        }
+    }
+}
+
+
+void Broker::deliverSync(const Subscriber& p_subscriber, Message& p_message)
+{
+    p_message.trace(TraceEvent::DispatchSync, p_subscriber.itsId);
+    p_message.deliver(p_subscriber.itsCallback);
+}
+
+
+void Broker::dispatchAsync(const Subscriber& p_subscriber, Message& p_message, int p_prio)
+{
+    if (p_subscriber.itsDelivery == Delivery::Latest)
+    {
+        dispatchLatest(p_subscriber, p_message, p_prio);
+        return;
+    }
+
+    p_message.trace(TraceEvent::DispatchAsync, p_subscriber.itsId);
+    DeferredCallsQueue::get().addDeferredCall([callPayload = p_message.signature().itsCallPayload,
+                                               callback = p_subscriber.itsCallback, payload = p_message.payload()]()
+                                              { callPayload(callback.get(), payload.get()); },
+                                              (p_prio < 0) ? p_subscriber.itsPriority : p_prio,
+                                              p_subscriber.itsAffinity);
+}
+
+
+void Broker::dispatchLatest(const Subscriber& p_subscriber, Message& p_message, int p_prio)
+{
+    std::shared_ptr<LatestValue> latest = p_subscriber.itsLatest;
+    {
+        std::lock_guard<std::mutex> lock(latest->itsMutex);
+        bool pending = (latest->itsPayload != nullptr);
+        latest->itsPayload = p_message.payload();
+        if (pending)
+        {
+            p_message.trace(TraceEvent::ReplaceLatest, p_subscriber.itsId);
+            return;
+        }
+    }
+
+    p_message.trace(TraceEvent::DispatchAsync, p_subscriber.itsId);
+    // the call keeps the state alive until the drop handler has returned
+    const DeferredCallsQueue::DropHandler onDrop = {clearLatest, latest.get()};
+    if (unlikely(!DeferredCallsQueue::get().addDeferredCall([callPayload = p_message.signature().itsCallPayload,
+                                                             callback = p_subscriber.itsCallback, latest]()
+        {
+            std::unique_lock<std::mutex> lock(latest->itsMutex);
+            PayloadPtr payload = std::move(latest->itsPayload);
+            lock.unlock();
+            callPayload(callback.get(), payload.get());
+        },
+        (p_prio < 0) ? p_subscriber.itsPriority : p_prio,
+        p_subscriber.itsAffinity, DeferredCallsQueue::itsNoDeadline, onDrop)))
+    {
+        onDrop();
+    }
+}
+
+
+void Broker::clearLatest(void* p_latest)
+{
+    LatestValue* latest = static_cast<LatestValue*>(p_latest);
+    std::lock_guard<std::mutex> lock(latest->itsMutex);
+    latest->itsPayload.reset();
+}
+
+
+void Broker::reserveStack(UBaseType_t p_priority, BaseType_t p_affinity, uint32_t p_stackSize)
+{
+    if ((p_stackSize > 0) && !DeferredCallsQueue::get().reserveStack(p_priority, p_affinity, p_stackSize))
+    {
+        ESP_LOGW(TAG, "the task for priority %d, core %d already exists with less than %u bytes of stack",
+                 p_priority, p_affinity, (unsigned) p_stackSize);
+    }
+}
+
+
+SubscriptionId Broker::subscribe(Channel& p_channel, CallbackPtr&& p_callback, UBaseType_t p_priority,
+                                 BaseType_t p_affinity, Delivery p_delivery)
+{
+    SubscriptionId id = itsNextSubscriptionId.fetch_add(1, std::memory_order_relaxed);
+    Subscriber subscriber(id, p_callback, p_priority, p_affinity, p_delivery);
+    if (unlikely(itsReadDepth > 0))
+    {
+        return Pending::defer({&p_channel, std::move(subscriber)}) ? id : 0;
+    }
+    addSubscriber(p_channel, std::move(subscriber));
+    return id;
+}
+
+
+void Broker::addSubscriber(Channel& p_channel, Subscriber&& p_subscriber)
+{
+    updateChannel(p_channel, [&p_subscriber](SubscriberTable& p_table)
+    {
+        p_table.itsSubscribers.push_back(std::move(p_subscriber));
+        return true;
+    });
+}
+
+
+void Broker::unsubscribe(Channel& p_channel, SubscriptionId p_id)
+{
+    updateChannel(p_channel, [p_id](SubscriberTable& p_table)
+    {
+        return std::erase_if(p_table.itsSubscribers, [p_id](const Subscriber& p_subscriber)
+                             { return p_subscriber.itsId == p_id; }) > 0;
+    });
+}
+
+
+void Broker::clear(Channel& p_channel)
+{
+    updateChannel(p_channel, [](SubscriberTable& p_table)
+    {
+        bool changed = !p_table.itsSubscribers.empty();
+        p_table.itsSubscribers.clear();
+        return changed;
+    });
+}
+
+
+TopicStats Broker::getStats(Channel& p_channel)
+{
+    Rcu::ReadGuard guard(itsRcu);
+    const SubscriberTable* table = p_channel.itsTable.load();
+    return p_channel.itsInfo.read((table != nullptr) ? table->itsSubscribers.size() : 0);
+}
+
+
+/**
+ * @brief Replace the subscriber table of a channel by a modified copy
+ *
+ * @param p_channel
+ * @param p_modify modifies the new table, returns false if nothing changed
+ */
+template <typename Modify>
+void Broker::updateChannel(Channel& p_channel, Modify p_modify)
+{
+    std::lock_guard<std::mutex> lock(itsWriterMutex);
+    const SubscriberTable* table = p_channel.itsTable.load();
+    SubscriberTable* newTable = (table != nullptr) ? poolNew<SubscriberTable>(*table) : poolNew<SubscriberTable>();
+    if (!p_modify(*newTable))
+    {
+        poolDelete(newTable);
+        return;
+    }
+    if (newTable->itsSubscribers.empty())
+    {
+        poolDelete(newTable);
+        newTable = nullptr;
+    }
+    else
+    {
+        newTable->updateOrder();
+    }
+    p_channel.itsTable.store(newTable);
+    if (table != nullptr)
+    {
+        itsRcu.retire(const_cast<SubscriberTable*>(table), &poolDeleter<SubscriberTable>);
+    }
+}
+
+
+void Broker::runOp(PendingOp&& p_op)
+{
+    addSubscriber(*p_op.itsChannel, std::move(p_op.itsSubscriber));
+}
+
+
+void Broker::runQueuedCalls()
+{
+    Pending::runAll([this](PendingOp&& p_op) { runOp(std::move(p_op)); });
+}
@@ -10,8 +10,12 @@
 
 #include <stdio.h>
 #include <cstring>
+#include <algorithm>
+#include <bit>
+#include <limits>
 #include "DeferredCallsQueue.hpp"
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_err.h>
 
 #ifndef likely
@@ -36,6 +40,16 @@ static const char TAG[] = "DeferredCallsQueue";
     } while (0)
 
 
+template <typename T>
+static void updateMax(std::atomic<T>& p_max, T p_value)
+{
+    T max = p_max.load(std::memory_order_relaxed);
+    while ((p_value > max) &&
+           !p_max.compare_exchange_weak(max, p_value, std::memory_order_relaxed))
+    {}
+}
+
+
 DeferredCallsQueue &DeferredCallsQueue::getInstance()
 {
     static DeferredCallsQueue instance;
@@ -43,30 +57,329 @@ DeferredCallsQueue &DeferredCallsQueue::getInstance()
 }
 
 
-void DeferredCallsQueue::addDeferredCall(const CallType& p_call, UBaseType_t p_priority, BaseType_t p_core_id)
+bool DeferredCallsQueue::addDeferredCall(CallType&& p_call, UBaseType_t p_priority, BaseType_t p_core_id,
+                                         int64_t p_deadlineUs, DropHandler p_onDrop)
+{
+    UBaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+    CallQueue* queue = selectQueue(p_priority, coreId);
+    //ESP_LOGI(TAG, "Queue entries (p%dc%d): %d", p_priority, p_core_id, uxQueueMessagesWaiting(queue->itsCalls));
+    return addToQueue(queue, p_call, p_priority, coreId, p_deadlineUs, p_onDrop, true);
+}
+
+
+DeferredCallsQueue::CallQueue* DeferredCallsQueue::selectQueue(UBaseType_t p_priority, BaseType_t p_core_id)
+{
+    return (unlikely(p_core_id == tskNO_AFFINITY) && itsDistributeUnpinned.load(std::memory_order_relaxed)) ?
+           getUnpinnedQueue(p_priority) : getQueueList(p_priority, p_core_id);
+}
+
+
+bool DeferredCallsQueue::addToQueue(CallQueue* p_queue, CallType& p_call, UBaseType_t p_priority,
+                                    BaseType_t p_core_id, int64_t p_deadlineUs, const DropHandler& p_onDrop,
+                                    bool p_mayBlock)
 {
-    // perform a clean copy of the function pointer
-    CallType* callCopy = new CallType(p_call);
-    void* queueEntry = static_cast<void*>(callCopy);
+    // keep the order of calls while coalesced calls are pending
+    if (unlikely(p_queue->itsPolicy.load(std::memory_order_relaxed) == OverflowPolicy::Coalesce))
+    {
+        const Coalesced coalesced = coalesce(p_queue, p_call, p_onDrop, true);
+        if (coalesced != Coalesced::NotPending)
+        {
+            return (coalesced == Coalesced::Added);
+        }
+    }
+
+    Slot* slot;
+    if (likely(acquireSlot(p_queue, slot, p_priority, p_core_id, p_mayBlock)))
+    {
+        slot->itsCall = std::move(p_call);
+        slot->itsOnDrop = p_onDrop;
+        stamp(slot);
+        setDeadline(p_queue, slot, p_deadlineUs);
+        post(p_queue, slot);
+        p_queue->itsAdded.fetch_add(1, std::memory_order_relaxed);
+
+        updateMax(p_queue->itsHighWater, uxQueueMessagesWaiting(p_queue->itsCalls));
+        return true;
+    }
+    if (p_queue->itsPolicy.load(std::memory_order_relaxed) == OverflowPolicy::Coalesce)
+    {
+        return (coalesce(p_queue, p_call, p_onDrop, false) == Coalesced::Added);
+    }
+    return false;
+}
 
+
+void DeferredCallsQueue::setQueueConfig(UBaseType_t p_priority, BaseType_t p_core_id, UBaseType_t p_size,
+                                        OverflowPolicy p_policy, uint32_t p_timeoutMs)
+{
     UBaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
 
-    QueueHandle_t queue = getQueueList(p_priority, coreId);
-    //ESP_LOGI(TAG, "Queue entries (p%dc%d): %d", p_priority, p_core_id, uxQueueMessagesWaiting(queue));
-    OS_ERROR_CHECK(xQueueSend(queue, &queueEntry, 5000 / portTICK_PERIOD_MS),
-                   "Cannot add entry to deferred calls queue");
+    auto configure = [this, p_size, p_policy, p_timeoutMs](CallQueue* p_queue)
+    {
+        growQueue(p_queue, p_size);
+        if (p_policy == OverflowPolicy::Coalesce)
+        {
+            reserveOverflow(p_queue);
+        }
+        p_queue->itsPolicy.store(p_policy, std::memory_order_relaxed);
+        p_queue->itsTimeout.store(pdMS_TO_TICKS(p_timeoutMs), std::memory_order_relaxed);
+    };
+    if (unlikely(coreId == tskNO_AFFINITY) && itsDistributeUnpinned.load(std::memory_order_relaxed))
+    {
+        for (CallQueue* queue : getUnpinnedGroup(p_priority, p_size)->itsQueues)
+        {
+            configure(queue);
+        }
+    }
+    else
+    {
+        configure(getQueueList(p_priority, coreId, p_size));
+    }
+}
+
+
+void DeferredCallsQueue::setWorkerPool(BaseType_t p_core_id, UBaseType_t p_numWorkers,
+                                       uint32_t p_stackSize, uint32_t p_caps)
+{
+    BaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+
+    WorkerPool* pool = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(itsQueueListMutex);
+        itsPoolConfigs[coreId] = {p_numWorkers, {p_stackSize, p_caps}};
+        auto it = itsWorkerPools.find(coreId);
+        if ((it != itsWorkerPools.end()) && (p_numWorkers > it->second->itsNumWorkers))
+        {
+            pool = it->second;
+            pool->itsNumWorkers = p_numWorkers;
+            pool->itsStack = {p_stackSize, p_caps};
+        }
+    }
+    if (pool != nullptr)
+    {
+        startWorkers(pool);
+    }
 }
 
 
-DeferredCallsQueue::DeferredCallsQueue()
-{}
+bool DeferredCallsQueue::setStackSize(UBaseType_t p_priority, BaseType_t p_core_id, uint32_t p_stackSize,
+                                      uint32_t p_caps)
+{
+    BaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+    const uint32_t key = queueKey(p_priority, coreId);
+
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    itsStackConfigs[key] = {p_stackSize, p_caps};
+    return (itsQueueList.find(key) == itsQueueList.end());
+}
+
+
+bool DeferredCallsQueue::reserveStack(UBaseType_t p_priority, BaseType_t p_core_id, uint32_t p_stackSize)
+{
+    BaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+    const uint32_t key = queueKey(p_priority, coreId);
+
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    StackConfig& config = itsStackConfigs.try_emplace(key, getStackConfig(key)).first->second;
+    config.itsSize = std::max(config.itsSize, p_stackSize);
+
+    auto it = itsQueueList.find(key);
+    if (it == itsQueueList.end())
+    {
+        return true;
+    }
+    const CallQueue* queue = it->second;
+    const uint32_t actualSize = (queue->itsPool != nullptr) ? queue->itsPool->itsStack.itsSize : queue->itsStack.itsSize;
+    return (actualSize >= p_stackSize);
+}
+
+
+std::vector<DeferredCallsQueue::TaskStats> DeferredCallsQueue::getTaskStats()
+{
+    std::vector<TaskStats> stats;
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    for (const TaskInfo& task : itsTasks)
+    {
+        stats.push_back({pcTaskGetName(task.itsHandle), uxTaskPriorityGet(task.itsHandle),
+                         xTaskGetAffinity(task.itsHandle), task.itsStackSize,
+                         (uint32_t) uxTaskGetStackHighWaterMark(task.itsHandle)});
+    }
+    return stats;
+}
+
+
+DeferredCallsQueue::QueueStats DeferredCallsQueue::getQueueStats(UBaseType_t p_priority, BaseType_t p_core_id)
+{
+    UBaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+
+    CallQueue* queue = findQueue(p_priority, coreId);
+    if (queue == nullptr)
+    {
+        QueueStats stats = {};
+        stats.itsPriority = p_priority;
+        stats.itsCoreId = coreId;
+        return stats;
+    }
+    return readStats(queue);
+}
+
+
+std::vector<DeferredCallsQueue::QueueStats> DeferredCallsQueue::getStats()
+{
+    std::vector<QueueStats> stats;
+    if (itsISRQueue != nullptr)
+    {
+        stats.push_back(readStats(itsISRQueue));
+    }
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    for (auto& entry : itsQueueList)
+    {
+        stats.push_back(readStats(entry.second));
+    }
+    return stats;
+}
+
+
+void DeferredCallsQueue::resetStats()
+{
+    if (itsISRQueue != nullptr)
+    {
+        resetStats(itsISRQueue);
+    }
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    for (auto& entry : itsQueueList)
+    {
+        resetStats(entry.second);
+    }
+}
+
+
+LatencyHistogram::Snapshot DeferredCallsQueue::getLatency(UBaseType_t p_priority, BaseType_t p_core_id)
+{
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+    UBaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+
+    CallQueue* queue = findQueue(p_priority, coreId);
+    if (queue != nullptr)
+    {
+        return queue->itsLatency.read();
+    }
+#endif
+    return LatencyHistogram().read();
+}
+
+
+void DeferredCallsQueue::setBatching(UBaseType_t p_priority, BaseType_t p_core_id, uint32_t p_maxCalls,
+                                     uint32_t p_maxTimeUs)
+{
+    UBaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+
+    auto configure = [p_maxCalls, p_maxTimeUs](CallQueue* p_queue)
+    {
+        p_queue->itsBatchCalls.store(std::max<uint32_t>(p_maxCalls, 1), std::memory_order_relaxed);
+        p_queue->itsBatchTimeUs.store(p_maxTimeUs, std::memory_order_relaxed);
+    };
+    if (unlikely(coreId == tskNO_AFFINITY) && itsDistributeUnpinned.load(std::memory_order_relaxed))
+    {
+        for (CallQueue* queue : getUnpinnedGroup(p_priority)->itsQueues)
+        {
+            configure(queue);
+        }
+    }
+    else
+    {
+        configure(getQueueList(p_priority, coreId));
+    }
+}
+
+
+void DeferredCallsQueue::setDeadlineScheduling(UBaseType_t p_priority, BaseType_t p_core_id, bool p_earliestFirst,
+                                               ExpiredPolicy p_expired)
+{
+    UBaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+
+    auto configure = [p_earliestFirst, p_expired](CallQueue* p_queue)
+    {
+        p_queue->itsExpiredPolicy.store(p_expired, std::memory_order_relaxed);
+        p_queue->itsEarliestFirst.store(p_earliestFirst, std::memory_order_relaxed);
+    };
+    if (unlikely(coreId == tskNO_AFFINITY) && itsDistributeUnpinned.load(std::memory_order_relaxed))
+    {
+        for (CallQueue* queue : getUnpinnedGroup(p_priority)->itsQueues)
+        {
+            configure(queue);
+        }
+    }
+    else
+    {
+        configure(getQueueList(p_priority, coreId));
+    }
+}
+
 
+bool DeferredCallsQueue::getCurrentQueue(UBaseType_t& p_priority, BaseType_t& p_core_id)
+{
+    const CallQueue* queue = itsRunningQueue;
+    if (queue == nullptr)
+    {
+        p_priority = uxTaskPriorityGet(NULL);
+        p_core_id = xTaskGetAffinity(NULL);
+        return false;
+    }
+    p_priority = queue->itsPriority;
+    p_core_id = (queue->itsGroup != nullptr) ? tskNO_AFFINITY : queue->itsCoreId;
+    return true;
+}
+
+
+void DeferredCallsQueue::setUnpinnedDistribution(bool p_enable)
+{
+    itsDistributeUnpinned.store(p_enable, std::memory_order_relaxed);
+}
+
+
+DeferredCallsQueue::DirectLink& DeferredCallsQueue::createDirectLink(UBaseType_t p_priority, BaseType_t p_core_id,
+                                                                     UBaseType_t p_size, uint32_t p_stackSize,
+                                                                     uint32_t p_caps)
+{
+    UBaseType_t coreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+
+    DirectLink* link = new DirectLink(p_priority, coreId, std::clamp<UBaseType_t>(p_size, 1, itsMaxQueueSize));
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(itsQueueListMutex);
+        index = itsLinks.size();
+        itsLinks.push_back(link);
+    }
+    char taskName[30];
+    snprintf(taskName, sizeof(taskName), "DefCalls-l%uc%c", (unsigned) index, coreToChar(coreId));
+    link->itsTask = spawnTask(DirectLink::linkTaskWrapper, taskName, static_cast<void*>(link), p_priority, coreId,
+                              {p_stackSize, p_caps});
+    return *link;
+}
 
-QueueHandle_t DeferredCallsQueue::getQueueList(UBaseType_t p_priority, BaseType_t p_core_id)
+
+DeferredCallsQueue::DeferredCallsQueue() :
+    itsISRQueue(nullptr),
+    itsISRDropCount(0),
+    itsDistributeUnpinned(CONFIG_PUBSUB_DISTRIBUTE_UNPINNED)
+{
+#if CONFIG_PUBSUB_ISR_QUEUE_SIZE > 0
+    // ISRs cannot create queues on demand
+    itsISRQueue = createQueue(CONFIG_PUBSUB_ISR_TASK_PRIORITY, tskNO_AFFINITY,
+                              CONFIG_PUBSUB_ISR_QUEUE_SIZE, CONFIG_PUBSUB_ISR_QUEUE_SIZE);
+    itsISRQueue->itsStack = {itsDefaultStackSize, itsDefaultStackCaps};
+    createTask(itsISRQueue, "DefCalls-isr", CONFIG_PUBSUB_ISR_TASK_PRIORITY, tskNO_AFFINITY);
+#endif
+}
+
+
+DeferredCallsQueue::CallQueue* DeferredCallsQueue::getQueueList(UBaseType_t p_priority, BaseType_t p_core_id,
+                                                                UBaseType_t p_numCalls)
 {
-    QueueHandle_t queue = nullptr;
+    CallQueue* queue = nullptr;
     bool newEntry = false;
-    const uint32_t key = ((p_priority & 0xffff) << 16) | (p_core_id & 0xffff);
+    const uint32_t key = queueKey(p_priority, p_core_id);
 
     itsQueueListMutex.lock();
 
@@ -77,8 +390,20 @@ QueueHandle_t DeferredCallsQueue::getQueueList(UBaseType_t p_priority, BaseType_
     }
     else
     {
-        // create new queue
-        queue = xQueueCreate(itsQueueSize, sizeof(CallType*));
+        queue = createQueue(p_priority, p_core_id, std::min(p_numCalls, itsMaxQueueSize), itsMaxQueueSize);
+        queue->itsStack = getStackConfig(key);
+        // the pool must be known before the first call is added
+        WorkerPool* pool = getWorkerPool(p_core_id);
+        if (pool != nullptr)
+        {
+            addToPool(pool, queue);
+            if (unlikely(queue->itsStack.itsSize > pool->itsStack.itsSize))
+            {
+                ESP_LOGW(TAG, "Calls of priority %d, core %d need %u bytes of stack, the workers have %u",
+                         p_priority, p_core_id, (unsigned) queue->itsStack.itsSize,
+                         (unsigned) pool->itsStack.itsSize);
+            }
+        }
         itsQueueList[key] = queue;
         newEntry = true;
     }
@@ -87,19 +412,531 @@ QueueHandle_t DeferredCallsQueue::getQueueList(UBaseType_t p_priority, BaseType_
 
     if (unlikely(newEntry))
     {
-        // create associated task with a significant name
-        char taskName[30];
-        snprintf(taskName, sizeof(taskName), "DefCalls-p%dc%c",
-                 p_priority, coreToChar(p_core_id));
-        //ESP_LOGI(TAG, "Creating new task '%s'", taskName);
-        OS_ERROR_CHECK(xTaskCreatePinnedToCore(callerTaskWrapper, taskName, 4096 * 2,
-                                               static_cast<void*>(queue), p_priority, NULL, p_core_id),
-                       "Cannot create calls queue for priority %d, core %d", p_priority, p_core_id);
+        if (queue->itsPool != nullptr)
+        {
+            startWorkers(queue->itsPool);
+        }
+        else
+        {
+            // create associated task with a significant name
+            char taskName[30];
+            snprintf(taskName, sizeof(taskName), "DefCalls-p%dc%c",
+                     p_priority, coreToChar(p_core_id));
+            createTask(queue, taskName, p_priority, p_core_id);
+        }
+    }
+    return queue;
+}
+
+
+DeferredCallsQueue::CallQueue* DeferredCallsQueue::findQueue(UBaseType_t p_priority, BaseType_t p_core_id)
+{
+    const uint32_t key = queueKey(p_priority, p_core_id);
+
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    auto it = itsQueueList.find(key);
+    return (it != itsQueueList.end()) ? it->second : nullptr;
+}
+
+
+DeferredCallsQueue::CallQueue* DeferredCallsQueue::createQueue(UBaseType_t p_priority, BaseType_t p_core_id,
+                                                               UBaseType_t p_numCalls, UBaseType_t p_maxCalls)
+{
+    // one slot more than the queue size is needed as a slot is only
+    // released after its call has returned, plus one for the flush slot
+    CallQueue* queue = new CallQueue();
+    queue->itsCalls = xQueueCreate(p_maxCalls + 2, sizeof(Slot*));
+    queue->itsFreeSlots = xQueueCreate(p_maxCalls + 1, sizeof(Slot*));
+    queue->itsFlushSlot.itsCall = CallType([queue]() { runCoalesced(queue); });
+    queue->itsBatchCalls.store(CONFIG_PUBSUB_BATCH_CALLS, std::memory_order_relaxed);
+    queue->itsBatchTimeUs.store(CONFIG_PUBSUB_BATCH_TIME_US, std::memory_order_relaxed);
+    queue->itsPolicy.store(itsDefaultPolicy, std::memory_order_relaxed);
+    queue->itsTimeout.store(pdMS_TO_TICKS(CONFIG_PUBSUB_QUEUE_BLOCK_TIMEOUT_MS), std::memory_order_relaxed);
+    queue->itsEarliestFirst.store(false, std::memory_order_relaxed);
+    queue->itsExpiredPolicy.store(ExpiredPolicy::Run, std::memory_order_relaxed);
+    queue->itsOverflowSize = 0;
+    queue->itsOverflowHead = 0;
+    queue->itsOverflowCount = 0;
+    queue->itsFlushPending = false;
+    queue->itsPriority = p_priority;
+    queue->itsCoreId = p_core_id;
+    queue->itsPool = nullptr;
+    queue->itsGroup = nullptr;
+    queue->itsClaimed = false;
+
+    // the additional slot for the call being executed is not counted
+    addSlots(queue, p_numCalls + 1);
+    queue->itsSize.store(p_numCalls, std::memory_order_relaxed);
+    if (itsDefaultPolicy == OverflowPolicy::Coalesce)
+    {
+        reserveOverflow(queue);
+    }
+    return queue;
+}
+
+
+void DeferredCallsQueue::growQueue(CallQueue* p_queue, UBaseType_t p_numCalls)
+{
+    if (unlikely(p_numCalls > itsMaxQueueSize))
+    {
+        ESP_LOGW(TAG, "Queue size %u exceeds the maximum of %u", (unsigned) p_numCalls, (unsigned) itsMaxQueueSize);
+        p_numCalls = itsMaxQueueSize;
+    }
+
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    const UBaseType_t size = p_queue->itsSize.load(std::memory_order_relaxed);
+    if (p_numCalls > size)
+    {
+        addSlots(p_queue, p_numCalls - size);
+        p_queue->itsSize.store(p_numCalls, std::memory_order_relaxed);
+    }
+}
+
+
+void DeferredCallsQueue::addSlots(CallQueue* p_queue, UBaseType_t p_numSlots)
+{
+    // slots are never released, queues live as long as the program
+    Slot* slots = new Slot[p_numSlots];
+    for (UBaseType_t i = 0; i < p_numSlots; i++)
+    {
+        Slot* slot = &slots[i];
+        xQueueSend(p_queue->itsFreeSlots, &slot, 0);
+    }
+}
+
+
+bool DeferredCallsQueue::acquireSlot(CallQueue* p_queue, Slot*& p_slot, UBaseType_t p_priority,
+                                     BaseType_t p_core_id, bool p_mayBlock)
+{
+    if (likely(xQueueReceive(p_queue->itsFreeSlots, &p_slot, 0) == pdPASS))
+    {
+        return true;
+    }
+
+    switch (p_queue->itsPolicy.load(std::memory_order_relaxed))
+    {
+    case OverflowPolicy::Block:
+    {
+        if (unlikely(!p_mayBlock))
+        {
+            ESP_LOGW(TAG, "Dropping deferred call, queue p%dc%c is full", p_priority, coreToChar(p_core_id));
+            break;
+        }
+
+        // only the slow path is timed
+        const int64_t start = esp_timer_get_time();
+        const bool acquired = (xQueueReceive(p_queue->itsFreeSlots, &p_slot,
+                                             p_queue->itsTimeout.load(std::memory_order_relaxed)) == pdPASS);
+        const uint32_t waitTimeUs = esp_timer_get_time() - start;
+        p_queue->itsWaits.fetch_add(1, std::memory_order_relaxed);
+        p_queue->itsWaitTimeUs.fetch_add(waitTimeUs, std::memory_order_relaxed);
+        updateMax(p_queue->itsMaxWaitTimeUs, waitTimeUs);
+        if (likely(acquired))
+        {
+            return true;
+        }
+        ESP_LOGW(TAG, "Dropping deferred call, queue p%dc%c is full", p_priority, coreToChar(p_core_id));
+        p_queue->itsTimeouts.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+
+    case OverflowPolicy::DropOldest:
+        while (true)
+        {
+            if (xQueueReceive(p_queue->itsCalls, &p_slot, 0) == pdPASS)
+            {
+                if (p_slot != &p_queue->itsFlushSlot)
+                {
+                    drop(p_slot);
+                    p_queue->itsDropped.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                // the oldest entry holds the coalesced calls
+                dropCoalesced(p_queue);
+            }
+            // the pending calls may have been taken by the task in the meantime
+            if (xQueueReceive(p_queue->itsFreeSlots, &p_slot, 0) == pdPASS)
+            {
+                return true;
+            }
+        }
+
+    case OverflowPolicy::Coalesce:
+        // the call is taken over by coalesce()
+        return false;
+
+    case OverflowPolicy::DropNewest:
+    default:
+        break;
+    }
+    p_queue->itsDropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+
+void DeferredCallsQueue::post(CallQueue* p_queue, Slot* p_slot)
+{
+    // cannot fail, the queue is large enough to hold all slots
+    xQueueSend(p_queue->itsCalls, &p_slot, 0);
+    if (p_queue->itsPool != nullptr)
+    {
+        xSemaphoreGive(p_queue->itsPool->itsPending);
+    }
+    else if (p_queue->itsGroup != nullptr)
+    {
+        xSemaphoreGive(p_queue->itsGroup->itsPending);
+    }
+}
+
+
+DeferredCallsQueue::WorkerPool* DeferredCallsQueue::getWorkerPool(BaseType_t p_core_id)
+{
+    // called with itsQueueListMutex locked
+    PoolConfig config = {CONFIG_PUBSUB_WORKERS_PER_CORE, {itsDefaultStackSize, itsDefaultStackCaps}};
+    auto configured = itsPoolConfigs.find(p_core_id);
+    if (configured != itsPoolConfigs.end())
+    {
+        config = configured->second;
+    }
+    if (config.itsNumWorkers == 0)
+    {
+        return nullptr;
+    }
+
+    auto it = itsWorkerPools.find(p_core_id);
+    if (it != itsWorkerPools.end())
+    {
+        return it->second;
+    }
+    WorkerPool* pool = new WorkerPool();
+    pool->itsCoreId = p_core_id;
+    pool->itsPending = xSemaphoreCreateCounting(std::numeric_limits<UBaseType_t>::max(), 0);
+    pool->itsMaxPriority.store(0, std::memory_order_relaxed);
+    pool->itsNumWorkers = config.itsNumWorkers;
+    pool->itsNumStarted = 0;
+    pool->itsStack = config.itsStack;
+    itsWorkerPools[p_core_id] = pool;
+    return pool;
+}
+
+
+DeferredCallsQueue::UnpinnedGroup* DeferredCallsQueue::getUnpinnedGroup(UBaseType_t p_priority,
+                                                                         UBaseType_t p_numCalls)
+{
+    UnpinnedGroup* group = nullptr;
+    bool newEntry = false;
+    {
+        std::lock_guard<std::mutex> lock(itsQueueListMutex);
+        auto it = itsUnpinnedGroups.find(p_priority);
+        if (likely(it != itsUnpinnedGroups.end()))
+        {
+            group = it->second;
+        }
+        else
+        {
+            group = new UnpinnedGroup();
+            group->itsPending = xSemaphoreCreateCounting(std::numeric_limits<UBaseType_t>::max(), 0);
+            // configured like the single queue of calls without affinity
+            const StackConfig stack = getStackConfig(queueKey(p_priority, tskNO_AFFINITY));
+            for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+            {
+                CallQueue* queue = createQueue(p_priority, core, std::min(p_numCalls, itsMaxQueueSize),
+                                               itsMaxQueueSize);
+                queue->itsStack = stack;
+                queue->itsGroup = group;
+                group->itsQueues[core] = queue;
+                itsQueueList[unpinnedKey(p_priority, core)] = queue;
+            }
+            itsUnpinnedGroups[p_priority] = group;
+            newEntry = true;
+        }
+    }
+
+    if (unlikely(newEntry))
+    {
+        for (CallQueue* queue : group->itsQueues)
+        {
+            char taskName[30];
+            snprintf(taskName, sizeof(taskName), "DefCalls-p%du%c",
+                     p_priority, coreToChar(queue->itsCoreId));
+            spawnTask(unpinnedTaskWrapper, taskName, static_cast<void*>(queue), p_priority, queue->itsCoreId,
+                      queue->itsStack);
+        }
+    }
+    return group;
+}
+
+
+DeferredCallsQueue::CallQueue* DeferredCallsQueue::getUnpinnedQueue(UBaseType_t p_priority)
+{
+    UnpinnedGroup* group = getUnpinnedGroup(p_priority);
+    // the caller's core unless another one has less backlog
+    CallQueue* queue = group->itsQueues[xPortGetCoreID()];
+    UBaseType_t pending = uxQueueMessagesWaiting(queue->itsCalls);
+    for (CallQueue* other : group->itsQueues)
+    {
+        const UBaseType_t otherPending = uxQueueMessagesWaiting(other->itsCalls);
+        if (otherPending < pending)
+        {
+            queue = other;
+            pending = otherPending;
+        }
     }
     return queue;
 }
 
 
+void DeferredCallsQueue::addToPool(WorkerPool* p_pool, CallQueue* p_queue)
+{
+    std::lock_guard<std::mutex> lock(p_pool->itsMutex);
+    auto position = std::upper_bound(p_pool->itsQueues.begin(), p_pool->itsQueues.end(), p_queue,
+                                     [](const CallQueue* p_a, const CallQueue* p_b)
+                                     { return p_a->itsPriority > p_b->itsPriority; });
+    p_pool->itsQueues.insert(position, p_queue);
+    p_pool->itsMaxPriority.store(p_pool->itsQueues.front()->itsPriority, std::memory_order_relaxed);
+    p_queue->itsPool = p_pool;
+}
+
+
+void DeferredCallsQueue::startWorkers(WorkerPool* p_pool)
+{
+    UBaseType_t first;
+    UBaseType_t last;
+    StackConfig stack;
+    {
+        std::lock_guard<std::mutex> lock(itsQueueListMutex);
+        first = p_pool->itsNumStarted;
+        last = p_pool->itsNumWorkers;
+        p_pool->itsNumStarted = last;
+        stack = p_pool->itsStack;
+    }
+    for (UBaseType_t i = first; i < last; i++)
+    {
+        char taskName[30];
+        snprintf(taskName, sizeof(taskName), "DefCalls-w%uc%c", (unsigned) i, coreToChar(p_pool->itsCoreId));
+        spawnTask(workerTaskWrapper, taskName, static_cast<void*>(p_pool),
+                  p_pool->itsMaxPriority.load(std::memory_order_relaxed), p_pool->itsCoreId, stack);
+    }
+}
+
+
+DeferredCallsQueue::Coalesced DeferredCallsQueue::coalesce(CallQueue* p_queue, CallType& p_call,
+                                                           const DropHandler& p_onDrop, bool p_onlyIfPending)
+{
+    std::lock_guard<std::mutex> lock(p_queue->itsOverflowMutex);
+    if (p_onlyIfPending && !p_queue->itsFlushPending)
+    {
+        return Coalesced::NotPending;
+    }
+    if (unlikely(p_queue->itsOverflowCount >= p_queue->itsOverflowSize))
+    {
+        // the batch entry holds no more calls than the queue itself
+        p_queue->itsDropped.fetch_add(1, std::memory_order_relaxed);
+        return Coalesced::Dropped;
+    }
+    Slot& entry = p_queue->itsOverflow[(p_queue->itsOverflowHead + p_queue->itsOverflowCount) %
+                                       p_queue->itsOverflowSize];
+    entry.itsCall = std::move(p_call);
+    entry.itsOnDrop = p_onDrop;
+    p_queue->itsOverflowCount++;
+    p_queue->itsCoalesced.fetch_add(1, std::memory_order_relaxed);
+    if (!p_queue->itsFlushPending)
+    {
+        // the queue has room for the flush slot in addition to all other slots
+        Slot* slot = &p_queue->itsFlushSlot;
+        stamp(slot);
+        setDeadline(p_queue, slot, itsNoDeadline);
+        post(p_queue, slot);
+        p_queue->itsFlushPending = true;
+    }
+    return Coalesced::Added;
+}
+
+
+void DeferredCallsQueue::reserveOverflow(CallQueue* p_queue)
+{
+    const UBaseType_t size = p_queue->itsSize.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(p_queue->itsOverflowMutex);
+    if (size <= p_queue->itsOverflowSize)
+    {
+        return;
+    }
+    // allocated when configuring the queue, so coalescing never allocates
+    std::unique_ptr<Slot[]> overflow(new Slot[size]);
+    for (UBaseType_t i = 0; i < p_queue->itsOverflowCount; i++)
+    {
+        const UBaseType_t index = (p_queue->itsOverflowHead + i) % p_queue->itsOverflowSize;
+        overflow[i].itsCall = std::move(p_queue->itsOverflow[index].itsCall);
+    }
+    p_queue->itsOverflow = std::move(overflow);
+    p_queue->itsOverflowSize = size;
+    p_queue->itsOverflowHead = 0;
+}
+
+
+UBaseType_t DeferredCallsQueue::beginCoalesced(CallQueue* p_queue)
+{
+    // calls coalesced from now on are appended and post the flush slot again
+    std::lock_guard<std::mutex> lock(p_queue->itsOverflowMutex);
+    p_queue->itsFlushPending = false;
+    return p_queue->itsOverflowCount;
+}
+
+
+bool DeferredCallsQueue::takeCoalesced(CallQueue* p_queue, Slot& p_entry)
+{
+    std::lock_guard<std::mutex> lock(p_queue->itsOverflowMutex);
+    if (p_queue->itsOverflowCount == 0)
+    {
+        // dropped by OverflowPolicy::DropOldest meanwhile
+        return false;
+    }
+    Slot& entry = p_queue->itsOverflow[p_queue->itsOverflowHead];
+    p_entry.itsCall = std::move(entry.itsCall);
+    p_entry.itsOnDrop = entry.itsOnDrop;
+    p_queue->itsOverflowHead = (p_queue->itsOverflowHead + 1) % p_queue->itsOverflowSize;
+    p_queue->itsOverflowCount--;
+    return true;
+}
+
+
+void DeferredCallsQueue::dropCoalesced(CallQueue* p_queue)
+{
+    // one at a time, so the drop handlers run without the lock
+    const UBaseType_t numCalls = beginCoalesced(p_queue);
+    Slot entry;
+    for (UBaseType_t i = 0; (i < numCalls) && takeCoalesced(p_queue, entry); i++)
+    {
+        drop(&entry);
+        p_queue->itsDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+void DeferredCallsQueue::runCoalesced(CallQueue* p_queue)
+{
+    const UBaseType_t numCalls = beginCoalesced(p_queue);
+    Slot entry;
+    for (UBaseType_t i = 0; (i < numCalls) && takeCoalesced(p_queue, entry); i++)
+    {
+        entry.itsCall();
+        entry.itsCall.reset();
+    }
+}
+
+
+void DeferredCallsQueue::drop(Slot* p_slot)
+{
+    p_slot->itsOnDrop();
+    p_slot->itsOnDrop = {};
+    p_slot->itsCall.reset();
+}
+
+
+DeferredCallsQueue::QueueStats DeferredCallsQueue::readStats(CallQueue* p_queue)
+{
+    QueueStats stats;
+    stats.itsPriority = p_queue->itsPriority;
+    stats.itsCoreId = p_queue->itsCoreId;
+    stats.itsSize = p_queue->itsSize.load(std::memory_order_relaxed);
+    stats.itsPending = uxQueueMessagesWaiting(p_queue->itsCalls);
+    stats.itsHighWater = p_queue->itsHighWater.load(std::memory_order_relaxed);
+    stats.itsAdded = p_queue->itsAdded.load(std::memory_order_relaxed);
+    stats.itsDropped = p_queue->itsDropped.load(std::memory_order_relaxed);
+    stats.itsTimeouts = p_queue->itsTimeouts.load(std::memory_order_relaxed);
+    stats.itsCoalesced = p_queue->itsCoalesced.load(std::memory_order_relaxed);
+    stats.itsWaits = p_queue->itsWaits.load(std::memory_order_relaxed);
+    stats.itsWaitTimeUs = p_queue->itsWaitTimeUs.load(std::memory_order_relaxed);
+    stats.itsMaxWaitTimeUs = p_queue->itsMaxWaitTimeUs.load(std::memory_order_relaxed);
+    stats.itsExecuted = p_queue->itsExecuted.load(std::memory_order_relaxed);
+    stats.itsExecTimeUs = p_queue->itsExecTimeUs.load(std::memory_order_relaxed);
+    stats.itsMaxExecTimeUs = p_queue->itsMaxExecTimeUs.load(std::memory_order_relaxed);
+    stats.itsUnpinned = (p_queue->itsGroup != nullptr);
+    stats.itsStolen = p_queue->itsStolen.load(std::memory_order_relaxed);
+    stats.itsMissed = p_queue->itsMissed.load(std::memory_order_relaxed);
+    stats.itsExpired = p_queue->itsExpired.load(std::memory_order_relaxed);
+    stats.itsEarliestFirst = p_queue->itsEarliestFirst.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+void DeferredCallsQueue::resetStats(CallQueue* p_queue)
+{
+    p_queue->itsHighWater.store(uxQueueMessagesWaiting(p_queue->itsCalls), std::memory_order_relaxed);
+    p_queue->itsAdded.store(0, std::memory_order_relaxed);
+    p_queue->itsDropped.store(0, std::memory_order_relaxed);
+    p_queue->itsTimeouts.store(0, std::memory_order_relaxed);
+    p_queue->itsCoalesced.store(0, std::memory_order_relaxed);
+    p_queue->itsWaits.store(0, std::memory_order_relaxed);
+    p_queue->itsWaitTimeUs.store(0, std::memory_order_relaxed);
+    p_queue->itsMaxWaitTimeUs.store(0, std::memory_order_relaxed);
+    p_queue->itsExecuted.store(0, std::memory_order_relaxed);
+    p_queue->itsExecTimeUs.store(0, std::memory_order_relaxed);
+    p_queue->itsMaxExecTimeUs.store(0, std::memory_order_relaxed);
+    p_queue->itsStolen.store(0, std::memory_order_relaxed);
+    p_queue->itsMissed.store(0, std::memory_order_relaxed);
+    p_queue->itsExpired.store(0, std::memory_order_relaxed);
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+    p_queue->itsLatency.reset();
+#endif
+}
+
+
+void DeferredCallsQueue::createTask(CallQueue* p_queue, const char* p_name, UBaseType_t p_priority,
+                                    BaseType_t p_core_id)
+{
+    //ESP_LOGI(TAG, "Creating new task '%s'", p_name);
+    spawnTask(callerTaskWrapper, p_name, static_cast<void*>(p_queue), p_priority, p_core_id, p_queue->itsStack);
+}
+
+
+TaskHandle_t DeferredCallsQueue::spawnTask(TaskFunction_t p_function, const char* p_name, void* p_parameter,
+                                           UBaseType_t p_priority, BaseType_t p_core_id, const StackConfig& p_stack)
+{
+    TaskHandle_t task = nullptr;
+    if (p_stack.itsCaps == 0)
+    {
+        OS_ERROR_CHECK(xTaskCreatePinnedToCore(p_function, p_name, p_stack.itsSize, p_parameter,
+                                               p_priority, &task, p_core_id),
+                       "Cannot create task '%s' with %u bytes of stack", p_name, (unsigned) p_stack.itsSize);
+    }
+    else
+    {
+        // the task control block has to be in internal RAM, the tasks are never deleted
+        StaticTask_t* taskBuffer = static_cast<StaticTask_t*>(
+            heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        StackType_t* stack = static_cast<StackType_t*>(heap_caps_malloc(p_stack.itsSize, p_stack.itsCaps));
+        if (likely((taskBuffer != nullptr) && (stack != nullptr)))
+        {
+            task = xTaskCreateStaticPinnedToCore(p_function, p_name, p_stack.itsSize, p_parameter,
+                                                 p_priority, stack, taskBuffer, p_core_id);
+        }
+        if (unlikely(task == nullptr))
+        {
+            ESP_LOGE(TAG, "Cannot create task '%s' with %u bytes of stack (caps 0x%x)", p_name,
+                     (unsigned) p_stack.itsSize, (unsigned) p_stack.itsCaps);
+            ESP_ERROR_CHECK(ESP_FAIL);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(itsQueueListMutex);
+    itsTasks.push_back({task, p_stack.itsSize});
+    return task;
+}
+
+
+DeferredCallsQueue::StackConfig DeferredCallsQueue::getStackConfig(uint32_t p_key) const
+{
+    // called with itsQueueListMutex locked
+    auto it = itsStackConfigs.find(p_key);
+    if (it != itsStackConfigs.end())
+    {
+        return it->second;
+    }
+    return {itsDefaultStackSize, itsDefaultStackCaps};
+}
+
+
 char DeferredCallsQueue::coreToChar(BaseType_t p_core_id) const
 {
     char coreChr = '?';
@@ -115,21 +952,132 @@ char DeferredCallsQueue::coreToChar(BaseType_t p_core_id) const
 }
 
 
-void DeferredCallsQueue::callerTask(QueueHandle_t p_queue)
+uint32_t DeferredCallsQueue::runBatch(CallQueue* p_queue, Slot* p_first)
+{
+    itsRunningQueue = p_queue;
+    if (unlikely(p_queue->itsEarliestFirst.load(std::memory_order_relaxed)))
+    {
+        return runEarliestFirst(p_queue, p_first);
+    }
+
+    // run a batch of calls before yielding
+    const uint32_t maxCalls = p_queue->itsBatchCalls.load(std::memory_order_relaxed);
+    const uint32_t maxTimeUs = p_queue->itsBatchTimeUs.load(std::memory_order_relaxed);
+    const int64_t start = esp_timer_get_time();
+    int64_t callStart = start;
+    uint32_t numCalls = 0;
+    Slot* functionToCall = p_first;
+    do
+    {
+        callStart = runCall(p_queue, functionToCall, callStart);
+        numCalls++;
+    } while ((numCalls < maxCalls) &&
+             ((maxTimeUs == 0) || (callStart - start < maxTimeUs)) &&
+             (xQueueReceive(p_queue->itsCalls, &functionToCall, 0) == pdPASS));
+    return numCalls;
+}
+
+
+uint32_t DeferredCallsQueue::runEarliestFirst(CallQueue* p_queue, Slot* p_first)
+{
+    const uint32_t maxCalls = p_queue->itsBatchCalls.load(std::memory_order_relaxed);
+    const uint32_t maxTimeUs = p_queue->itsBatchTimeUs.load(std::memory_order_relaxed);
+    const int64_t start = esp_timer_get_time();
+    int64_t callStart = start;
+    uint32_t numCalls = 0;
+
+    // all slots of the largest queue plus the flush slot
+    std::array<Slot*, CONFIG_PUBSUB_QUEUE_MAX_SIZE + 2> heap;
+    std::size_t heapSize = 0;
+    auto push = [&heap, &heapSize](Slot* p_slot)
+    {
+        heap[heapSize++] = p_slot;
+        std::push_heap(heap.begin(), heap.begin() + heapSize, runsAfter);
+    };
+    push(p_first);
+
+    while (true)
+    {
+        // calls added meanwhile may have an earlier deadline
+        Slot* slot;
+        while ((heapSize < heap.size()) && (xQueueReceive(p_queue->itsCalls, &slot, 0) == pdPASS))
+        {
+            push(slot);
+        }
+        if (heapSize == 0)
+        {
+            break;
+        }
+        std::pop_heap(heap.begin(), heap.begin() + heapSize, runsAfter);
+        callStart = runCall(p_queue, heap[--heapSize], callStart);
+        numCalls++;
+        if ((numCalls >= maxCalls) || ((maxTimeUs != 0) && (callStart - start >= maxTimeUs)))
+        {
+            break;
+        }
+    }
+
+    // the remaining calls go back to the queue, so other tasks and the stats see them
+    for (std::size_t i = 0; i < heapSize; i++)
+    {
+        xQueueSendToFront(p_queue->itsCalls, &heap[i], 0);
+    }
+    return numCalls;
+}
+
+
+int64_t DeferredCallsQueue::runCall(CallQueue* p_queue, Slot* p_slot, int64_t p_start)
+{
+    int64_t callEnd = p_start;
+    bool expired = false;
+    if (unlikely(p_slot->itsDeadlineUs < p_start))
+    {
+        p_queue->itsMissed.fetch_add(1, std::memory_order_relaxed);
+        expired = (p_queue->itsExpiredPolicy.load(std::memory_order_relaxed) == ExpiredPolicy::Drop);
+        if (expired)
+        {
+            p_queue->itsExpired.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (unlikely(expired))
+    {
+        drop(p_slot);
+    }
+    else
+    {
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+        p_queue->itsLatency.record(p_start - p_slot->itsAddedUs);
+#endif
+        p_slot->itsCall();
+        callEnd = esp_timer_get_time();
+        const uint32_t execTimeUs = callEnd - p_start;
+        p_queue->itsExecuted.fetch_add(1, std::memory_order_relaxed);
+        p_queue->itsExecTimeUs.fetch_add(execTimeUs, std::memory_order_relaxed);
+        updateMax(p_queue->itsMaxExecTimeUs, execTimeUs);
+    }
+    // the flush slot is reused and never becomes a free slot
+    if (likely(p_slot != &p_queue->itsFlushSlot))
+    {
+        p_slot->itsCall.reset();
+        p_slot->itsOnDrop = {};
+        xQueueSend(p_queue->itsFreeSlots, &p_slot, 0);
+    }
+    return callEnd;
+}
+
+
+void DeferredCallsQueue::callerTask(CallQueue* p_queue)
 {
     while (true)
     {
-        CallType* functionToCall;
-        //ESP_LOGI(TAG, "%s: Waiting for next call (queue size = %d)", pcTaskGetName(nullptr), uxQueueMessagesWaiting(p_queue));;
-        if (likely(xQueueReceive(p_queue, &functionToCall, portMAX_DELAY) == pdPASS))
+        Slot* functionToCall;
+        if (likely(xQueueReceive(p_queue->itsCalls, &functionToCall, portMAX_DELAY) == pdPASS))
         {
-            //ESP_LOGI(TAG, "%s: Invoking next call (queue size = %d)", pcTaskGetName(nullptr), uxQueueMessagesWaiting(p_queue));;
-            (*functionToCall)();
-            delete functionToCall;
+            runBatch(p_queue, functionToCall);
         }
         else
         {
-            ESP_LOGW(TAG, "%s: Error waiting for queue entry (queue size = %d)", pcTaskGetName(nullptr), uxQueueMessagesWaiting(p_queue));;
+            ESP_LOGW(TAG, "%s: Error waiting for queue entry (queue size = %d)", pcTaskGetName(nullptr), uxQueueMessagesWaiting(p_queue->itsCalls));;
         }
         vTaskDelay(0);
     }
@@ -138,6 +1086,317 @@ void DeferredCallsQueue::callerTask(QueueHandle_t p_queue)
 
 void DeferredCallsQueue::callerTaskWrapper(void* pvParameter)
 {
-    QueueHandle_t queue = static_cast<QueueHandle_t>(pvParameter);
+    CallQueue* queue = static_cast<CallQueue*>(pvParameter);
     DeferredCallsQueue::get().callerTask(queue);
 }
+
+
+DeferredCallsQueue::CallQueue* DeferredCallsQueue::claimQueue(WorkerPool* p_pool)
+{
+    std::lock_guard<std::mutex> lock(p_pool->itsMutex);
+    for (CallQueue* queue : p_pool->itsQueues)
+    {
+        if (!queue->itsClaimed && (uxQueueMessagesWaiting(queue->itsCalls) > 0))
+        {
+            queue->itsClaimed = true;
+            return queue;
+        }
+    }
+    return nullptr;
+}
+
+
+void DeferredCallsQueue::workerTask(WorkerPool* p_pool)
+{
+    while (true)
+    {
+        CallQueue* queue = claimQueue(p_pool);
+        if (queue == nullptr)
+        {
+            // wait with the highest priority of the pool, so a new call does
+            // not wait for lower priority tasks before a worker picks it up
+            const UBaseType_t maxPriority = p_pool->itsMaxPriority.load(std::memory_order_relaxed);
+            if (uxTaskPriorityGet(NULL) != maxPriority)
+            {
+                vTaskPrioritySet(NULL, maxPriority);
+            }
+            xSemaphoreTake(p_pool->itsPending, portMAX_DELAY);
+            continue;
+        }
+
+        Slot* functionToCall;
+        // the call may have been dropped by OverflowPolicy::DropOldest meanwhile
+        if (likely(xQueueReceive(queue->itsCalls, &functionToCall, 0) == pdPASS))
+        {
+            if (uxTaskPriorityGet(NULL) != queue->itsPriority)
+            {
+                vTaskPrioritySet(NULL, queue->itsPriority);
+            }
+            runBatch(queue, functionToCall);
+        }
+        {
+            std::lock_guard<std::mutex> lock(p_pool->itsMutex);
+            queue->itsClaimed = false;
+        }
+        vTaskDelay(0);
+    }
+}
+
+
+void DeferredCallsQueue::workerTaskWrapper(void* pvParameter)
+{
+    WorkerPool* pool = static_cast<WorkerPool*>(pvParameter);
+    DeferredCallsQueue::get().workerTask(pool);
+}
+
+
+DeferredCallsQueue::CallQueue* DeferredCallsQueue::takeUnpinned(CallQueue* p_queue, Slot*& p_slot)
+{
+    if (xQueueReceive(p_queue->itsCalls, &p_slot, 0) == pdPASS)
+    {
+        return p_queue;
+    }
+    for (CallQueue* other : p_queue->itsGroup->itsQueues)
+    {
+        if ((other != p_queue) && (xQueueReceive(other->itsCalls, &p_slot, 0) == pdPASS))
+        {
+            return other;
+        }
+    }
+    return nullptr;
+}
+
+
+void DeferredCallsQueue::unpinnedTask(CallQueue* p_queue)
+{
+    while (true)
+    {
+        Slot* functionToCall;
+        CallQueue* queue = takeUnpinned(p_queue, functionToCall);
+        if (queue == nullptr)
+        {
+            xSemaphoreTake(p_queue->itsGroup->itsPending, portMAX_DELAY);
+            continue;
+        }
+
+        const uint32_t numCalls = runBatch(queue, functionToCall);
+        if (queue != p_queue)
+        {
+            queue->itsStolen.fetch_add(numCalls, std::memory_order_relaxed);
+        }
+        vTaskDelay(0);
+    }
+}
+
+
+void DeferredCallsQueue::unpinnedTaskWrapper(void* pvParameter)
+{
+    CallQueue* queue = static_cast<CallQueue*>(pvParameter);
+    DeferredCallsQueue::get().unpinnedTask(queue);
+}
+
+
+DeferredCallsQueue::DirectLink::DirectLink(UBaseType_t p_priority, BaseType_t p_core_id, UBaseType_t p_size) :
+    itsMask(std::bit_ceil(uint32_t(p_size)) - 1),
+    itsSlots(new Slot[itsMask + 1]),
+    itsHead(0),
+    itsTail(0),
+    itsWaiting(false),
+    itsTask(nullptr),
+    itsPriority(p_priority),
+    itsCoreId(p_core_id),
+    itsHighWater(0),
+    itsAdded(0),
+    itsDropped(0),
+    itsExecuted(0),
+    itsExecTimeUs(0),
+    itsMaxExecTimeUs(0)
+{}
+
+
+bool DeferredCallsQueue::DirectLink::addCall(CallType&& p_call)
+{
+    const uint32_t tail = itsTail.load(std::memory_order_relaxed);
+    const uint32_t pending = tail - itsHead.load(std::memory_order_acquire);
+    if (unlikely(pending > itsMask))
+    {
+        itsDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    Slot* slot = &itsSlots[tail & itsMask];
+    slot->itsCall = std::move(p_call);
+    stamp(slot);
+    // sequentially consistent, so either the task sees the call or the call sees the task waiting
+    itsTail.store(tail + 1);
+    if (itsWaiting.load() && itsWaiting.exchange(false))
+    {
+        xTaskNotifyGive(itsTask);
+    }
+    itsAdded.fetch_add(1, std::memory_order_relaxed);
+    updateMax(itsHighWater, UBaseType_t(pending + 1));
+    return true;
+}
+
+
+DeferredCallsQueue::QueueStats DeferredCallsQueue::DirectLink::getStats() const
+{
+    QueueStats stats = {};
+    stats.itsPriority = itsPriority;
+    stats.itsCoreId = itsCoreId;
+    stats.itsSize = itsMask + 1;
+    stats.itsPending = itsTail.load(std::memory_order_relaxed) - itsHead.load(std::memory_order_relaxed);
+    stats.itsHighWater = itsHighWater.load(std::memory_order_relaxed);
+    stats.itsAdded = itsAdded.load(std::memory_order_relaxed);
+    stats.itsDropped = itsDropped.load(std::memory_order_relaxed);
+    stats.itsExecuted = itsExecuted.load(std::memory_order_relaxed);
+    stats.itsExecTimeUs = itsExecTimeUs.load(std::memory_order_relaxed);
+    stats.itsMaxExecTimeUs = itsMaxExecTimeUs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+void DeferredCallsQueue::DirectLink::resetStats()
+{
+    itsHighWater.store(itsTail.load(std::memory_order_relaxed) - itsHead.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+    itsAdded.store(0, std::memory_order_relaxed);
+    itsDropped.store(0, std::memory_order_relaxed);
+    itsExecuted.store(0, std::memory_order_relaxed);
+    itsExecTimeUs.store(0, std::memory_order_relaxed);
+    itsMaxExecTimeUs.store(0, std::memory_order_relaxed);
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+    itsLatency.reset();
+#endif
+}
+
+
+LatencyHistogram::Snapshot DeferredCallsQueue::DirectLink::getLatency() const
+{
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+    return itsLatency.read();
+#else
+    return LatencyHistogram().read();
+#endif
+}
+
+
+void DeferredCallsQueue::DirectLink::run()
+{
+    uint32_t numCalls = 0;
+    while (true)
+    {
+        const uint32_t head = itsHead.load(std::memory_order_relaxed);
+        if (head == itsTail.load(std::memory_order_acquire))
+        {
+            itsWaiting.store(true);
+            if (head == itsTail.load())
+            {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            // a notification given meanwhile only causes another pass
+            itsWaiting.store(false, std::memory_order_relaxed);
+            numCalls = 0;
+            continue;
+        }
+
+        Slot* functionToCall = &itsSlots[head & itsMask];
+        const int64_t callStart = esp_timer_get_time();
+#if CONFIG_PUBSUB_LATENCY_HISTOGRAM
+        itsLatency.record(callStart - functionToCall->itsAddedUs);
+#endif
+        functionToCall->itsCall();
+        const uint32_t execTimeUs = esp_timer_get_time() - callStart;
+        functionToCall->itsCall.reset();
+        itsHead.store(head + 1, std::memory_order_release);
+        itsExecuted.fetch_add(1, std::memory_order_relaxed);
+        itsExecTimeUs.fetch_add(execTimeUs, std::memory_order_relaxed);
+        updateMax(itsMaxExecTimeUs, execTimeUs);
+
+        // like the tasks of the queues, give way to tasks of the same priority after a batch
+        if (unlikely(++numCalls > itsMask))
+        {
+            numCalls = 0;
+            vTaskDelay(0);
+        }
+    }
+}
+
+
+void DeferredCallsQueue::DirectLink::linkTaskWrapper(void* pvParameter)
+{
+    static_cast<DirectLink*>(pvParameter)->run();
+}
+
+
+DeferredCallsQueue::Timer::Timer() :
+    itsTimer(nullptr),
+    itsArmed(false),
+    itsQueue(nullptr),
+    itsPriority(0),
+    itsCoreId(tskNO_AFFINITY),
+    itsOnDrop({nullptr, nullptr})
+{
+    const esp_timer_create_args_t args = {expired, this, ESP_TIMER_TASK, "DefCalls-timer", false};
+    ESP_ERROR_CHECK(esp_timer_create(&args, &itsTimer));
+}
+
+
+DeferredCallsQueue::Timer::~Timer()
+{
+    esp_timer_stop(itsTimer);
+    esp_timer_delete(itsTimer);
+}
+
+
+bool DeferredCallsQueue::Timer::start(uint64_t p_delayUs, CallType&& p_call, UBaseType_t p_priority,
+                                      BaseType_t p_core_id, DropHandler p_onDrop)
+{
+    bool armed = false;
+    if (unlikely(!itsArmed.compare_exchange_strong(armed, true, std::memory_order_acquire)))
+    {
+        return false;
+    }
+    itsCall = std::move(p_call);
+    itsPriority = p_priority;
+    itsCoreId = (p_core_id == itsCurrentAffinity) ? xTaskGetAffinity(NULL) : p_core_id;
+    itsOnDrop = p_onDrop;
+    // the queue and its task are created here, not by the esp_timer task
+    itsQueue = DeferredCallsQueue::get().selectQueue(itsPriority, itsCoreId);
+    if (unlikely(esp_timer_start_once(itsTimer, p_delayUs) != ESP_OK))
+    {
+        itsCall.reset();
+        itsArmed.store(false, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+
+bool DeferredCallsQueue::Timer::stop()
+{
+    if (esp_timer_stop(itsTimer) != ESP_OK)
+    {
+        return false;
+    }
+    itsCall.reset();
+    itsArmed.store(false, std::memory_order_release);
+    return true;
+}
+
+
+void DeferredCallsQueue::Timer::expired(void* p_timer)
+{
+    Timer* timer = static_cast<Timer*>(p_timer);
+    CallType call = std::move(timer->itsCall);
+    CallQueue* queue = timer->itsQueue;
+    const UBaseType_t priority = timer->itsPriority;
+    const BaseType_t coreId = timer->itsCoreId;
+    const DropHandler onDrop = timer->itsOnDrop;
+    // the timer may be started again from here on, and even be deleted by the drop handler
+    timer->itsArmed.store(false, std::memory_order_release);
+    if (unlikely(!DeferredCallsQueue::get().addToQueue(queue, call, priority, coreId, itsNoDeadline, onDrop,
+                                                       false)))
+    {
+        onDrop();
+    }
+}
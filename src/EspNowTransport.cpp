@@ -0,0 +1,124 @@
+/**
+ * @file EspNowTransport.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Bridge transport sending frames with ESP-NOW
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include <cstring>
+#include "EspNowTransport.hpp"
+#include "freertos/task.h"
+#include <esp_err.h>
+#include <esp_idf_version.h>
+#include <esp_log.h>
+
+static const char TAG[] = "EspNowTransport";
+
+// ESP-NOW has a single receive callback
+static std::atomic<EspNowTransport*> theInstance(nullptr);
+
+
+EspNowTransport::EspNowTransport(const uint8_t* p_peer, uint8_t p_channel, UBaseType_t p_priority,
+                                 BaseType_t p_core_id) :
+    itsQueue(xQueueCreate(CONFIG_PUBSUB_BRIDGE_RX_QUEUE_SIZE, sizeof(Packet))),
+    itsStopped(false),
+    itsDropped(0)
+{
+    memcpy(itsPeer, p_peer, sizeof(itsPeer));
+    if (unlikely(itsQueue == nullptr))
+    {
+        ESP_LOGE(TAG, "Cannot create receive queue");
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+    EspNowTransport* expected = nullptr;
+    if (unlikely(!theInstance.compare_exchange_strong(expected, this)))
+    {
+        ESP_LOGE(TAG, "Only one ESP-NOW transport may exist");
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+
+    if (!esp_now_is_peer_exist(itsPeer))
+    {
+        esp_now_peer_info_t peer = {};
+        memcpy(peer.peer_addr, itsPeer, sizeof(itsPeer));
+        peer.channel = p_channel;
+        peer.ifidx = WIFI_IF_STA;
+        peer.encrypt = false;
+        ESP_ERROR_CHECK(esp_now_add_peer(&peer));
+    }
+
+    if (unlikely(xTaskCreatePinnedToCore(receiveTask, "PubSubEspNow", CONFIG_PUBSUB_TASK_STACK_SIZE, this,
+                                         p_priority, NULL, p_core_id) != pdPASS))
+    {
+        ESP_LOGE(TAG, "Cannot create receiving task");
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    ESP_ERROR_CHECK(esp_now_register_recv_cb([](const esp_now_recv_info_t*, const uint8_t* p_data, int p_size)
+                                             { enqueue(p_data, p_size); }));
+#else
+    ESP_ERROR_CHECK(esp_now_register_recv_cb([](const uint8_t*, const uint8_t* p_data, int p_size)
+                                             { enqueue(p_data, p_size); }));
+#endif
+}
+
+
+EspNowTransport::~EspNowTransport()
+{
+    esp_now_unregister_recv_cb();
+    theInstance.store(nullptr);
+    // an empty packet stops the task
+    Packet stop;
+    stop.itsSize = 0;
+    xQueueSend(itsQueue, &stop, portMAX_DELAY);
+    while (!itsStopped.load(std::memory_order_acquire))
+    {
+        vTaskDelay(1);
+    }
+    vQueueDelete(itsQueue);
+}
+
+
+bool EspNowTransport::send(const uint8_t* p_frame, std::size_t p_size)
+{
+    return esp_now_send(itsPeer, p_frame, p_size) == ESP_OK;
+}
+
+
+void EspNowTransport::enqueue(const uint8_t* p_data, int p_size)
+{
+    EspNowTransport* transport = theInstance.load();
+    if ((transport == nullptr) || (p_size <= 0) || (p_size > ESP_NOW_MAX_DATA_LEN))
+    {
+        return;
+    }
+    Packet packet;
+    packet.itsSize = p_size;
+    memcpy(packet.itsData, p_data, p_size);
+    if (xQueueSend(transport->itsQueue, &packet, 0) != pdPASS)
+    {
+        transport->itsDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+void EspNowTransport::receiveTask(void* p_transport)
+{
+    EspNowTransport* transport = static_cast<EspNowTransport*>(p_transport);
+    Packet packet;
+    while (true)
+    {
+        xQueueReceive(transport->itsQueue, &packet, portMAX_DELAY);
+        if (packet.itsSize == 0)
+        {
+            break;
+        }
+        transport->received(packet.itsData, packet.itsSize);
+    }
+    transport->itsStopped.store(true, std::memory_order_release);
+    vTaskDelete(NULL);
+}
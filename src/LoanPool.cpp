@@ -0,0 +1,182 @@
+/**
+ * @file LoanPool.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Fixed-size pool of buffers loaned to publishers of large payloads
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include <algorithm>
+#include "LoanPool.hpp"
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+static const char TAG[] = "LoanPool";
+
+
+LoanedBuffer::LoanedBuffer(const LoanedBuffer& p_other) :
+    itsPool(p_other.itsPool),
+    itsIndex(p_other.itsIndex)
+{
+    if (itsPool != nullptr)
+    {
+        itsPool->addRef(itsIndex);
+    }
+}
+
+
+LoanedBuffer& LoanedBuffer::operator=(const LoanedBuffer& p_other)
+{
+    if (this != &p_other)
+    {
+        if (p_other.itsPool != nullptr)
+        {
+            p_other.itsPool->addRef(p_other.itsIndex);
+        }
+        reset();
+        itsPool = p_other.itsPool;
+        itsIndex = p_other.itsIndex;
+    }
+    return *this;
+}
+
+
+LoanedBuffer& LoanedBuffer::operator=(LoanedBuffer&& p_other) noexcept
+{
+    if (this != &p_other)
+    {
+        reset();
+        itsPool = std::exchange(p_other.itsPool, nullptr);
+        itsIndex = p_other.itsIndex;
+    }
+    return *this;
+}
+
+
+void LoanedBuffer::reset()
+{
+    if (itsPool != nullptr)
+    {
+        std::exchange(itsPool, nullptr)->release(itsIndex);
+    }
+}
+
+
+uint8_t* LoanedBuffer::data()
+{
+    return itsPool->itsData + itsIndex * itsPool->itsBlockSize;
+}
+
+
+const uint8_t* LoanedBuffer::data() const
+{
+    return itsPool->itsData + itsIndex * itsPool->itsBlockSize;
+}
+
+
+std::size_t LoanedBuffer::size() const
+{
+    return itsPool->itsBlocks[itsIndex].itsSize;
+}
+
+
+std::size_t LoanedBuffer::capacity() const
+{
+    return itsPool->itsBlockSize;
+}
+
+
+LoanPool::LoanPool(std::size_t p_blockSize, std::size_t p_numBlocks, uint32_t p_caps) :
+    itsBlockSize((p_blockSize + itsAlignment - 1) / itsAlignment * itsAlignment),
+    itsNumBlocks(p_numBlocks),
+    itsData(static_cast<uint8_t*>(heap_caps_aligned_alloc(itsAlignment, itsBlockSize * itsNumBlocks, p_caps))),
+    itsBlocks(new Block[p_numBlocks]),
+    itsFreeList(nullptr),
+    itsBlocksInUse(0),
+    itsBlocksHighWater(0),
+    itsFailed(0)
+{
+    if (unlikely(itsData == nullptr))
+    {
+        ESP_LOGE(TAG, "Cannot allocate %u buffers of %u bytes", (unsigned) itsNumBlocks, (unsigned) itsBlockSize);
+        ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+    }
+
+    // push the blocks in reverse order so they are handed out in address order
+    for (std::size_t i = itsNumBlocks; i > 0; i--)
+    {
+        Block& block = itsBlocks[i - 1];
+        block.itsRefs.store(0, std::memory_order_relaxed);
+        block.itsSize = 0;
+        block.itsNext = itsFreeList;
+        itsFreeList = &block;
+    }
+}
+
+
+LoanPool::~LoanPool()
+{
+    if (unlikely(itsBlocksInUse > 0))
+    {
+        ESP_LOGE(TAG, "Destroying pool with %u loaned buffers", (unsigned) itsBlocksInUse);
+    }
+    heap_caps_free(itsData);
+    delete[] itsBlocks;
+}
+
+
+LoanedBuffer LoanPool::loan(std::size_t p_size)
+{
+    if (unlikely(p_size > itsBlockSize))
+    {
+        ESP_LOGW(TAG, "Cannot loan %u bytes from a pool of %u byte buffers", (unsigned) p_size, (unsigned) itsBlockSize);
+        return LoanedBuffer();
+    }
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    Block* block = itsFreeList;
+    if (unlikely(block == nullptr))
+    {
+        itsFailed++;
+        return LoanedBuffer();
+    }
+    itsFreeList = block->itsNext;
+    itsBlocksInUse++;
+    itsBlocksHighWater = std::max(itsBlocksHighWater, itsBlocksInUse);
+
+    block->itsRefs.store(1, std::memory_order_relaxed);
+    block->itsSize = p_size;
+    return LoanedBuffer(this, block - itsBlocks);
+}
+
+
+LoanPool::Stats LoanPool::getStats()
+{
+    std::lock_guard<std::mutex> lock(itsMutex);
+    return {itsBlockSize, itsNumBlocks, itsBlocksInUse, itsBlocksHighWater, itsFailed};
+}
+
+
+void LoanPool::release(std::size_t p_index)
+{
+    Block& block = itsBlocks[p_index];
+    // the last reference may be dropped by a different task than the one filling the buffer
+    if (block.itsRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        block.itsNext = itsFreeList;
+        itsFreeList = &block;
+        itsBlocksInUse--;
+    }
+}
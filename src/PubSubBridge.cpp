@@ -0,0 +1,279 @@
+/**
+ * @file PubSubBridge.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Forward topics to other nodes and republish their messages
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include "PubSubBridge.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <esp_err.h>
+#include <esp_log.h>
+
+static const char TAG[] = "PubSubBridge";
+
+static constexpr uint8_t theMagic[2] = { 'P', 'S' };
+
+
+PubSubBridge::PubSubBridge(Transport& p_transport, uint32_t p_nodeId, uint32_t p_flushMs,
+                           UBaseType_t p_priority) :
+    itsTransport(p_transport),
+    itsNodeId(p_nodeId),
+    itsFlushUs(p_flushMs * 1000),
+    itsPriority(p_priority),
+    itsFrame(p_transport.maxFrameSize()),
+    itsFrameSize(itsHeaderSize),
+    itsFrameMessages(0),
+    itsFlushScheduled(false),
+    itsFlushCalls(0)
+{
+    if (unlikely(itsFrame.size() < itsHeaderSize + itsMessageHeaderSize))
+    {
+        ESP_LOGE(TAG, "Frames of %u bytes are too small", (unsigned)itsFrame.size());
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+    resetStats();
+
+    PubSubBridge* expected = nullptr;
+    if (unlikely(!itsTransport.itsBridge.compare_exchange_strong(expected, this, std::memory_order_acq_rel)))
+    {
+        ESP_LOGE(TAG, "Transport is already attached to a bridge");
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+}
+
+
+PubSubBridge::~PubSubBridge()
+{
+    itsTransport.itsBridge.store(nullptr, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(itsInboundMutex);
+        for (auto& [id, inbound] : itsInbound)
+        {
+            inbound.itsUnsubscribe();
+        }
+    }
+    if (itsFlushTimer.stop())
+    {
+        itsFlushCalls.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // a flush call may already be queued, it refers to this bridge
+    while (itsFlushCalls.load(std::memory_order_acquire) > 0)
+    {
+        vTaskDelay(1);
+    }
+}
+
+
+void PubSubBridge::addInbound(uint32_t p_topicId, std::string_view p_name, Inbound&& p_inbound)
+{
+    std::lock_guard<std::mutex> lock(itsInboundMutex);
+    if (unlikely(!itsInbound.emplace(p_topicId, std::move(p_inbound)).second))
+    {
+        ESP_LOGE(TAG, "Topic %.*s is already bridged or its ID %08lx is taken", (int)p_name.size(), p_name.data(),
+                 (unsigned long)p_topicId);
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+}
+
+
+void PubSubBridge::flush()
+{
+    std::lock_guard<std::mutex> lock(itsFrameMutex);
+    itsFlushScheduled = false;
+    if (itsFrameMessages > 0)
+    {
+        sendFrame();
+    }
+}
+
+
+void PubSubBridge::flushExpired()
+{
+    flush();
+    itsFlushCalls.fetch_sub(1, std::memory_order_release);
+}
+
+
+void PubSubBridge::flushDropped(void* p_bridge)
+{
+    PubSubBridge* bridge = static_cast<PubSubBridge*>(p_bridge);
+    {
+        // the pending frame is flushed after the next message instead
+        std::lock_guard<std::mutex> lock(bridge->itsFrameMutex);
+        bridge->itsFlushScheduled = false;
+    }
+    // the bridge may be destroyed from here on
+    bridge->itsFlushCalls.fetch_sub(1, std::memory_order_release);
+}
+
+
+void PubSubBridge::messageAdded()
+{
+    if (itsFlushUs == 0)
+    {
+        sendFrame();
+    }
+    else if (!itsFlushScheduled)
+    {
+        // if the frame fills up before, the next one is sent early instead
+        itsFlushCalls.fetch_add(1, std::memory_order_relaxed);
+        if (itsFlushTimer.start(itsFlushUs, [this]() { flushExpired(); }, itsPriority, tskNO_AFFINITY,
+                                {flushDropped, this}))
+        {
+            itsFlushScheduled = true;
+        }
+        else
+        {
+            // the previous flush call is queued but has not run yet
+            itsFlushCalls.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+
+void PubSubBridge::sendFrame()
+{
+    uint8_t* header = itsFrame.data();
+    header[0] = theMagic[0];
+    header[1] = theMagic[1];
+    header[2] = itsVersion;
+    header[3] = itsFrameMessages;
+    memcpy(header + 4, &itsNodeId, sizeof(itsNodeId));
+
+    if (likely(itsTransport.send(itsFrame.data(), itsFrameSize)))
+    {
+        itsFramesSent.fetch_add(1, std::memory_order_relaxed);
+        itsMessagesSent.fetch_add(itsFrameMessages, std::memory_order_relaxed);
+        itsBytesSent.fetch_add(itsFrameSize, std::memory_order_relaxed);
+    }
+    else
+    {
+        itsSendErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    startFrame();
+}
+
+
+void PubSubBridge::startFrame()
+{
+    itsFrameSize = itsHeaderSize;
+    itsFrameMessages = 0;
+}
+
+
+void PubSubBridge::receive(const uint8_t* p_frame, std::size_t p_size)
+{
+    if ((p_size < itsHeaderSize) || (p_frame[0] != theMagic[0]) || (p_frame[1] != theMagic[1]) ||
+        (p_frame[2] != itsVersion))
+    {
+        itsInvalidFrames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t origin;
+    memcpy(&origin, p_frame + 4, sizeof(origin));
+    if (origin == itsNodeId)
+    {
+        itsOwnFrames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    itsFramesReceived.fetch_add(1, std::memory_order_relaxed);
+    itsBytesReceived.fetch_add(p_size, std::memory_order_relaxed);
+
+    // messages published here are not forwarded again by any bridge
+    const bool wasReceiving = itsReceiving;
+    itsReceiving = true;
+
+    const uint8_t count = p_frame[3];
+    std::size_t offset = itsHeaderSize;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint32_t id;
+        uint16_t length;
+        if (p_size - offset < itsMessageHeaderSize)
+        {
+            itsInvalidFrames.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        memcpy(&id, p_frame + offset, sizeof(id));
+        memcpy(&length, p_frame + offset + sizeof(id), sizeof(length));
+        offset += itsMessageHeaderSize;
+        if (p_size - offset < length)
+        {
+            itsInvalidFrames.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+
+        const Inbound* inbound = nullptr;
+        {
+            // elements are never erased, so the reference stays valid
+            std::lock_guard<std::mutex> lock(itsInboundMutex);
+            auto it = itsInbound.find(id);
+            if (it != itsInbound.end())
+            {
+                inbound = &it->second;
+            }
+        }
+        if (inbound == nullptr)
+        {
+            itsUnknownTopics.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            BinaryReader reader(p_frame + offset, length);
+            if (inbound->itsDecoder(reader))
+            {
+                itsMessagesReceived.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                itsDecodeErrors.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        offset += length;
+    }
+
+    itsReceiving = wasReceiving;
+}
+
+
+BridgeStats PubSubBridge::getStats() const
+{
+    BridgeStats stats;
+    stats.itsFramesSent = itsFramesSent.load(std::memory_order_relaxed);
+    stats.itsMessagesSent = itsMessagesSent.load(std::memory_order_relaxed);
+    stats.itsBytesSent = itsBytesSent.load(std::memory_order_relaxed);
+    stats.itsSendErrors = itsSendErrors.load(std::memory_order_relaxed);
+    stats.itsOversized = itsOversized.load(std::memory_order_relaxed);
+    stats.itsSuppressed = itsSuppressed.load(std::memory_order_relaxed);
+    stats.itsFramesReceived = itsFramesReceived.load(std::memory_order_relaxed);
+    stats.itsMessagesReceived = itsMessagesReceived.load(std::memory_order_relaxed);
+    stats.itsBytesReceived = itsBytesReceived.load(std::memory_order_relaxed);
+    stats.itsOwnFrames = itsOwnFrames.load(std::memory_order_relaxed);
+    stats.itsInvalidFrames = itsInvalidFrames.load(std::memory_order_relaxed);
+    stats.itsUnknownTopics = itsUnknownTopics.load(std::memory_order_relaxed);
+    stats.itsDecodeErrors = itsDecodeErrors.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+void PubSubBridge::resetStats()
+{
+    itsFramesSent.store(0, std::memory_order_relaxed);
+    itsMessagesSent.store(0, std::memory_order_relaxed);
+    itsBytesSent.store(0, std::memory_order_relaxed);
+    itsSendErrors.store(0, std::memory_order_relaxed);
+    itsOversized.store(0, std::memory_order_relaxed);
+    itsSuppressed.store(0, std::memory_order_relaxed);
+    itsFramesReceived.store(0, std::memory_order_relaxed);
+    itsMessagesReceived.store(0, std::memory_order_relaxed);
+    itsBytesReceived.store(0, std::memory_order_relaxed);
+    itsOwnFrames.store(0, std::memory_order_relaxed);
+    itsInvalidFrames.store(0, std::memory_order_relaxed);
+    itsUnknownTopics.store(0, std::memory_order_relaxed);
+    itsDecodeErrors.store(0, std::memory_order_relaxed);
+}
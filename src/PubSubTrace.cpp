@@ -0,0 +1,136 @@
+/**
+ * @file PubSubTrace.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Tracing of published messages, selected at compile time
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include <algorithm>
+#include "PubSubTrace.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <esp_timer.h>
+
+static const char TAG[] = "PubSubTrace";
+
+static_assert((PubSubTrace::itsRingSize & (PubSubTrace::itsRingSize - 1)) == 0,
+              "trace ring size must be a power of two");
+
+// only allocated in full if the ring is used
+static constexpr bool theRingEnabled = (PubSubTrace::itsLevel == PubSubTrace::Level::Ring);
+static std::array<PubSubTrace::Record, theRingEnabled ? PubSubTrace::itsRingSize : 1> theRing;
+static std::atomic<uint32_t> theRingHead(0);
+
+
+PubSubTrace::Counters PubSubTrace::getCounters()
+{
+    Counters counters;
+    for (std::size_t i = 0; i < itsNumEvents; i++)
+    {
+        counters[i] = itsCounters[i].load(std::memory_order_relaxed);
+    }
+    return counters;
+}
+
+
+std::size_t PubSubTrace::readRing(Record* p_records, std::size_t p_maxRecords)
+{
+    if (!theRingEnabled)
+    {
+        return 0;
+    }
+    const uint32_t head = theRingHead.load();
+    const std::size_t numRecords = std::min<std::size_t>({head, theRing.size(), p_maxRecords});
+    for (std::size_t i = 0; i < numRecords; i++)
+    {
+        p_records[i] = theRing[(head - numRecords + i) % theRing.size()];
+    }
+    return numRecords;
+}
+
+
+void PubSubTrace::dumpRing()
+{
+    if (!theRingEnabled)
+    {
+        ESP_LOGW(TAG, "Trace ring not enabled");
+        return;
+    }
+    const uint32_t head = theRingHead.load();
+    const std::size_t numRecords = std::min<std::size_t>(head, theRing.size());
+    for (std::size_t i = 0; i < numRecords; i++)
+    {
+        const Record record = theRing[(head - numRecords + i) % theRing.size()];
+        ESP_LOGI(TAG, "%10u p%u c%u %-14s topic %08x #%u",
+                 (unsigned) record.itsTimestamp, record.itsPriority, record.itsCore,
+                 eventName(record.itsEvent), (unsigned) record.itsTopic, (unsigned) record.itsSubscriber);
+    }
+}
+
+
+const char* PubSubTrace::eventName(TraceEvent p_event)
+{
+    switch (p_event)
+    {
+        case TraceEvent::Publish:       return "publish";
+        case TraceEvent::PublishAsync:  return "publishAsync";
+        case TraceEvent::DispatchSync:  return "dispatchSync";
+        case TraceEvent::DispatchAsync: return "dispatchAsync";
+        case TraceEvent::ReplaceLatest: return "replaceLatest";
+        case TraceEvent::AddToBatch:    return "addToBatch";
+        case TraceEvent::DropFromBatch: return "dropFromBatch";
+        case TraceEvent::Retained:      return "retained";
+        default:                        return "?";
+    }
+}
+
+
+void PubSubTrace::log(TraceEvent p_event, const char* p_topicName, uint32_t p_subscriber)
+{
+    switch (p_event)
+    {
+        case TraceEvent::Publish:
+        case TraceEvent::PublishAsync:
+            ESP_LOGI(TAG, "Publishing '%s'", p_topicName);
+            break;
+        case TraceEvent::DispatchSync:
+            ESP_LOGI(TAG, "  -> #%u", (unsigned) p_subscriber);
+            break;
+        case TraceEvent::DispatchAsync:
+            ESP_LOGI(TAG, "  ~> #%u", (unsigned) p_subscriber);
+            break;
+        case TraceEvent::ReplaceLatest:
+            ESP_LOGI(TAG, "  ~> #%u (replaced)", (unsigned) p_subscriber);
+            break;
+        case TraceEvent::AddToBatch:
+            ESP_LOGI(TAG, "  ~> #%u (batched)", (unsigned) p_subscriber);
+            break;
+        case TraceEvent::DropFromBatch:
+            ESP_LOGI(TAG, "  ~> #%u (batch full, dropped)", (unsigned) p_subscriber);
+            break;
+        case TraceEvent::Retained:
+            ESP_LOGI(TAG, "Delivering retained '%s' to #%u", p_topicName, (unsigned) p_subscriber);
+            break;
+        default:
+            break;
+    }
+}
+
+
+void PubSubTrace::push(TraceEvent p_event, uint32_t p_topicId, uint32_t p_subscriber)
+{
+    if constexpr (theRingEnabled)
+    {
+        Record& record = theRing[theRingHead.fetch_add(1, std::memory_order_relaxed) % theRing.size()];
+        record.itsTimestamp = static_cast<uint32_t>(esp_timer_get_time());
+        record.itsTopic = p_topicId;
+        record.itsSubscriber = p_subscriber;
+        record.itsEvent = p_event;
+        record.itsPriority = static_cast<uint8_t>(uxTaskPriorityGet(NULL));
+        record.itsCore = static_cast<uint8_t>(xPortGetCoreID());
+        record.itsReserved = 0;
+    }
+}
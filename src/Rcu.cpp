@@ -0,0 +1,134 @@
+/**
+ * @file Rcu.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Epoch-based read-copy-update for lock-free readers
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include <algorithm>
+#include "Rcu.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+
+Rcu::Rcu() :
+    itsEpoch(0),
+    itsReaders{0, 0},
+    itsHasRetired(false)
+{}
+
+
+Rcu::~Rcu()
+{
+    std::lock_guard<std::mutex> lock(itsRetiredMutex);
+    for (auto& retired : itsRetired)
+    {
+        retired.itsDeleter(retired.itsData);
+    }
+}
+
+
+uint32_t Rcu::readLock()
+{
+    while (true)
+    {
+        uint32_t epoch = itsEpoch.load();
+        itsReaders[epoch & 1].fetch_add(1);
+        // the epoch may have advanced before the reader became visible
+        if (likely(itsEpoch.load() == epoch))
+        {
+            return epoch & 1;
+        }
+        itsReaders[epoch & 1].fetch_sub(1);
+    }
+}
+
+
+void Rcu::readUnlock(uint32_t p_token)
+{
+    itsReaders[p_token].fetch_sub(1);
+    if (unlikely(itsHasRetired.load(std::memory_order_relaxed)))
+    {
+        // never block a reader, the next writer will clean up otherwise
+        if (itsRetiredMutex.try_lock())
+        {
+            reclaim();
+            itsRetiredMutex.unlock();
+        }
+    }
+}
+
+
+void Rcu::retire(void* p_data, Deleter p_deleter)
+{
+    std::lock_guard<std::mutex> lock(itsRetiredMutex);
+    itsRetired.push_back({p_data, p_deleter, itsEpoch.load()});
+    itsHasRetired.store(true, std::memory_order_relaxed);
+    reclaim();
+}
+
+
+void Rcu::synchronize()
+{
+    std::unique_lock<std::mutex> lock(itsRetiredMutex);
+    const uint32_t epoch = itsEpoch.load();
+    while (itsEpoch.load() - epoch < 2)
+    {
+        if (!tryAdvance())
+        {
+            lock.unlock();
+            vTaskDelay(1);
+            lock.lock();
+        }
+    }
+    reclaim();
+}
+
+
+std::size_t Rcu::getRetiredCount()
+{
+    std::lock_guard<std::mutex> lock(itsRetiredMutex);
+    return itsRetired.size();
+}
+
+
+bool Rcu::tryAdvance()
+{
+    // only the readers of the previous epoch share the counter with the next one
+    const uint32_t epoch = itsEpoch.load();
+    if (itsReaders[(epoch + 1) & 1].load() == 0)
+    {
+        itsEpoch.store(epoch + 1);
+        return true;
+    }
+    return false;
+}
+
+
+void Rcu::reclaim()
+{
+    // advancing twice releases data retired in the current epoch if there are no readers
+    tryAdvance() && tryAdvance();
+
+    const uint32_t epoch = itsEpoch.load();
+    auto released = std::partition(itsRetired.begin(), itsRetired.end(),
+                                   [epoch](const Retired& p_retired)
+                                   { return epoch - p_retired.itsEpoch < 2; });
+    for (auto it = released; it != itsRetired.end(); ++it)
+    {
+        it->itsDeleter(it->itsData);
+    }
+    itsRetired.erase(released, itsRetired.end());
+    itsHasRetired.store(!itsRetired.empty(), std::memory_order_relaxed);
+}
@@ -0,0 +1,172 @@
+/**
+ * @file SubscriptionPool.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Memory pool for the subscription data structures
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include <algorithm>
+#include "SubscriptionPool.hpp"
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+static const char TAG[] = "SubscriptionPool";
+
+static_assert(CONFIG_PUBSUB_POOL_CHUNK_SIZE >= SubscriptionPool::itsMaxBlockSize,
+              "chunk size must hold at least one block of the largest size class");
+
+
+SubscriptionPool& SubscriptionPool::getInstance()
+{
+    static SubscriptionPool instance;
+    return instance;
+}
+
+
+SubscriptionPool::SubscriptionPool() :
+#if CONFIG_PUBSUB_POOL_IN_PSRAM
+    itsCaps(MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT),
+#else
+    itsCaps(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+#endif
+    itsClasses(),
+    itsChunkBytes(0),
+    itsLargeInUse(0),
+    itsLargeHighWater(0)
+{
+    for (std::size_t i = 0; i < itsNumClasses; i++)
+    {
+        itsClasses[i].itsFreeList = nullptr;
+        itsClasses[i].itsStats.itsBlockSize = itsMinBlockSize << i;
+    }
+}
+
+
+void SubscriptionPool::setCaps(uint32_t p_caps)
+{
+    std::lock_guard<std::mutex> lock(itsMutex);
+    itsCaps = p_caps;
+}
+
+
+void* SubscriptionPool::allocate(std::size_t p_size)
+{
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    if (unlikely(p_size > itsMaxBlockSize))
+    {
+        void* block = heap_caps_malloc(p_size, itsCaps);
+        if (unlikely(block == nullptr))
+        {
+            ESP_LOGE(TAG, "Cannot allocate %u bytes", (unsigned) p_size);
+            ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+        }
+        itsLargeInUse++;
+        itsLargeHighWater = std::max(itsLargeHighWater, itsLargeInUse);
+        return block;
+    }
+
+    SizeClass& sizeClass = itsClasses[sizeToClass(p_size)];
+    if (unlikely(sizeClass.itsFreeList == nullptr))
+    {
+        grow(sizeClass);
+    }
+    FreeBlock* block = sizeClass.itsFreeList;
+    sizeClass.itsFreeList = block->itsNext;
+
+    ClassStats& stats = sizeClass.itsStats;
+    stats.itsBlocksInUse++;
+    stats.itsBlocksHighWater = std::max(stats.itsBlocksHighWater, stats.itsBlocksInUse);
+    return block;
+}
+
+
+void SubscriptionPool::deallocate(void* p_block, std::size_t p_size)
+{
+    if (p_block == nullptr)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    if (unlikely(p_size > itsMaxBlockSize))
+    {
+        heap_caps_free(p_block);
+        itsLargeInUse--;
+    }
+    else
+    {
+        SizeClass& sizeClass = itsClasses[sizeToClass(p_size)];
+        FreeBlock* block = static_cast<FreeBlock*>(p_block);
+        block->itsNext = sizeClass.itsFreeList;
+        sizeClass.itsFreeList = block;
+        sizeClass.itsStats.itsBlocksInUse--;
+    }
+}
+
+
+SubscriptionPool::Stats SubscriptionPool::getStats()
+{
+    std::lock_guard<std::mutex> lock(itsMutex);
+
+    Stats stats;
+    for (std::size_t i = 0; i < itsNumClasses; i++)
+    {
+        stats.itsClasses[i] = itsClasses[i].itsStats;
+    }
+    stats.itsChunkBytes = itsChunkBytes;
+    stats.itsLargeInUse = itsLargeInUse;
+    stats.itsLargeHighWater = itsLargeHighWater;
+    return stats;
+}
+
+
+std::size_t SubscriptionPool::sizeToClass(std::size_t p_size)
+{
+    std::size_t index = 0;
+    std::size_t blockSize = itsMinBlockSize;
+    while (blockSize < p_size)
+    {
+        blockSize <<= 1;
+        index++;
+    }
+    return index;
+}
+
+
+void SubscriptionPool::grow(SizeClass& p_class)
+{
+    const std::size_t blockSize = p_class.itsStats.itsBlockSize;
+    const std::size_t numBlocks = CONFIG_PUBSUB_POOL_CHUNK_SIZE / blockSize;
+    const std::size_t chunkSize = numBlocks * blockSize;
+
+    uint8_t* chunk = static_cast<uint8_t*>(heap_caps_aligned_alloc(alignof(std::max_align_t), chunkSize, itsCaps));
+    if (unlikely(chunk == nullptr))
+    {
+        ESP_LOGE(TAG, "Cannot allocate chunk of %u bytes", (unsigned) chunkSize);
+        ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+    }
+
+    // push the new blocks in reverse order so they are handed out in address order
+    for (std::size_t i = numBlocks; i > 0; i--)
+    {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + (i - 1) * blockSize);
+        block->itsNext = p_class.itsFreeList;
+        p_class.itsFreeList = block;
+    }
+    p_class.itsStats.itsBlocksTotal += numBlocks;
+    itsChunkBytes += chunkSize;
+}
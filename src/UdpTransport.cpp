@@ -0,0 +1,103 @@
+/**
+ * @file UdpTransport.cpp
+ * @author Thomas Reitmayr (treitmayr@devbase.at)
+ * @brief Bridge transport sending frames as UDP datagrams
+ *
+ * @copyright Copyright (c) 2023 Thomas Reitmayr
+ * MIT License
+ */
+
+
+#include "UdpTransport.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <esp_err.h>
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char TAG[] = "UdpTransport";
+
+// how often the receiving task checks whether to stop
+static const int thePollIntervalMs = 100;
+
+
+UdpTransport::UdpTransport(uint16_t p_port, const char* p_destination, UBaseType_t p_priority,
+                           BaseType_t p_core_id) :
+    itsSocket(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)),
+    itsDestination{},
+    itsBuffer(itsMaxFrameSize),
+    itsStopping(false),
+    itsStopped(false)
+{
+    if (unlikely(itsSocket < 0))
+    {
+        ESP_LOGE(TAG, "Cannot create socket");
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+    const int enable = 1;
+    setsockopt(itsSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(itsSocket, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+    const timeval timeout = { 0, thePollIntervalMs * 1000 };
+    setsockopt(itsSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(p_port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (unlikely(bind(itsSocket, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0))
+    {
+        ESP_LOGE(TAG, "Cannot bind to port %u", (unsigned)p_port);
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+
+    itsDestination.sin_family = AF_INET;
+    itsDestination.sin_port = htons(p_port);
+    if (unlikely(inet_pton(AF_INET, p_destination, &itsDestination.sin_addr) != 1))
+    {
+        ESP_LOGE(TAG, "Invalid destination %s", p_destination);
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+
+    if (unlikely(xTaskCreatePinnedToCore(receiveTask, "PubSubUdp", CONFIG_PUBSUB_TASK_STACK_SIZE, this,
+                                         p_priority, NULL, p_core_id) != pdPASS))
+    {
+        ESP_LOGE(TAG, "Cannot create receiving task");
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+}
+
+
+UdpTransport::~UdpTransport()
+{
+    itsStopping.store(true, std::memory_order_relaxed);
+    while (!itsStopped.load(std::memory_order_acquire))
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    close(itsSocket);
+}
+
+
+bool UdpTransport::send(const uint8_t* p_frame, std::size_t p_size)
+{
+    return sendto(itsSocket, p_frame, p_size, 0, reinterpret_cast<const sockaddr*>(&itsDestination),
+                  sizeof(itsDestination)) == ssize_t(p_size);
+}
+
+
+void UdpTransport::receiveTask(void* p_transport)
+{
+    UdpTransport* transport = static_cast<UdpTransport*>(p_transport);
+    while (!transport->itsStopping.load(std::memory_order_relaxed))
+    {
+        const ssize_t size = recv(transport->itsSocket, transport->itsBuffer.data(), transport->itsBuffer.size(), 0);
+        if (size > 0)
+        {
+            transport->received(transport->itsBuffer.data(), size);
+        }
+    }
+    transport->itsStopped.store(true, std::memory_order_release);
+    vTaskDelete(NULL);
+}
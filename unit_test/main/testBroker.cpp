@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <Broker.hpp>
+#include "test_app_main.hpp"
+
+
+TEST_CASE("typed topics", "[Broker]")
+{
+    auto number = Broker::get().topic<int>("broker1");
+    auto text = Broker::get().topic<const std::string&, int>("broker2");
+    number.subscribeSync([](int arg) {
+        coutCapture << "number=" << arg << "\n";
+    });
+    text.subscribeSync([](const std::string& arg1, int arg2) {
+        coutCapture << "text=" << arg1 << "," << arg2 << "\n";
+    });
+    coutCapture << "before\n";
+    number.publish(1);
+    text.publish("two", 2);
+    // resolving the channel again refers to the same subscribers
+    Broker::get().topic<int>("broker1").publish(3);
+    coutCapture << "after\n";
+    expectedOutput = "before\nnumber=1\ntext=two,2\nnumber=3\nafter\n";
+}
+
+TEST_CASE("async", "[Broker]")
+{
+    auto topic = Broker::get().topic<int>("broker3");
+    topic.subscribeAsyncWithPrio([](int arg) {
+        coutCapture << "arg1=" << arg << "\n";
+    }, 0);
+    topic.subscribeSync([](int arg) {
+        coutCapture << "arg2=" << arg << "\n";
+    });
+    coutCapture << "before\n";
+    topic.publish(41);
+    coutCapture << "middle\n";
+    usleep(100 * 1000);
+    topic.publishAsyncWithPrio(42, 0);
+    coutCapture << "after\n";
+    expectedOutput = "before\narg2=41\nmiddle\narg1=41\nafter\narg1=42\narg2=42\n";
+}
+
+TEST_CASE("deferred subscription", "[Broker]")
+{
+    auto outer = Broker::get().topic<int>("broker4");
+    auto inner = Broker::get().topic<int>("broker5");
+    outer.subscribeSync([inner](int arg) {
+        // only in effect after the outermost publish has finished
+        inner.subscribeSync([](int arg) {
+            coutCapture << "inner=" << arg << "\n";
+        });
+        inner.publish(arg + 1);
+        coutCapture << "outer=" << arg << "\n";
+    });
+    coutCapture << "before\n";
+    outer.publish(43);
+    inner.publish(45);
+    coutCapture << "after\n";
+    expectedOutput = "before\nouter=43\ninner=45\nafter\n";
+}
+
+TEST_CASE("many deferred subscriptions", "[Broker]")
+{
+    static int calls;
+    static int rejected;
+    calls = 0;
+    rejected = 0;
+    auto outer = Broker::get().topic<int>("broker12");
+    auto inner = Broker::get().topic<int>("broker13");
+    outer.subscribeSync([inner](int arg) {
+        // more than fit into the ring of deferred subscriptions
+        for (int i = 0; i < 2 * CONFIG_PUBSUB_PENDING_OPS_SIZE; i++)
+        {
+            if (inner.subscribeSync([](int) { calls++; }) == 0)
+            {
+                rejected++;
+            }
+        }
+    });
+    outer.publish(1);
+    inner.publish(2);
+    coutCapture << "calls=" << (calls == CONFIG_PUBSUB_PENDING_OPS_SIZE) << "\n";
+    coutCapture << "rejected=" << (rejected == CONFIG_PUBSUB_PENDING_OPS_SIZE) << "\n";
+    expectedOutput = "calls=1\nrejected=1\n";
+}
+
+TEST_CASE("unsubscribe", "[Broker]")
+{
+    auto topic = Broker::get().topic<int>("broker6");
+    SubscriptionId id = topic.subscribeSync([](int arg) {
+        coutCapture << "first=" << arg << "\n";
+    });
+    topic.subscribeSync([](int arg) {
+        coutCapture << "second=" << arg << "\n";
+    });
+    topic.publish(46);
+    topic.unsubscribe(id);
+    topic.publish(47);
+    topic.clear();
+    topic.publish(48);
+    expectedOutput = "first=46\nsecond=46\nsecond=47\n";
+}
+
+TEST_CASE("latest value", "[Broker]")
+{
+    const UBaseType_t prio = 14;
+    auto topic = Broker::get().topic<int>("broker7");
+    topic.subscribeLatestWithPrio([](int arg) {
+        coutCapture << "latest=" << arg << "\n";
+    }, prio);
+    // keep the task busy so the messages are still pending
+    DeferredCallsQueue::get().addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    coutCapture << "before\n";
+    for (int i = 53; i <= 56; i++)
+    {
+        topic.publish(i);
+    }
+    usleep(150 * 1000);
+    coutCapture << "after\n";
+    expectedOutput = "before\nlatest=56\nafter\n";
+}
+
+TEST_CASE("latest value dropped", "[Broker]")
+{
+    const UBaseType_t prio = 21;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, DeferredCallsQueue::itsCurrentAffinity, 1, DeferredCallsQueue::OverflowPolicy::DropNewest);
+    auto topic = Broker::get().topic<int>("broker11");
+    topic.subscribeLatestWithPrio([](int arg) {
+        coutCapture << "latest=" << arg << "\n";
+    }, prio);
+    // fill the queue, so the call of the first message is dropped
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    dcq.addDeferredCall([]() {}, prio);
+    topic.publish(1);
+    usleep(100 * 1000);
+    topic.publish(2);
+    usleep(50 * 1000);
+    topic.clear();
+    expectedOutput = "latest=2\n";
+}
+
+TEST_CASE("publish from ISR", "[Broker]")
+{
+    auto topic = Broker::get().topic<int, char>("broker8");
+    topic.subscribeSync([](int arg1, char arg2) {
+        coutCapture << "arg=" << arg1 << arg2 << "\n";
+    });
+    coutCapture << "before\n";
+    bool queued = topic.publishFromISR(52, 'x');
+    usleep(100 * 1000);
+    coutCapture << "queued=" << queued << "\n";
+    coutCapture << "after\n";
+    expectedOutput = "before\narg=52x\nqueued=1\nafter\n";
+}
+
+TEST_CASE("stats", "[Broker]")
+{
+    auto topic = Broker::get().topic<float>("broker9");
+    topic.subscribeSync([](float) {});
+    topic.subscribeAsync([](float) {});
+    topic.publish(1.0f);
+    topic.publishAsync(2.0f);
+    usleep(50 * 1000);
+    TopicStats stats = topic.getStats();
+    coutCapture << "name: " << stats.itsName << "\n";
+    coutCapture << "subscribers: " << stats.itsSubscribers << "\n";
+    coutCapture << "published: " << stats.itsPublished << "\n";
+    coutCapture << "sync calls: " << stats.itsSyncCalls << "\n";
+    Broker::get().resetStats();
+    coutCapture << "reset: " << topic.getStats().itsPublished << "\n";
+    expectedOutput = "name: broker9\nsubscribers: 2\npublished: 2\nsync calls: 1\nreset: 0\n";
+}
+
+TEST_CASE("sync order", "[Broker]")
+{
+    auto topic = Broker::get().topic<int>("broker10");
+    const UBaseType_t prio = uxTaskPriorityGet(NULL);
+    topic.subscribeSync([](int arg) { coutCapture << "low=" << arg << "\n"; });
+    topic.subscribeAsyncWithPrio([](int arg) { coutCapture << "async=" << arg << "\n"; }, 0);
+    vTaskPrioritySet(NULL, prio + 2);
+    topic.subscribeSync([](int arg) { coutCapture << "high=" << arg << "\n"; });
+    vTaskPrioritySet(NULL, prio);
+    topic.subscribeCritical([](int arg) { coutCapture << "critical=" << arg << "\n"; });
+    topic.publish(1);
+    coutCapture << "published\n";
+    usleep(50 * 1000);
+    topic.clear();
+    expectedOutput = "critical=1\nhigh=1\nlow=1\npublished\nasync=1\n";
+}
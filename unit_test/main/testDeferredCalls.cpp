@@ -1,5 +1,11 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
 #include <DeferredCallsQueue.hpp>
 #include "test_app_main.hpp"
 
@@ -112,3 +118,366 @@ TEST_CASE("many args", "[DeferredCallsQueue]")
     }
     expectedOutput += "after\n";
 }
+
+TEST_CASE("large capture", "[DeferredCallsQueue]")
+{
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    uint32_t fallbacks = DeferredCallsQueue::getHeapFallbackCount();
+    int small = 1;
+    dcq.addDeferredCall([small]() { coutCapture << "small=" << small << "\n"; }, 0);
+    std::array<int, 32> large{};
+    large.back() = 2;
+    dcq.addDeferredCall([large]() { coutCapture << "large=" << large.back() << "\n"; }, 0);
+    coutCapture << "fallbacks=" << (DeferredCallsQueue::getHeapFallbackCount() - fallbacks) << "\n";
+    expectedOutput = "fallbacks=1\nsmall=1\nlarge=2\n";
+}
+
+TEST_CASE("from ISR", "[DeferredCallsQueue]")
+{
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    uint32_t drops = dcq.getISRDropCount();
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    int added = 0;
+    for (int i = 0; i < CONFIG_PUBSUB_ISR_QUEUE_SIZE + 3; i++)
+    {
+        added += dcq.addDeferredCallFromISR([]() { usleep(1000); }, &higherPriorityTaskWoken);
+    }
+    usleep(300 * 1000);
+    dcq.addDeferredCallFromISR([]() { coutCapture << "isr call\n"; }, &higherPriorityTaskWoken);
+    usleep(100 * 1000);
+    coutCapture << "dropped=" << (dcq.getISRDropCount() - drops) << " added=" << added << "\n";
+    expectedOutput = "isr call\ndropped=2 added=" + std::to_string(CONFIG_PUBSUB_ISR_QUEUE_SIZE + 1) + "\n";
+}
+
+TEST_CASE("batching", "[DeferredCallsQueue]")
+{
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setBatching(1, DeferredCallsQueue::itsCurrentAffinity, 8, 1000);
+    coutCapture << "before\n";
+    for (int i = 0; i < DeferredCallsQueue::itsQueueSize; i++)
+    {
+        dcq.addDeferredCall([i]() { coutCapture << i << " "; }, 1);
+    }
+    usleep(300 * 1000);
+    coutCapture << "after\n";
+    expectedOutput = "before\n";
+    for (int i = 0; i < DeferredCallsQueue::itsQueueSize; i++)
+    {
+        expectedOutput += std::to_string(i) + " ";
+    }
+    expectedOutput += "after\n";
+}
+
+TEST_CASE("overflow policies", "[DeferredCallsQueue]")
+{
+    static std::string calls[3];
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    const UBaseType_t prio = 10;
+    const UBaseType_t size = 4;
+    dcq.setQueueConfig(prio, DeferredCallsQueue::itsCurrentAffinity, size, DeferredCallsQueue::OverflowPolicy::DropNewest);
+    dcq.setQueueConfig(prio + 1, DeferredCallsQueue::itsCurrentAffinity, size, DeferredCallsQueue::OverflowPolicy::DropOldest);
+    dcq.setQueueConfig(prio + 2, DeferredCallsQueue::itsCurrentAffinity, size, DeferredCallsQueue::OverflowPolicy::Coalesce);
+
+    // keep the task of each queue busy so calls pile up
+    for (UBaseType_t q = 0; q < 3; q++)
+    {
+        dcq.addDeferredCall([]() { usleep(100 * 1000); }, prio + q);
+    }
+    usleep(20 * 1000);
+    for (int i = 0; i < 8; i++)
+    {
+        for (UBaseType_t q = 0; q < 3; q++)
+        {
+            dcq.addDeferredCall([i, q]() { calls[q] += std::to_string(i) + " "; }, prio + q);
+        }
+    }
+    // the batch entry is full as well
+    dcq.addDeferredCall([]() { calls[2] += "8 "; }, prio + 2);
+    usleep(300 * 1000);
+
+    auto newest = dcq.getQueueStats(prio);
+    auto oldest = dcq.getQueueStats(prio + 1);
+    auto coalesced = dcq.getQueueStats(prio + 2);
+    coutCapture << "newest: " << calls[0] << "dropped=" << newest.itsDropped << "\n";
+    coutCapture << "oldest: " << calls[1] << "dropped=" << oldest.itsDropped << "\n";
+    coutCapture << "coalesce: " << calls[2] << "coalesced=" << coalesced.itsCoalesced
+                << " dropped=" << coalesced.itsDropped << "\n";
+    coutCapture << "size=" << newest.itsSize << "\n";
+    expectedOutput = "newest: 0 1 2 3 dropped=4\n"
+                     "oldest: 4 5 6 7 dropped=4\n"
+                     "coalesce: 0 1 2 3 4 5 6 7 coalesced=4 dropped=1\n"
+                     "size=4\n";
+}
+
+TEST_CASE("drop handler", "[DeferredCallsQueue]")
+{
+    static std::string calls;
+    static std::string drops;
+    static const char* names[] = {"a", "b", "c", "d"};
+    const UBaseType_t prio = 2;
+    const BaseType_t core = DeferredCallsQueue::itsCurrentAffinity;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, core, 1, DeferredCallsQueue::OverflowPolicy::DropNewest);
+    dcq.setDeadlineScheduling(prio, core, false, DeferredCallsQueue::ExpiredPolicy::Drop);
+    dcq.setQueueConfig(prio, tskNO_AFFINITY, 1, DeferredCallsQueue::OverflowPolicy::DropOldest);
+
+    auto add = [&dcq](int p_index, BaseType_t p_core, int64_t p_deadlineUs)
+    {
+        const DeferredCallsQueue::DropHandler onDrop = {[](void* p_name) {
+            drops += std::string(static_cast<const char*>(p_name)) + " ";
+        }, const_cast<char*>(names[p_index])};
+        return dcq.addDeferredCall([p_index]() { calls += std::string(names[p_index]) + " "; },
+                                   prio, p_core, p_deadlineUs, onDrop);
+    };
+    // keep the task of each queue busy so calls pile up
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio, tskNO_AFFINITY);
+    usleep(5 * 1000);
+    // a expires while waiting, b does not fit into the queue
+    const bool addedA = add(0, core, esp_timer_get_time() + 10 * 1000);
+    const bool addedB = add(1, core, DeferredCallsQueue::itsNoDeadline);
+    // d replaces c
+    const bool addedC = add(2, tskNO_AFFINITY, DeferredCallsQueue::itsNoDeadline);
+    const bool addedD = add(3, tskNO_AFFINITY, DeferredCallsQueue::itsNoDeadline);
+    usleep(100 * 1000);
+    coutCapture << "added: " << addedA << addedB << addedC << addedD << "\n";
+    coutCapture << "calls: " << calls << "\ndrops: " << drops << "\n";
+    expectedOutput = "added: 1011\ncalls: d \ndrops: c a \n";
+}
+
+TEST_CASE("timer", "[DeferredCallsQueue]")
+{
+    const UBaseType_t prio = 21;
+    const BaseType_t core = DeferredCallsQueue::itsCurrentAffinity;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, core, 1, DeferredCallsQueue::OverflowPolicy::Block, 1000);
+    DeferredCallsQueue::Timer timer;
+    const DeferredCallsQueue::DropHandler onDrop = {[](void*) { coutCapture << "dropped\n"; }, nullptr};
+    // a running timer cannot be started again
+    const bool first = timer.start(10 * 1000, []() { coutCapture << "first\n"; }, prio, core, onDrop);
+    const bool second = timer.start(10 * 1000, []() { coutCapture << "second\n"; }, prio, core, onDrop);
+    usleep(30 * 1000);
+    coutCapture << "started: " << first << second << "\n";
+    // the esp_timer task does not wait for the full queue
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    usleep(5 * 1000);
+    dcq.addDeferredCall([]() {}, prio);
+    timer.start(1000, []() { coutCapture << "third\n"; }, prio, core, onDrop);
+    usleep(20 * 1000);
+    const bool fourth = timer.start(60 * 1000, []() { coutCapture << "fourth\n"; }, prio, core, onDrop);
+    coutCapture << "restarted: " << fourth << "\n";
+    usleep(100 * 1000);
+    expectedOutput = "first\nstarted: 10\ndropped\nrestarted: 1\nfourth\n";
+}
+
+TEST_CASE("stats", "[DeferredCallsQueue]")
+{
+    const UBaseType_t prio = 14;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, tskNO_AFFINITY, 1, DeferredCallsQueue::OverflowPolicy::Block, 1000);
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio, tskNO_AFFINITY);
+    usleep(5 * 1000);
+    dcq.addDeferredCall([]() {}, prio, tskNO_AFFINITY);
+    // waits until the first call has finished
+    dcq.addDeferredCall([]() {}, prio, tskNO_AFFINITY);
+    usleep(100 * 1000);
+
+    auto all = dcq.getStats();
+    auto stats = std::find_if(all.begin(), all.end(), [prio](const DeferredCallsQueue::QueueStats& p_stats)
+                              { return (p_stats.itsPriority == prio) && (p_stats.itsCoreId == tskNO_AFFINITY); });
+    coutCapture << "found: " << (stats != all.end()) << "\n";
+    coutCapture << "executed: " << stats->itsExecuted << "\n";
+    coutCapture << "waits: " << stats->itsWaits << "\n";
+    coutCapture << "timed: " << (stats->itsMaxWaitTimeUs >= 10000) << (stats->itsMaxExecTimeUs >= 20000) << "\n";
+    dcq.resetStats();
+    coutCapture << "reset: " << dcq.getQueueStats(prio, tskNO_AFFINITY).itsExecuted << "\n";
+    expectedOutput = "found: 1\nexecuted: 3\nwaits: 1\ntimed: 11\nreset: 0\n";
+}
+
+TEST_CASE("latency", "[DeferredCallsQueue]")
+{
+    const UBaseType_t prio = 15;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    for (int i = 0; i < 3; i++)
+    {
+        dcq.addDeferredCall([]() {}, prio, tskNO_AFFINITY);
+    }
+    usleep(50 * 1000);
+    auto latency = dcq.getLatency(prio, tskNO_AFFINITY);
+    coutCapture << "count: " << latency.itsCount << "\n";
+    expectedOutput = CONFIG_PUBSUB_LATENCY_HISTOGRAM ? "count: 3\n" : "count: 0\n";
+}
+
+TEST_CASE("worker pool", "[DeferredCallsQueue]")
+{
+    static std::mutex mutex;
+    static std::vector<std::string> calls;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setWorkerPool(tskNO_AFFINITY, 2);
+    for (UBaseType_t prio : {3, 5, 7})
+    {
+        dcq.addDeferredCall([]() {
+            char call[40];
+            snprintf(call, sizeof(call), "prio=%u worker=%d", (unsigned) uxTaskPriorityGet(NULL),
+                     strncmp(pcTaskGetName(NULL), "DefCalls-w", 10) == 0);
+            std::lock_guard<std::mutex> lock(mutex);
+            calls.push_back(call);
+        }, prio, tskNO_AFFINITY);
+    }
+    usleep(50 * 1000);
+    // queues created from now on get a dedicated task again
+    dcq.setWorkerPool(tskNO_AFFINITY, 0);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::sort(calls.begin(), calls.end());
+    for (const auto& call : calls)
+    {
+        coutCapture << call << "\n";
+    }
+    expectedOutput = "prio=3 worker=1\nprio=5 worker=1\nprio=7 worker=1\n";
+}
+
+TEST_CASE("stack size", "[DeferredCallsQueue]")
+{
+    const UBaseType_t prio = 17;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    coutCapture << "set: " << dcq.setStackSize(prio, tskNO_AFFINITY, 3072) << "\n";
+    coutCapture << "reserve: " << dcq.reserveStack(prio, tskNO_AFFINITY, 2048) << "\n";
+    dcq.addDeferredCall([]() {}, prio, tskNO_AFFINITY);
+    usleep(20 * 1000);
+    coutCapture << "set again: " << dcq.setStackSize(prio, tskNO_AFFINITY, 4096) << "\n";
+    coutCapture << "reserve more: " << dcq.reserveStack(prio, tskNO_AFFINITY, 4096) << "\n";
+
+    auto all = dcq.getTaskStats();
+    auto stats = std::find_if(all.begin(), all.end(), [](const DeferredCallsQueue::TaskStats& p_stats)
+                              { return strcmp(p_stats.itsName, "DefCalls-p17c*") == 0; });
+    coutCapture << "found: " << (stats != all.end()) << "\n";
+    coutCapture << "size: " << stats->itsStackSize << "\n";
+    coutCapture << "free: " << (stats->itsStackFree <= stats->itsStackSize) << "\n";
+    expectedOutput = "set: 1\nreserve: 1\nset again: 0\nreserve more: 0\nfound: 1\nsize: 3072\nfree: 1\n";
+}
+
+TEST_CASE("deadlines", "[DeferredCallsQueue]")
+{
+    static std::string calls[2];
+    // priorities no other test uses, creating the queues fixes the stack size of their tasks
+    const UBaseType_t prios[2] = {4, 6};
+    const BaseType_t core = DeferredCallsQueue::itsCurrentAffinity;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setDeadlineScheduling(prios[0], core, true, DeferredCallsQueue::ExpiredPolicy::Drop);
+    dcq.setDeadlineScheduling(prios[1], core, false);
+
+    // keep the task of each queue busy so calls pile up
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prios[0]);
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prios[1]);
+    usleep(10 * 1000);
+    const int64_t now = esp_timer_get_time();
+    dcq.addDeferredCall([]() { calls[0] += "none1 "; }, prios[0]);
+    dcq.addDeferredCall([]() { calls[0] += "late "; }, prios[0], core, now + 1000 * 1000);
+    dcq.addDeferredCall([]() { calls[0] += "expired "; }, prios[0], core, now + 10 * 1000);
+    dcq.addDeferredCall([]() { calls[0] += "soon1 "; }, prios[0], core, now + 200 * 1000);
+    dcq.addDeferredCall([]() { calls[0] += "none2 "; }, prios[0]);
+    dcq.addDeferredCall([]() { calls[0] += "soon2 "; }, prios[0], core, now + 200 * 1000);
+    // a queue in FIFO order only counts the missed deadlines
+    dcq.addDeferredCall([]() { calls[1] += "missed "; }, prios[1], core, now + 10 * 1000);
+    dcq.addDeferredCall([]() { calls[1] += "in time "; }, prios[1], core, now + 1000 * 1000);
+    usleep(100 * 1000);
+
+    for (UBaseType_t q = 0; q < 2; q++)
+    {
+        auto stats = dcq.getQueueStats(prios[q]);
+        coutCapture << calls[q] << "missed=" << stats.itsMissed << " expired=" << stats.itsExpired
+                    << " edf=" << stats.itsEarliestFirst << " executed=" << stats.itsExecuted << "\n";
+    }
+    expectedOutput = "soon1 soon2 late none1 none2 missed=1 expired=1 edf=1 executed=6\n"
+                     "missed in time missed=1 expired=0 edf=0 executed=3\n";
+}
+
+#if portNUM_PROCESSORS > 1
+TEST_CASE("unpinned distribution", "[DeferredCallsQueue]")
+{
+    const UBaseType_t prio = 8;
+    static std::mutex mutex;
+    static std::string cores;
+    static QueueHandle_t done = xQueueCreate(1, sizeof(int));
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setUnpinnedDistribution(true);
+
+    // keep core 1 busy, so the task of its queue cannot run
+    xTaskCreatePinnedToCore([](void*) {
+        const int64_t end = esp_timer_get_time() + 50 * 1000;
+        while (esp_timer_get_time() < end)
+        {}
+        vTaskDelete(NULL);
+    }, "busy", 4096, nullptr, 20, nullptr, 1);
+    usleep(5 * 1000);
+
+    // add the calls without being preempted by the tasks of the queues
+    xTaskCreatePinnedToCore([](void*) {
+        for (int i = 0; i < 4; i++)
+        {
+            DeferredCallsQueue::get().addDeferredCall([]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                cores += std::to_string(xPortGetCoreID());
+            }, prio, tskNO_AFFINITY);
+        }
+        int result = 0;
+        xQueueSend(done, &result, portMAX_DELAY);
+        vTaskDelete(NULL);
+    }, "adder", 4096, nullptr, prio + 2, nullptr, 0);
+    int result;
+    xQueueReceive(done, &result, portMAX_DELAY);
+    usleep(100 * 1000);
+    dcq.setUnpinnedDistribution(false);
+
+    uint32_t executed = 0;
+    uint32_t stolen = 0;
+    uint32_t queues = 0;
+    for (const auto& stats : dcq.getStats())
+    {
+        if ((stats.itsPriority == prio) && stats.itsUnpinned)
+        {
+            executed += stats.itsExecuted;
+            stolen += stats.itsStolen;
+            queues++;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    coutCapture << "cores: " << cores << "\n";
+    coutCapture << "queues: " << queues << "\n";
+    coutCapture << "executed: " << executed << "\n";
+    coutCapture << "stolen: " << stolen << "\n";
+    expectedOutput = "cores: 0000\nqueues: 2\nexecuted: 4\nstolen: 2\n";
+}
+#endif
+
+TEST_CASE("direct link", "[DeferredCallsQueue]")
+{
+    const UBaseType_t prio = 12;
+    DeferredCallsQueue::DirectLink& link = DeferredCallsQueue::get().createDirectLink(prio, tskNO_AFFINITY, 3);
+    coutCapture << "before\n";
+    link.addCall([]() {
+        coutCapture << "name=" << strncmp(pcTaskGetName(NULL), "DefCalls-l", 10) << "\n";
+        usleep(50 * 1000);
+    });
+    usleep(5 * 1000);
+    // the ring is rounded up to 4 slots, the running call keeps its slot until it returns
+    for (int i = 0; i < 5; i++)
+    {
+        coutCapture << "added=" << link.addCall([i]() { coutCapture << "call=" << i << "\n"; }) << "\n";
+    }
+    usleep(100 * 1000);
+    DeferredCallsQueue::QueueStats stats = link.getStats();
+    coutCapture << "size=" << stats.itsSize << " executed=" << stats.itsExecuted
+                << " dropped=" << stats.itsDropped << " high water=" << stats.itsHighWater << "\n";
+    // the task sleeps now and is woken by the next call
+    link.addCall([]() { coutCapture << "woken\n"; });
+    usleep(20 * 1000);
+    link.resetStats();
+    coutCapture << "reset: " << link.getStats().itsExecuted << "\n";
+    expectedOutput = "before\nname=0\n"
+                     "added=1\nadded=1\nadded=1\nadded=0\nadded=0\n"
+                     "call=0\ncall=1\ncall=2\n"
+                     "size=4 executed=4 dropped=2 high water=4\n"
+                     "woken\nreset: 0\n";
+}
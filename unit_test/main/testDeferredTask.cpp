@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <DeferredTask.hpp>
+#include <PublishSubscribe.hpp>
+#include "test_app_main.hpp"
+
+
+static DeferredTask delayed(int p_id, uint32_t p_delayMs)
+{
+    coutCapture << "start " << p_id << "\n";
+    co_await DeferredTask::delay(p_delayMs);
+    coutCapture << "resumed " << p_id << " prio=" << uxTaskPriorityGet(NULL) << "\n";
+}
+
+static DeferredTask child(int& p_result)
+{
+    co_await DeferredTask::delay(10);
+    p_result = 42;
+}
+
+static DeferredTask parent()
+{
+    int result = 0;
+    co_await child(result);
+    coutCapture << "child result=" << result << "\n";
+}
+
+static DeferredTask waitForBits(EventGroupHandle_t p_group)
+{
+    EventBits_t bits = co_await DeferredTask::waitBits(p_group, 0x3, true, true);
+    coutCapture << "bits=" << bits << "\n";
+    bits = co_await DeferredTask::waitBits(p_group, 0x4, false, false, pdMS_TO_TICKS(30));
+    coutCapture << "timeout bits=" << bits << "\n";
+}
+
+static DeferredTask onRequest(int p_id, const std::string& p_text)
+{
+    coutCapture << "request " << p_id << " " << p_text << "\n";
+    auto [answer] = co_await PublishSubscribe<int>::get().topic("coroutine2").nextMessage();
+    // the argument passed by reference is still valid
+    coutCapture << "answer " << answer << " for " << p_text << "\n";
+}
+
+struct Released
+{
+    const char* itsName;
+    ~Released() { coutCapture << itsName << " released\n"; }
+};
+
+static DeferredTask awaitReply()
+{
+    Released released = {"inner"};
+    co_await PublishSubscribe<int>::get().topic("coroutine3").nextMessage();
+    coutCapture << "inner resumed\n";
+}
+
+static DeferredTask awaitInner()
+{
+    Released released = {"outer"};
+    co_await awaitReply();
+    coutCapture << "outer resumed\n";
+}
+
+
+TEST_CASE("delay", "[DeferredTask]")
+{
+    const UBaseType_t prio = 9;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    // both coroutines are suspended in the same task, which runs other calls meanwhile
+    dcq.addDeferredCall([]() { delayed(1, 40).start(); }, prio);
+    dcq.addDeferredCall([]() { delayed(2, 20).start(); }, prio);
+    dcq.addDeferredCall([]() { coutCapture << "other call\n"; }, prio);
+    usleep(80 * 1000);
+    expectedOutput = "start 1\nstart 2\nother call\nresumed 2 prio=9\nresumed 1 prio=9\n";
+}
+
+TEST_CASE("nested", "[DeferredTask]")
+{
+    DeferredCallsQueue::get().addDeferredCall([]() { parent().start(); }, 9);
+    usleep(40 * 1000);
+    expectedOutput = "child result=42\n";
+}
+
+TEST_CASE("event bits", "[DeferredTask]")
+{
+    EventGroupHandle_t group = xEventGroupCreate();
+    DeferredCallsQueue::get().addDeferredCall([group]() { waitForBits(group).start(); }, 9);
+    xEventGroupSetBits(group, 0x1);
+    usleep(30 * 1000);
+    coutCapture << "set\n";
+    xEventGroupSetBits(group, 0x2);
+    usleep(30 * 1000);
+    coutCapture << "cleared=" << xEventGroupGetBits(group) << "\n";
+    usleep(60 * 1000);
+    vEventGroupDelete(group);
+    expectedOutput = "set\nbits=3\ncleared=0\ntimeout bits=0\n";
+}
+
+TEST_CASE("subscriber", "[DeferredTask]")
+{
+    const UBaseType_t prio = 9;
+    auto topic = PublishSubscribe<int, const std::string&>::get().topic("coroutine1");
+    auto reply = PublishSubscribe<int>::get().topic("coroutine2");
+    topic.subscribeAsyncWithPrio(onRequest, prio);
+    topic.publish(1, "first");
+    topic.publish(2, "second");
+    usleep(20 * 1000);
+    coutCapture << "waiting=" << reply.getStats().itsSubscribers << "\n";
+    // both coroutines get the reply and unsubscribe
+    reply.publish(7);
+    usleep(20 * 1000);
+    coutCapture << "waiting=" << reply.getStats().itsSubscribers << "\n";
+    topic.clear();
+    expectedOutput = "request 1 first\nrequest 2 second\nwaiting=2\n"
+                     "answer 7 for first\nanswer 7 for second\nwaiting=0\n";
+}
+
+TEST_CASE("dropped resumption", "[DeferredTask]")
+{
+    const UBaseType_t prio = 21;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, DeferredCallsQueue::itsCurrentAffinity, 1, DeferredCallsQueue::OverflowPolicy::DropNewest);
+    auto reply = PublishSubscribe<int>::get().topic("coroutine3");
+    dcq.addDeferredCall([]() { awaitInner().start(); }, prio);
+    usleep(10 * 1000);
+    // fill the queue, so the call resuming the coroutines is dropped
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    usleep(5 * 1000);
+    dcq.addDeferredCall([]() {}, prio);
+    reply.publish(1);
+    coutCapture << "waiting=" << reply.getStats().itsSubscribers << "\n";
+    usleep(100 * 1000);
+    expectedOutput = "inner released\nouter released\nwaiting=0\n";
+}
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <LatencyHistogram.hpp>
+#include "test_app_main.hpp"
+
+
+TEST_CASE("buckets", "[LatencyHistogram]")
+{
+    coutCapture << LatencyHistogram::bucketOf(0) << " "
+                << LatencyHistogram::bucketOf(1) << " "
+                << LatencyHistogram::bucketOf(3) << " "
+                << LatencyHistogram::bucketOf(4) << " "
+                << LatencyHistogram::bucketOf(1000) << " "
+                << LatencyHistogram::bucketOf(0xffffffff) << "\n";
+    expectedOutput = "0 1 2 3 10 19\n";
+}
+
+TEST_CASE("percentile", "[LatencyHistogram]")
+{
+    LatencyHistogram histogram;
+    for (int i = 0; i < 9; i++)
+    {
+        histogram.record(10);
+    }
+    histogram.record(5000000);
+    auto snapshot = histogram.read();
+    coutCapture << "count: " << snapshot.itsCount << ", max: " << snapshot.itsMaxUs << "\n";
+    coutCapture << "p50: " << snapshot.percentile(50) << ", p90: " << snapshot.percentile(90)
+                << ", p100: " << snapshot.percentile(100) << "\n";
+    histogram.reset();
+    coutCapture << "reset: " << histogram.read().itsCount << "\n";
+    expectedOutput = "count: 10, max: 5000000\np50: 16, p90: 16, p100: 5000000\nreset: 0\n";
+}
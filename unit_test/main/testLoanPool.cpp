@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <LoanPool.hpp>
+#include <PublishSubscribe.hpp>
+#include "test_app_main.hpp"
+
+
+TEST_CASE("loan", "[LoanPool]")
+{
+    LoanPool pool(100, 2, MALLOC_CAP_DEFAULT);
+    LoanedBuffer first = pool.loan(10);
+    LoanedBuffer second = pool.loan(100);
+    LoanedBuffer third = pool.loan(10);
+    LoanedBuffer large = pool.loan(1000);
+    coutCapture << "loaned: " << bool(first) << bool(second) << bool(third) << bool(large) << "\n";
+    coutCapture << "size: " << first.size() << "/" << first.capacity() << "\n";
+    first.reset();
+    third = pool.loan(10);
+    coutCapture << "reloaned: " << bool(third) << "\n";
+    const auto stats = pool.getStats();
+    coutCapture << "in use: " << stats.itsBlocksInUse << ", failed: " << stats.itsFailed << "\n";
+    expectedOutput = "loaned: 1100\nsize: 10/112\nreloaned: 1\nin use: 2, failed: 1\n";
+}
+
+TEST_CASE("shared references", "[LoanPool]")
+{
+    LoanPool pool(16, 1, MALLOC_CAP_DEFAULT);
+    LoanedBuffer buffer = pool.loan(4);
+    LoanedBuffer copy = buffer;
+    coutCapture << "same data: " << (copy.data() == buffer.data()) << "\n";
+    buffer.reset();
+    coutCapture << "in use: " << pool.getStats().itsBlocksInUse << "\n";
+    copy.reset();
+    coutCapture << "in use: " << pool.getStats().itsBlocksInUse << "\n";
+    expectedOutput = "same data: 1\nin use: 1\nin use: 0\n";
+}
+
+TEST_CASE("publish loaned buffer", "[LoanPool]")
+{
+    auto topic = PublishSubscribe<LoanedBuffer>::get().topic("topic14");
+    topic.createLoanPool(64, 2);
+    auto handler = [](const LoanedBuffer& buf) {
+        coutCapture << "received " << (const char*) buf.data() << "\n";
+    };
+    topic.subscribeAsync(handler);
+    topic.subscribeAsync(handler);
+    LoanedBuffer buf = topic.loan(6);
+    strcpy((char*) buf.data(), "frame");
+    const uint8_t* data = buf.data();
+    topic.publishAsync(std::move(buf));
+    coutCapture << "moved: " << !buf << "\n";
+    usleep(50 * 1000);
+    LoanedBuffer next = topic.loan(6);
+    coutCapture << "returned: " << (next.data() == data) << "\n";
+    expectedOutput = "moved: 1\nreceived frame\nreceived frame\nreturned: 1\n";
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <array>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <PubSubBridge.hpp>
+#include "test_app_main.hpp"
+
+
+// keeps the sent frames instead of sending them, flushes may send from another task
+class CaptureTransport : public PubSubBridge::Transport
+{
+public:
+    explicit CaptureTransport(std::size_t p_maxFrameSize) :
+        itsMaxFrameSize(p_maxFrameSize)
+    {}
+
+    std::size_t maxFrameSize() const override
+    {
+        return itsMaxFrameSize;
+    }
+
+    bool send(const uint8_t* p_frame, std::size_t p_size) override
+    {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        itsFrames.emplace_back(p_frame, p_frame + p_size);
+        return true;
+    }
+
+    std::size_t count()
+    {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        return itsFrames.size();
+    }
+
+    std::vector<uint8_t> frame(std::size_t p_index)
+    {
+        std::lock_guard<std::mutex> lock(itsMutex);
+        return itsFrames.at(p_index);
+    }
+
+private:
+    std::size_t itsMaxFrameSize;
+    std::mutex itsMutex;
+    std::vector<std::vector<uint8_t>> itsFrames;
+};
+
+enum class Color : uint16_t
+{
+    red = 1,
+    blue = 200
+};
+
+static void printBytes(const uint8_t* p_data, std::size_t p_size)
+{
+    for (std::size_t i = 0; i < p_size; i++)
+    {
+        char hex[4];
+        snprintf(hex, sizeof(hex), "%02x", p_data[i]);
+        coutCapture << (i ? " " : "") << hex;
+    }
+    coutCapture << "\n";
+}
+
+static void printStats(const BridgeStats& p_stats)
+{
+    coutCapture << "sent " << p_stats.itsFramesSent << "/" << p_stats.itsMessagesSent << "/" << p_stats.itsBytesSent
+                << ", received " << p_stats.itsFramesReceived << "/" << p_stats.itsMessagesReceived << "/"
+                << p_stats.itsBytesReceived << ", suppressed " << p_stats.itsSuppressed
+                << ", oversized " << p_stats.itsOversized << ", own " << p_stats.itsOwnFrames
+                << ", invalid " << p_stats.itsInvalidFrames << ", unknown " << p_stats.itsUnknownTopics
+                << ", decode errors " << p_stats.itsDecodeErrors << "\n";
+}
+
+
+TEST_CASE("codec", "[PubSubBridge]")
+{
+    uint8_t buffer[32];
+    BinaryWriter writer(buffer, sizeof(buffer));
+    binaryEncode(writer, int8_t(-1), uint16_t(300), int32_t(-2), true, Color::blue, 1.5f,
+                 std::string("ab"), std::array<int16_t, 2>{ -1, 64 });
+    printBytes(buffer, writer.size());
+
+    std::tuple<int8_t, uint16_t, int32_t, bool, Color, float, std::string, std::array<int16_t, 2>> values;
+    BinaryReader reader(buffer, writer.size());
+    binaryDecode(reader, values);
+    coutCapture << int(std::get<0>(values)) << " " << std::get<1>(values) << " " << std::get<2>(values) << " "
+                << std::get<3>(values) << " " << int(std::get<4>(values)) << " " << std::get<5>(values) << " "
+                << std::get<6>(values) << " " << std::get<7>(values)[0] << " " << std::get<7>(values)[1]
+                << ", error " << reader.error() << ", remaining " << reader.remaining() << "\n";
+
+    // a truncated buffer and a full one are reported
+    BinaryReader truncated(buffer, writer.size() - 1);
+    binaryDecode(truncated, values);
+    BinaryWriter small(buffer, 2);
+    binaryEncode(small, std::string("abc"));
+    coutCapture << "truncated " << truncated.error() << ", overflow " << small.overflow() << "\n";
+    expectedOutput = "ff ac 02 03 01 c8 01 00 00 c0 3f 02 61 62 01 80 01\n"
+                     "-1 300 -2 1 200 1.5 ab -1 64, error 0, remaining 0\n"
+                     "truncated 1, overflow 1\n";
+}
+
+TEST_CASE("forward", "[PubSubBridge]")
+{
+    CaptureTransport transport(32);
+    {
+        PubSubBridge bridge(transport, 1, 1000);
+        bridge.bridge<int, const std::string&>("bridge1");
+        auto topic = PublishSubscribe<int, const std::string&>::get().topic("bridge1");
+        topic.publish(1, "one");
+        topic.publish(2, "two");
+        coutCapture << "frames " << transport.count() << "\n";
+        // does not fit into the frame anymore
+        topic.publish(3, "three");
+        coutCapture << "frames " << transport.count() << "\n";
+        // does not fit into any frame
+        topic.publish(4, std::string(32, 'x'));
+        bridge.flush();
+        std::vector<uint8_t> frame = transport.frame(0);
+        printBytes(frame.data(), frame.size());
+        printStats(bridge.getStats());
+    }
+    coutCapture << "frames " << transport.count() << "\n";
+    expectedOutput = "frames 0\n"
+                     "frames 1\n"
+                     "50 53 01 02 01 00 00 00 f3 a5 b1 a0 05 00 02 03 6f 6e 65 f3 a5 b1 a0 05 00 04 03 74 77 6f\n"
+                     "sent 2/3/51, received 0/0/0, suppressed 0, oversized 1, own 0, invalid 0, unknown 0, "
+                     "decode errors 0\n"
+                     "frames 2\n";
+}
+
+TEST_CASE("receive", "[PubSubBridge]")
+{
+    CaptureTransport transport(64);
+    PubSubBridge bridge(transport, 1, 0);
+    bridge.bridge<int, const std::string&>("bridge2");
+    bridge.bridge<uint8_t>("bridge3");
+    auto topic = PublishSubscribe<int, const std::string&>::get().topic("bridge2");
+    topic.subscribeSync([](int p_number, const std::string& p_text) {
+        coutCapture << "bridge2 " << p_number << " " << p_text << "\n";
+    });
+    topic.publish(-7, "local");
+    std::vector<uint8_t> frame = transport.frame(0);
+
+    // the own frame is dropped
+    bridge.receive(frame.data(), frame.size());
+    // a frame of another node is published but not forwarded again
+    frame[4] = 2;
+    bridge.receive(frame.data(), frame.size());
+    coutCapture << "frames " << transport.count() << "\n";
+    // a truncated message
+    bridge.receive(frame.data(), frame.size() - 1);
+    // the arguments of a topic with other types
+    const uint32_t other = topicId("bridge3");
+    memcpy(&frame[8], &other, sizeof(other));
+    bridge.receive(frame.data(), frame.size());
+    // a topic which is not bridged
+    frame[8]++;
+    bridge.receive(frame.data(), frame.size());
+    printStats(bridge.getStats());
+    expectedOutput = "bridge2 -7 local\n"
+                     "bridge2 -7 local\n"
+                     "frames 1\n"
+                     "sent 1/1/21, received 4/1/83, suppressed 1, oversized 0, own 1, invalid 1, unknown 1, "
+                     "decode errors 1\n";
+}
+
+TEST_CASE("flush timer", "[PubSubBridge]")
+{
+    CaptureTransport transport(64);
+    PubSubBridge bridge(transport, 1, 20);
+    bridge.bridge<int>("bridge4");
+    auto topic = PublishSubscribe<int>::get().topic("bridge4");
+    topic.publish(1);
+    topic.publish(2);
+    coutCapture << "frames " << transport.count() << "\n";
+    vTaskDelay(pdMS_TO_TICKS(100));
+    coutCapture << "frames " << transport.count() << ", messages " << int(transport.frame(0)[3]) << "\n";
+    topic.publish(3);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    coutCapture << "frames " << transport.count() << "\n";
+    expectedOutput = "frames 0\nframes 1, messages 2\nframes 2\n";
+}
+
+TEST_CASE("flush dropped", "[PubSubBridge]")
+{
+    const UBaseType_t prio = 21;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, tskNO_AFFINITY, 1, DeferredCallsQueue::OverflowPolicy::DropNewest);
+    CaptureTransport transport(64);
+    {
+        PubSubBridge bridge(transport, 1, 5, prio);
+        bridge.bridge<int>("bridge6");
+        auto topic = PublishSubscribe<int>::get().topic("bridge6");
+        // fill the queue, so the first flush call is dropped
+        dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio, tskNO_AFFINITY);
+        usleep(5 * 1000);
+        dcq.addDeferredCall([]() {}, prio, tskNO_AFFINITY);
+        topic.publish(1);
+        vTaskDelay(pdMS_TO_TICKS(100));
+        coutCapture << "frames " << transport.count() << "\n";
+        // the next message flushes the pending frame
+        topic.publish(2);
+        vTaskDelay(pdMS_TO_TICKS(50));
+        coutCapture << "frames " << transport.count() << ", messages " << int(transport.frame(0)[3]) << "\n";
+        topic.publish(3);
+    }
+    coutCapture << "destroyed\n";
+    expectedOutput = "frames 0\nframes 1, messages 2\ndestroyed\n";
+}
+
+// the test app does not bring up a network interface on the target
+#ifndef ESP_PLATFORM
+#include <UdpTransport.hpp>
+
+TEST_CASE("udp", "[PubSubBridge]")
+{
+    // the frames sent to the own port come back and are dropped
+    UdpTransport transport(47800, "127.0.0.1");
+    PubSubBridge bridge(transport, 1, 0);
+    bridge.bridge<int>("bridge5");
+    PublishSubscribe<int>::get().topic("bridge5").publish(5);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    BridgeStats stats = bridge.getStats();
+    coutCapture << "sent " << stats.itsFramesSent << ", own " << stats.itsOwnFrames << "\n";
+    expectedOutput = "sent 1, own 1\n";
+}
+#endif
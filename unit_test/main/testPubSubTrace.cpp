@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <PublishSubscribe.hpp>
+#include <PubSubTrace.hpp>
+#include "test_app_main.hpp"
+
+
+static constexpr bool traceEnabled = (PubSubTrace::itsLevel != PubSubTrace::Level::None);
+
+TEST_CASE("counters", "[PubSubTrace]")
+{
+    PublishSubscribe<int>::get().subscribeSync("topic15", [](int) {});
+    const auto before = PubSubTrace::getCounters();
+    PublishSubscribe<int>::get().publish("topic15", 1);
+    PublishSubscribe<int>::get().publish("topic15", 2);
+    const auto after = PubSubTrace::getCounters();
+    auto delta = [&before, &after](TraceEvent p_event) {
+        return after[static_cast<size_t>(p_event)] - before[static_cast<size_t>(p_event)];
+    };
+    coutCapture << "publish: " << delta(TraceEvent::Publish) << "\n";
+    coutCapture << "dispatch: " << delta(TraceEvent::DispatchSync) << "\n";
+    expectedOutput = traceEnabled ? "publish: 2\ndispatch: 2\n" : "publish: 0\ndispatch: 0\n";
+}
+
+TEST_CASE("ring", "[PubSubTrace]")
+{
+    const SubscriptionId id = PublishSubscribe<int>::get().subscribeSync("topic16", [](int) {});
+    PublishSubscribe<int>::get().publish("topic16", 1);
+    PubSubTrace::Record records[2];
+    const size_t numRecords = PubSubTrace::readRing(records, 2);
+    if (PubSubTrace::itsLevel == PubSubTrace::Level::Ring)
+    {
+        coutCapture << "records: " << numRecords << "\n";
+        coutCapture << "topic: " << (records[0].itsTopic == topicId("topic16")) << "\n";
+        coutCapture << "subscriber: " << (records[1].itsSubscriber == id) << "\n";
+        coutCapture << "event: " << PubSubTrace::eventName(records[1].itsEvent) << "\n";
+        expectedOutput = "records: 2\ntopic: 1\nsubscriber: 1\nevent: dispatchSync\n";
+    }
+    else
+    {
+        coutCapture << "records: " << numRecords << "\n";
+        expectedOutput = "records: 0\n";
+    }
+}
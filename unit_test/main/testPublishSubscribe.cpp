@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <PublishSubscribe.hpp>
 #include "test_app_main.hpp"
 
@@ -29,7 +31,8 @@ TEST_CASE("async", "[PublishSubscribe]")
     usleep(100 * 1000);
     PublishSubscribe<int>::get().publishAsyncWithPrio("topic2", 42, 0);
     coutCapture << "after\n";
-    expectedOutput = "before\narg2=41\nmiddle\narg1=41\nafter\narg2=42\narg1=42\n";
+    // asynchronous calls of one priority run in the order of subscription
+    expectedOutput = "before\narg2=41\nmiddle\narg1=41\nafter\narg1=42\narg2=42\n";
 }
 
 TEST_CASE("recursive", "[PublishSubscribe]")
@@ -60,6 +63,515 @@ TEST_CASE("deferred subscription", "[PublishSubscribe]")
     });
     coutCapture << "before\n";
     PublishSubscribe<int>::get().publish("topic5", 43);
+    PublishSubscribe<int>::get().publish("topic6", 45);
+    PublishSubscribe<int>::get().clear("topic5");
     coutCapture << "after\n";
-    expectedOutput = "before\narg5=43\nafter\n";
+    expectedOutput = "before\narg5=43\narg6=45\nafter\n";
+}
+
+TEST_CASE("topic handle", "[PublishSubscribe]")
+{
+    auto topic = PublishSubscribe<int>::get().topic("topic7");
+    topic.subscribeSync([](int arg) {
+        coutCapture << "arg=" << arg << "\n";
+    });
+    coutCapture << "before\n";
+    topic.publish(45);
+    PublishSubscribe<int>::get().publish("topic7", 46);
+    coutCapture << "after\n";
+    expectedOutput = "before\narg=45\narg=46\nafter\n";
+}
+
+static void staticHandler(int arg)
+{
+    coutCapture << "static=" << arg << "\n";
+}
+
+TEST_CASE("static topic", "[PublishSubscribe]")
+{
+    using Topic = PublishSubscribe<int>::StaticTopic<"topic8", 2, &staticHandler>;
+    static_assert(Topic::itsId == topicId("topic8"));
+    Topic::subscribeSync([](int arg) {
+        coutCapture << "arg=" << arg << "\n";
+    });
+    coutCapture << "before\n";
+    Topic::publish(47);
+    coutCapture << "after\n";
+    expectedOutput = "before\nstatic=47\narg=47\nafter\n";
+}
+
+TEST_CASE("unsubscribe", "[PublishSubscribe]")
+{
+    static SubscriptionId id1;
+    id1 = PublishSubscribe<int>::get().subscribeSync("topic9", [](int arg) {
+        // unsubscribing while publishing only takes effect with the next message
+        PublishSubscribe<int>::get().unsubscribe("topic9", id1);
+        coutCapture << "arg1=" << arg << "\n";
+    });
+    SubscriptionId id2 = PublishSubscribe<int>::get().subscribeSync("topic9", [](int arg) {
+        coutCapture << "arg2=" << arg << "\n";
+    });
+    PublishSubscribe<int>::get().subscribeSync("topic9", [](int arg) {
+        coutCapture << "arg3=" << arg << "\n";
+    });
+    coutCapture << "before\n";
+    PublishSubscribe<int>::get().publish("topic9", 48);
+    PublishSubscribe<int>::get().unsubscribe("topic9", id2);
+    PublishSubscribe<int>::get().publish("topic9", 49);
+    coutCapture << "after\n";
+    expectedOutput = "before\narg1=48\narg2=48\narg3=48\narg3=49\nafter\n";
+}
+
+TEST_CASE("concurrent subscribe", "[PublishSubscribe]")
+{
+    static QueueHandle_t done;
+    done = xQueueCreate(1, sizeof(int));
+    PublishSubscribe<int>::get().subscribeSync("topic10", [](int arg) {
+        if (arg == 50)
+        {
+            // subscribe and publish from another task while this message is being delivered
+            xTaskCreatePinnedToCore([](void*) {
+                PublishSubscribe<int>::get().subscribeSync("topic10", [](int arg) {
+                    coutCapture << "arg2=" << arg << "\n";
+                });
+                PublishSubscribe<int>::get().publish("topic10", 51);
+                int result = 0;
+                xQueueSend(done, &result, portMAX_DELAY);
+                vTaskDelete(NULL);
+            }, "subscriber", 4096, nullptr, uxTaskPriorityGet(NULL), nullptr, tskNO_AFFINITY);
+            int result;
+            xQueueReceive(done, &result, portMAX_DELAY);
+        }
+        coutCapture << "arg1=" << arg << "\n";
+    });
+    coutCapture << "before\n";
+    PublishSubscribe<int>::get().publish("topic10", 50);
+    coutCapture << "after\n";
+    vQueueDelete(done);
+    expectedOutput = "before\narg1=51\narg2=51\narg1=50\nafter\n";
+}
+
+TEST_CASE("publish from ISR", "[PublishSubscribe]")
+{
+    auto topic = PublishSubscribe<int>::get().topic("topic11");
+    topic.subscribeSync([](int arg) {
+        coutCapture << "arg=" << arg << "\n";
+    });
+    coutCapture << "before\n";
+    // the ISR task has no core affinity and may run the call right away
+    bool queued = topic.publishFromISR(52);
+    usleep(100 * 1000);
+    coutCapture << "queued=" << queued << "\n";
+    coutCapture << "after\n";
+    expectedOutput = "before\narg=52\nqueued=1\nafter\n";
+}
+
+TEST_CASE("latest value", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 13;
+    PublishSubscribe<int>::get().subscribeLatestWithPrio("topic12", [](int arg) {
+        coutCapture << "latest=" << arg << "\n";
+    }, prio);
+    // keep the task busy so the messages are still pending
+    DeferredCallsQueue::get().addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    coutCapture << "before\n";
+    for (int i = 53; i <= 56; i++)
+    {
+        PublishSubscribe<int>::get().publish("topic12", i);
+    }
+    usleep(150 * 1000);
+    PublishSubscribe<int>::get().publish("topic12", 57);
+    usleep(50 * 1000);
+    coutCapture << "after\n";
+    expectedOutput = "before\nlatest=56\nlatest=57\nafter\n";
+}
+
+TEST_CASE("latest value dropped", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 21;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, DeferredCallsQueue::itsCurrentAffinity, 1, DeferredCallsQueue::OverflowPolicy::DropNewest);
+    auto topic = PublishSubscribe<int>::get().topic("topic29");
+    topic.subscribeLatestWithPrio([](int arg) {
+        coutCapture << "latest=" << arg << "\n";
+    }, prio);
+    // fill the queue, so the call of the first message is dropped
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    dcq.addDeferredCall([]() {}, prio);
+    topic.publish(1);
+    usleep(100 * 1000);
+    topic.publish(2);
+    usleep(50 * 1000);
+    topic.clear();
+    expectedOutput = "latest=2\n";
+}
+
+struct CopyCounter
+{
+    int itsCopies = 0;
+    CopyCounter() = default;
+    CopyCounter(const CopyCounter& p_other) : itsCopies(p_other.itsCopies + 1) {}
+};
+
+TEST_CASE("shared payload", "[PublishSubscribe]")
+{
+    auto handler = [](const CopyCounter& arg) {
+        coutCapture << "copies=" << arg.itsCopies << "\n";
+    };
+    PublishSubscribe<const CopyCounter&>::get().subscribeSync("topic13", handler);
+    PublishSubscribe<const CopyCounter&>::get().subscribeAsync("topic13", handler);
+    PublishSubscribe<const CopyCounter&>::get().subscribeAsync("topic13", handler);
+    coutCapture << "before\n";
+    PublishSubscribe<const CopyCounter&>::get().publish("topic13", CopyCounter());
+    usleep(50 * 1000);
+    coutCapture << "after\n";
+    expectedOutput = "before\ncopies=0\ncopies=1\ncopies=1\nafter\n";
+}
+
+TEST_CASE("stats", "[PublishSubscribe]")
+{
+    auto topic = PublishSubscribe<int>::get().topic("topic17");
+    topic.subscribeSync([](int) { usleep(2000); });
+    topic.subscribeAsync([](int) {});
+    topic.publish(1);
+    topic.publish(2);
+    usleep(50 * 1000);
+    TopicStats stats = PublishSubscribe<int>::get().getStats("topic17");
+    coutCapture << "name: " << stats.itsName << "\n";
+    coutCapture << "subscribers: " << stats.itsSubscribers << "\n";
+    coutCapture << "published: " << stats.itsPublished << "\n";
+    coutCapture << "sync calls: " << stats.itsSyncCalls << "\n";
+    coutCapture << "timed: " << (stats.itsMaxSyncTimeUs >= 2000) << (stats.itsSyncTimeUs >= 4000) << "\n";
+    topic.resetStats();
+    coutCapture << "reset: " << topic.getStats().itsPublished << "\n";
+    expectedOutput = "name: topic17\nsubscribers: 2\npublished: 2\nsync calls: 2\ntimed: 11\nreset: 0\n";
+}
+
+TEST_CASE("latency", "[PublishSubscribe]")
+{
+    auto topic = PublishSubscribe<int>::get().topic("topic18");
+    SubscriptionId id = topic.subscribeAsyncWithPrio([](int) {}, 16);
+    topic.publish(1);
+    topic.publish(2);
+    usleep(50 * 1000);
+    coutCapture << "count: " << topic.getLatency(id).itsCount << "\n";
+    coutCapture << "unknown: " << topic.getLatency(id + 1000).itsCount << "\n";
+    expectedOutput = CONFIG_PUBSUB_LATENCY_HISTOGRAM ? "count: 2\nunknown: 0\n" : "count: 0\nunknown: 0\n";
+}
+
+TEST_CASE("subscriber stack", "[PublishSubscribe]")
+{
+    auto topic = PublishSubscribe<int>::get().topic("topic19");
+    topic.subscribeAsyncWithPrio([](int) {}, 19, 12 * 1024);
+    topic.subscribeAsyncWithPrio([](int) {}, 19, 2 * 1024);
+    topic.publish(1);
+    usleep(20 * 1000);
+
+    char name[20];
+    snprintf(name, sizeof(name), "DefCalls-p19c%d", (int) xTaskGetAffinity(NULL));
+    auto all = DeferredCallsQueue::get().getTaskStats();
+    auto stats = std::find_if(all.begin(), all.end(), [&name](const DeferredCallsQueue::TaskStats& p_stats)
+                              { return strcmp(p_stats.itsName, name) == 0; });
+    coutCapture << "found: " << (stats != all.end()) << "\n";
+    coutCapture << "size: " << stats->itsStackSize << "\n";
+    topic.clear();
+    expectedOutput = "found: 1\nsize: 12288\n";
+}
+
+TEST_CASE("topic patterns", "[PublishSubscribe]")
+{
+    for (const char* pattern : {"a/b", "a/+/c", "+", "a/#", "#", "a/b+", "a/#/c", "a/b#"})
+    {
+        coutCapture << isTopicPattern(pattern);
+    }
+    coutCapture << "\n";
+    coutCapture << topicMatches("a/+/c", "a/b/c") << topicMatches("a/+/c", "a/b/d") << topicMatches("a/+", "a")
+                << topicMatches("a/+", "a/b/c") << topicMatches("a/#", "a") << topicMatches("a/#", "a/b/c")
+                << topicMatches("#", "a/b") << topicMatches("a/b", "a/b") << topicMatches("a/b", "a/bc")
+                << topicMatches("+/+", "a/") << "\n";
+    expectedOutput = "11111000\n1000111101\n";
+}
+
+TEST_CASE("wildcard subscriptions", "[PublishSubscribe]")
+{
+    auto& pubSub = PublishSubscribe<int>::get();
+    // exists before the patterns, all other channels are created afterwards
+    auto accel = pubSub.topic("sensor/imu/accel");
+    accel.subscribeSync([](int arg) { coutCapture << "accel=" << arg << "\n"; });
+    auto imu = pubSub.pattern("sensor/imu/+");
+    SubscriptionId imuId = imu.subscribeSync([](int arg) { coutCapture << "imu/+=" << arg << "\n"; });
+    auto sensor = pubSub.pattern("sensor/#");
+    sensor.subscribeSync([](int arg) { coutCapture << "sensor/#=" << arg << "\n"; });
+
+    const size_t channels = pubSub.getStats().size();
+    accel.publish(1);
+    pubSub.publish("sensor/imu/gyro", 2);
+    pubSub.publish("sensor", 3);
+    pubSub.publish("sensor/imu/gyro/x", 4);
+    pubSub.publish("other/imu/accel", 5);
+    pubSub.publishAsync("sensor/temp", 8);
+    usleep(50 * 1000);
+    // names only matched by patterns do not get a channel
+    coutCapture << "new channels=" << pubSub.getStats().size() - channels << "\n";
+    imu.unsubscribe(imuId);
+    accel.publish(6);
+
+    accel.clear();
+    sensor.clear();
+    accel.publish(7);
+    expectedOutput = "accel=1\nimu/+=1\nsensor/#=1\n"
+                     "imu/+=2\nsensor/#=2\n"
+                     "sensor/#=3\n"
+                     "sensor/#=4\n"
+                     "sensor/#=8\nnew channels=0\n"
+                     "accel=6\nsensor/#=6\n";
+}
+
+TEST_CASE("sync order", "[PublishSubscribe]")
+{
+    auto topic = PublishSubscribe<int>::get().topic("topic20");
+    const UBaseType_t prio = uxTaskPriorityGet(NULL);
+    topic.subscribeSync([](int arg) { coutCapture << "low=" << arg << "\n"; });
+    topic.subscribeAsyncWithPrio([](int arg) { coutCapture << "async=" << arg << "\n"; }, 0);
+    // synchronous subscribers take over the priority of the subscribing task
+    vTaskPrioritySet(NULL, prio + 2);
+    topic.subscribeSync([](int arg) { coutCapture << "high=" << arg << "\n"; });
+    vTaskPrioritySet(NULL, prio);
+    topic.subscribeCritical([](int arg) { coutCapture << "critical=" << arg << "\n"; });
+    topic.publish(1);
+    coutCapture << "published\n";
+    usleep(50 * 1000);
+    topic.clear();
+    expectedOutput = "critical=1\nhigh=1\nlow=1\npublished\nasync=1\n";
+}
+
+TEST_CASE("many deferred subscriptions", "[PublishSubscribe]")
+{
+    static int calls;
+    static int rejected;
+    calls = 0;
+    rejected = 0;
+    auto outer = PublishSubscribe<int>::get().topic("topic21");
+    auto inner = PublishSubscribe<int>::get().topic("topic22");
+    outer.subscribeSync([inner](int arg) {
+        // more than fit into the ring of deferred subscriptions
+        for (int i = 0; i < 2 * CONFIG_PUBSUB_PENDING_OPS_SIZE; i++)
+        {
+            if (inner.subscribeSync([](int) { calls++; }) == 0)
+            {
+                rejected++;
+            }
+        }
+    });
+    outer.publish(1);
+    inner.publish(2);
+    coutCapture << "calls=" << (calls == CONFIG_PUBSUB_PENDING_OPS_SIZE) << "\n";
+    coutCapture << "rejected=" << (rejected == CONFIG_PUBSUB_PENDING_OPS_SIZE) << "\n";
+    outer.clear();
+    inner.clear();
+    expectedOutput = "calls=1\nrejected=1\n";
+}
+
+TEST_CASE("deferred subscriptions of another task", "[PublishSubscribe]")
+{
+    auto outer = PublishSubscribe<int>::get().topic("topic30");
+    auto inner = PublishSubscribe<int>::get().topic("topic31");
+    outer.subscribeSync([inner](int arg) {
+        inner.subscribeSync([](int arg) { coutCapture << "inner=" << arg << "\n"; });
+        // still publishing, so the subscription is pending
+        usleep(50 * 1000);
+    });
+    DeferredCallsQueue::get().addDeferredCall([outer]() { outer.publish(1); }, 23);
+    usleep(10 * 1000);
+    // ending the reader sections of this task does not apply the subscription
+    inner.publish(2);
+    inner.publish(3);
+    usleep(100 * 1000);
+    inner.publish(4);
+    outer.clear();
+    inner.clear();
+    expectedOutput = "inner=4\n";
+}
+
+TEST_CASE("deferred subscriptions of two publishing tasks", "[PublishSubscribe]")
+{
+    auto outer = PublishSubscribe<int>::get().topic("topic34");
+    auto inner = PublishSubscribe<int>::get().topic("topic35");
+    outer.subscribeSync([inner](int arg) {
+        inner.subscribeSync([arg](int p_inner) { coutCapture << "inner" << arg << "=" << p_inner << "\n"; });
+        // the other task ends its publish meanwhile
+        usleep(50 * 1000);
+        inner.publish(arg);
+    });
+    DeferredCallsQueue::get().addDeferredCall([outer]() { outer.publish(1); }, 23);
+    usleep(10 * 1000);
+    // only the subscription of the other task applies while this one still publishes
+    outer.publish(2);
+    inner.publish(3);
+    usleep(10 * 1000);
+    outer.clear();
+    inner.clear();
+    expectedOutput = "inner1=2\ninner1=3\ninner2=3\n";
+}
+
+TEST_CASE("throttled", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 11;
+    auto topic = PublishSubscribe<int>::get().topic("topic23");
+    topic.subscribeThrottledWithPrio([](int arg) {
+        coutCapture << "throttled=" << arg << "\n";
+    }, 50, prio);
+    coutCapture << "before\n";
+    // the first message is delivered right away, the latest one of the others after the interval
+    for (int i = 1; i <= 4; i++)
+    {
+        topic.publish(i);
+    }
+    coutCapture << "published\n";
+    usleep(100 * 1000);
+    coutCapture << "after\n";
+    topic.clear();
+    expectedOutput = "before\nthrottled=1\npublished\nthrottled=4\nafter\n";
+}
+
+TEST_CASE("batched", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 11;
+    auto topic = PublishSubscribe<int, char>::get().topic("topic24");
+    topic.subscribeBatchedWithPrio([](PublishSubscribe<int, char>::Batch batch) {
+        coutCapture << "batch=";
+        for (const auto& [number, letter] : batch)
+        {
+            coutCapture << number << letter << " ";
+        }
+        coutCapture << "\n";
+    }, 30, 3, prio);
+    coutCapture << "before\n";
+    // only three messages fit into a batch
+    for (int i = 1; i <= 5; i++)
+    {
+        topic.publish(i, 'a' + i - 1);
+    }
+    coutCapture << "published\n";
+    usleep(60 * 1000);
+    topic.publishAsync(6, 'f');
+    usleep(60 * 1000);
+    coutCapture << "after\n";
+    topic.clear();
+    expectedOutput = "before\npublished\nbatch=1a 2b 3c \nbatch=6f \nafter\n";
+}
+
+TEST_CASE("batched after async", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 11;
+    auto topic = PublishSubscribe<std::string>::get().topic("topic32");
+    topic.subscribeAsyncWithPrio([](std::string arg) {
+        coutCapture << "async=" << arg << "\n";
+    }, prio);
+    topic.subscribeBatchedWithPrio([](PublishSubscribe<std::string>::Batch batch) {
+        for (const auto& [text] : batch)
+        {
+            coutCapture << "batch=" << text << "\n";
+        }
+    }, 20, 3, prio);
+    // the argument is moved into the payload of the async subscriber
+    topic.publishAsync(std::string("moved"));
+    usleep(50 * 1000);
+    topic.clear();
+    expectedOutput = "async=moved\nbatch=moved\n";
+}
+
+TEST_CASE("throttled dropped", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 21;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setQueueConfig(prio, DeferredCallsQueue::itsCurrentAffinity, 1, DeferredCallsQueue::OverflowPolicy::DropNewest);
+    auto topic = PublishSubscribe<int>::get().topic("topic33");
+    topic.subscribeThrottledWithPrio([](int arg) {
+        coutCapture << "throttled=" << arg << "\n";
+    }, 20, prio);
+    // fill the queue, so the call of the first message is dropped
+    dcq.addDeferredCall([]() { usleep(50 * 1000); }, prio);
+    usleep(5 * 1000);
+    dcq.addDeferredCall([]() {}, prio);
+    topic.publish(1);
+    usleep(100 * 1000);
+    topic.publish(2);
+    usleep(50 * 1000);
+    topic.clear();
+    expectedOutput = "throttled=2\n";
+}
+
+TEST_CASE("retained", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 11;
+    auto topic = PublishSubscribe<int, const std::string&>::get().topic("topic25");
+    // subscriptions are only deferred while publishing to a topic of the same signature
+    auto trigger = PublishSubscribe<int, const std::string&>::get().topic("topic26");
+    topic.retain();
+    topic.subscribeSync([](int arg1, const std::string& arg2) {
+        coutCapture << "early=" << arg1 << arg2 << "\n";
+    });
+    coutCapture << "before\n";
+    topic.publish(1, "boot");
+    // late subscribers get the last message right away
+    topic.subscribeSync([](int arg1, const std::string& arg2) {
+        coutCapture << "late=" << arg1 << arg2 << "\n";
+    });
+    topic.subscribeAsyncWithPrio([](int arg1, const std::string& arg2) {
+        coutCapture << "async=" << arg1 << arg2 << "\n";
+    }, prio);
+    usleep(20 * 1000);
+    // a subscription made during dispatch gets it once in effect
+    trigger.subscribeSync([topic](int arg1, const std::string& arg2) {
+        topic.subscribeSync([](int arg1, const std::string& arg2) {
+            coutCapture << "deferred=" << arg1 << arg2 << "\n";
+        });
+        coutCapture << "trigger=" << arg1 << arg2 << "\n";
+    });
+    trigger.publish(2, "go");
+    trigger.clear();
+    topic.clearRetained();
+    topic.subscribeSync([](int arg1, const std::string& arg2) {
+        coutCapture << "cleared=" << arg1 << arg2 << "\n";
+    });
+    coutCapture << "after\n";
+    topic.clear();
+    expectedOutput = "before\nearly=1boot\nlate=1boot\nasync=1boot\ntrigger=2go\ndeferred=1boot\nafter\n";
+}
+
+TEST_CASE("retained static topic", "[PublishSubscribe]")
+{
+    using Topic = PublishSubscribe<int>::StaticTopic<"topic27", 2>;
+    Topic::retain();
+    Topic::publish(3);
+    SubscriptionId id = Topic::subscribeSync([](int arg) {
+        coutCapture << "arg=" << arg << "\n";
+    });
+    Topic::publish(4);
+    Topic::unsubscribe(id);
+    expectedOutput = "arg=3\narg=4\n";
+}
+
+TEST_CASE("deadline", "[PublishSubscribe]")
+{
+    const UBaseType_t prio = 16;
+    DeferredCallsQueue& dcq = DeferredCallsQueue::get();
+    dcq.setDeadlineScheduling(prio, DeferredCallsQueue::itsCurrentAffinity, true,
+                              DeferredCallsQueue::ExpiredPolicy::Drop);
+    auto topic = PublishSubscribe<int>::get().topic("topic28");
+    topic.subscribeAsyncWithPrio([](int arg) {
+        coutCapture << "arg=" << arg << "\n";
+    }, prio);
+    // keep the task busy so the messages pile up
+    dcq.addDeferredCall([]() { usleep(30 * 1000); }, prio);
+    usleep(5 * 1000);
+    const int64_t now = esp_timer_get_time();
+    topic.publishAsyncWithDeadline(1, now + 500 * 1000);
+    topic.publishAsyncWithDeadline(2, now + 100 * 1000);
+    topic.publishAsyncWithDeadline(3, now + 1000);
+    usleep(60 * 1000);
+    coutCapture << "expired=" << dcq.getQueueStats(prio).itsExpired << "\n";
+    topic.clear();
+    expectedOutput = "arg=2\narg=1\nexpired=1\n";
 }
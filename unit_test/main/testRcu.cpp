@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <Rcu.hpp>
+#include "test_app_main.hpp"
+
+
+static void releaseInt(void* p_data)
+{
+    coutCapture << "released=" << *static_cast<int*>(p_data) << "\n";
+    delete static_cast<int*>(p_data);
+}
+
+TEST_CASE("no readers", "[Rcu]")
+{
+    Rcu rcu;
+    rcu.retire(new int(1), &releaseInt);
+    coutCapture << "retired=" << rcu.getRetiredCount() << "\n";
+    expectedOutput = "released=1\nretired=0\n";
+}
+
+TEST_CASE("grace period", "[Rcu]")
+{
+    Rcu rcu;
+    uint32_t outer = rcu.readLock();
+    rcu.retire(new int(2), &releaseInt);
+    uint32_t inner = rcu.readLock();
+    rcu.retire(new int(3), &releaseInt);
+    coutCapture << "retired=" << rcu.getRetiredCount() << "\n";
+    rcu.readUnlock(inner);
+    coutCapture << "retired=" << rcu.getRetiredCount() << "\n";
+    rcu.readUnlock(outer);
+    coutCapture << "retired=" << rcu.getRetiredCount() << "\n";
+    expectedOutput = "retired=2\nretired=2\nreleased=2\nreleased=3\nretired=0\n";
+}
+
+TEST_CASE("synchronize", "[Rcu]")
+{
+    Rcu rcu;
+    rcu.retire(new int(4), &releaseInt);
+    rcu.synchronize();
+    coutCapture << "retired=" << rcu.getRetiredCount() << "\n";
+    expectedOutput = "released=4\nretired=0\n";
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <SubscriptionPool.hpp>
+#include "test_app_main.hpp"
+
+
+TEST_CASE("allocate", "[SubscriptionPool]")
+{
+    SubscriptionPool& pool = SubscriptionPool::get();
+    const auto before = pool.getStats().itsClasses.back();
+    void* blocks[3];
+    for (auto& block : blocks)
+    {
+        block = pool.allocate(SubscriptionPool::itsMaxBlockSize - 1);
+    }
+    const auto during = pool.getStats().itsClasses.back();
+    for (auto& block : blocks)
+    {
+        pool.deallocate(block, SubscriptionPool::itsMaxBlockSize - 1);
+    }
+    const auto after = pool.getStats().itsClasses.back();
+    coutCapture << "in use: " << (during.itsBlocksInUse - before.itsBlocksInUse) << "\n";
+    coutCapture << "released: " << (during.itsBlocksInUse - after.itsBlocksInUse) << "\n";
+    coutCapture << "high water: " << (after.itsBlocksHighWater >= during.itsBlocksInUse) << "\n";
+    expectedOutput = "in use: 3\nreleased: 3\nhigh water: 1\n";
+}
+
+TEST_CASE("reuse", "[SubscriptionPool]")
+{
+    SubscriptionPool& pool = SubscriptionPool::get();
+    void* first = pool.allocate(SubscriptionPool::itsMinBlockSize);
+    pool.deallocate(first, SubscriptionPool::itsMinBlockSize);
+    const size_t chunkBytes = pool.getStats().itsChunkBytes;
+    void* second = pool.allocate(SubscriptionPool::itsMinBlockSize);
+    pool.deallocate(second, SubscriptionPool::itsMinBlockSize);
+    coutCapture << "same block: " << (first == second) << "\n";
+    coutCapture << "grown: " << (pool.getStats().itsChunkBytes != chunkBytes) << "\n";
+    expectedOutput = "same block: 1\ngrown: 0\n";
+}
+
+TEST_CASE("large", "[SubscriptionPool]")
+{
+    SubscriptionPool& pool = SubscriptionPool::get();
+    const size_t largeBefore = pool.getStats().itsLargeInUse;
+    void* block = pool.allocate(SubscriptionPool::itsMaxBlockSize + 1);
+    coutCapture << "large: " << (pool.getStats().itsLargeInUse - largeBefore) << "\n";
+    pool.deallocate(block, SubscriptionPool::itsMaxBlockSize + 1);
+    coutCapture << "large: " << (pool.getStats().itsLargeInUse - largeBefore) << "\n";
+    expectedOutput = "large: 1\nlarge: 0\n";
+}